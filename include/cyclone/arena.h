@@ -0,0 +1,177 @@
+/*
+ * Interface file for the frame arena.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains an allocator for memory that is only needed for
+ * one frame of the simulation.
+ */
+#ifndef CYCLONE_ARENA_H
+#define CYCLONE_ARENA_H
+
+#include <vector>
+#include <mutex>
+#include <new>
+#include <cstddef>
+
+namespace cyclone {
+
+    /**
+     * Hands out memory that lasts until the end of the frame, then
+     * takes it all back at once.
+     *
+     * Memory is handed out from a block by moving a pointer along it,
+     * so allocating costs next to nothing, and nothing is freed until
+     * the arena is reset. If a frame needs more than the block holds,
+     * further blocks are taken from the heap; when the arena is next
+     * reset they are swapped for one block big enough for the whole
+     * frame. Once the simulation has settled, frames fit in the one
+     * block, and the arena doesn't go to the heap at all. The other
+     * stores used in stepping, such as the thread pool's queues and
+     * the pairs of SweepAndPrune and ManifoldCache, likewise keep
+     * their memory from frame to frame, so they only go to the heap
+     * when they need more than they have ever held.
+     *
+     * The arena keeps track of the most memory any frame has used,
+     * and how many times it has gone to the heap, so the size of the
+     * block can be checked and tuned.
+     *
+     * Memory can be taken by several threads at once.
+     */
+    class FrameArena
+    {
+    protected:
+        /**
+         * Holds one block of memory.
+         */
+        struct Block
+        {
+            char *memory;
+            size_t size;
+        };
+
+        /**
+         * Holds the blocks in use this frame. Memory is handed out
+         * from the last.
+         */
+        std::vector<Block> blocks;
+
+        /**
+         * Holds how far along the last block memory has been handed
+         * out.
+         */
+        size_t offset;
+
+        /**
+         * Holds the number of bytes handed out this frame, including
+         * the padding used to align them.
+         */
+        size_t used;
+
+        /**
+         * Holds the most bytes handed out in any one frame.
+         */
+        size_t highWater;
+
+        /**
+         * Holds the number of blocks taken from the heap.
+         */
+        unsigned heapAllocations;
+
+        /**
+         * Guards the arena, for threads allocating at once.
+         */
+        std::mutex lock;
+
+        /**
+         * Takes a new block from the heap with room for at least the
+         * given number of bytes, and makes it the last block.
+         */
+        void addBlock(size_t size);
+
+    public:
+        /**
+         * Creates an arena whose first block holds the given number of
+         * bytes.
+         */
+        FrameArena(size_t blockSize = 65536);
+
+        /**
+         * Frees every block.
+         */
+        ~FrameArena();
+
+        /**
+         * Returns the given number of bytes, aligned to the given
+         * power of two.
+         */
+        void *allocate(size_t size, size_t alignment = 16);
+
+        /**
+         * Returns an array of the given number of objects of the
+         * given type, each made with its default constructor, so
+         * built in types are left uninitialised. The objects are never
+         * destroyed, so this should only be used for types that need
+         * no destructor, such as contacts.
+         */
+        template<class T>
+        T *allocate(unsigned count)
+        {
+            T *objects = (T*)allocate(sizeof(T) * count, alignof(T));
+            for (unsigned i = 0; i < count; i++) new (objects + i) T;
+            return objects;
+        }
+
+        /**
+         * Takes back everything handed out. If the frame needed more
+         * than one block, they are replaced by one large enough to
+         * hold everything the frame used.
+         */
+        void reset();
+
+        /**
+         * Returns the number of bytes handed out since the arena was
+         * last reset.
+         */
+        size_t getUsed() const
+        {
+            return used;
+        }
+
+        /**
+         * Returns the most bytes handed out in any one frame.
+         */
+        size_t getHighWater() const
+        {
+            return highWater;
+        }
+
+        /**
+         * Returns the number of bytes the arena's blocks hold.
+         */
+        size_t getCapacity() const;
+
+        /**
+         * Returns the number of blocks taken from the heap since the
+         * arena was created. This stops going up once the simulation
+         * has settled.
+         */
+        unsigned getHeapAllocations() const
+        {
+            return heapAllocations;
+        }
+    };
+
+} // namespace cyclone
+
+#endif // CYCLONE_ARENA_H
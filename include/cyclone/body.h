@@ -41,6 +41,8 @@ namespace cyclone {
      */
     class RigidBody
     {
+        friend class RigidBodyStore;
+
     public:
 
         // ... Other RigidBody code as before ...
@@ -278,8 +280,13 @@ namespace cyclone {
          * This function uses a Newton-Euler integration method, which is a
          * linear approximation to the correct integral. For this reason it
          * may be inaccurate in some cases.
+         *
+         * The body's motion is tracked for sleeping. If fallAsleep is
+         * false, the body isn't put to sleep when its motion drops
+         * below the sleep epsilon, and that is left to the caller, as
+         * the World does for whole islands.
          */
-        void integrate(real duration);
+        void integrate(real duration, bool fallAsleep = true);
 
         /*@}*/
 
@@ -803,6 +810,18 @@ namespace cyclone {
             return isAwake;
         }
 
+        /**
+         * Returns the recency weighted mean of the body's motion. The
+         * body is put to sleep when this drops below the sleep
+         * epsilon.
+         *
+         * @see sleepEpsilon
+         */
+        real getMotion() const
+        {
+            return motion;
+        }
+
         /**
          * Sets the awake state of the body. If the body is set to be
          * not awake, then its velocities are also cancelled, since
@@ -973,6 +992,25 @@ namespace cyclone {
 
     };
 
+    /**
+     * Fills the given matrix with the transform for a body at the
+     * given position and orientation, as
+     * RigidBody::calculateDerivedData does. The orientation should be
+     * normalised.
+     */
+    void calculateTransformMatrix(Matrix4 &transformMatrix,
+                                  const Vector3 &position,
+                                  const Quaternion &orientation);
+
+    /**
+     * Fills the given matrix with a body's inverse inertia tensor in
+     * world coordinates, using the rotation part of its transform
+     * matrix, as RigidBody::calculateDerivedData does.
+     */
+    void transformInertiaTensor(Matrix3 &iitWorld,
+                                const Matrix3 &iitBody,
+                                const Matrix4 &transformMatrix);
+
 } // namespace cyclone
 
 #endif // CYCLONE_BODY_H
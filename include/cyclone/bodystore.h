@@ -0,0 +1,442 @@
+/*
+ * Interface file for the rigid body store.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains a store that holds the data of many rigid bodies
+ * in separate arrays, one for each property, along with the handles
+ * and views used to get at one body.
+ */
+#ifndef CYCLONE_BODYSTORE_H
+#define CYCLONE_BODYSTORE_H
+
+#include <vector>
+#include "body.h"
+#include "integrator.h"
+
+namespace cyclone {
+
+    /**
+     * Identifies a body in a rigid body store. A handle stays valid
+     * until its body is destroyed, however many other bodies are
+     * created or destroyed in the meantime. Once its body has been
+     * destroyed the handle is stale, and the store can tell.
+     */
+    struct BodyHandle
+    {
+        /** Holds the slot of the body in the store. */
+        unsigned slot;
+
+        /**
+         * Holds the generation of the slot when the body was created.
+         * The slot's generation goes up each time a body in it is
+         * destroyed.
+         */
+        unsigned generation;
+    };
+
+    class RigidBodyStore;
+
+    /**
+     * Gives access to one body in a rigid body store, with the same
+     * methods as the RigidBody class. A view is only a handle and a
+     * pointer to the store, so it is cheap to make and copy, and it
+     * stays valid as long as the handle does.
+     */
+    class RigidBodyView
+    {
+    protected:
+        /** Holds the store the body is in. */
+        RigidBodyStore *store;
+
+        /** Holds the handle of the body. */
+        BodyHandle handle;
+
+        /**
+         * Returns the position of the body in the store's arrays.
+         */
+        unsigned index() const;
+
+        /**
+         * Returns the position of the body in the store's arrays, and
+         * marks its RigidBody object as needing all its data copied
+         * into it, because the caller is about to change the body.
+         */
+        unsigned change() const;
+
+    public:
+        /**
+         * Creates a view of the body with the given handle.
+         */
+        RigidBodyView(RigidBodyStore *store, BodyHandle handle);
+
+        /**
+         * Returns the handle of the body.
+         */
+        BodyHandle getHandle() const
+        {
+            return handle;
+        }
+
+        /**
+         * @name Integration and Simulation Functions
+         *
+         * These work as the RigidBody methods of the same name.
+         */
+        /*@{*/
+
+        void calculateDerivedData();
+
+        void integrate(real duration);
+
+        /*@}*/
+
+        /**
+         * @name Accessor Functions
+         *
+         * These work as the RigidBody methods of the same name.
+         */
+        /*@{*/
+
+        void setMass(const real mass);
+        real getMass() const;
+        void setInverseMass(const real inverseMass);
+        real getInverseMass() const;
+        bool hasFiniteMass() const;
+
+        void setInertiaTensor(const Matrix3 &inertiaTensor);
+        Matrix3 getInertiaTensor() const;
+        Matrix3 getInertiaTensorWorld() const;
+        void setInverseInertiaTensor(const Matrix3 &inverseInertiaTensor);
+        Matrix3 getInverseInertiaTensor() const;
+        Matrix3 getInverseInertiaTensorWorld() const;
+
+        void setDamping(const real linearDamping, const real angularDamping);
+        void setLinearDamping(const real linearDamping);
+        real getLinearDamping() const;
+        void setAngularDamping(const real angularDamping);
+        real getAngularDamping() const;
+
+        void setPosition(const Vector3 &position);
+        void setPosition(const real x, const real y, const real z);
+        Vector3 getPosition() const;
+
+        void setOrientation(const Quaternion &orientation);
+        void setOrientation(const real r, const real i,
+            const real j, const real k);
+        Quaternion getOrientation() const;
+
+        Matrix4 getTransform() const;
+        void getGLTransform(float matrix[16]) const;
+        Vector3 getPointInLocalSpace(const Vector3 &point) const;
+        Vector3 getPointInWorldSpace(const Vector3 &point) const;
+        Vector3 getDirectionInLocalSpace(const Vector3 &direction) const;
+        Vector3 getDirectionInWorldSpace(const Vector3 &direction) const;
+
+        void setVelocity(const Vector3 &velocity);
+        void setVelocity(const real x, const real y, const real z);
+        Vector3 getVelocity() const;
+        void addVelocity(const Vector3 &deltaVelocity);
+
+        void setRotation(const Vector3 &rotation);
+        void setRotation(const real x, const real y, const real z);
+        Vector3 getRotation() const;
+        void addRotation(const Vector3 &deltaRotation);
+
+        bool getAwake() const;
+        real getMotion() const;
+        void setAwake(const bool awake=true);
+        bool getCanSleep() const;
+        void setCanSleep(const bool canSleep=true);
+
+        Vector3 getLastFrameAcceleration() const;
+
+        /*@}*/
+
+        /**
+         * @name Force, Torque and Acceleration Set-up Functions
+         *
+         * These work as the RigidBody methods of the same name.
+         */
+        /*@{*/
+
+        void clearAccumulators();
+        void addForce(const Vector3 &force);
+        void addForceAtPoint(const Vector3 &force, const Vector3 &point);
+        void addForceAtBodyPoint(const Vector3 &force, const Vector3 &point);
+        void addTorque(const Vector3 &torque);
+
+        void setAcceleration(const Vector3 &acceleration);
+        void setAcceleration(const real x, const real y, const real z);
+        Vector3 getAcceleration() const;
+
+        /*@}*/
+    };
+
+    /**
+     * Holds the data for a set of rigid bodies, with each property in
+     * its own contiguous array rather than each body in its own
+     * object. Going through one property of every body, as
+     * integration does, then reads memory in order, and reads only
+     * the properties it needs.
+     *
+     * Bodies are created and destroyed through handles. The arrays are
+     * kept packed: destroying a body moves the last body into its
+     * place, and the handles are looked up through a table of slots
+     * so they don't change when a body moves.
+     *
+     * The collision detectors and contact resolvers work on RigidBody
+     * objects, so the store also keeps one for each body, with a
+     * fixed address for as long as the body exists. Collision
+     * primitives, joints and contacts should point at these. The
+     * store's arrays hold the state of the bodies between frames:
+     * writeBodies copies them into the objects before contacts are
+     * generated, and readBodies copies back what the resolver changed.
+     * Between the two, the objects hold the state.
+     *
+     * Only what can change from frame to frame is copied, and only for
+     * bodies that are awake: a sleeping body's object already holds
+     * its state. Anything set through a view marks the body's object
+     * as stale, and the next writeBodies copies all of its data.
+     *
+     * Forces and torques can be added to the objects between frames,
+     * by force generators that work on RigidBody objects. readForces
+     * moves them into the store, and should be called before the
+     * bodies are integrated.
+     */
+    class RigidBodyStore
+    {
+        friend class RigidBodyView;
+
+    protected:
+        /**
+         * @name Slots
+         *
+         * Handles refer to slots, which refer to the position of the
+         * body in the arrays.
+         */
+        /*@{*/
+
+        /** Holds the position in the arrays of the body in each slot. */
+        std::vector<unsigned> slotIndex;
+
+        /** Holds the generation of each slot. */
+        std::vector<unsigned> slotGeneration;
+
+        /** Holds the slots that have no body. */
+        std::vector<unsigned> freeSlots;
+
+        /** Holds the slot of the body at each position in the arrays. */
+        std::vector<unsigned> indexSlot;
+
+        /*@}*/
+
+        /**
+         * @name Body Data
+         *
+         * These hold the data of the bodies, as the members of
+         * RigidBody of the same names. Each component has an array of
+         * its own: x, y and z for a vector, r, i, j and k for a
+         * quaternion, and each entry of a matrix's data. The same
+         * component of neighbouring bodies can then be loaded straight
+         * into the lanes of a vector register.
+         */
+        /*@{*/
+
+        std::vector<real> inverseMass;
+        std::vector<real> inverseInertiaTensor[9];
+        std::vector<real> linearDamping;
+        std::vector<real> angularDamping;
+        std::vector<real> position[3];
+        std::vector<real> orientation[4];
+        std::vector<real> velocity[3];
+        std::vector<real> rotation[3];
+
+        std::vector<real> inverseInertiaTensorWorld[9];
+        std::vector<real> motion;
+        std::vector<unsigned char> isAwake;
+        std::vector<unsigned char> canSleep;
+        std::vector<real> transformMatrix[12];
+
+        std::vector<real> forceAccum[3];
+        std::vector<real> torqueAccum[3];
+        std::vector<real> acceleration[3];
+        std::vector<real> lastFrameAcceleration[3];
+
+        /*@}*/
+
+        /**
+         * Is set for each body whose RigidBody object needs all of its
+         * data copied into it by the next writeBodies.
+         */
+        std::vector<unsigned char> objectStale;
+
+        /**
+         * Holds, for each body, whether its RigidBody object was awake
+         * when the two were last brought into line. A body that falls
+         * asleep as it is integrated is written once more, so its
+         * object stops too.
+         */
+        std::vector<unsigned char> objectAwake;
+
+        /**
+         * The number of arrays of reals above.
+         */
+        enum { REAL_ARRAYS = 4 + 7*3 + 4 + 2*9 + 12 };
+
+        /**
+         * Holds the RigidBody object for each body, in the same order
+         * as the arrays.
+         */
+        std::vector<RigidBody*> bodies;
+
+        /**
+         * Holds the integrator used to move the bodies.
+         */
+        BatchIntegrator integrator;
+
+        /**
+         * Fills the given list with every array of reals, so they can
+         * all be grown or shrunk together.
+         */
+        void getRealArrays(std::vector<real> *arrays[REAL_ARRAYS]);
+
+        /**
+         * Returns pointers to the data of the given run of bodies, for
+         * the integrator.
+         */
+        BodyArrays getArrays(unsigned first, unsigned count);
+
+    public:
+        RigidBodyStore();
+        ~RigidBodyStore();
+
+        /**
+         * Creates a new body, and returns its handle. The body is
+         * awake, at the origin and at rest, with unit mass, a unit
+         * inverse inertia tensor and no damping.
+         */
+        BodyHandle create();
+
+        /**
+         * Destroys the body with the given handle, along with its
+         * RigidBody object. Does nothing if the handle is stale.
+         */
+        void destroy(BodyHandle handle);
+
+        /**
+         * Returns true if the given handle refers to a body that
+         * still exists.
+         */
+        bool isValid(BodyHandle handle) const;
+
+        /**
+         * Returns the number of bodies in the store.
+         */
+        unsigned getSize() const
+        {
+            return (unsigned)bodies.size();
+        }
+
+        /**
+         * Returns the position in the arrays of the body with the
+         * given handle. This changes when other bodies are destroyed.
+         */
+        unsigned getIndex(BodyHandle handle) const;
+
+        /**
+         * Returns the handle of the body at the given position in the
+         * arrays.
+         */
+        BodyHandle getHandle(unsigned index) const;
+
+        /**
+         * Returns a view of the body with the given handle.
+         */
+        RigidBodyView getView(BodyHandle handle);
+
+        /**
+         * Returns the RigidBody object of the body with the given
+         * handle, for use with collision primitives and joints.
+         */
+        RigidBody *getBody(BodyHandle handle) const;
+
+        /**
+         * Returns the RigidBody object of the body at the given
+         * position in the arrays.
+         */
+        RigidBody *getBodyAt(unsigned index) const
+        {
+            return bodies[index];
+        }
+
+        /**
+         * Returns the integrator used to move the bodies, so its
+         * instruction set can be chosen.
+         */
+        BatchIntegrator &getIntegrator()
+        {
+            return integrator;
+        }
+
+        /**
+         * Integrates every body forward in time by the given amount,
+         * as RigidBody::integrate.
+         */
+        void integrate(real duration, bool fallAsleep = true);
+
+        /**
+         * Works out the derived data of every body, as
+         * RigidBody::calculateDerivedData. Only the store's arrays
+         * are changed: writeBodies copies the derived data of awake
+         * bodies anyway, and a sleeping body's can only change if it
+         * is moved through a view, which marks its object as stale.
+         */
+        void calculateDerivedData();
+
+        /**
+         * Clears the force and torque accumulators of every body.
+         */
+        void clearAccumulators();
+
+        /**
+         * Adds the forces and torques accumulated on each RigidBody
+         * object since the last frame to the body's own, and clears
+         * the object's. A body whose object was woken by a force is
+         * woken too. Only objects that are awake are looked at, since
+         * adding a force wakes the object.
+         */
+        void readForces();
+
+        /**
+         * Brings the RigidBody objects up to date. Awake bodies have
+         * their position, orientation, velocity, rotation, derived
+         * data, sleep state and last frame acceleration copied. Bodies
+         * changed through a view, or created, since the last call have
+         * all their data copied. Sleeping bodies are otherwise left
+         * alone.
+         */
+        void writeBodies();
+
+        /**
+         * Copies back from the RigidBody objects the parts of the
+         * bodies' state that contact resolution and sleeping can
+         * change, for bodies that were awake when they were written
+         * or have been woken since.
+         */
+        void readBodies();
+    };
+
+} // namespace cyclone
+
+#endif // CYCLONE_BODYSTORE_H
@@ -23,6 +23,7 @@
 #include <vector>
 #include <cstddef>
 #include "contacts.h"
+#include "threads.h"
 
 namespace cyclone {
 
@@ -73,6 +74,96 @@ namespace cyclone {
         }
     };
 
+    /**
+     * Represents an axis-aligned bounding box, held as its lowest and
+     * highest corners. It can be used as the bounding volume of a
+     * BVHNode in place of BoundingSphere.
+     *
+     * A box fits long thin objects, such as planks or limbs, much
+     * more tightly than a sphere, whose size is set by the longest
+     * side, so fewer pairs of bodies that aren't touching are passed
+     * on for fine collision detection. Boxes are also cheaper to
+     * merge. When Cyclone is built with SSE (see simd.h), boxes are
+     * merged and tested for overlap with all three axes at once.
+     */
+    struct BoundingBox
+    {
+        /** Holds the corner with the lowest coordinates. */
+        Vector3 lower;
+
+        /** Holds the corner with the highest coordinates. */
+        Vector3 upper;
+
+    public:
+        /**
+         * Creates an empty box at the origin.
+         */
+        BoundingBox() {}
+
+        /**
+         * Creates a new bounding box with the given corners.
+         */
+        BoundingBox(const Vector3 &lower, const Vector3 &upper);
+
+        /**
+         * Creates a bounding box to enclose the two given bounding
+         * boxes.
+         */
+        BoundingBox(const BoundingBox &one, const BoundingBox &two);
+
+        /**
+         * Creates a bounding box to enclose a box with the given
+         * half-sizes, centred at the origin of the given transform
+         * and turned with it, as the box of a CollisionBox.
+         */
+        BoundingBox(const Vector3 &halfSize, const Matrix4 &transform);
+
+        /**
+         * Checks if the bounding box overlaps with the other given
+         * bounding box. Boxes that only touch count as overlapping.
+         */
+        bool overlaps(const BoundingBox *other) const;
+
+        /**
+         * Checks if the given bounding box lies entirely inside this
+         * one.
+         */
+        bool contains(const BoundingBox &other) const;
+
+        /**
+         * Returns the surface area of the box. This is the measure
+         * used to decide where boxes go in a tree, since the chance
+         * of a random ray or box hitting a box goes with its surface
+         * area.
+         */
+        real getSurfaceArea() const
+        {
+            Vector3 size = upper - lower;
+            return 2 * (size.x*size.y + size.y*size.z + size.z*size.x);
+        }
+
+        /**
+         * Reports how much this bounding box would have to grow by to
+         * incorporate the given bounding box, as the increase in its
+         * surface area.
+         */
+        real getGrowth(const BoundingBox &other) const
+        {
+            return BoundingBox(*this, other).getSurfaceArea() -
+                getSurfaceArea();
+        }
+
+        /**
+         * Returns the size of this bounding volume, used to decide
+         * which side of a pair of nodes to descend into. For a box
+         * this is its surface area.
+         */
+        real getSize() const
+        {
+            return getSurfaceArea();
+        }
+    };
+
     /**
      * Stores a potential contact to check later.
      */
@@ -204,7 +295,7 @@ namespace cyclone {
         const BVHNode<BoundingVolumeClass> * other
         ) const
     {
-        return volume->overlaps(other->volume);
+        return volume.overlaps(&other->volume);
     }
 
     template<class BoundingVolumeClass>
@@ -319,11 +410,25 @@ namespace cyclone {
         // if we're a leaf node.
         if (isLeaf() || limit == 0) return 0;
 
-        // Get the potential contacts of one of our children with
-        // the other
-        return children[0]->getPotentialContactsWith(
-            children[1], contacts, limit
+        // Get the potential contacts within each of our children
+        unsigned count = children[0]->getPotentialContacts(
+            contacts, limit
             );
+        if (limit > count)
+        {
+            count += children[1]->getPotentialContacts(
+                contacts+count, limit-count
+                );
+        }
+
+        // Then those of one of our children with the other
+        if (limit > count)
+        {
+            count += children[0]->getPotentialContactsWith(
+                children[1], contacts+count, limit-count
+                );
+        }
+        return count;
     }
 
     template<class BoundingVolumeClass>
@@ -349,7 +454,7 @@ namespace cyclone {
         // a leaf, then we descend the other. If both are branches,
         // then we use the one with the largest size.
         if (other->isLeaf() ||
-            (!isLeaf() && volume->getSize() >= other->volume->getSize()))
+            (!isLeaf() && volume.getSize() >= other->volume.getSize()))
         {
             // Recurse into ourself
             unsigned count = children[0]->getPotentialContactsWith(
@@ -383,6 +488,823 @@ namespace cyclone {
         }
     }
 
+    /**
+     * A bounding volume hierarchy of axis-aligned boxes, for bodies
+     * that are added, removed and moved as the simulation runs.
+     *
+     * Unlike BVHNode, the nodes are held in one array and refer to
+     * each other by their position in it, so walking the tree reads
+     * memory that is close together, and nodes are reused rather than
+     * allocated one at a time. Each body is held in a leaf, called its
+     * proxy, whose number stays the same for as long as the body is
+     * in the tree.
+     *
+     * The box stored for each proxy is the body's box grown by a
+     * margin. A body can then move a little without its proxy
+     * changing: only when it leaves the fat box is the proxy taken
+     * out and put back in. Inserting picks the place in the tree that
+     * adds least surface area, and after each change the tree is
+     * rebalanced by rotating nodes, so it stays of logarithmic height
+     * whatever order bodies arrive and move in.
+     */
+    class AABBTree
+    {
+    public:
+        /**
+         * Marks the absence of a node.
+         */
+        static const unsigned NULL_NODE;
+
+        /**
+         * Holds the tallest tree whose walks keep their stacks on the
+         * machine stack. Taller trees use the heap.
+         */
+        static const int STACK_HEIGHT = 64;
+
+        /**
+         * Holds one node of the tree.
+         */
+        struct Node
+        {
+            /**
+             * Holds a box enclosing everything below the node. For a
+             * leaf, this is the fat box of its body.
+             */
+            BoundingBox box;
+
+            /**
+             * Holds the body of a leaf, or NULL for other nodes.
+             */
+            RigidBody *body;
+
+            /**
+             * Holds the node's parent, or NULL_NODE for the root. For
+             * nodes that aren't in use, holds the next free node.
+             */
+            unsigned parent;
+
+            /**
+             * Holds the node's children, or NULL_NODE for a leaf.
+             */
+            unsigned children[2];
+
+            /**
+             * Holds the height of the node above the leaves below it:
+             * zero for a leaf, or -1 if the node isn't in use.
+             */
+            int height;
+
+            /**
+             * Is set for a node whose box may no longer enclose its
+             * children, because a leaf below it has been refitted.
+             * Every node above a stale node is stale too.
+             */
+            bool stale;
+
+            /**
+             * Holds the place of a leaf in the list of awake proxies,
+             * or NULL_NODE if it isn't in the list.
+             */
+            unsigned awakeSlot;
+
+            /**
+             * Checks if this node is at the bottom of the tree.
+             */
+            bool isLeaf() const
+            {
+                return children[0] == NULL_NODE;
+            }
+        };
+
+    protected:
+        /**
+         * Holds every node, in use or not.
+         */
+        std::vector<Node> nodes;
+
+        /**
+         * Holds the root node, or NULL_NODE if the tree is empty.
+         */
+        unsigned root;
+
+        /**
+         * Holds the first node that isn't in use, or NULL_NODE.
+         */
+        unsigned freeList;
+
+        /**
+         * Holds the number of proxies in the tree.
+         */
+        unsigned proxyCount;
+
+        /**
+         * Holds the proxies whose bodies are awake, in no order, so
+         * refitAwake needn't look at the sleeping ones.
+         */
+        std::vector<unsigned> awakeProxies;
+
+        /**
+         * Holds the margin added on each side of a body's box.
+         */
+        real margin;
+
+        /**
+         * Returns a free node, growing the array if needed. This may
+         * move the nodes, so references to them must be taken again.
+         */
+        unsigned allocateNode();
+
+        /**
+         * Returns the given node to the free list.
+         */
+        void freeNode(unsigned index);
+
+        /**
+         * Puts the given leaf into the tree, beside the node that
+         * adds least surface area.
+         */
+        void insertLeaf(unsigned leaf);
+
+        /**
+         * Takes the given leaf out of the tree, without freeing it.
+         */
+        void removeLeaf(unsigned leaf);
+
+        /**
+         * Walks up the tree from the given node, rebalancing and
+         * working out the boxes and heights of each node on the way.
+         */
+        void refitUpwards(unsigned index);
+
+        /**
+         * Rotates the given node's taller child above it, if one child
+         * is more than one level taller than the other. Returns the
+         * node now in its place.
+         */
+        unsigned balance(unsigned index);
+
+        /**
+         * Makes the box for a proxy from the body's box.
+         */
+        BoundingBox fatten(const BoundingBox &box,
+                           const Vector3 &displacement) const;
+
+        /**
+         * Works out the boxes of the given stale node and the stale
+         * nodes below it.
+         */
+        void refitNode(unsigned index);
+
+        /**
+         * @name Parallel Pair Generation
+         *
+         * These hold the work of the threaded getPotentialContacts,
+         * and are kept from call to call so their memory is reused.
+         */
+        /*@{*/
+
+        /** Holds the pair of nodes each task starts from. */
+        std::vector<unsigned> taskNodes;
+
+        /** Holds the contacts found by each task. */
+        std::vector< std::vector<PotentialContact> > taskContacts;
+
+        /** Holds the number of contacts found by each task. */
+        std::vector<unsigned> taskCounts;
+
+        /**
+         * Holds a traversal stack for each worker, with room for the
+         * deepest walk of the current tree.
+         */
+        std::vector< std::vector<unsigned> > workerStacks;
+
+        /** Holds the limit of the current call. */
+        unsigned taskLimit;
+
+        /*@}*/
+
+        /**
+         * Walks the pairs of nodes on the given stack, which holds
+         * pairs of node indices and has the given number of entries,
+         * writing the pairs of overlapping proxies it finds to the
+         * given array, until the stack is empty or the given limit is
+         * reached. Returns the number written. If the limit is
+         * reached, the stack holds the pairs still to be walked, so
+         * the walk can carry on later.
+         *
+         * A walk from one pair never has more than one more pair on
+         * the stack than twice the height of the tree, so the stack
+         * needs room for 4 * height + 2 entries.
+         */
+        unsigned walkPairs(unsigned *stack, unsigned &size,
+                           PotentialContact *contacts,
+                           unsigned limit) const;
+
+        /**
+         * Adds the tasks for the given pair of nodes, splitting it
+         * into the pairs the walk would visit until the given depth
+         * is used up.
+         */
+        void splitPairs(unsigned indexA, unsigned indexB, unsigned depth);
+
+        /**
+         * The thread pool task that walks from one pair of nodes.
+         */
+        static void pairTask(unsigned index, unsigned worker, void *data);
+
+    public:
+        /**
+         * Works out the box of the given body, for refitAwake. The
+         * data is passed on from refitAwake.
+         */
+        typedef BoundingBox (*BoxFunction)(RigidBody *body, void *data);
+
+        /**
+         * Creates an empty tree, whose proxies have the given margin
+         * around their bodies' boxes.
+         */
+        AABBTree(real margin = (real)0.1);
+
+        /**
+         * Adds a proxy for the given body, with the given box, and
+         * returns its number.
+         */
+        unsigned createProxy(const BoundingBox &box, RigidBody *body);
+
+        /**
+         * Removes the given proxy from the tree. Its number may be
+         * given to a later proxy.
+         */
+        void destroyProxy(unsigned proxy);
+
+        /**
+         * Tells the tree the body of the given proxy now has the given
+         * box, having moved by the given displacement since it was last
+         * moved. If the box is still inside the proxy's fat box,
+         * nothing changes. Otherwise the proxy is given a new fat box,
+         * stretched along the displacement to allow for the body
+         * moving on the same way, and is moved in the tree. Returns
+         * true if the proxy was moved.
+         */
+        bool moveProxy(unsigned proxy, const BoundingBox &box,
+                       const Vector3 &displacement = Vector3());
+
+        /**
+         * Gives the proxy of the given body a new box, in the same way
+         * as moveProxy, but leaves it where it is in the tree. The
+         * nodes above it are marked as stale, and their boxes aren't
+         * changed until refit is called. Returns true if the proxy's
+         * fat box changed.
+         *
+         * Refitting is much cheaper than moving, but the tree isn't
+         * rearranged to suit the new boxes, so it gets less efficient
+         * as bodies travel. It suits bodies that move a little each
+         * frame; moveProxy suits those that have jumped.
+         */
+        bool refitProxy(unsigned proxy, const BoundingBox &box,
+                        const Vector3 &displacement = Vector3());
+
+        /**
+         * Works out the boxes of every stale node, from the bottom of
+         * the tree up, in one pass. Parts of the tree with no
+         * refitted proxies aren't visited.
+         */
+        void refit();
+
+        /**
+         * Refits the proxy of every awake body, using the given
+         * function to find each body's box, then refits the tree.
+         * Returns the number of proxies whose fat boxes changed.
+         *
+         * Only the proxies in the tree's list of awake proxies are
+         * visited, so sleeping bodies cost nothing, and aren't even
+         * loaded. A proxy is put in the list when it is created for
+         * an awake body, and taken out once refitAwake finds that its
+         * body has fallen asleep. A body that is woken must be put
+         * back with setProxyAwake.
+         */
+        unsigned refitAwake(BoxFunction getBox, void *data = NULL);
+
+        /**
+         * Puts the given proxy into the list of awake proxies, or
+         * takes it out, for refitAwake. Proxies with no body are
+         * never awake.
+         */
+        void setProxyAwake(unsigned proxy, bool awake = true);
+
+        /**
+         * Returns the number of proxies in the list of awake proxies.
+         */
+        unsigned getAwakeProxyCount() const
+        {
+            return (unsigned)awakeProxies.size();
+        }
+
+        /**
+         * Returns the body of the given proxy.
+         */
+        RigidBody *getBody(unsigned proxy) const
+        {
+            return nodes[proxy].body;
+        }
+
+        /**
+         * Returns the fat box of the given proxy.
+         */
+        const BoundingBox &getFatBox(unsigned proxy) const
+        {
+            return nodes[proxy].box;
+        }
+
+        /**
+         * Returns the number of proxies in the tree.
+         */
+        unsigned getProxyCount() const
+        {
+            return proxyCount;
+        }
+
+        /**
+         * Returns the height of the tree: zero for a tree with one
+         * proxy, or -1 for an empty tree.
+         */
+        int getHeight() const
+        {
+            return root == NULL_NODE ? -1 : nodes[root].height;
+        }
+
+        /**
+         * Writes the proxies whose fat boxes overlap the given box to
+         * the given array, up to the given limit. Returns the number
+         * written. This, and getPotentialContacts, should only be
+         * called when no nodes are stale.
+         */
+        unsigned query(const BoundingBox &box, unsigned *proxies,
+                       unsigned limit) const;
+
+        /**
+         * Writes each pair of bodies whose proxies' fat boxes overlap
+         * to the given array, up to the given limit. Each pair is
+         * written once. Returns the number written.
+         */
+        unsigned getPotentialContacts(PotentialContact *contacts,
+                                      unsigned limit) const;
+
+        /**
+         * Works as getPotentialContacts, but shares the work between
+         * the workers of the given thread pool.
+         *
+         * The walk through the tree is split into tasks the given
+         * number of levels down: each task walks one pair of subtrees,
+         * into a buffer of its own that grows as needed. The buffers
+         * are then copied into the array in task order, so the pairs
+         * come out in the same order as getPotentialContacts gives
+         * them, however the tasks were shared out. Each extra level
+         * gives up to three times as many tasks.
+         */
+        unsigned getPotentialContacts(PotentialContact *contacts,
+                                      unsigned limit,
+                                      ThreadPool *pool,
+                                      unsigned splitDepth = 5);
+    };
+
+    /**
+     * Is told when a broadphase finds that two bodies have started or
+     * stopped overlapping. Implement this to keep per-pair data, such
+     * as contact manifolds, in step with the broadphase.
+     */
+    class PairCallback
+    {
+    public:
+        virtual ~PairCallback() {}
+
+        /**
+         * Called when the boxes of the given bodies start to overlap.
+         */
+        virtual void addPair(RigidBody *one, RigidBody *two) = 0;
+
+        /**
+         * Called when the boxes of the given bodies stop overlapping,
+         * or one of them is removed.
+         */
+        virtual void removePair(RigidBody *one, RigidBody *two) = 0;
+    };
+
+    /**
+     * A broadphase that keeps the ends of every body's box sorted
+     * along each of the three axes, and the set of pairs whose boxes
+     * overlap.
+     *
+     * The lists are kept from frame to frame. When a body moves, its
+     * ends are moved along each list by insertion sort, and pairs are
+     * added or removed only as its ends pass the ends of other
+     * bodies. When most bodies move only a little each frame, as with
+     * settling debris or stacks, each update costs little more than
+     * checking the body's neighbours, far less than searching a tree.
+     * When bodies move a long way, or many are lined up along an
+     * axis, AABBTree does better.
+     *
+     * Bodies are held as proxies, as in AABBTree, whose numbers stay
+     * the same for as long as the body is held.
+     */
+    class SweepAndPrune
+    {
+    public:
+        /**
+         * Marks a missing proxy.
+         */
+        static const unsigned NULL_PROXY;
+
+    protected:
+        /**
+         * Holds one end of a proxy's box along one axis.
+         */
+        struct Endpoint
+        {
+            /** Holds the position of the end along the axis. */
+            real value;
+
+            /**
+             * Holds the proxy, shifted up one bit, with the lowest bit
+             * set for the upper end of the box.
+             */
+            unsigned data;
+
+            unsigned getProxy() const
+            {
+                return data >> 1;
+            }
+
+            bool isUpper() const
+            {
+                return (data & 1) != 0;
+            }
+
+            /**
+             * Checks if this end belongs before the other in the list.
+             * Where two ends are at the same place, lower ends go
+             * first, so boxes that touch count as overlapping, as
+             * they do for BoundingBox::overlaps.
+             */
+            bool isBefore(const Endpoint &other) const
+            {
+                return value < other.value ||
+                    (value == other.value && !isUpper() && other.isUpper());
+            }
+
+            /**
+             * Checks if the first end belongs before the second, for
+             * searching the lists.
+             */
+            static bool compare(const Endpoint &one, const Endpoint &two)
+            {
+                return one.isBefore(two);
+            }
+        };
+
+        /**
+         * Holds one proxy.
+         */
+        struct Proxy
+        {
+            /** Holds the box of the body. */
+            BoundingBox box;
+
+            /** Holds the body. */
+            RigidBody *body;
+
+            /**
+             * Holds the place in each axis's list of the lower and
+             * upper ends of the box. For proxies that aren't in use,
+             * the first entry holds the next free proxy.
+             */
+            unsigned endpoints[3][2];
+
+            /** Is set while the proxy is in use. */
+            bool inUse;
+        };
+
+        /**
+         * Holds a pair of overlapping proxies, the lower one first.
+         */
+        typedef std::pair<unsigned, unsigned> Pair;
+
+        /**
+         * Holds the sorted ends along each axis.
+         */
+        std::vector<Endpoint> endpoints[3];
+
+        /**
+         * Holds every proxy, in use or not.
+         */
+        std::vector<Proxy> proxies;
+
+        /**
+         * Holds the first proxy that isn't in use, or NULL_PROXY.
+         */
+        unsigned freeList;
+
+        /**
+         * Holds the number of proxies in use.
+         */
+        unsigned proxyCount;
+
+        /**
+         * Holds the pairs of proxies whose boxes overlap, in order.
+         * Pairs come and go a few at a time, so a sorted array is
+         * cheap to keep up, and it keeps its memory once it has grown
+         * to hold the most pairs there have been.
+         */
+        std::vector<Pair> pairs;
+
+        /**
+         * Holds the callback told of changes to the pairs, or NULL.
+         */
+        PairCallback *callback;
+
+        /**
+         * Adds the given pair if the proxies' boxes overlap and it
+         * isn't there already.
+         */
+        void addPair(unsigned one, unsigned two);
+
+        /**
+         * Removes the given pair if it is there, after their ends
+         * have passed each other along the given axis.
+         */
+        void removePair(unsigned one, unsigned two, unsigned axis);
+
+        /**
+         * Moves the given end down the given axis's list until it is
+         * in order, adding and removing pairs as it passes the ends
+         * of other proxies.
+         */
+        void sortDown(unsigned axis, unsigned index);
+
+        /**
+         * Moves the given end up the given axis's list until it is in
+         * order, adding and removing pairs as it passes the ends of
+         * other proxies.
+         */
+        void sortUp(unsigned axis, unsigned index);
+
+        /**
+         * Puts the ends of the given proxy back in order on every
+         * axis, after its box has changed.
+         */
+        void sortProxy(unsigned proxy);
+
+    public:
+        /**
+         * Creates an empty broadphase.
+         */
+        SweepAndPrune();
+
+        /**
+         * Sets the callback told when pairs are added and removed.
+         * Pass NULL for no callback.
+         */
+        void setCallback(PairCallback *callback);
+
+        /**
+         * Adds a proxy for the given body, with the given box, and
+         * returns its number.
+         */
+        unsigned createProxy(const BoundingBox &box, RigidBody *body);
+
+        /**
+         * Removes the given proxy, along with its pairs. Its number
+         * may be given to a later proxy.
+         */
+        void destroyProxy(unsigned proxy);
+
+        /**
+         * Gives the given proxy a new box, and updates the pairs.
+         */
+        void moveProxy(unsigned proxy, const BoundingBox &box);
+
+        /**
+         * Moves the proxy of every awake body, using the given
+         * function to find each body's box. Proxies of sleeping
+         * bodies are left alone.
+         */
+        void updateAwake(AABBTree::BoxFunction getBox, void *data = NULL);
+
+        /**
+         * Returns the body of the given proxy.
+         */
+        RigidBody *getBody(unsigned proxy) const
+        {
+            return proxies[proxy].body;
+        }
+
+        /**
+         * Returns the box of the given proxy.
+         */
+        const BoundingBox &getBox(unsigned proxy) const
+        {
+            return proxies[proxy].box;
+        }
+
+        /**
+         * Returns the number of proxies.
+         */
+        unsigned getProxyCount() const
+        {
+            return proxyCount;
+        }
+
+        /**
+         * Returns the number of pairs of proxies whose boxes overlap.
+         */
+        unsigned getPairCount() const
+        {
+            return (unsigned)pairs.size();
+        }
+
+        /**
+         * Writes each pair of bodies whose boxes overlap to the given
+         * array, up to the given limit. Each pair is written once.
+         * Returns the number written.
+         */
+        unsigned getPotentialContacts(PotentialContact *contacts,
+                                      unsigned limit) const;
+    };
+
+    /**
+     * A broadphase that divides space into a grid of cubic cells, and
+     * finds pairs of bodies whose boxes share a cell. It suits many
+     * bodies of about the same size, such as debris, where it costs
+     * time in proportion to the number of bodies. The cells should be
+     * about as big as the bodies, so each body covers only a few.
+     *
+     * The grid isn't stored: cells are hashed into a fixed number of
+     * buckets, so bodies can be anywhere. The hash is rebuilt from
+     * scratch each frame: clear it, add every body with its box, then
+     * call build. Building sorts the bodies into flat arrays by
+     * bucket with a counting sort, with no allocation once the arrays
+     * have grown to size.
+     *
+     * Bodies that would cover more than a set number of cells, such
+     * as the ground, are kept out of the grid and checked against
+     * every other body instead.
+     */
+    class SpatialHash
+    {
+    protected:
+        /**
+         * Holds one body added to the hash.
+         */
+        struct Object
+        {
+            /** Holds the box of the body. */
+            BoundingBox box;
+
+            /** Holds the body. */
+            RigidBody *body;
+
+            /** Holds the lowest and highest cells the box covers. */
+            int lower[3];
+            int upper[3];
+
+            /** Is set if the box covers too many cells for the grid. */
+            bool oversize;
+        };
+
+        /**
+         * Holds one cell covered by one object.
+         */
+        struct CellEntry
+        {
+            /** Holds the coordinates of the cell. */
+            int cell[3];
+
+            /** Holds the object. */
+            unsigned object;
+        };
+
+        /**
+         * Holds the size of each side of a cell.
+         */
+        real cellSize;
+
+        /**
+         * Holds the most cells an object may cover and still be put
+         * in the grid.
+         */
+        unsigned maxCells;
+
+        /**
+         * Holds the objects added since the hash was cleared.
+         */
+        std::vector<Object> objects;
+
+        /**
+         * Holds the objects too big for the grid.
+         */
+        std::vector<unsigned> oversize;
+
+        /**
+         * Holds one entry for each cell covered by each object,
+         * sorted by bucket.
+         */
+        std::vector<CellEntry> entries;
+
+        /**
+         * Holds where each bucket's entries start, with one more
+         * entry at the end holding the total.
+         */
+        std::vector<unsigned> bucketStart;
+
+        /**
+         * Holds the number of buckets less one. The number of buckets
+         * is a power of two.
+         */
+        unsigned bucketMask;
+
+        /**
+         * Returns the bucket of the given cell.
+         */
+        unsigned getBucket(int x, int y, int z) const;
+
+        /**
+         * Writes the pairs the given object makes with later objects
+         * to the given array, up to the given limit. Returns the
+         * number written.
+         */
+        unsigned getContactsOf(unsigned index, PotentialContact *contacts,
+                               unsigned limit) const;
+
+    public:
+        /**
+         * Creates an empty hash with cells of the given size. Bodies
+         * covering more than the given number of cells are kept out
+         * of the grid.
+         */
+        SpatialHash(real cellSize = 1, unsigned maxCells = 64);
+
+        /**
+         * Sets the size of each side of a cell. This takes effect the
+         * next time the hash is built.
+         */
+        void setCellSize(real cellSize);
+
+        /**
+         * Returns the size of each side of a cell.
+         */
+        real getCellSize() const
+        {
+            return cellSize;
+        }
+
+        /**
+         * Removes every body from the hash.
+         */
+        void clear();
+
+        /**
+         * Adds the given body, with the given box, and returns its
+         * number. Bodies are numbered in the order they are added,
+         * from zero.
+         */
+        unsigned add(const BoundingBox &box, RigidBody *body);
+
+        /**
+         * Sorts the bodies added since the hash was cleared into
+         * their cells. This must be called before pairs are looked
+         * for.
+         */
+        void build();
+
+        /**
+         * Returns the number of bodies added.
+         */
+        unsigned getObjectCount() const
+        {
+            return (unsigned)objects.size();
+        }
+
+        /**
+         * Writes each pair of bodies whose boxes overlap to the given
+         * array, up to the given limit. Each pair is written once.
+         * Returns the number written.
+         */
+        unsigned getPotentialContacts(PotentialContact *contacts,
+                                      unsigned limit) const;
+
+        /**
+         * Works as getPotentialContacts, but only writes the pairs
+         * whose first body is one of the given run of bodies, from
+         * first up to but not including last. Runs that don't overlap
+         * give different pairs, so they can be worked on by different
+         * threads, each with its own array.
+         */
+        unsigned getPotentialContacts(PotentialContact *contacts,
+                                      unsigned limit,
+                                      unsigned first,
+                                      unsigned last) const;
+    };
+
 } // namespace cyclone
 
 #endif // CYCLONE_COLLISION_FINE_H
\ No newline at end of file
@@ -26,12 +26,14 @@
 #define CYCLONE_COLLISION_FINE_H
 
 #include "contacts.h"
+#include "contactbuffer.h"
 
 namespace cyclone {
 
     // Forward declarations of primitive friends
     class IntersectionTests;
     class CollisionDetector;
+    class CollisionTriangleMesh;
 
     /**
      * Represents a primitive to detect collisions against.
@@ -105,6 +107,29 @@ namespace cyclone {
         real radius;
     };
 
+    /**
+     * Points to a set of spheres laid out with each of their centre
+     * coordinates and radii in an array of its own, so that several
+     * spheres can be loaded into a register at once. The arrays are
+     * the caller's: this only points into them.
+     */
+    struct SphereArrays
+    {
+        /** Holds the x, y and z coordinates of the centres. */
+        const real *x;
+        const real *y;
+        const real *z;
+
+        /** Holds the radii. */
+        const real *radius;
+
+        /**
+         * Holds the sphere each entry came from, which gives the body
+         * for its contacts.
+         */
+        const CollisionSphere * const *spheres;
+    };
+
     /**
      * The plane is not a primitive: it doesn't represent another
      * rigid body. It is used for contacts with the immovable
@@ -137,6 +162,72 @@ namespace cyclone {
         Vector3 halfSize;
     };
 
+    /**
+     * Represents a rigid body that can be treated as a capsule for
+     * collision detection: the points within a radius of a segment.
+     * The segment runs along the primitive's Y axis, through its
+     * origin. Capsules suit limbs and characters: their tests are
+     * much cheaper than a box's, and they slide over edges rather
+     * than catching on them.
+     */
+    class CollisionCapsule : public CollisionPrimitive
+    {
+    public:
+        /**
+         * The radius of the capsule.
+         */
+        real radius;
+
+        /**
+         * Half the length of the segment, so the whole capsule is
+         * twice this plus twice the radius long.
+         */
+        real halfHeight;
+
+        /**
+         * Returns one of the two ends of the segment, in world
+         * coordinates: the end along the Y axis for index 0, the
+         * end against it for index 1.
+         */
+        Vector3 getEnd(unsigned index) const
+        {
+            return getAxis(3) + getAxis(1) * (index ? -halfHeight : halfHeight);
+        }
+    };
+
+    /**
+     * Represents a rigid body that can be treated as a convex hull
+     * for collision detection, such as a wedge or a piece of debris,
+     * that would otherwise need several boxes.
+     *
+     * The hull is given by its vertices. Points that aren't on the
+     * hull do no harm, but slow the tests down. Pairs with a hull are
+     * tested with the GJK and EPA algorithms (see convex.h), which
+     * give one contact, at the deepest point of the overlap.
+     */
+    class CollisionConvex : public CollisionPrimitive
+    {
+    public:
+        /**
+         * Holds the vertices of the hull, in the primitive's own
+         * coordinates. The array belongs to the caller, and can be
+         * shared by any number of hulls of the same shape.
+         */
+        const Vector3 *vertices;
+
+        /**
+         * Holds the number of vertices.
+         */
+        unsigned vertexCount;
+
+        /**
+         * Returns the vertex furthest in the given direction, in
+         * world coordinates. This is the support function used by
+         * GJK and EPA.
+         */
+        Vector3 support(const Vector3 &direction) const;
+    };
+
     /**
      * A wrapper class that holds fast intersection tests. These
      * can be used to drive the coarse collision detection system or
@@ -173,6 +264,48 @@ namespace cyclone {
         static bool boxAndHalfSpace(
             const CollisionBox &box,
             const CollisionPlane &plane);
+
+        /**
+         * Does an intersection test on a capsule and a half-space.
+         */
+        static bool capsuleAndHalfSpace(
+            const CollisionCapsule &capsule,
+            const CollisionPlane &plane);
+
+        /**
+         * Does an intersection test on a capsule and a sphere.
+         */
+        static bool capsuleAndSphere(
+            const CollisionCapsule &capsule,
+            const CollisionSphere &sphere);
+
+        /**
+         * Does an intersection test on two capsules.
+         */
+        static bool capsuleAndCapsule(
+            const CollisionCapsule &one,
+            const CollisionCapsule &two);
+
+        /**
+         * Does an intersection test on a capsule and a box.
+         */
+        static bool capsuleAndBox(
+            const CollisionCapsule &capsule,
+            const CollisionBox &box);
+
+        /**
+         * Does an intersection test on a convex hull and a half-space.
+         */
+        static bool convexAndHalfSpace(
+            const CollisionConvex &convex,
+            const CollisionPlane &plane);
+
+        /**
+         * Does an intersection test on two convex hulls, using GJK.
+         */
+        static bool convexAndConvex(
+            const CollisionConvex &one,
+            const CollisionConvex &two);
     };
 
 
@@ -186,7 +319,8 @@ namespace cyclone {
          * Holds the base of the collision data: the first contact
          * in the array. This is used so that the contact pointer (below)
          * can be incremented each time a contact is detected, while
-         * this pointer points to the first contact found.
+         * this pointer points to the first contact found. This isn't
+         * used when contacts go into a buffer.
          */
         Contact *contactArray;
 
@@ -211,25 +345,74 @@ namespace cyclone {
          */
         real tolerance;
 
+        /**
+         * Holds the buffer contacts are written to, or NULL if they
+         * are written to the contact array. A buffer grows as it
+         * needs to, so contacts are never dropped. Each buffer should
+         * be filled through only one collision data at a time.
+         */
+        ContactBuffer *buffer;
+
+        /**
+         * Creates collision data with no contact array or buffer.
+         */
+        CollisionData()
+            : contactArray(NULL), contacts(NULL), contactsLeft(0),
+            contactCount(0), friction(0), restitution(0), tolerance(0),
+            buffer(NULL)
+        {
+        }
+
         /**
          * Checks if there are more contacts available in the contact
-         * data.
+         * data. There always are when writing to a buffer.
          */
         bool hasMoreContacts()
         {
+            return buffer != NULL || contactsLeft > 0;
+        }
+
+        /**
+         * Makes sure there is room for the given number of contacts
+         * at the contacts pointer, taking more from the buffer if
+         * there is one. Returns false if there is no room at all. With
+         * a contact array, there may be room for fewer contacts than
+         * asked for, as given by contactsLeft.
+         */
+        bool makeRoom(unsigned count)
+        {
+            if (buffer && contactsLeft < (int)count)
+            {
+                contacts = buffer->reserve(count);
+                contactsLeft = (int)buffer->getRoom();
+            }
             return contactsLeft > 0;
         }
 
         /**
-         * Resets the data so that it has no used contacts recorded.
+         * Resets the data so that it has no used contacts recorded,
+         * and writes contacts to the contact array.
          */
         void reset(unsigned maxContacts)
         {
+            buffer = NULL;
             contactsLeft = maxContacts;
             contactCount = 0;
             contacts = contactArray;
         }
 
+        /**
+         * Resets the data so that it has no used contacts recorded,
+         * and writes contacts to the end of the given buffer.
+         */
+        void reset(ContactBuffer *buffer)
+        {
+            CollisionData::buffer = buffer;
+            contactCount = 0;
+            contacts = buffer->reserve(1);
+            contactsLeft = (int)buffer->getRoom();
+        }
+
         /**
          * Notifies the data that the given number of contacts have
          * been added.
@@ -242,6 +425,7 @@ namespace cyclone {
 
             // Move the array forward
             contacts += count;
+            if (buffer) buffer->commit(count);
         }
     };
 
@@ -275,6 +459,34 @@ namespace cyclone {
             CollisionData *data
             );
 
+        /**
+         * Tests each sphere in one against the sphere with the same
+         * index in two, for the given number of pairs. The pairs are
+         * tested a register at a time when built with SSE, and
+         * contacts are only made for those that touch. The contacts
+         * are the same, in the same order, as calling sphereAndSphere
+         * on each pair.
+         */
+        static unsigned sphereAndSphereBatch(
+            const SphereArrays &one,
+            const SphereArrays &two,
+            unsigned count,
+            CollisionData *data
+            );
+
+        /**
+         * Tests the given number of spheres against a half-space, a
+         * register at a time when built with SSE. The contacts are
+         * the same, in the same order, as calling sphereAndHalfSpace
+         * on each sphere.
+         */
+        static unsigned sphereAndHalfSpaceBatch(
+            const SphereArrays &spheres,
+            unsigned count,
+            const CollisionPlane &plane,
+            CollisionData *data
+            );
+
         /**
          * Does a collision test on a collision box and a plane representing
          * a half-space (i.e. the normal of the plane
@@ -286,12 +498,49 @@ namespace cyclone {
             CollisionData *data
             );
 
+        /**
+         * Does a collision test on two boxes. When built with SSE,
+         * the separating axes are tested a register at a time: the
+         * face axes first, then the edge axes if none of the face
+         * axes separate the boxes.
+         */
         static unsigned boxAndBox(
             const CollisionBox &one,
             const CollisionBox &two,
             CollisionData *data
             );
 
+        /**
+         * Does a collision test on two boxes, giving up to four
+         * contacts that hold a face resting on another face flat.
+         *
+         * The separating axis test is the same as boxAndBox's. When
+         * the axis of least penetration is a face axis, the nearest
+         * face of the other box is clipped against the sides of that
+         * face, and the clipped points below it become contacts. If
+         * there are more than four, the four that cover the most area
+         * are kept. Edges touching give one contact, as in boxAndBox,
+         * unless a face axis is nearly as good.
+         */
+        static unsigned boxAndBoxClipped(
+            const CollisionBox &one,
+            const CollisionBox &two,
+            CollisionData *data
+            );
+
+        /**
+         * Tests each box in one against the box with the same index
+         * in two, for the given number of pairs, stopping when there
+         * is no more room for contacts. The contacts are the same, in
+         * the same order, as calling boxAndBox on each pair.
+         */
+        static unsigned boxAndBoxBatch(
+            const CollisionBox * const *one,
+            const CollisionBox * const *two,
+            unsigned count,
+            CollisionData *data
+            );
+
         static unsigned boxAndPoint(
             const CollisionBox &box,
             const Vector3 &point,
@@ -303,6 +552,161 @@ namespace cyclone {
             const CollisionSphere &sphere,
             CollisionData *data
             );
+
+        /**
+         * Does a collision test on a capsule and a half-space, giving
+         * a contact for each end of the capsule in the half-space.
+         */
+        static unsigned capsuleAndHalfSpace(
+            const CollisionCapsule &capsule,
+            const CollisionPlane &plane,
+            CollisionData *data
+            );
+
+        /**
+         * Does a collision test on a capsule and a sphere, as two
+         * spheres, one at the point of the capsule's segment nearest
+         * the sphere.
+         */
+        static unsigned capsuleAndSphere(
+            const CollisionCapsule &capsule,
+            const CollisionSphere &sphere,
+            CollisionData *data
+            );
+
+        /**
+         * Does a collision test on two capsules, as two spheres at the
+         * nearest points of their segments. Capsules lying side by
+         * side get a contact at each end of the stretch where they
+         * overlap, so they don't roll about a single point.
+         */
+        static unsigned capsuleAndCapsule(
+            const CollisionCapsule &one,
+            const CollisionCapsule &two,
+            CollisionData *data
+            );
+
+        /**
+         * Does a collision test on a capsule and a box, from the
+         * points of the capsule's segment and the box nearest each
+         * other. A capsule lying on a face of the box gets a contact
+         * at each end of the part over the face. If the segment goes
+         * into the box, the capsule is pushed out through the face it
+         * is nearest to leaving by.
+         */
+        static unsigned capsuleAndBox(
+            const CollisionCapsule &capsule,
+            const CollisionBox &box,
+            CollisionData *data
+            );
+
+        /**
+         * Does a collision test on a convex hull and a half-space,
+         * giving a contact at each vertex below the plane.
+         */
+        static unsigned convexAndHalfSpace(
+            const CollisionConvex &convex,
+            const CollisionPlane &plane,
+            CollisionData *data
+            );
+
+        /**
+         * Does a collision test on a convex hull and a sphere. The
+         * centre of the sphere is tested against the hull with GJK,
+         * which is exact; EPA is only needed if the centre is inside.
+         */
+        static unsigned convexAndSphere(
+            const CollisionConvex &convex,
+            const CollisionSphere &sphere,
+            CollisionData *data
+            );
+
+        /**
+         * Does a collision test on a convex hull and a capsule. The
+         * capsule's segment is tested against the hull with GJK, as
+         * for a sphere.
+         */
+        static unsigned convexAndCapsule(
+            const CollisionConvex &convex,
+            const CollisionCapsule &capsule,
+            CollisionData *data
+            );
+
+        /**
+         * Does a collision test on a convex hull and a box, using GJK
+         * and EPA.
+         */
+        static unsigned convexAndBox(
+            const CollisionConvex &convex,
+            const CollisionBox &box,
+            CollisionData *data
+            );
+
+        /**
+         * Does a collision test on two convex hulls, using GJK and
+         * EPA.
+         */
+        static unsigned convexAndConvex(
+            const CollisionConvex &one,
+            const CollisionConvex &two,
+            CollisionData *data
+            );
+
+        /**
+         * Does a collision test on a sphere and a triangle mesh. Only
+         * the triangles in leaves of the mesh's hierarchy that the
+         * sphere's bounding box reaches are tested, and each that the
+         * sphere touches from the front gives a point. The feature
+         * is the index the triangle was given to the mesh with,
+         * shifted up by MESH_FEATURE_BITS.
+         *
+         * The points from every triangle are gathered before any
+         * contact is written. Points that neighbouring triangles find
+         * in the same place with the same normal, as where a sphere
+         * rests on a corner they share, become one contact. Points
+         * with much the same normal are then reduced to at most four,
+         * as boxAndBoxClipped reduces a clipped face, so a primitive
+         * resting on a patch of small triangles gets no more contacts
+         * than it would on a plane.
+         */
+        static unsigned sphereAndTriangleMesh(
+            const CollisionSphere &sphere,
+            const CollisionTriangleMesh &mesh,
+            CollisionData *data
+            );
+
+        /**
+         * Does a collision test on a capsule and a triangle mesh, as
+         * for a sphere. Each end of the capsule is tested against a
+         * triangle as a sphere, so a capsule lying on the mesh rests
+         * on both, and the middle gets a contact too if it goes in
+         * deeper than either, as it does lying across an edge.
+         */
+        static unsigned capsuleAndTriangleMesh(
+            const CollisionCapsule &capsule,
+            const CollisionTriangleMesh &mesh,
+            CollisionData *data
+            );
+
+        /**
+         * Does a collision test on a box and a triangle mesh, as for
+         * a sphere. Each triangle is tested with the separating axis
+         * test, and the face of the box or triangle it finds is
+         * clipped against the other, as boxAndBoxClipped does, giving
+         * up to four points for each triangle before they are merged
+         * and reduced.
+         */
+        static unsigned boxAndTriangleMesh(
+            const CollisionBox &box,
+            const CollisionTriangleMesh &mesh,
+            CollisionData *data
+            );
+
+        /**
+         * Holds the number of bits of a triangle mesh contact's
+         * feature that tell apart the contacts with one triangle.
+         */
+        static const unsigned MESH_FEATURE_BITS = 7;
     };
 
 
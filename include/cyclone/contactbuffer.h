@@ -0,0 +1,246 @@
+/*
+ * Interface file for the growable contact buffers.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains buffers that hold any number of contacts,
+ * growing in chunks as contacts are added, and the arena the chunks
+ * come from.
+ */
+#ifndef CYCLONE_CONTACTBUFFER_H
+#define CYCLONE_CONTACTBUFFER_H
+
+#include <vector>
+#include "arena.h"
+#include "contacts.h"
+
+namespace cyclone {
+
+    /**
+     * Hands out chunks of contacts to contact buffers, and takes them
+     * all back at once when the frame is over.
+     *
+     * The chunks are taken from a frame arena, so once the simulation
+     * has settled into its usual number of contacts no more memory is
+     * allocated. The frame arena can be shared with the rest of the
+     * frame's memory, or the contact arena can keep one of its own.
+     * Chunks can be taken by several threads at once.
+     */
+    class ContactArena
+    {
+    protected:
+        /**
+         * Holds the frame arena used when none is given.
+         */
+        FrameArena *ownArena;
+
+        /**
+         * Holds the frame arena chunks are taken from.
+         */
+        FrameArena *frameArena;
+
+        /**
+         * Holds the number of contacts in a chunk.
+         */
+        unsigned chunkSize;
+
+    public:
+        /**
+         * Creates an arena whose chunks hold the given number of
+         * contacts, taken from the given frame arena. If no frame
+         * arena is given, the contact arena makes its own.
+         */
+        ContactArena(unsigned chunkSize = 256, FrameArena *frameArena = NULL);
+
+        /**
+         * Frees the frame arena, if it is the contact arena's own.
+         */
+        ~ContactArena();
+
+        /**
+         * Returns a chunk with room for at least the given number of
+         * contacts, and sets size to the number it holds. This is the
+         * chunk size unless more were asked for. The contacts are
+         * left uninitialised.
+         */
+        Contact *allocate(unsigned count, unsigned &size);
+
+        /**
+         * Takes back every chunk handed out. Buffers using the arena
+         * must be cleared before they are used again. A frame arena
+         * that was given to the contact arena is left alone: whoever
+         * owns it resets it.
+         */
+        void reset();
+
+        /**
+         * Sets the number of contacts in the chunks allocated from
+         * now on.
+         */
+        void setChunkSize(unsigned chunkSize);
+
+        /**
+         * Returns the number of contacts in a chunk.
+         */
+        unsigned getChunkSize() const
+        {
+            return chunkSize;
+        }
+
+        /**
+         * Returns the frame arena chunks are taken from.
+         */
+        FrameArena *getFrameArena() const
+        {
+            return frameArena;
+        }
+    };
+
+    /**
+     * Holds any number of contacts, in a list of chunks taken from a
+     * contact arena as they are needed. Contacts are never dropped for
+     * lack of room, and no room is set aside for contacts that aren't
+     * found.
+     *
+     * Each thread that generates contacts should have a buffer of its
+     * own. The buffers can then be joined, in an order that doesn't
+     * depend on the threads, by handing one's chunks on to another:
+     * no contacts are copied.
+     *
+     * The contacts in each chunk are contiguous, but the chunks are
+     * not contiguous with each other. Use a CollisionData to fill a
+     * buffer from the collision detector.
+     */
+    class ContactBuffer
+    {
+    protected:
+        /**
+         * Holds one chunk of the buffer.
+         */
+        struct Chunk
+        {
+            /** Holds the first contact of the chunk. */
+            Contact *contacts;
+
+            /** Holds the number of contacts used. */
+            unsigned count;
+
+            /** Holds the number of contacts the chunk has room for. */
+            unsigned size;
+        };
+
+        /**
+         * Holds the arena chunks are taken from.
+         */
+        ContactArena *arena;
+
+        /**
+         * Holds the chunks in order.
+         */
+        std::vector<Chunk> chunks;
+
+        /**
+         * Holds the number of contacts in every chunk.
+         */
+        unsigned total;
+
+    public:
+        /**
+         * Creates an empty buffer taking its chunks from the given
+         * arena.
+         */
+        ContactBuffer(ContactArena *arena);
+
+        /**
+         * Empties the buffer. Its chunks are still the arena's until
+         * the arena is reset.
+         */
+        void clear();
+
+        /**
+         * Returns room for at least the given number of contacts, at
+         * the end of the buffer, taking a new chunk if the last one is
+         * too full. The contacts written there are added to the buffer
+         * by calling commit.
+         */
+        Contact *reserve(unsigned count);
+
+        /**
+         * Returns the room left at the end of the buffer without
+         * taking another chunk.
+         */
+        unsigned getRoom() const
+        {
+            if (chunks.empty()) return 0;
+            const Chunk &last = chunks.back();
+            return last.size - last.count;
+        }
+
+        /**
+         * Adds the given number of contacts, written at the end of the
+         * buffer, to it.
+         */
+        void commit(unsigned count)
+        {
+            chunks.back().count += count;
+            total += count;
+        }
+
+        /**
+         * Moves the chunks of the given buffer onto the end of this
+         * one, leaving the other empty. Both must use the same arena.
+         */
+        void append(ContactBuffer &other);
+
+        /**
+         * Copies every contact in the buffer, in order, to the given
+         * array, which must have room for them.
+         */
+        void copyTo(Contact *destination) const;
+
+        /**
+         * Returns the number of contacts in the buffer.
+         */
+        unsigned getSize() const
+        {
+            return total;
+        }
+
+        /**
+         * Returns the number of chunks in the buffer.
+         */
+        unsigned getChunkCount() const
+        {
+            return (unsigned)chunks.size();
+        }
+
+        /**
+         * Returns the first contact of the given chunk.
+         */
+        Contact *getChunk(unsigned chunk) const
+        {
+            return chunks[chunk].contacts;
+        }
+
+        /**
+         * Returns the number of contacts in the given chunk.
+         */
+        unsigned getChunkSize(unsigned chunk) const
+        {
+            return chunks[chunk].count;
+        }
+    };
+
+} // namespace cyclone
+
+#endif // CYCLONE_CONTACTBUFFER_H
@@ -26,6 +26,7 @@
 #ifndef CYCLONE_CONTACTS_H
 #define CYCLONE_CONTACTS_H
 
+#include <vector>
 #include "body.h"
 
 namespace cyclone {
@@ -65,6 +66,7 @@ namespace cyclone {
          * set and effect the contact.
          */
         friend class ContactResolver;
+        friend class SequentialImpulseResolver;
 
     public:
         /**
@@ -100,12 +102,24 @@ namespace cyclone {
          */
         real penetration;
 
+        /**
+         * Identifies the features of the two bodies (a vertex and a
+         * face, say) that produced the contact, so the same contact
+         * can be recognised from one frame to the next. Together with
+         * the two bodies this makes a key for caching data about the
+         * contact. Generators that can't tell features apart should
+         * leave it at zero.
+         */
+        unsigned feature;
+
         /**
          * Sets the data that doesn't normally depend on the position
-         * of the contact (i.e. the bodies, and their material properties).
+         * of the contact (i.e. the bodies, and their material properties),
+         * along with the feature identifier.
          */
         void setBodyData(RigidBody* one, RigidBody *two,
-                         real friction, real restitution);
+                         real friction, real restitution,
+                         unsigned feature = 0);
 
     protected:
 
@@ -218,6 +232,99 @@ namespace cyclone {
         Vector3 calculateFrictionImpulse(Matrix3 *inverseInertiaTensor);
     };
 
+    /**
+     * An indexed binary max-heap of contact indices, keyed on a real
+     * value. The contact resolver uses it to find the most severe
+     * contact without scanning the whole contact array: the key of
+     * any contact can be changed in O(log n) time, so after each
+     * resolution step only the contacts that were touched need to be
+     * re-ordered.
+     */
+    class ContactQueue
+    {
+        /**
+         * Holds the contact indices in heap order.
+         */
+        std::vector<unsigned> heap;
+
+        /**
+         * Holds the position of each contact index in the heap.
+         */
+        std::vector<unsigned> position;
+
+        /**
+         * Holds the current key of each contact index.
+         */
+        std::vector<real> key;
+
+        /**
+         * Moves the entry at the given heap position towards the root
+         * until the heap property is restored.
+         */
+        void siftUp(unsigned at);
+
+        /**
+         * Moves the entry at the given heap position towards the leaves
+         * until the heap property is restored.
+         */
+        void siftDown(unsigned at);
+
+        /**
+         * Checks if the entry at the first heap position should come
+         * out of the queue before the entry at the second.
+         */
+        bool before(unsigned a, unsigned b) const;
+
+        /**
+         * Swaps the two entries at the given heap positions.
+         */
+        void swapEntries(unsigned a, unsigned b);
+
+    public:
+        /**
+         * Sets the queue to hold the given number of contacts, all
+         * with a key of zero. The keys should then be set with setKey
+         * and the queue ordered with a call to heapify.
+         */
+        void reset(unsigned count);
+
+        /**
+         * Sets the key for the given contact without reordering the
+         * queue. Use this to fill the queue before calling heapify.
+         */
+        void setKey(unsigned index, real value)
+        {
+            key[index] = value;
+        }
+
+        /**
+         * Orders the whole queue. This takes linear time.
+         */
+        void heapify();
+
+        /**
+         * Changes the key of the given contact and restores the heap
+         * order.
+         */
+        void update(unsigned index, real value);
+
+        /**
+         * Returns the index of the contact with the largest key.
+         */
+        unsigned top() const
+        {
+            return heap[0];
+        }
+
+        /**
+         * Returns the largest key in the queue.
+         */
+        real topKey() const
+        {
+            return key[heap[0]];
+        }
+    };
+
     /**
      * The contact resolution routine. One resolver instance
      * can be shared for the whole simulation, as long as you need
@@ -318,6 +425,76 @@ namespace cyclone {
          */
         bool validSettings;
 
+    protected:
+        /**
+         * True if the resolver should keep its contacts in a priority
+         * queue, rather than scanning every contact to find the most
+         * severe one at each iteration.
+         *
+         * @see setUseHeap
+         */
+        bool useHeap;
+
+        /**
+         * Holds the priority queue used when useHeap is set.
+         */
+        ContactQueue queue;
+
+        /**
+         * @name Body Adjacency
+         *
+         * These arrays are rebuilt by prepareContacts. Together they
+         * form a compressed (CSR) list of the contacts each body takes
+         * part in, so that after a contact is resolved only the
+         * contacts sharing one of its bodies need to be updated.
+         *
+         * Each contact has two body slots, identified by the value
+         * contactIndex*2 + bodyIndex.
+         */
+        /*@{*/
+
+        /**
+         * Holds the number of distinct bodies in the current contacts.
+         */
+        unsigned numBodies;
+
+        /**
+         * Holds the body number for each contact slot, or NO_BODY if the
+         * slot holds no body.
+         */
+        std::vector<unsigned> slotBody;
+
+        /**
+         * Holds, for each body number, the offset of its first entry in
+         * bodySlots. The entries for body n run up to the offset held
+         * for body n+1.
+         */
+        std::vector<unsigned> bodySlotStart;
+
+        /**
+         * Holds the contact slots that refer to each body, grouped by
+         * body and in increasing slot order within each group.
+         */
+        std::vector<unsigned> bodySlots;
+
+        /**
+         * Holds the slots affected by the last resolved contact, as
+         * filled by findAffectedSlots.
+         */
+        std::vector<unsigned> affectedSlots;
+
+        /**
+         * Holds scratch data used to sort slots by body.
+         */
+        std::vector< std::pair<RigidBody*, unsigned> > slotSortBuffer;
+
+        /*@}*/
+
+        /**
+         * Marks a contact slot with no body in the adjacency data.
+         */
+        static const unsigned NO_BODY = 0xffffffff;
+
     public:
         /**
          * Creates a new contact resolver with the given number of iterations
@@ -336,6 +513,16 @@ namespace cyclone {
             real velocityEpsilon=(real)0.01,
             real positionEpsilon=(real)0.01);
 
+        virtual ~ContactResolver() {}
+
+        /**
+         * Creates a new resolver with the same settings as this one.
+         * This is used to give each worker thread its own resolver,
+         * so resolvers that share data between calls should make sure
+         * their clones share it too.
+         */
+        virtual ContactResolver *clone() const;
+
         /**
          * Returns true if the resolver has valid settings and is ready to go.
          */
@@ -364,6 +551,31 @@ namespace cyclone {
         void setEpsilon(real velocityEpsilon,
                         real positionEpsilon);
 
+        /**
+         * Sets whether the resolver selects the next contact to resolve
+         * from a priority queue.
+         *
+         * By default the resolver scans every contact at each iteration
+         * to find the worst one, which makes resolution quadratic in the
+         * number of contacts when the iteration count is proportional to
+         * it. With the heap, finding the worst contact is constant time
+         * and only the contacts touched by a resolution step have their
+         * position in the queue updated. Ties are broken the same way as
+         * the scan, so both modes resolve contacts in the same order.
+         * The heap is worth using for
+         * large piles of objects: for a handful of contacts the linear
+         * scan is faster.
+         */
+        void setUseHeap(bool useHeap=true);
+
+        /**
+         * Tells the resolver that a new simulation frame is starting.
+         * This should be called once per frame, before the frame's
+         * calls to resolveContacts. This resolver keeps nothing from
+         * one frame to the next, so it does nothing.
+         */
+        virtual void startFrame() {}
+
         /**
          * Resolves a set of contacts for both penetration and velocity.
          *
@@ -390,7 +602,7 @@ namespace cyclone {
          * @param duration The duration of the previous integration step.
          * This is used to compensate for forces applied.
          */
-        void resolveContacts(Contact *contactArray,
+        virtual void resolveContacts(Contact *contactArray,
             unsigned numContacts,
             real duration);
 
@@ -398,11 +610,24 @@ namespace cyclone {
         /**
          * Sets up contacts ready for processing. This makes sure their
          * internal data is configured correctly and the correct set of bodies
-         * is made alive.
+         * is made alive. It also builds the body adjacency data.
          */
         void prepareContacts(Contact *contactArray, unsigned numContacts,
             real duration);
 
+        /**
+         * Builds the body adjacency data for the given contacts.
+         */
+        void buildAdjacency(Contact *contactArray, unsigned numContacts);
+
+        /**
+         * Fills affectedSlots with every contact slot that shares a body
+         * with the given contact. Each entry is the slot number shifted
+         * up by one bit, with the low bit holding which body of the given
+         * contact it shares. Entries come out in increasing slot order.
+         */
+        void findAffectedSlots(unsigned index);
+
         /**
          * Resolves the velocity issues with the given array of constraints,
          * using the given number of iterations.
@@ -436,6 +661,18 @@ namespace cyclone {
          * been written.
          */
         virtual unsigned addContact(Contact *contact, unsigned limit) const = 0;
+
+        /**
+         * Checks if a contact between the given bodies can be left
+         * out because neither of them can move: each is either asleep
+         * or scenery (NULL). The world puts whole islands to sleep,
+         * so such a contact would only join two sleeping islands.
+         * Generators should use this to skip those pairs.
+         */
+        static bool isSettled(const RigidBody *one, const RigidBody *two)
+        {
+            return (!one || !one->getAwake()) && (!two || !two->getAwake());
+        }
     };
 
 } // namespace cyclone
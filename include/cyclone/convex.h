@@ -0,0 +1,228 @@
+/*
+ * Interface file for the convex shape queries.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains the GJK and EPA algorithms, which find the
+ * distance between two convex shapes, or how far they overlap, from
+ * nothing more than the furthest point of each shape in a given
+ * direction.
+ */
+#ifndef CYCLONE_CONVEX_H
+#define CYCLONE_CONVEX_H
+
+#include "collide_fine.h"
+
+namespace cyclone {
+
+    /**
+     * A convex shape that can be handed to ConvexTests. A shape is
+     * known only by its support function: the point of the shape
+     * furthest in a given direction.
+     */
+    class ConvexShape
+    {
+    public:
+        virtual ~ConvexShape() {}
+
+        /**
+         * Returns the point of the shape, in world coordinates, that
+         * is furthest in the given direction. The direction needn't
+         * be of unit length.
+         */
+        virtual Vector3 support(const Vector3 &direction) const = 0;
+
+        /**
+         * Returns a point inside the shape, from which the search
+         * starts.
+         */
+        virtual Vector3 getCentre() const = 0;
+    };
+
+    /**
+     * Presents a sphere, or a point if its radius is zero, as a
+     * convex shape.
+     */
+    class SphereShape : public ConvexShape
+    {
+    public:
+        Vector3 centre;
+        real radius;
+
+        SphereShape(const Vector3 &centre, real radius = 0)
+            : centre(centre), radius(radius)
+        {
+        }
+
+        SphereShape(const CollisionSphere &sphere)
+            : centre(sphere.getAxis(3)), radius(sphere.radius)
+        {
+        }
+
+        virtual Vector3 support(const Vector3 &direction) const;
+
+        virtual Vector3 getCentre() const
+        {
+            return centre;
+        }
+    };
+
+    /**
+     * Presents a capsule, or a segment if its radius is zero, as a
+     * convex shape.
+     */
+    class CapsuleShape : public ConvexShape
+    {
+    public:
+        Vector3 start;
+        Vector3 end;
+        real radius;
+
+        CapsuleShape(const Vector3 &start, const Vector3 &end,
+                     real radius = 0)
+            : start(start), end(end), radius(radius)
+        {
+        }
+
+        CapsuleShape(const CollisionCapsule &capsule)
+            : start(capsule.getEnd(0)), end(capsule.getEnd(1)),
+            radius(capsule.radius)
+        {
+        }
+
+        virtual Vector3 support(const Vector3 &direction) const;
+
+        virtual Vector3 getCentre() const
+        {
+            return (start + end) * (real)0.5;
+        }
+    };
+
+    /**
+     * Presents a collision box as a convex shape.
+     */
+    class BoxShape : public ConvexShape
+    {
+    public:
+        const CollisionBox &box;
+
+        BoxShape(const CollisionBox &box) : box(box) {}
+
+        virtual Vector3 support(const Vector3 &direction) const;
+
+        virtual Vector3 getCentre() const
+        {
+            return box.getAxis(3);
+        }
+    };
+
+    /**
+     * Presents a collision hull as a convex shape.
+     */
+    class HullShape : public ConvexShape
+    {
+    public:
+        const CollisionConvex &hull;
+
+        HullShape(const CollisionConvex &hull) : hull(hull) {}
+
+        virtual Vector3 support(const Vector3 &direction) const
+        {
+            return hull.support(direction);
+        }
+
+        virtual Vector3 getCentre() const
+        {
+            return hull.getAxis(3);
+        }
+    };
+
+    /**
+     * Holds the result of a query between two convex shapes.
+     */
+    struct ConvexResult
+    {
+        /**
+         * Holds the closest point on each shape or, if they overlap,
+         * the deepest point of each inside the other.
+         */
+        Vector3 pointOne;
+        Vector3 pointTwo;
+
+        /**
+         * Holds the unit direction from the first shape to the
+         * second. Moving the second shape along it by the depth of
+         * their overlap separates them.
+         */
+        Vector3 normal;
+
+        /**
+         * Holds the distance between the shapes, which is the
+         * negative of the depth of their overlap if they overlap.
+         */
+        real distance;
+    };
+
+    /**
+     * A wrapper class that holds the queries between pairs of convex
+     * shapes.
+     *
+     * The Gilbert-Johnson-Keerthi (GJK) algorithm looks for the point
+     * nearest the origin in the set of differences between a point of
+     * one shape and a point of the other. It builds a simplex of up
+     * to four such differences, found with the support functions of
+     * the shapes, moving it towards the origin until it can get no
+     * nearer, or until it holds the origin, in which case the shapes
+     * overlap.
+     *
+     * For overlapping shapes, the Expanding Polytope Algorithm (EPA)
+     * grows the final simplex into a polytope, adding the support
+     * point beyond its nearest face each time, until the nearest face
+     * is on the surface of the difference. That face gives the
+     * direction and depth of the overlap.
+     *
+     * Both are approximate for curved shapes, to within a small
+     * fraction of the size of the shapes.
+     */
+    class ConvexTests
+    {
+    public:
+        /**
+         * Checks if the two shapes overlap. Shapes that only touch
+         * count as overlapping.
+         */
+        static bool intersect(const ConvexShape &one,
+                              const ConvexShape &two);
+
+        /**
+         * Finds the distance between the two shapes, returning false
+         * if they overlap, in which case the result is not written.
+         */
+        static bool distance(const ConvexShape &one,
+                             const ConvexShape &two,
+                             ConvexResult *result);
+
+        /**
+         * Finds how far the two shapes overlap, returning false if
+         * they don't. If they don't overlap, the result holds their
+         * distance, as from distance, unless they only touch or one
+         * is flat, when it is not written.
+         */
+        static bool penetration(const ConvexShape &one,
+                                const ConvexShape &two,
+                                ConvexResult *result);
+    };
+
+} // namespace cyclone
+
+#endif // CYCLONE_CONVEX_H
@@ -98,6 +98,7 @@
 #define CYCLONE_CORE_H
 
 #include "precision.h"
+#include "simd.h"
 
 /**
  * The cyclone namespace includes all cyclone functions and
@@ -166,19 +167,58 @@ namespace cyclone {
         real z;
 
     private:
-        /** Padding to ensure 4 word alignment. */
+        /**
+         * Padding to ensure 4 word alignment. This is kept at zero,
+         * so that when the vector is loaded into SSE registers the
+         * fourth lane holds an ordinary value.
+         */
         real pad;
 
     public:
+#ifdef CYCLONE_USE_SSE
+        /**
+         * @name SSE Functions
+         *
+         * These move the vector in and out of SSE registers, for the
+         * vector and matrix classes. The padding is loaded and stored
+         * along with the vector, so the lanes stored should have zero
+         * in the last lane, as they do when they were worked out from
+         * vectors.
+         */
+        /*@{*/
+
+        /** Loads the vector, padding included. */
+        simd::Real4 lanes() const
+        {
+            return simd::load4(&x);
+        }
+
+        /** Stores the given lanes into the vector, padding included. */
+        void setLanes(const simd::Real4 &lanes)
+        {
+            simd::store4(&x, lanes);
+        }
+
+        /** Creates a vector from the given lanes. */
+        static Vector3 fromLanes(const simd::Real4 &lanes)
+        {
+            Vector3 result;
+            result.setLanes(lanes);
+            return result;
+        }
+
+        /*@}*/
+#endif
+
         /** The default constructor creates a zero vector. */
-        Vector3() : x(0), y(0), z(0) {}
+        Vector3() : x(0), y(0), z(0), pad(0) {}
 
         /**
          * The explicit constructor creates a vector with the given
          * components.
          */
         Vector3(const real x, const real y, const real z)
-            : x(x), y(y), z(z) {}
+            : x(x), y(y), z(z), pad(0) {}
 
         const static Vector3 GRAVITY;
         const static Vector3 HIGH_GRAVITY;
@@ -209,9 +249,13 @@ namespace cyclone {
         /** Adds the given vector to this. */
         void operator+=(const Vector3& v)
         {
+#ifdef CYCLONE_USE_SSE
+            setLanes(simd::add(lanes(), v.lanes()));
+#else
             x += v.x;
             y += v.y;
             z += v.z;
+#endif
         }
 
         /**
@@ -219,15 +263,23 @@ namespace cyclone {
          */
         Vector3 operator+(const Vector3& v) const
         {
+#ifdef CYCLONE_USE_SSE
+            return fromLanes(simd::add(lanes(), v.lanes()));
+#else
             return Vector3(x+v.x, y+v.y, z+v.z);
+#endif
         }
 
         /** Subtracts the given vector from this. */
         void operator-=(const Vector3& v)
         {
+#ifdef CYCLONE_USE_SSE
+            setLanes(simd::sub(lanes(), v.lanes()));
+#else
             x -= v.x;
             y -= v.y;
             z -= v.z;
+#endif
         }
 
         /**
@@ -235,21 +287,33 @@ namespace cyclone {
          */
         Vector3 operator-(const Vector3& v) const
         {
+#ifdef CYCLONE_USE_SSE
+            return fromLanes(simd::sub(lanes(), v.lanes()));
+#else
             return Vector3(x-v.x, y-v.y, z-v.z);
+#endif
         }
 
         /** Multiplies this vector by the given scalar. */
         void operator*=(const real value)
         {
+#ifdef CYCLONE_USE_SSE
+            setLanes(simd::mul(lanes(), simd::splat(value)));
+#else
             x *= value;
             y *= value;
             z *= value;
+#endif
         }
 
         /** Returns a copy of this vector scaled the given value. */
         Vector3 operator*(const real value) const
         {
+#ifdef CYCLONE_USE_SSE
+            return fromLanes(simd::mul(lanes(), simd::splat(value)));
+#else
             return Vector3(x*value, y*value, z*value);
+#endif
         }
 
         /**
@@ -258,7 +322,11 @@ namespace cyclone {
          */
         Vector3 componentProduct(const Vector3 &vector) const
         {
+#ifdef CYCLONE_USE_SSE
+            return fromLanes(simd::mul(lanes(), vector.lanes()));
+#else
             return Vector3(x * vector.x, y * vector.y, z * vector.z);
+#endif
         }
 
         /**
@@ -267,9 +335,13 @@ namespace cyclone {
          */
         void componentProductUpdate(const Vector3 &vector)
         {
+#ifdef CYCLONE_USE_SSE
+            setLanes(simd::mul(lanes(), vector.lanes()));
+#else
             x *= vector.x;
             y *= vector.y;
             z *= vector.z;
+#endif
         }
 
         /**
@@ -278,9 +350,13 @@ namespace cyclone {
          */
         Vector3 vectorProduct(const Vector3 &vector) const
         {
+#ifdef CYCLONE_USE_SSE
+            return fromLanes(simd::cross(lanes(), vector.lanes()));
+#else
             return Vector3(y*vector.z-z*vector.y,
                            z*vector.x-x*vector.z,
                            x*vector.y-y*vector.x);
+#endif
         }
 
         /**
@@ -298,9 +374,7 @@ namespace cyclone {
          */
         Vector3 operator%(const Vector3 &vector) const
         {
-            return Vector3(y*vector.z-z*vector.y,
-                           z*vector.x-x*vector.z,
-                           x*vector.y-y*vector.x);
+            return vectorProduct(vector);
         }
 
         /**
@@ -309,7 +383,11 @@ namespace cyclone {
          */
         real scalarProduct(const Vector3 &vector) const
         {
+#ifdef CYCLONE_USE_SSE
+            return simd::sum3(simd::mul(lanes(), vector.lanes()));
+#else
             return x*vector.x + y*vector.y + z*vector.z;
+#endif
         }
 
         /**
@@ -318,7 +396,7 @@ namespace cyclone {
          */
         real operator *(const Vector3 &vector) const
         {
-            return x*vector.x + y*vector.y + z*vector.z;
+            return scalarProduct(vector);
         }
 
         /**
@@ -326,21 +404,31 @@ namespace cyclone {
          */
         void addScaledVector(const Vector3& vector, real scale)
         {
+#ifdef CYCLONE_USE_SSE
+            setLanes(simd::add(lanes(),
+                simd::mul(vector.lanes(), simd::splat(scale))));
+#else
             x += vector.x * scale;
             y += vector.y * scale;
             z += vector.z * scale;
+#endif
         }
 
         /** Gets the magnitude of this vector. */
         real magnitude() const
         {
-            return real_sqrt(x*x+y*y+z*z);
+            return real_sqrt(squareMagnitude());
         }
 
         /** Gets the squared magnitude of this vector. */
         real squareMagnitude() const
         {
+#ifdef CYCLONE_USE_SSE
+            simd::Real4 v = lanes();
+            return simd::sum3(simd::mul(v, v));
+#else
             return x*x+y*y+z*z;
+#endif
         }
 
         /** Limits the size of the vector to the given maximum. */
@@ -546,7 +634,12 @@ namespace cyclone {
          */
         void normalise()
         {
+#ifdef CYCLONE_USE_SSE
+            simd::Real4 q = simd::load4(data);
+            real d = simd::sum4(simd::mul(q, q));
+#else
             real d = r*r+i*i+j*j+k*k;
+#endif
 
             // Check for zero length quaternion, and use the no-rotation
             // quaternion in that case.
@@ -556,10 +649,14 @@ namespace cyclone {
             }
 
             d = ((real)1.0)/real_sqrt(d);
+#ifdef CYCLONE_USE_SSE
+            simd::store4(data, simd::mul(q, simd::splat(d)));
+#else
             r *= d;
             i *= d;
             j *= d;
             k *= d;
+#endif
         }
 
         /**
@@ -569,6 +666,30 @@ namespace cyclone {
          */
         void operator *=(const Quaternion &multiplier)
         {
+#ifdef CYCLONE_USE_SSE
+            // Each component is the sum of four products, added in
+            // the same order as below. Where the plain code subtracts
+            // a product, the product's sign is flipped and it is added.
+            // Multiplying by itself reads components that have already
+            // been written, which only the plain code reproduces.
+            if (&multiplier != this)
+            {
+                const Quaternion &m = multiplier;
+                simd::Real4 negateFirst = simd::set4(-0.0f, 0.0f, 0.0f, 0.0f);
+                simd::Real4 sum =
+                    simd::mul(simd::splat(r), simd::load4(m.data));
+                sum = simd::add(sum, simd::flip(simd::mul(
+                    simd::set4(i, i, j, k), simd::set4(m.i, m.r, m.r, m.r)),
+                    negateFirst));
+                sum = simd::add(sum, simd::flip(simd::mul(
+                    simd::set4(j, j, k, i), simd::set4(m.j, m.k, m.i, m.j)),
+                    negateFirst));
+                sum = simd::sub(sum, simd::mul(
+                    simd::set4(k, k, i, j), simd::set4(m.k, m.j, m.k, m.i)));
+                simd::store4(data, sum);
+                return;
+            }
+#endif
             Quaternion q = *this;
             r = q.r*multiplier.r - q.i*multiplier.i -
                 q.j*multiplier.j - q.k*multiplier.k;
@@ -596,10 +717,15 @@ namespace cyclone {
                 vector.y * scale,
                 vector.z * scale);
             q *= *this;
+#ifdef CYCLONE_USE_SSE
+            simd::store4(data, simd::add(simd::load4(data),
+                simd::mul(simd::load4(q.data), simd::splat((real)0.5))));
+#else
             r += q.r * ((real)0.5);
             i += q.i * ((real)0.5);
             j += q.j * ((real)0.5);
             k += q.k * ((real)0.5);
+#endif
         }
 
         void rotateByVector(const Vector3& vector)
@@ -652,6 +778,21 @@ namespace cyclone {
         Matrix4 operator*(const Matrix4 &o) const
         {
             Matrix4 result;
+#ifdef CYCLONE_USE_SSE
+            // Each row of the result is a sum of the rows of o, with
+            // this row's translation added on the end. Negative zero
+            // leaves the other lanes as they are.
+            simd::Real4 o0 = simd::load4(o.data);
+            simd::Real4 o1 = simd::load4(o.data + 4);
+            simd::Real4 o2 = simd::load4(o.data + 8);
+            for (unsigned row = 0; row < 12; row += 4)
+            {
+                const real *d = data + row;
+                simd::Real4 sum = simd::combine(d[0], o0, d[1], o1, d[2], o2);
+                sum = simd::add(sum, simd::set4(-0.0f, -0.0f, -0.0f, d[3]));
+                simd::store4(result.data + row, sum);
+            }
+#else
             result.data[0] = (o.data[0]*data[0]) + (o.data[4]*data[1]) + (o.data[8]*data[2]);
             result.data[4] = (o.data[0]*data[4]) + (o.data[4]*data[5]) + (o.data[8]*data[6]);
             result.data[8] = (o.data[0]*data[8]) + (o.data[4]*data[9]) + (o.data[8]*data[10]);
@@ -667,6 +808,7 @@ namespace cyclone {
             result.data[3] = (o.data[3]*data[0]) + (o.data[7]*data[1]) + (o.data[11]*data[2]) + data[3];
             result.data[7] = (o.data[3]*data[4]) + (o.data[7]*data[5]) + (o.data[11]*data[6]) + data[7];
             result.data[11] = (o.data[3]*data[8]) + (o.data[7]*data[9]) + (o.data[11]*data[10]) + data[11];
+#endif
 
             return result;
         }
@@ -678,6 +820,13 @@ namespace cyclone {
          */
         Vector3 operator*(const Vector3 &vector) const
         {
+#ifdef CYCLONE_USE_SSE
+            return Vector3::fromLanes(simd::add(simd::combine(
+                vector.x, simd::set4(data[0], data[4], data[8], 0),
+                vector.y, simd::set4(data[1], data[5], data[9], 0),
+                vector.z, simd::set4(data[2], data[6], data[10], 0)),
+                simd::set4(data[3], data[7], data[11], 0)));
+#else
             return Vector3(
                 vector.x * data[0] +
                 vector.y * data[1] +
@@ -691,6 +840,7 @@ namespace cyclone {
                 vector.y * data[9] +
                 vector.z * data[10] + data[11]
             );
+#endif
         }
 
         /**
@@ -741,6 +891,12 @@ namespace cyclone {
          */
         Vector3 transformDirection(const Vector3 &vector) const
         {
+#ifdef CYCLONE_USE_SSE
+            return Vector3::fromLanes(simd::combine(
+                vector.x, simd::set4(data[0], data[4], data[8], 0),
+                vector.y, simd::set4(data[1], data[5], data[9], 0),
+                vector.z, simd::set4(data[2], data[6], data[10], 0)));
+#else
             return Vector3(
                 vector.x * data[0] +
                 vector.y * data[1] +
@@ -754,6 +910,7 @@ namespace cyclone {
                 vector.y * data[9] +
                 vector.z * data[10]
             );
+#endif
         }
 
         /**
@@ -774,6 +931,14 @@ namespace cyclone {
          */
         Vector3 transformInverseDirection(const Vector3 &vector) const
         {
+#ifdef CYCLONE_USE_SSE
+            // Only the first three of each row: the fourth is the
+            // translation, which would end up in pad.
+            return Vector3::fromLanes(simd::combine(
+                vector.x, simd::load3(data),
+                vector.y, simd::load3(data + 4),
+                vector.z, simd::load3(data + 8)));
+#else
             return Vector3(
                 vector.x * data[0] +
                 vector.y * data[4] +
@@ -787,6 +952,7 @@ namespace cyclone {
                 vector.y * data[6] +
                 vector.z * data[10]
             );
+#endif
         }
 
         /**
@@ -808,6 +974,9 @@ namespace cyclone {
             tmp.x -= data[3];
             tmp.y -= data[7];
             tmp.z -= data[11];
+#ifdef CYCLONE_USE_SSE
+            return transformInverseDirection(tmp);
+#else
             return Vector3(
                 tmp.x * data[0] +
                 tmp.y * data[4] +
@@ -821,6 +990,7 @@ namespace cyclone {
                 tmp.y * data[6] +
                 tmp.z * data[10]
             );
+#endif
         }
 
         /**
@@ -1014,11 +1184,18 @@ namespace cyclone {
          */
         Vector3 operator*(const Vector3 &vector) const
         {
+#ifdef CYCLONE_USE_SSE
+            return Vector3::fromLanes(simd::combine(
+                vector.x, simd::set4(data[0], data[3], data[6], 0),
+                vector.y, simd::set4(data[1], data[4], data[7], 0),
+                vector.z, simd::set4(data[2], data[5], data[8], 0)));
+#else
             return Vector3(
                 vector.x * data[0] + vector.y * data[1] + vector.z * data[2],
                 vector.x * data[3] + vector.y * data[4] + vector.z * data[5],
                 vector.x * data[6] + vector.y * data[7] + vector.z * data[8]
             );
+#endif
         }
 
         /**
@@ -1038,11 +1215,18 @@ namespace cyclone {
          */
         Vector3 transformTranspose(const Vector3 &vector) const
         {
+#ifdef CYCLONE_USE_SSE
+            return Vector3::fromLanes(simd::combine(
+                vector.x, simd::load3(data),
+                vector.y, simd::load3(data + 3),
+                vector.z, simd::load3(data + 6)));
+#else
             return Vector3(
                 vector.x * data[0] + vector.y * data[3] + vector.z * data[6],
                 vector.x * data[1] + vector.y * data[4] + vector.z * data[7],
                 vector.x * data[2] + vector.y * data[5] + vector.z * data[8]
             );
+#endif
         }
 
         /**
@@ -1074,6 +1258,15 @@ namespace cyclone {
          */
         void setInverse(const Matrix3 &m)
         {
+#ifdef CYCLONE_USE_SSE
+            // Inverting in place reads entries that have already been
+            // written, which only the plain code below reproduces.
+            if (&m != this)
+            {
+                setInverseLanes(m);
+                return;
+            }
+#endif
             real t4 = m.data[0]*m.data[4];
             real t6 = m.data[0]*m.data[5];
             real t8 = m.data[1]*m.data[3];
@@ -1100,6 +1293,55 @@ namespace cyclone {
             data[8] = (t4-t8)*t17;
         }
 
+#ifdef CYCLONE_USE_SSE
+        /**
+         * Sets the matrix to be the inverse of the given, different,
+         * matrix, working out each row of the result at once.
+         */
+        void setInverseLanes(const Matrix3 &m)
+        {
+            const real *d = m.data;
+            real t4 = d[0]*d[4];
+            real t6 = d[0]*d[5];
+            real t8 = d[1]*d[3];
+            real t10 = d[2]*d[3];
+            real t12 = d[1]*d[6];
+            real t14 = d[2]*d[6];
+
+            // Calculate the determinant
+            real t16 = (t4*d[8] - t6*d[7] - t8*d[8]+
+                        t10*d[7] + t12*d[5] - t14*d[4]);
+
+            // Make sure the determinant is non-zero.
+            if (t16 == (real)0.0f) return;
+            simd::Real4 t17 = simd::splat(1/t16);
+
+            // Each entry is a difference of two products, negated for
+            // every other entry.
+            simd::Real4 negate = simd::set4(0.0f, -0.0f, 0.0f, 0.0f);
+            simd::store3(data, simd::mul(simd::flip(simd::sub(
+                simd::mul(simd::set4(d[4], d[1], d[1], 0),
+                          simd::set4(d[8], d[8], d[5], 0)),
+                simd::mul(simd::set4(d[5], d[2], d[2], 0),
+                          simd::set4(d[7], d[7], d[4], 0))),
+                negate), t17));
+
+            negate = simd::set4(-0.0f, 0.0f, -0.0f, 0.0f);
+            simd::store3(data + 3, simd::mul(simd::flip(simd::sub(
+                simd::mul(simd::set4(d[3], d[0], d[0], 0),
+                          simd::set4(d[8], d[8], d[5], 0)),
+                simd::set4(d[5]*d[6], t14, t10, 0)),
+                negate), t17));
+
+            negate = simd::set4(0.0f, -0.0f, 0.0f, 0.0f);
+            simd::store3(data + 6, simd::mul(simd::flip(simd::sub(
+                simd::mul(simd::set4(d[3], d[0], t4, 0),
+                          simd::set4(d[7], d[7], 1, 0)),
+                simd::set4(d[4]*d[6], t12, t8, 0)),
+                negate), t17));
+        }
+#endif
+
         /** Returns a new matrix containing the inverse of this matrix. */
         Matrix3 inverse() const
         {
@@ -1148,6 +1390,20 @@ namespace cyclone {
          */
         Matrix3 operator*(const Matrix3 &o) const
         {
+#ifdef CYCLONE_USE_SSE
+            // Each row of the result is a sum of the rows of o.
+            Matrix3 result;
+            simd::Real4 o0 = simd::load3(o.data);
+            simd::Real4 o1 = simd::load3(o.data + 3);
+            simd::Real4 o2 = simd::load3(o.data + 6);
+            for (unsigned row = 0; row < 9; row += 3)
+            {
+                const real *d = data + row;
+                simd::store3(result.data + row,
+                    simd::combine(d[0], o0, d[1], o1, d[2], o2));
+            }
+            return result;
+#else
             return Matrix3(
                 data[0]*o.data[0] + data[1]*o.data[3] + data[2]*o.data[6],
                 data[0]*o.data[1] + data[1]*o.data[4] + data[2]*o.data[7],
@@ -1161,6 +1417,7 @@ namespace cyclone {
                 data[6]*o.data[1] + data[7]*o.data[4] + data[8]*o.data[7],
                 data[6]*o.data[2] + data[7]*o.data[5] + data[8]*o.data[8]
                 );
+#endif
         }
 
         /**
@@ -1168,6 +1425,18 @@ namespace cyclone {
          */
         void operator*=(const Matrix3 &o)
         {
+#ifdef CYCLONE_USE_SSE
+            // The rows of o are loaded afresh for each row, since o
+            // may be this matrix.
+            for (unsigned row = 0; row < 9; row += 3)
+            {
+                real *d = data + row;
+                simd::store3(d, simd::combine(
+                    d[0], simd::load3(o.data),
+                    d[1], simd::load3(o.data + 3),
+                    d[2], simd::load3(o.data + 6)));
+            }
+#else
             real t1;
             real t2;
             real t3;
@@ -1192,6 +1461,7 @@ namespace cyclone {
             data[6] = t1;
             data[7] = t2;
             data[8] = t3;
+#endif
         }
 
         /**
@@ -10,13 +10,24 @@
  * software licence.
  */
 #include "precision.h"
+#include "simd.h"
 #include "core.h"
 #include "random.h"
 #include "particle.h"
 #include "body.h"
+#include "integrator.h"
+#include "bodystore.h"
 #include "pcontacts.h"
 #include "pworld.h"
+#include "arena.h"
+#include "contactbuffer.h"
 #include "collide_fine.h"
+#include "convex.h"
+#include "trimesh.h"
+#include "manifold.h"
+#include "narrowphase.h"
 #include "contacts.h"
 #include "fgen.h"
-#include "joints.h"
\ No newline at end of file
+#include "joints.h"
+#include "solver.h"
+#include "world.h"
\ No newline at end of file
@@ -0,0 +1,137 @@
+/*
+ * Interface file for the batch integrator.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains an integrator that moves many rigid bodies
+ * forward at once, using the vector instructions of the processor.
+ */
+#ifndef CYCLONE_INTEGRATOR_H
+#define CYCLONE_INTEGRATOR_H
+
+#include "body.h"
+
+namespace cyclone {
+
+    /**
+     * Points at the data of a run of bodies, held one component to an
+     * array, as in a RigidBodyStore. Each member has the meaning of
+     * the RigidBody member of the same name, with one array for each
+     * component: x, y and z of a vector, r, i, j and k of a
+     * quaternion, and each entry of a matrix's data.
+     */
+    struct BodyArrays
+    {
+        /** Holds the number of bodies. */
+        unsigned count;
+
+        const real *inverseMass;
+        const real *inverseInertiaTensor[9];
+        const real *linearDamping;
+        const real *angularDamping;
+        real *position[3];
+        real *orientation[4];
+        real *velocity[3];
+        real *rotation[3];
+
+        real *inverseInertiaTensorWorld[9];
+        real *motion;
+        unsigned char *isAwake;
+        const unsigned char *canSleep;
+        real *transformMatrix[12];
+
+        real *forceAccum[3];
+        real *torqueAccum[3];
+        const real *acceleration[3];
+        real *lastFrameAcceleration[3];
+    };
+
+    /**
+     * Integrates bodies and works out their derived data several at a
+     * time, with each body in its own lane of the processor's vector
+     * registers. The results are exactly the same as those of
+     * RigidBody::integrate and RigidBody::calculateDerivedData, since
+     * the same operations are done in the same order, just on more
+     * than one body at once.
+     *
+     * The instruction set is chosen when the integrator is created,
+     * from those the processor supports: AVX2 works on four bodies at
+     * a time, and SSE2 on two. Where neither is available, or the
+     * engine is built in single precision, the same code is used on
+     * one body at a time, as it is for the bodies left over at the
+     * end of a run. Damping is applied with one call to real_pow for
+     * each different damping value in a run of bodies, rather than
+     * two for every body.
+     */
+    class BatchIntegrator
+    {
+    public:
+        /**
+         * The instruction sets the integrator can use.
+         */
+        enum InstructionSet
+        {
+            INSTRUCTIONS_SCALAR,
+            INSTRUCTIONS_SSE2,
+            INSTRUCTIONS_AVX2
+        };
+
+    protected:
+        /**
+         * Holds the instruction set in use.
+         */
+        InstructionSet instructionSet;
+
+    public:
+        /**
+         * Creates an integrator using the best instruction set the
+         * processor supports.
+         */
+        BatchIntegrator();
+
+        /**
+         * Returns the best instruction set the processor supports.
+         */
+        static InstructionSet getBestInstructionSet();
+
+        /**
+         * Sets the instruction set to use. If the processor doesn't
+         * support it, the best one it does support is used instead.
+         */
+        void setInstructionSet(InstructionSet instructionSet);
+
+        /**
+         * Returns the instruction set in use.
+         */
+        InstructionSet getInstructionSet() const
+        {
+            return instructionSet;
+        }
+
+        /**
+         * Integrates the given bodies forward in time by the given
+         * amount, as RigidBody::integrate.
+         */
+        void integrate(const BodyArrays &bodies, real duration,
+                       bool fallAsleep = true) const;
+
+        /**
+         * Works out the derived data of the given bodies, as
+         * RigidBody::calculateDerivedData.
+         */
+        void calculateDerivedData(const BodyArrays &bodies) const;
+    };
+
+} // namespace cyclone
+
+#endif // CYCLONE_INTEGRATOR_H
@@ -0,0 +1,273 @@
+/*
+ * Interface file for persistent contact manifolds.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains a cache of contact manifolds: the contact points
+ * between a pair of primitives, kept from one frame to the next.
+ */
+#ifndef CYCLONE_MANIFOLD_H
+#define CYCLONE_MANIFOLD_H
+
+#include <vector>
+#include "collide_fine.h"
+
+namespace cyclone {
+
+    /**
+     * Holds one point of a contact manifold.
+     */
+    struct ManifoldPoint
+    {
+        /**
+         * Holds the point where the contact was first found, in the
+         * local coordinates of each body. For a contact with the
+         * scenery, the second point is in world coordinates.
+         */
+        Vector3 localPoint[2];
+
+        /**
+         * Holds the penetration when the contact was first found.
+         */
+        real basePenetration;
+
+        /**
+         * Holds the position of the contact this frame, in world
+         * coordinates.
+         */
+        Vector3 contactPoint;
+
+        /**
+         * Holds the penetration of the contact this frame.
+         */
+        real penetration;
+
+        /**
+         * Holds the feature identifier given by the collision
+         * detector, used to match the point to new contacts.
+         */
+        unsigned feature;
+
+        /**
+         * Holds the identifier of the point, which stays the same for
+         * as long as the point persists. This is written into the
+         * contact's feature, so resolvers that cache data by feature
+         * (such as the sequential impulse resolver) carry the point's
+         * accumulated impulse from one frame to the next.
+         */
+        unsigned id;
+
+        /**
+         * Holds the number of frames the point has persisted for.
+         */
+        unsigned lifetime;
+    };
+
+    /**
+     * Holds the contact points between one pair of primitives.
+     */
+    struct ContactManifold
+    {
+        /**
+         * The most points a manifold keeps. Four well spread points
+         * are enough to hold one face flat against another.
+         */
+        enum { MAX_POINTS = 4 };
+
+        /**
+         * Holds the points of the manifold.
+         */
+        ManifoldPoint points[MAX_POINTS];
+
+        /**
+         * Holds the number of points in use.
+         */
+        unsigned pointCount;
+
+        /**
+         * Holds the contact normal shared by the points.
+         */
+        Vector3 normal;
+
+        /**
+         * Holds the identifier to give the next new point.
+         */
+        unsigned nextId;
+
+        /**
+         * Holds the frame in which the manifold was last updated.
+         */
+        unsigned lastFrame;
+    };
+
+    /**
+     * Keeps contact manifolds for pairs of primitives from one frame
+     * to the next.
+     *
+     * The collision detector finds the contacts between a pair of
+     * boxes afresh each frame, and for a box against a box it finds
+     * only one. The cache matches the new contacts with the points it
+     * had last frame, and keeps old points the bodies are still
+     * resting on, moving them with the bodies. This builds up a
+     * stable set of points for a box resting on another. The points
+     * are then reduced to at most four: the deepest, and three others
+     * chosen to cover as much area as possible.
+     *
+     * Manifolds are keyed by the addresses of the two primitives, so
+     * a pair should always be tested in the same order. The cache is
+     * not thread safe.
+     */
+    class ManifoldCache
+    {
+    protected:
+        /**
+         * Identifies a pair of primitives.
+         */
+        typedef std::pair<const void*, const void*> Key;
+
+        /**
+         * Holds the place of one pair's manifold.
+         */
+        struct Entry
+        {
+            Key key;
+            unsigned manifold;
+
+            /**
+             * Checks if the entry belongs before the given key, for
+             * searching the index.
+             */
+            static bool compare(const Entry &entry, const Key &key)
+            {
+                return entry.key < key;
+            }
+        };
+
+        /**
+         * Holds the entry of each pair with a manifold, in order of
+         * their keys. Manifolds are large, so they are kept apart
+         * and only the small entries move when pairs come and go.
+         */
+        std::vector<Entry> index;
+
+        /**
+         * Holds the manifolds, used or not. These and the free list
+         * keep their memory once they have grown to hold the most
+         * manifolds there have been.
+         */
+        std::vector<ContactManifold> manifolds;
+
+        /**
+         * Holds the manifolds that aren't in use.
+         */
+        std::vector<unsigned> freeManifolds;
+
+        /**
+         * Returns the place in the index where the given pair's
+         * entry is, or would be.
+         */
+        unsigned findEntry(const Key &key) const;
+
+        /**
+         * Removes the entry at the given place in the index, and
+         * frees its manifold.
+         */
+        void removeEntry(unsigned place);
+
+        /**
+         * Holds the number of the current frame.
+         */
+        unsigned frame;
+
+        /**
+         * Holds the distance a point can drift, or separate, before
+         * it is discarded.
+         */
+        real breakingThreshold;
+
+        /**
+         * Merges newly detected contacts between the given pair of
+         * primitives with the pair's manifold, and writes the
+         * manifold's points into the collision data. Returns the
+         * number of contacts written.
+         */
+        unsigned mergeContacts(const void *one, const void *two,
+                               RigidBody *bodyOne, RigidBody *bodyTwo,
+                               Contact *contacts, unsigned count,
+                               CollisionData *data);
+
+    public:
+        /**
+         * Creates an empty cache, with the given breaking threshold.
+         */
+        ManifoldCache(real breakingThreshold = (real)0.02);
+
+        /**
+         * Sets the distance a point can drift, or separate, before it
+         * is discarded.
+         */
+        void setBreakingThreshold(real breakingThreshold);
+
+        /**
+         * Finds the contacts between two boxes, as
+         * CollisionDetector::boxAndBox, and merges them with the
+         * pair's manifold.
+         */
+        unsigned boxAndBox(
+            const CollisionBox &one,
+            const CollisionBox &two,
+            CollisionData *data
+            );
+
+        /**
+         * Finds the contacts between a box and a half-space, as
+         * CollisionDetector::boxAndHalfSpace, and merges them with the
+         * pair's manifold.
+         */
+        unsigned boxAndHalfSpace(
+            const CollisionBox &box,
+            const CollisionPlane &plane,
+            CollisionData *data
+            );
+
+        /**
+         * Discards the manifolds that weren't updated this frame, and
+         * starts a new frame. This should be called once per frame,
+         * after the contacts have been generated.
+         */
+        void advanceFrame();
+
+        /**
+         * Discards all the manifolds.
+         */
+        void clear();
+
+        /**
+         * Returns the number of manifolds held.
+         */
+        unsigned getManifoldCount() const
+        {
+            return (unsigned)index.size();
+        }
+
+        /**
+         * Returns the manifold for the given pair of primitives, or
+         * NULL if there isn't one.
+         */
+        const ContactManifold *getManifold(const void *one,
+                                           const void *two) const;
+    };
+
+} // namespace cyclone
+
+#endif // CYCLONE_MANIFOLD_H
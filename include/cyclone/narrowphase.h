@@ -0,0 +1,314 @@
+/*
+ * Interface file for the narrow phase dispatcher.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains the narrow phase: the stage that takes the pairs
+ * of bodies found by a broad phase and runs the right collision test
+ * on each.
+ */
+#ifndef CYCLONE_NARROWPHASE_H
+#define CYCLONE_NARROWPHASE_H
+
+#include <vector>
+#include "collide_fine.h"
+#include "collide_coarse.h"
+
+namespace cyclone {
+
+    /**
+     * Lists the kinds of collision primitive the narrow phase knows
+     * about. Pairs are tested in batches of the same two kinds.
+     */
+    enum PrimitiveType
+    {
+        PRIMITIVE_SPHERE,
+        PRIMITIVE_BOX,
+        PRIMITIVE_CONVEX,
+        PRIMITIVE_CAPSULE,
+
+        /** Holds the number of kinds of primitive. */
+        PRIMITIVE_TYPE_COUNT
+    };
+
+    /**
+     * Holds two primitives to be tested against each other. The first
+     * is of the kind that comes first in PrimitiveType.
+     */
+    struct PrimitivePair
+    {
+        const CollisionPrimitive *one;
+        const CollisionPrimitive *two;
+    };
+
+    /**
+     * Runs the collision tests for the pairs of bodies found by a
+     * broad phase.
+     *
+     * Each body that takes part is registered with its primitive. The
+     * pairs are sorted into batches by the kinds of their two
+     * primitives, and each batch is handed in one go to the batch
+     * function for its kinds, found in a table. Running the same test
+     * over and over keeps it in the cache, and lets a batch function
+     * test several pairs at once.
+     *
+     * The table starts with functions that call the CollisionDetector
+     * test for each pair. Any of them can be replaced.
+     */
+    class Narrowphase
+    {
+    public:
+        /**
+         * Tests the given number of pairs, whose primitives are of the
+         * kinds the function was registered for, writing their
+         * contacts to the given collision data.
+         */
+        typedef void (*BatchFunction)(const PrimitivePair *pairs,
+                                      unsigned count,
+                                      CollisionData *data);
+
+    protected:
+        /**
+         * Holds a registered primitive.
+         */
+        struct Entry
+        {
+            RigidBody *body;
+            const CollisionPrimitive *primitive;
+            PrimitiveType type;
+
+            bool operator<(const Entry &other) const
+            {
+                return body < other.body;
+            }
+        };
+
+        /**
+         * Holds the registered primitives, sorted by body when the
+         * narrow phase next runs.
+         */
+        std::vector<Entry> entries;
+
+        /**
+         * True if the entries are sorted by body.
+         */
+        bool sorted;
+
+        /**
+         * Holds the batch function for each pair of kinds. Only the
+         * entries whose first kind is no later than the second are
+         * used.
+         */
+        BatchFunction table[PRIMITIVE_TYPE_COUNT][PRIMITIVE_TYPE_COUNT];
+
+        /**
+         * Holds the pairs found, and the batch of each, in the order
+         * of the potential contacts.
+         */
+        std::vector<PrimitivePair> found;
+        std::vector<unsigned> foundBatch;
+
+        /**
+         * Holds the pairs sorted into their batches.
+         */
+        std::vector<PrimitivePair> batched;
+
+        /**
+         * Holds the offset of each batch in the batched pairs, and
+         * the end of the last.
+         */
+        unsigned batchStart[PRIMITIVE_TYPE_COUNT*PRIMITIVE_TYPE_COUNT + 1];
+
+        /**
+         * Returns the primitive registered for the given body, or NULL
+         * if it has none.
+         */
+        const Entry *findEntry(RigidBody *body) const;
+
+    public:
+        /**
+         * Creates a narrow phase with no primitives, and the standard
+         * batch functions.
+         */
+        Narrowphase();
+
+        /**
+         * Registers the given primitive, of the given kind, for its
+         * body. Each body has at most one primitive.
+         */
+        void addPrimitive(const CollisionPrimitive *primitive,
+                          PrimitiveType type);
+
+        /**
+         * Registers the given sphere for its body.
+         */
+        void addPrimitive(const CollisionSphere *sphere)
+        {
+            addPrimitive(sphere, PRIMITIVE_SPHERE);
+        }
+
+        /**
+         * Registers the given box for its body.
+         */
+        void addPrimitive(const CollisionBox *box)
+        {
+            addPrimitive(box, PRIMITIVE_BOX);
+        }
+
+        /**
+         * Registers the given convex hull for its body.
+         */
+        void addPrimitive(const CollisionConvex *convex)
+        {
+            addPrimitive(convex, PRIMITIVE_CONVEX);
+        }
+
+        /**
+         * Registers the given capsule for its body.
+         */
+        void addPrimitive(const CollisionCapsule *capsule)
+        {
+            addPrimitive(capsule, PRIMITIVE_CAPSULE);
+        }
+
+        /**
+         * Removes the given primitive.
+         */
+        void removePrimitive(const CollisionPrimitive *primitive);
+
+        /**
+         * Removes every primitive.
+         */
+        void clear();
+
+        /**
+         * Sets the function used to test pairs of the given kinds.
+         */
+        void setBatchFunction(PrimitiveType one, PrimitiveType two,
+                              BatchFunction function);
+
+        /**
+         * Returns the function used to test pairs of the given kinds.
+         */
+        BatchFunction getBatchFunction(PrimitiveType one,
+                                       PrimitiveType two) const;
+
+        /**
+         * Tests the given potential contacts, writing the contacts
+         * found to the given collision data. Pairs whose bodies don't
+         * both have a primitive are skipped. The primitives' internals
+         * must be up to date. Returns the number of contacts written.
+         *
+         * Batches run in the order of PrimitiveType, and the pairs in
+         * a batch in the order they were given.
+         */
+        unsigned collide(const PotentialContact *contacts, unsigned count,
+                         CollisionData *data);
+
+        /**
+         * Returns the number of pairs of the given kinds found by the
+         * last call to collide.
+         */
+        unsigned getBatchSize(PrimitiveType one, PrimitiveType two) const;
+
+        /**
+         * Tests the pairs of spheres with the CollisionDetector's
+         * batch test.
+         */
+        static void sphereAndSphereBatch(const PrimitivePair *pairs,
+                                         unsigned count,
+                                         CollisionData *data);
+
+        /**
+         * Calls the CollisionDetector for each pair of a sphere and a
+         * box.
+         */
+        static void sphereAndBoxBatch(const PrimitivePair *pairs,
+                                      unsigned count,
+                                      CollisionData *data);
+
+        /**
+         * Tests the pairs of boxes with the CollisionDetector's batch
+         * test.
+         */
+        static void boxAndBoxBatch(const PrimitivePair *pairs,
+                                   unsigned count,
+                                   CollisionData *data);
+
+        /**
+         * Calls the CollisionDetector's clipping test for each pair of
+         * boxes, giving up to four contacts for each. Set this as the
+         * function for pairs of boxes to have stacks settle sooner.
+         */
+        static void boxAndBoxClippedBatch(const PrimitivePair *pairs,
+                                          unsigned count,
+                                          CollisionData *data);
+
+        /**
+         * Calls the CollisionDetector for each pair of a sphere and a
+         * convex hull.
+         */
+        static void sphereAndConvexBatch(const PrimitivePair *pairs,
+                                         unsigned count,
+                                         CollisionData *data);
+
+        /**
+         * Calls the CollisionDetector for each pair of a box and a
+         * convex hull.
+         */
+        static void boxAndConvexBatch(const PrimitivePair *pairs,
+                                      unsigned count,
+                                      CollisionData *data);
+
+        /**
+         * Calls the CollisionDetector for each pair of convex hulls.
+         */
+        static void convexAndConvexBatch(const PrimitivePair *pairs,
+                                         unsigned count,
+                                         CollisionData *data);
+
+        /**
+         * Calls the CollisionDetector for each pair of a sphere and a
+         * capsule.
+         */
+        static void sphereAndCapsuleBatch(const PrimitivePair *pairs,
+                                          unsigned count,
+                                          CollisionData *data);
+
+        /**
+         * Calls the CollisionDetector for each pair of a box and a
+         * capsule.
+         */
+        static void boxAndCapsuleBatch(const PrimitivePair *pairs,
+                                       unsigned count,
+                                       CollisionData *data);
+
+        /**
+         * Calls the CollisionDetector for each pair of a convex hull
+         * and a capsule.
+         */
+        static void convexAndCapsuleBatch(const PrimitivePair *pairs,
+                                          unsigned count,
+                                          CollisionData *data);
+
+        /**
+         * Calls the CollisionDetector for each pair of capsules.
+         */
+        static void capsuleAndCapsuleBatch(const PrimitivePair *pairs,
+                                           unsigned count,
+                                           CollisionData *data);
+    };
+
+} // namespace cyclone
+
+#endif // CYCLONE_NARROWPHASE_H
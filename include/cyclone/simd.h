@@ -0,0 +1,507 @@
+/*
+ * Interface file for the vector instructions used by the core maths.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file holds the operations the vector, quaternion and matrix
+ * classes in core.h use when Cyclone is built with SSE. To build
+ * with SSE, define CYCLONE_SSE when compiling. If the compiler isn't
+ * generating SSE2 code, the define is ignored, and the core maths is
+ * built as plain code.
+ *
+ * Each operation works on four reals at a time, and does exactly the
+ * arithmetic the plain code does, in the same order, so both builds
+ * give the same results to the bit. Sums across the lanes are added
+ * from the first lane onwards, as the plain code adds its terms, and
+ * subtraction is done by adding a negated value, which IEEE
+ * arithmetic defines to be the same thing. This holds as long as the
+ * compiler isn't contracting multiplies and adds into fused
+ * instructions in the plain code, which it doesn't unless told to
+ * target a processor with FMA.
+ *
+ * There are also operations on a whole register of reals, used to
+ * run one test on several objects at once. These use AVX registers
+ * when the compiler targets AVX, and SSE registers otherwise.
+ */
+#ifndef CYCLONE_SIMD_H
+#define CYCLONE_SIMD_H
+
+#include "precision.h"
+
+#if defined(CYCLONE_SSE) && defined(__SSE2__)
+
+/**
+ * Defined when the core maths is built with SSE.
+ */
+#define CYCLONE_USE_SSE
+
+#include <emmintrin.h>
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+namespace cyclone {
+
+    /**
+     * Holds the SSE operations used by the core maths.
+     */
+    namespace simd {
+
+#ifdef DOUBLE_PRECISION
+
+        /**
+         * Holds four reals: in double precision, two to a register.
+         */
+        struct Real4
+        {
+            __m128d xy;
+            __m128d zw;
+        };
+
+        /** Loads four reals. */
+        inline Real4 load4(const real *p)
+        {
+            Real4 a;
+            a.xy = _mm_loadu_pd(p);
+            a.zw = _mm_loadu_pd(p + 2);
+            return a;
+        }
+
+        /** Stores four reals. */
+        inline void store4(real *p, const Real4 &a)
+        {
+            _mm_storeu_pd(p, a.xy);
+            _mm_storeu_pd(p + 2, a.zw);
+        }
+
+        /** Loads three reals, with zero in the last lane. */
+        inline Real4 load3(const real *p)
+        {
+            Real4 a;
+            a.xy = _mm_loadu_pd(p);
+            a.zw = _mm_load_sd(p + 2);
+            return a;
+        }
+
+        /** Stores the first three lanes. */
+        inline void store3(real *p, const Real4 &a)
+        {
+            _mm_storeu_pd(p, a.xy);
+            _mm_store_sd(p + 2, a.zw);
+        }
+
+        /** Returns the given reals, in order. */
+        inline Real4 set4(real x, real y, real z, real w)
+        {
+            Real4 a;
+            a.xy = _mm_set_pd(y, x);
+            a.zw = _mm_set_pd(w, z);
+            return a;
+        }
+
+        /** Returns the given real in every lane. */
+        inline Real4 splat(real v)
+        {
+            Real4 a;
+            a.xy = a.zw = _mm_set1_pd(v);
+            return a;
+        }
+
+        inline Real4 add(const Real4 &a, const Real4 &b)
+        {
+            Real4 r;
+            r.xy = _mm_add_pd(a.xy, b.xy);
+            r.zw = _mm_add_pd(a.zw, b.zw);
+            return r;
+        }
+
+        inline Real4 sub(const Real4 &a, const Real4 &b)
+        {
+            Real4 r;
+            r.xy = _mm_sub_pd(a.xy, b.xy);
+            r.zw = _mm_sub_pd(a.zw, b.zw);
+            return r;
+        }
+
+        inline Real4 mul(const Real4 &a, const Real4 &b)
+        {
+            Real4 r;
+            r.xy = _mm_mul_pd(a.xy, b.xy);
+            r.zw = _mm_mul_pd(a.zw, b.zw);
+            return r;
+        }
+
+        /**
+         * Flips the sign of each lane of a whose lane in signs is
+         * negative zero. Signs should hold only positive and negative
+         * zeros.
+         */
+        inline Real4 flip(const Real4 &a, const Real4 &signs)
+        {
+            Real4 r;
+            r.xy = _mm_xor_pd(a.xy, signs.xy);
+            r.zw = _mm_xor_pd(a.zw, signs.zw);
+            return r;
+        }
+
+        /**
+         * Returns, in each lane, b if b is less than a, otherwise a:
+         * as std::min(a, b).
+         */
+        inline Real4 min(const Real4 &a, const Real4 &b)
+        {
+            Real4 r;
+            r.xy = _mm_min_pd(b.xy, a.xy);
+            r.zw = _mm_min_pd(b.zw, a.zw);
+            return r;
+        }
+
+        /**
+         * Returns, in each lane, b if a is less than b, otherwise a:
+         * as std::max(a, b).
+         */
+        inline Real4 max(const Real4 &a, const Real4 &b)
+        {
+            Real4 r;
+            r.xy = _mm_max_pd(b.xy, a.xy);
+            r.zw = _mm_max_pd(b.zw, a.zw);
+            return r;
+        }
+
+        /**
+         * Returns a mask with a bit set for each lane, first lane
+         * lowest, in which a is less than or equal to b.
+         */
+        inline int lessEqual(const Real4 &a, const Real4 &b)
+        {
+            return _mm_movemask_pd(_mm_cmple_pd(a.xy, b.xy)) |
+                (_mm_movemask_pd(_mm_cmple_pd(a.zw, b.zw)) << 2);
+        }
+
+        /** Returns the first lane. */
+        inline real first(const Real4 &a)
+        {
+            return _mm_cvtsd_f64(a.xy);
+        }
+
+        /** Returns the sum of the first three lanes, in order. */
+        inline real sum3(const Real4 &a)
+        {
+            __m128d s = _mm_add_sd(a.xy, _mm_unpackhi_pd(a.xy, a.xy));
+            return _mm_cvtsd_f64(_mm_add_sd(s, a.zw));
+        }
+
+        /** Returns the sum of all four lanes, in order. */
+        inline real sum4(const Real4 &a)
+        {
+            __m128d s = _mm_add_sd(a.xy, _mm_unpackhi_pd(a.xy, a.xy));
+            s = _mm_add_sd(s, a.zw);
+            return _mm_cvtsd_f64(
+                _mm_add_sd(s, _mm_unpackhi_pd(a.zw, a.zw)));
+        }
+
+        /**
+         * Returns the vector product of the first three lanes of a
+         * and b, as Vector3::vectorProduct.
+         */
+        inline Real4 cross(const Real4 &a, const Real4 &b)
+        {
+            // The y and z parts come from (y, z) * (z, x) - (z, x) * (y, z).
+            __m128d ayz = _mm_shuffle_pd(a.xy, a.zw, 1);
+            __m128d byz = _mm_shuffle_pd(b.xy, b.zw, 1);
+            __m128d azx = _mm_shuffle_pd(a.zw, a.xy, 0);
+            __m128d bzx = _mm_shuffle_pd(b.zw, b.xy, 0);
+
+            // The z part comes from x * y - y * x, with zero after it.
+            __m128d zero = _mm_setzero_pd();
+            __m128d ax = _mm_move_sd(zero, a.xy);
+            __m128d bx = _mm_move_sd(zero, b.xy);
+            __m128d ay = _mm_unpackhi_pd(a.xy, zero);
+            __m128d by = _mm_unpackhi_pd(b.xy, zero);
+
+            Real4 r;
+            r.xy = _mm_sub_pd(_mm_mul_pd(ayz, bzx), _mm_mul_pd(azx, byz));
+            r.zw = _mm_sub_pd(_mm_mul_pd(ax, by), _mm_mul_pd(ay, bx));
+            return r;
+        }
+
+#else // DOUBLE_PRECISION
+
+        /**
+         * Holds four reals: in single precision, in one register.
+         */
+        struct Real4
+        {
+            __m128 v;
+        };
+
+        /** Loads four reals. */
+        inline Real4 load4(const real *p)
+        {
+            Real4 a;
+            a.v = _mm_loadu_ps(p);
+            return a;
+        }
+
+        /** Stores four reals. */
+        inline void store4(real *p, const Real4 &a)
+        {
+            _mm_storeu_ps(p, a.v);
+        }
+
+        /** Loads three reals, with zero in the last lane. */
+        inline Real4 load3(const real *p)
+        {
+            Real4 a;
+            a.v = _mm_movelh_ps(
+                _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)p),
+                _mm_load_ss(p + 2));
+            return a;
+        }
+
+        /** Stores the first three lanes. */
+        inline void store3(real *p, const Real4 &a)
+        {
+            _mm_storel_pi((__m64*)p, a.v);
+            _mm_store_ss(p + 2, _mm_movehl_ps(a.v, a.v));
+        }
+
+        /** Returns the given reals, in order. */
+        inline Real4 set4(real x, real y, real z, real w)
+        {
+            Real4 a;
+            a.v = _mm_set_ps(w, z, y, x);
+            return a;
+        }
+
+        /** Returns the given real in every lane. */
+        inline Real4 splat(real v)
+        {
+            Real4 a;
+            a.v = _mm_set1_ps(v);
+            return a;
+        }
+
+        inline Real4 add(const Real4 &a, const Real4 &b)
+        {
+            Real4 r;
+            r.v = _mm_add_ps(a.v, b.v);
+            return r;
+        }
+
+        inline Real4 sub(const Real4 &a, const Real4 &b)
+        {
+            Real4 r;
+            r.v = _mm_sub_ps(a.v, b.v);
+            return r;
+        }
+
+        inline Real4 mul(const Real4 &a, const Real4 &b)
+        {
+            Real4 r;
+            r.v = _mm_mul_ps(a.v, b.v);
+            return r;
+        }
+
+        /**
+         * Flips the sign of each lane of a whose lane in signs is
+         * negative zero. Signs should hold only positive and negative
+         * zeros.
+         */
+        inline Real4 flip(const Real4 &a, const Real4 &signs)
+        {
+            Real4 r;
+            r.v = _mm_xor_ps(a.v, signs.v);
+            return r;
+        }
+
+        /**
+         * Returns, in each lane, b if b is less than a, otherwise a:
+         * as std::min(a, b).
+         */
+        inline Real4 min(const Real4 &a, const Real4 &b)
+        {
+            Real4 r;
+            r.v = _mm_min_ps(b.v, a.v);
+            return r;
+        }
+
+        /**
+         * Returns, in each lane, b if a is less than b, otherwise a:
+         * as std::max(a, b).
+         */
+        inline Real4 max(const Real4 &a, const Real4 &b)
+        {
+            Real4 r;
+            r.v = _mm_max_ps(b.v, a.v);
+            return r;
+        }
+
+        /**
+         * Returns a mask with a bit set for each lane, first lane
+         * lowest, in which a is less than or equal to b.
+         */
+        inline int lessEqual(const Real4 &a, const Real4 &b)
+        {
+            return _mm_movemask_ps(_mm_cmple_ps(a.v, b.v));
+        }
+
+        /** Returns the first lane. */
+        inline real first(const Real4 &a)
+        {
+            return _mm_cvtss_f32(a.v);
+        }
+
+        /** Returns the sum of the first three lanes, in order. */
+        inline real sum3(const Real4 &a)
+        {
+            __m128 s = _mm_add_ss(a.v, _mm_shuffle_ps(a.v, a.v, 1));
+            return _mm_cvtss_f32(_mm_add_ss(s, _mm_movehl_ps(a.v, a.v)));
+        }
+
+        /** Returns the sum of all four lanes, in order. */
+        inline real sum4(const Real4 &a)
+        {
+            __m128 s = _mm_add_ss(a.v, _mm_shuffle_ps(a.v, a.v, 1));
+            s = _mm_add_ss(s, _mm_movehl_ps(a.v, a.v));
+            return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(a.v, a.v, 3)));
+        }
+
+        /**
+         * Returns the vector product of the first three lanes of a
+         * and b, as Vector3::vectorProduct. The last lane is the
+         * product of the last lanes less itself.
+         */
+        inline Real4 cross(const Real4 &a, const Real4 &b)
+        {
+            __m128 ayzx = _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(3, 0, 2, 1));
+            __m128 byzx = _mm_shuffle_ps(b.v, b.v, _MM_SHUFFLE(3, 0, 2, 1));
+            __m128 azxy = _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(3, 1, 0, 2));
+            __m128 bzxy = _mm_shuffle_ps(b.v, b.v, _MM_SHUFFLE(3, 1, 0, 2));
+
+            Real4 r;
+            r.v = _mm_sub_ps(_mm_mul_ps(ayzx, bzxy), _mm_mul_ps(azxy, byzx));
+            return r;
+        }
+
+#endif // DOUBLE_PRECISION
+
+        /**
+         * Returns the sum of three terms, each a row scaled by one
+         * real, added in order: the way the plain code multiplies a
+         * vector by a matrix.
+         */
+        inline Real4 combine(real a, const Real4 &rowA,
+                             real b, const Real4 &rowB,
+                             real c, const Real4 &rowC)
+        {
+            return add(add(mul(splat(a), rowA), mul(splat(b), rowB)),
+                       mul(splat(c), rowC));
+        }
+
+        /**
+         * Holds as many reals as fit in the widest register: with
+         * AVX, four doubles or eight floats, otherwise two doubles or
+         * four floats. The less operation returns a mask with a bit
+         * set for each lane, first lane lowest, in which a is less
+         * than b.
+         */
+#if defined(DOUBLE_PRECISION) && defined(__AVX__)
+        typedef __m256d Lanes;
+        const unsigned LANES = 4;
+
+        inline Lanes loadLanes(const real *p) { return _mm256_loadu_pd(p); }
+        inline void storeLanes(real *p, Lanes a) { _mm256_storeu_pd(p, a); }
+        inline Lanes splatLanes(real v) { return _mm256_set1_pd(v); }
+        inline Lanes add(Lanes a, Lanes b) { return _mm256_add_pd(a, b); }
+        inline Lanes sub(Lanes a, Lanes b) { return _mm256_sub_pd(a, b); }
+        inline Lanes mul(Lanes a, Lanes b) { return _mm256_mul_pd(a, b); }
+        inline Lanes div(Lanes a, Lanes b) { return _mm256_div_pd(a, b); }
+        inline Lanes squareRoot(Lanes a) { return _mm256_sqrt_pd(a); }
+        inline Lanes absolute(Lanes a)
+        {
+            return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a);
+        }
+        inline int less(Lanes a, Lanes b)
+        {
+            return _mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_LT_OQ));
+        }
+#elif defined(DOUBLE_PRECISION)
+        typedef __m128d Lanes;
+        const unsigned LANES = 2;
+
+        inline Lanes loadLanes(const real *p) { return _mm_loadu_pd(p); }
+        inline void storeLanes(real *p, Lanes a) { _mm_storeu_pd(p, a); }
+        inline Lanes splatLanes(real v) { return _mm_set1_pd(v); }
+        inline Lanes add(Lanes a, Lanes b) { return _mm_add_pd(a, b); }
+        inline Lanes sub(Lanes a, Lanes b) { return _mm_sub_pd(a, b); }
+        inline Lanes mul(Lanes a, Lanes b) { return _mm_mul_pd(a, b); }
+        inline Lanes div(Lanes a, Lanes b) { return _mm_div_pd(a, b); }
+        inline Lanes squareRoot(Lanes a) { return _mm_sqrt_pd(a); }
+        inline Lanes absolute(Lanes a)
+        {
+            return _mm_andnot_pd(_mm_set1_pd(-0.0), a);
+        }
+        inline int less(Lanes a, Lanes b)
+        {
+            return _mm_movemask_pd(_mm_cmplt_pd(a, b));
+        }
+#elif defined(__AVX__)
+        typedef __m256 Lanes;
+        const unsigned LANES = 8;
+
+        inline Lanes loadLanes(const real *p) { return _mm256_loadu_ps(p); }
+        inline void storeLanes(real *p, Lanes a) { _mm256_storeu_ps(p, a); }
+        inline Lanes splatLanes(real v) { return _mm256_set1_ps(v); }
+        inline Lanes add(Lanes a, Lanes b) { return _mm256_add_ps(a, b); }
+        inline Lanes sub(Lanes a, Lanes b) { return _mm256_sub_ps(a, b); }
+        inline Lanes mul(Lanes a, Lanes b) { return _mm256_mul_ps(a, b); }
+        inline Lanes div(Lanes a, Lanes b) { return _mm256_div_ps(a, b); }
+        inline Lanes squareRoot(Lanes a) { return _mm256_sqrt_ps(a); }
+        inline Lanes absolute(Lanes a)
+        {
+            return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a);
+        }
+        inline int less(Lanes a, Lanes b)
+        {
+            return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_LT_OQ));
+        }
+#else
+        typedef __m128 Lanes;
+        const unsigned LANES = 4;
+
+        inline Lanes loadLanes(const real *p) { return _mm_loadu_ps(p); }
+        inline void storeLanes(real *p, Lanes a) { _mm_storeu_ps(p, a); }
+        inline Lanes splatLanes(real v) { return _mm_set1_ps(v); }
+        inline Lanes add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+        inline Lanes sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+        inline Lanes mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+        inline Lanes div(Lanes a, Lanes b) { return _mm_div_ps(a, b); }
+        inline Lanes squareRoot(Lanes a) { return _mm_sqrt_ps(a); }
+        inline Lanes absolute(Lanes a)
+        {
+            return _mm_andnot_ps(_mm_set1_ps(-0.0f), a);
+        }
+        inline int less(Lanes a, Lanes b)
+        {
+            return _mm_movemask_ps(_mm_cmplt_ps(a, b));
+        }
+#endif
+
+    } // namespace simd
+
+} // namespace cyclone
+
+#endif // CYCLONE_SSE && __SSE2__
+
+#endif // CYCLONE_SIMD_H
@@ -0,0 +1,429 @@
+/*
+ * Interface file for the sequential impulse contact solver.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains an alternative contact resolver, based on
+ * sequential impulses (also known as projected Gauss-Seidel), along
+ * with the cache it uses to carry impulses from one frame to the
+ * next.
+ */
+#ifndef CYCLONE_SOLVER_H
+#define CYCLONE_SOLVER_H
+
+#include <vector>
+#include <mutex>
+#include "contacts.h"
+#include "threads.h"
+
+namespace cyclone {
+
+    /**
+     * Remembers the impulse applied at each contact, so that it can be
+     * used as the starting point for the same contact in the next
+     * frame. Contacts are identified by their two bodies and their
+     * feature identifier.
+     *
+     * The cache holds two frames of data: the impulses stored during
+     * the last frame, which can be looked up, and those being stored
+     * during this one. Lookups don't change the cache, and stores are
+     * locked, so one cache can be shared by resolvers running on
+     * different threads.
+     */
+    class ContactCache
+    {
+    public:
+        /**
+         * Holds the impulse for one contact.
+         */
+        struct Entry
+        {
+            /** Holds the bodies of the contact. */
+            RigidBody *body[2];
+
+            /** Holds the feature identifier of the contact. */
+            unsigned feature;
+
+            /** Holds the impulse applied, in world coordinates. */
+            Vector3 impulse;
+        };
+
+    protected:
+        /**
+         * Holds the entries stored last frame, sorted by key.
+         */
+        std::vector<Entry> previous;
+
+        /**
+         * Holds the entries stored so far this frame.
+         */
+        std::vector<Entry> current;
+
+        /**
+         * Guards the current entries.
+         */
+        std::mutex lock;
+
+        /**
+         * Orders entries by their key.
+         */
+        static bool keyLess(const Entry &a, const Entry &b);
+
+    public:
+        /**
+         * Finds the impulse stored last frame for the contact with the
+         * given key. Returns false if there isn't one.
+         */
+        bool lookup(RigidBody *one, RigidBody *two, unsigned feature,
+                    Vector3 *impulse) const;
+
+        /**
+         * Stores the given entries for this frame.
+         */
+        void store(const Entry *entries, unsigned count);
+
+        /**
+         * Makes the entries stored this frame available for lookup,
+         * and discards those from the frame before.
+         */
+        void advanceFrame();
+
+        /**
+         * Removes everything from the cache.
+         */
+        void clear();
+
+        /**
+         * Returns the number of entries that can be looked up.
+         */
+        unsigned getSize() const
+        {
+            return (unsigned)previous.size();
+        }
+    };
+
+    /**
+     * A contact resolver that works on all the contacts at once,
+     * rather than the worst one at a time.
+     *
+     * @section algorithm Resolution Algorithm
+     *
+     * Velocities are resolved by sweeping through the contacts a fixed
+     * number of times. At each contact the resolver works out the
+     * impulse that would give the contact its target velocity, and
+     * adds it to the impulse accumulated at the contact so far. The
+     * accumulated impulse, rather than each change, is clamped: the
+     * normal impulse can't pull, and the friction impulse must stay
+     * inside the friction cone. This lets later sweeps take back
+     * impulse that earlier sweeps applied, so the contacts converge
+     * towards a consistent set of impulses.
+     *
+     * If the resolver is given a contact cache, each contact starts
+     * from the impulse it ended with last frame. For resting contacts
+     * this is almost the right answer, so very few sweeps are needed.
+     *
+     * Interpenetration is removed in the same way as the original
+     * resolver, but by sweeping through every penetrating contact
+     * rather than picking the worst one each time.
+     *
+     * Since the number of sweeps is fixed, the time taken is linear in
+     * the number of contacts, however they are arranged. Between eight
+     * and ten velocity iterations is normally enough for stacks.
+     *
+     * Bodies that are asleep, and not woken by the contact, are
+     * treated as immovable.
+     *
+     * @section colouring Parallel Resolution
+     *
+     * If the resolver is given a thread pool, the contacts in each
+     * call are coloured so that no two contacts of the same colour
+     * share a body. All the contacts of one colour can then be
+     * resolved at the same time, and the sweeps go through the colours
+     * in turn. This lets one large island use every worker. Scenery
+     * should be given as a NULL body, otherwise every contact with it
+     * needs its own colour. The results depend only on the colouring,
+     * not on the number of workers.
+     *
+     * Colouring only pays when the pool has workers free. If the
+     * resolver is called from one of the pool's own tasks, as it is
+     * when it is given to a World that uses the same pool to resolve
+     * islands at once, the other workers are busy with other islands
+     * and a batch would run on the calling thread alone. In that case
+     * the contacts are resolved in order, just as without a pool.
+     */
+    class SequentialImpulseResolver : public ContactResolver
+    {
+    protected:
+        /**
+         * Holds the data the resolver works out for each contact.
+         */
+        struct ContactState
+        {
+            /**
+             * Holds the impulse accumulated at the contact, in contact
+             * coordinates.
+             */
+            Vector3 impulse;
+
+            /**
+             * Holds the impulse needed per unit of velocity change
+             * along each contact axis.
+             */
+            Vector3 axisMass;
+
+            /**
+             * Holds the closing velocity the contact should end with.
+             */
+            real targetVelocity;
+
+            /**
+             * Holds the inverse mass of each body, or zero if it can't
+             * be moved.
+             */
+            real inverseMass[2];
+
+            /**
+             * Holds the world inverse inertia tensor of each body.
+             */
+            Matrix3 inverseInertiaTensor[2];
+        };
+
+        /**
+         * Holds the state of each contact being resolved.
+         */
+        std::vector<ContactState> states;
+
+        /**
+         * Holds the entries to add to the cache.
+         */
+        std::vector<ContactCache::Entry> cacheEntries;
+
+        /**
+         * Holds the cache used for warm starting, or NULL.
+         */
+        ContactCache *cache;
+
+        /**
+         * Holds the thread pool used to resolve colours in parallel,
+         * or NULL to resolve contacts in order on the calling thread.
+         */
+        ThreadPool *threadPool;
+
+        /**
+         * @name Colouring
+         *
+         * These arrays are rebuilt by colourContacts when a thread
+         * pool is in use. Bodies are identified by the numbers given
+         * them in the body adjacency data.
+         */
+        /*@{*/
+
+        /**
+         * Holds the colour of each contact.
+         */
+        std::vector<unsigned> contactColour;
+
+        /**
+         * Holds, for each colour, the last contact that found it in
+         * use by a neighbour. Scratch data for colourContacts.
+         */
+        std::vector<unsigned> colourMark;
+
+        /**
+         * Holds, for each colour, the offset of its first contact in
+         * colouredContacts, with one extra entry for the end.
+         */
+        std::vector<unsigned> colourStart;
+
+        /**
+         * Holds the contact indices grouped by colour.
+         */
+        std::vector<unsigned> colouredContacts;
+
+        /**
+         * Holds the position change made to each body by the colour
+         * being resolved.
+         */
+        std::vector<Vector3> bodyLinearChange;
+        std::vector<Vector3> bodyAngularChange;
+
+        /**
+         * Holds, for each body, the number of the last batch that
+         * moved it.
+         */
+        std::vector<unsigned> bodyMovedBatch;
+
+        /**
+         * Counts the position batches run so far.
+         */
+        unsigned movedBatch;
+
+        /**
+         * Holds, for each colour, the offset of its first entry in
+         * colourNeighbours, with one extra entry for the end.
+         */
+        std::vector<unsigned> neighbourStart;
+
+        /**
+         * Holds, grouped by colour, every contact that shares a body
+         * with a contact of that colour, and so needs its penetration
+         * brought up to date when the colour's bodies are moved.
+         */
+        std::vector<unsigned> colourNeighbours;
+
+        /**
+         * Holds, for each contact, the last colour that added it to
+         * colourNeighbours. Scratch data for findColourNeighbours.
+         */
+        std::vector<unsigned> neighbourMark;
+
+        /*@}*/
+
+        /**
+         * Is set while the contacts of the current call are being
+         * resolved by colour.
+         */
+        bool colouring;
+
+        /**
+         * Describes a set of contacts to be shared out between the
+         * workers of the thread pool.
+         */
+        struct Batch
+        {
+            SequentialImpulseResolver *resolver;
+            Contact *contacts;
+
+            /** Holds the contact indices. */
+            const unsigned *order;
+
+            unsigned count;
+            unsigned chunkSize;
+        };
+
+        /**
+         * Holds the batch being run on the thread pool.
+         */
+        Batch batch;
+
+        /**
+         * Works out the state of each contact, warm starting it from
+         * the cache if there is one.
+         */
+        void prepareStates(Contact *contacts, unsigned numContacts);
+
+        /**
+         * Applies the given impulse, in world coordinates, to the
+         * bodies of the given contact.
+         */
+        void applyImpulse(Contact &contact, const ContactState &state,
+                          const Vector3 &impulse);
+
+        /**
+         * Resolves the velocity of a single contact.
+         */
+        void solveContactVelocity(Contact &contact, ContactState &state);
+
+        /**
+         * Sweeps through the contacts resolving their velocities.
+         */
+        void solveVelocities(Contact *contacts, unsigned numContacts);
+
+        /**
+         * Colours the contacts, so no two contacts of the same colour
+         * share a body, and groups them by colour.
+         */
+        void colourContacts(unsigned numContacts);
+
+        /**
+         * Finds, for each colour, the contacts that share a body with
+         * one of its contacts.
+         */
+        void findColourNeighbours(unsigned numContacts);
+
+        /**
+         * Runs the given task on the thread pool over the given
+         * contacts, split into chunks.
+         */
+        void runBatch(ThreadPool::Task task, Contact *contacts,
+                      const unsigned *order, unsigned count);
+
+        /**
+         * Sweeps through the contacts resolving their penetration, one
+         * colour at a time on the thread pool.
+         */
+        void solvePositionsByColour(Contact *contacts, unsigned numContacts);
+
+        /**
+         * The thread pool tasks for one chunk of a batch.
+         */
+        static void velocityTask(unsigned index, unsigned worker, void *data);
+        static void positionTask(unsigned index, unsigned worker, void *data);
+        static void penetrationTask(unsigned index, unsigned worker,
+                                    void *data);
+
+        /**
+         * Sweeps through the contacts resolving their penetration.
+         */
+        void solvePositions(Contact *contacts, unsigned numContacts);
+
+        /**
+         * Stores the impulses accumulated at each contact in the cache.
+         */
+        void storeImpulses(Contact *contacts, unsigned numContacts);
+
+    public:
+        /**
+         * Creates a new resolver with the given number of sweeps for
+         * velocity and for position, and optional epsilon values.
+         */
+        SequentialImpulseResolver(unsigned velocityIterations = 10,
+            unsigned positionIterations = 4,
+            real velocityEpsilon=(real)0.01,
+            real positionEpsilon=(real)0.01);
+
+        virtual ContactResolver *clone() const;
+
+        /**
+         * Sets the cache used to warm start contacts, or NULL to start
+         * every contact from zero. The cache is not owned by the
+         * resolver, and is shared with its clones.
+         */
+        void setCache(ContactCache *cache);
+
+        /**
+         * Sets the thread pool used to resolve the contacts of one
+         * call in parallel, or NULL to resolve them on the calling
+         * thread. The pool is not owned by the resolver, and is shared
+         * with its clones. Calls made from inside one of the pool's
+         * tasks are resolved in order on the calling thread.
+         */
+        void setThreadPool(ThreadPool *pool);
+
+        /**
+         * Advances the cache, if there is one, to the new frame.
+         */
+        virtual void startFrame();
+
+        /**
+         * Resolves a set of contacts for both penetration and velocity,
+         * using the fixed number of sweeps given for each.
+         */
+        virtual void resolveContacts(Contact *contactArray,
+            unsigned numContacts,
+            real duration);
+    };
+
+} // namespace cyclone
+
+#endif // CYCLONE_SOLVER_H
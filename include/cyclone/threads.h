@@ -0,0 +1,184 @@
+/*
+ * Interface file for the thread pool.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains the definitions for a pool of worker threads
+ * that can be used to run independent parts of the simulation at the
+ * same time.
+ */
+#ifndef CYCLONE_THREADS_H
+#define CYCLONE_THREADS_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace cyclone {
+
+    /**
+     * A fixed set of worker threads that run batches of independent
+     * tasks.
+     *
+     * Each batch is a number of tasks, given by index. The tasks are
+     * dealt out to the workers in order, so a caller that wants the
+     * expensive tasks run first should number them first. Each worker
+     * then runs its own tasks in that order, and when it runs out it
+     * steals the cheapest remaining task from the back of another
+     * worker's queue.
+     *
+     * The thread that starts a batch takes part in it as worker zero,
+     * so a pool with one worker runs everything on the calling thread
+     * and creates no threads at all. A task that starts a batch on the
+     * pool running it gets the whole batch run on its own thread.
+     */
+    class ThreadPool
+    {
+    public:
+        /**
+         * The type of function run for each task. It is given the
+         * index of the task, the index of the worker running it (which
+         * can be used to pick per-worker scratch data), and the data
+         * pointer passed to run.
+         */
+        typedef void (*Task)(unsigned index, unsigned worker, void *data);
+
+    protected:
+        /**
+         * Holds the queue of tasks waiting for one worker. The tasks
+         * waiting are those from head up to tail. No tasks are added
+         * during a batch, so the queue is only ever emptied, from the
+         * front by its worker and from the back by thieves. The array
+         * is kept between batches, so it only needs to grow when a
+         * batch has more tasks than any before it.
+         */
+        struct Worker
+        {
+            std::mutex lock;
+            std::vector<unsigned> tasks;
+            unsigned head;
+            unsigned tail;
+
+            Worker() : head(0), tail(0) {}
+        };
+
+        /**
+         * Holds the queues of the workers.
+         */
+        Worker *workers;
+
+        /**
+         * Holds the number of workers, including the calling thread.
+         */
+        unsigned workerCount;
+
+        /**
+         * Holds the threads of workers one onwards.
+         */
+        std::vector<std::thread> threads;
+
+        /**
+         * Guards the batch state below.
+         */
+        std::mutex lock;
+
+        /**
+         * Signalled when a new batch starts, or the pool shuts down.
+         */
+        std::condition_variable started;
+
+        /**
+         * Signalled when the last thread finishes its part of a batch.
+         */
+        std::condition_variable finished;
+
+        /**
+         * Counts the batches run so far, so that threads can tell a
+         * new batch from the one they have just finished.
+         */
+        unsigned batch;
+
+        /**
+         * Holds the number of threads still working on this batch.
+         */
+        unsigned busy;
+
+        /**
+         * True when the pool is being destroyed.
+         */
+        bool quit;
+
+        /**
+         * Holds the function and data of the current batch.
+         */
+        Task task;
+        void *data;
+
+        /**
+         * Takes the next task for the given worker, stealing one if
+         * its own queue is empty. Returns false if there are none
+         * left anywhere.
+         */
+        bool takeTask(unsigned worker, unsigned &index);
+
+        /**
+         * Runs tasks on the given worker until there are none left.
+         */
+        void work(unsigned worker);
+
+        /**
+         * The loop run by each of the pool's threads.
+         */
+        void threadMain(unsigned worker);
+
+    public:
+        /**
+         * Creates a pool with the given number of workers, including
+         * the calling thread. If no number is given, one worker is
+         * used for each hardware thread.
+         */
+        ThreadPool(unsigned workers = 0);
+
+        /**
+         * Stops and joins the pool's threads.
+         */
+        ~ThreadPool();
+
+        /**
+         * Returns the number of workers, including the calling thread.
+         */
+        unsigned getWorkerCount() const
+        {
+            return workerCount;
+        }
+
+        /**
+         * Runs the given function once for each task index from zero
+         * up to the given count, and returns when they have all
+         * finished. Tasks must not depend on each other. Batches can't
+         * be started from more than one thread at a time.
+         */
+        void run(unsigned count, Task task, void *data);
+
+        /**
+         * Checks if the calling thread is running one of this pool's
+         * tasks, in which case a batch it starts is run on that
+         * thread alone.
+         */
+        bool isRunningTask() const;
+    };
+
+} // namespace cyclone
+
+#endif // CYCLONE_THREADS_H
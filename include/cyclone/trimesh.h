@@ -0,0 +1,233 @@
+/*
+ * Interface file for the static triangle mesh.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+/**
+ * @file
+ *
+ * This file contains the triangle mesh used for level geometry, and
+ * the bounding volume hierarchy that lets the collision detector find
+ * the few triangles near a primitive without testing them all.
+ */
+#ifndef CYCLONE_TRIMESH_H
+#define CYCLONE_TRIMESH_H
+
+#include <vector>
+#include "collide_coarse.h"
+
+namespace cyclone {
+
+    /**
+     * A mesh of triangles that never moves, such as the terrain or
+     * the walls of a level. Like the plane, it is not a primitive: it
+     * doesn't represent a rigid body, and contacts with it have no
+     * second body.
+     *
+     * Triangles are one sided. Each faces the side from which its
+     * corners run anticlockwise, and anything behind a triangle is
+     * left alone by it, so neighbouring triangles don't push a body
+     * the wrong way through the surface.
+     *
+     * The mesh keeps its own copy of the vertices and triangles, and
+     * builds a bounding volume hierarchy over the triangles when they
+     * are given. The hierarchy is built once, top down, splitting each
+     * set of triangles where the surface area heuristic (SAH) says a
+     * query is cheapest: the chance of a query box reaching a node
+     * goes with the node's surface area, so the best split is the one
+     * that makes the sum, over the two halves, of surface area times
+     * triangles smallest. Candidate splits are found by sorting the
+     * triangles' centres into a few bins along each axis, so building
+     * takes time in proportion to the number of triangles at each
+     * level.
+     *
+     * The nodes are stored in one flat array, in depth first order:
+     * a node's first child comes straight after it, and only the
+     * second needs an index. The triangles are reordered so each leaf
+     * holds a run of them.
+     */
+    class CollisionTriangleMesh
+    {
+    public:
+        /**
+         * Holds the deepest hierarchy whose walks keep their stacks
+         * on the machine stack. Deeper ones use the heap.
+         */
+        static const unsigned STACK_HEIGHT = 64;
+
+        /**
+         * Holds the number of bins the triangles' centres are sorted
+         * into along each axis, when looking for the best split.
+         */
+        static const unsigned SPLIT_BINS = 16;
+
+        /**
+         * Holds one node of the hierarchy.
+         */
+        struct Node
+        {
+            /**
+             * Holds a box enclosing every triangle below the node.
+             */
+            BoundingBox box;
+
+            /**
+             * Holds the first triangle of a leaf, or the index of the
+             * second child of any other node. The first child is the
+             * next node in the array.
+             */
+            unsigned offset;
+
+            /**
+             * Holds the number of triangles in a leaf, or zero for
+             * any other node.
+             */
+            unsigned count;
+
+            /**
+             * Checks if this node is at the bottom of the hierarchy.
+             */
+            bool isLeaf() const
+            {
+                return count > 0;
+            }
+        };
+
+    protected:
+        /**
+         * Holds the vertices of the mesh.
+         */
+        std::vector<Vector3> vertices;
+
+        /**
+         * Holds the three vertex indices of each triangle, in the
+         * order of the leaves.
+         */
+        std::vector<unsigned> indices;
+
+        /**
+         * Holds the unit normal of each triangle, in the order of the
+         * leaves.
+         */
+        std::vector<Vector3> normals;
+
+        /**
+         * Holds the index each triangle had when it was given, in the
+         * order of the leaves.
+         */
+        std::vector<unsigned> sourceTriangles;
+
+        /**
+         * Holds the nodes, with the root first.
+         */
+        std::vector<Node> nodes;
+
+        /**
+         * Holds the number of levels of nodes.
+         */
+        unsigned height;
+
+    public:
+        /**
+         * Creates a mesh with no triangles.
+         */
+        CollisionTriangleMesh();
+
+        /**
+         * Creates a mesh from the given vertices, and the given
+         * number of triangles, each three indices into the vertices.
+         */
+        CollisionTriangleMesh(const Vector3 *vertices,
+                              unsigned vertexCount,
+                              const unsigned *indices,
+                              unsigned triangleCount,
+                              unsigned leafSize = 4);
+
+        /**
+         * Replaces the mesh's triangles with those given, as for the
+         * constructor, and builds the hierarchy over them. Leaves
+         * hold no more than the given number of triangles, and fewer
+         * if the surface area heuristic finds splitting them cheaper.
+         * Triangles with no area are left out.
+         */
+        void build(const Vector3 *vertices,
+                   unsigned vertexCount,
+                   const unsigned *indices,
+                   unsigned triangleCount,
+                   unsigned leafSize = 4);
+
+        /**
+         * Returns the number of triangles in the mesh.
+         */
+        unsigned getTriangleCount() const
+        {
+            return (unsigned)normals.size();
+        }
+
+        /**
+         * Writes the corners of the given triangle, numbered in the
+         * order of the leaves.
+         */
+        void getTriangle(unsigned index, Vector3 *corners) const
+        {
+            const unsigned *triangle = &indices[index*3];
+            corners[0] = vertices[triangle[0]];
+            corners[1] = vertices[triangle[1]];
+            corners[2] = vertices[triangle[2]];
+        }
+
+        /**
+         * Returns the unit normal of the given triangle, numbered in
+         * the order of the leaves.
+         */
+        const Vector3 &getNormal(unsigned index) const
+        {
+            return normals[index];
+        }
+
+        /**
+         * Returns the index the given triangle, numbered in the order
+         * of the leaves, had when it was given to the mesh.
+         */
+        unsigned getSourceTriangle(unsigned index) const
+        {
+            return sourceTriangles[index];
+        }
+
+        /**
+         * Returns the nodes of the hierarchy, with the root first.
+         */
+        const Node *getNodes() const
+        {
+            return nodes.empty() ? NULL : &nodes[0];
+        }
+
+        /**
+         * Returns the number of nodes in the hierarchy.
+         */
+        unsigned getNodeCount() const
+        {
+            return (unsigned)nodes.size();
+        }
+
+        /**
+         * Returns the number of levels of nodes, which is zero for an
+         * empty mesh. A walk down the hierarchy needs a stack this
+         * deep.
+         */
+        unsigned getHeight() const
+        {
+            return height;
+        }
+    };
+
+} // namespace cyclone
+
+#endif // CYCLONE_TRIMESH_H
@@ -19,14 +19,38 @@
 #ifndef CYCLONE_WORLD_H
 #define CYCLONE_WORLD_H
 
+#include <vector>
 #include "body.h"
+#include "bodystore.h"
 #include "contacts.h"
+#include "contactbuffer.h"
+#include "joints.h"
+#include "threads.h"
 
 namespace cyclone {
     /**
      * The world represents an independent simulation of physics.  It
      * keeps track of a set of rigid bodies, and provides the means to
      * update them all.
+     *
+     * Each frame the world splits its bodies into islands: groups of
+     * bodies that are connected to each other by contacts or joints.
+     * Islands cannot affect each other, so each is resolved with its
+     * own call to the contact resolver, and each is put to sleep and
+     * woken up as a whole. Contacts with immovable scenery should be
+     * given a NULL second body, otherwise every body resting on the
+     * scenery ends up in the same island.
+     *
+     * If the world is given a thread pool, its islands are resolved
+     * on the pool's workers at the same time, largest first. Since
+     * islands share no bodies, the result is the same as resolving
+     * them one after another.
+     *
+     * Bodies can either be made elsewhere and added with addBody, or
+     * created in the world's own body store with createBody. The
+     * world integrates the bodies in its store together, a property
+     * at a time, then copies them into their RigidBody objects for
+     * contact generation and resolution.
      */
     class World
     {
@@ -51,11 +75,22 @@ namespace cyclone {
          */
         BodyRegistration *firstBody;
 
+        /**
+         * Holds the bodies created by the world.
+         */
+        RigidBodyStore bodyStore;
+
         /**
          * Holds the resolver for sets of contacts.
          */
         ContactResolver resolver;
 
+        /**
+         * Holds the resolver given with setResolver, or NULL to use
+         * the world's own.
+         */
+        ContactResolver *customResolver;
+
         /**
          * Holds one contact generators in a linked list.
          */
@@ -71,31 +106,316 @@ namespace cyclone {
         ContactGenRegistration *firstContactGen;
 
         /**
-         * Holds an array of contacts, for filling by the contact
-         * generators.
+         * Holds the memory used for one frame: the contacts, the
+         * islands and anything else taken from it. It is reset when
+         * each frame starts.
+         */
+        FrameArena frameArena;
+
+        /**
+         * Holds the memory the frame's contacts are kept in. It takes
+         * its chunks from the frame arena.
+         */
+        ContactArena contactArena;
+
+        /**
+         * Holds the contacts found by the contact generators and
+         * joints this frame.
+         */
+        ContactBuffer contacts;
+
+        /**
+         * Holds one joint in a linked list of joints.
+         */
+        struct JointRegistration
+        {
+            Joint *joint;
+            JointRegistration *next;
+        };
+
+        /**
+         * Holds the head of the list of joints.
+         */
+        JointRegistration *firstJoint;
+
+        /**
+         * Holds a set of bodies that are connected to each other by
+         * contacts or joints, along with the contacts between them.
+         */
+        struct Island
+        {
+            /** Holds the offset of the first body in islandBodies. */
+            unsigned firstBody;
+
+            /** Holds the number of bodies in the island. */
+            unsigned bodyCount;
+
+            /** Holds the offset of the first contact in islandContacts. */
+            unsigned firstContact;
+
+            /** Holds the number of contacts in the island. */
+            unsigned contactCount;
+
+            /** True if any body in the island is awake. */
+            bool awake;
+        };
+
+        /**
+         * Holds the islands found in the current frame.
+         */
+        std::vector<Island> islands;
+
+        /**
+         * Holds every body taking part in the current frame, sorted
+         * by address so bodies can be looked up by pointer.
+         */
+        std::vector<RigidBody*> frameBodies;
+
+        /**
+         * Holds the union-find parent of each entry in frameBodies.
+         * Once the islands are built, holds the island of each body.
+         */
+        std::vector<unsigned> bodyIsland;
+
+        /**
+         * Holds the bodies that were asleep after the islands were
+         * last put to sleep, sorted by address, so that bodies woken
+         * since can be told apart.
+         */
+        std::vector<RigidBody*> sleepingBodies;
+
+        /**
+         * Holds the bodies of each island, grouped by island. This is
+         * taken from the frame arena.
+         */
+        RigidBody **islandBodies;
+
+        /**
+         * Holds the frame's contacts, grouped by island. The contacts
+         * are copied here straight from the chunks they were
+         * generated into. This is taken from the frame arena.
+         */
+        Contact *islandContacts;
+
+        /**
+         * Holds the thread pool used to resolve islands, or NULL to
+         * resolve them on the calling thread.
+         */
+        ThreadPool *threadPool;
+
+        /**
+         * Holds one clone of the active resolver for each worker of
+         * the thread pool. These are made when they are first needed.
+         */
+        std::vector<ContactResolver*> workerResolvers;
+
+        /**
+         * Holds the islands that need resolving this frame, largest
+         * first.
+         */
+        std::vector<unsigned> islandOrder;
+
+        /**
+         * Holds the duration of the frame being resolved, for the
+         * thread pool tasks.
+         */
+        real frameDuration;
+
+        /**
+         * Finds the entry for the given body in frameBodies.
+         */
+        unsigned findBody(RigidBody *body) const;
+
+        /**
+         * Finds the root of the given entry in the union-find forest,
+         * compressing the path as it goes.
          */
-        Contact *contacts;
+        unsigned findRoot(unsigned body);
 
         /**
-         * Holds the maximum number of contacts allowed (i.e. the size
-         * of the contacts array).
+         * Joins the sets of the two given bodies.
          */
-        unsigned maxContacts;
+        void joinBodies(RigidBody *one, RigidBody *two);
+
+        /**
+         * Adds the contacts of the given generator to the frame's
+         * contacts.
+         */
+        void addGeneratorContacts(const ContactGenerator *gen);
+
+        /**
+         * Splits the bodies and the generated contacts into islands.
+         */
+        void buildIslands();
+
+        /**
+         * Puts islands that have come to rest to sleep, and wakes any
+         * sleeping body in an island that is still moving.
+         */
+        void updateIslandSleep();
+
+        /**
+         * Returns the resolver in use: the custom one if there is one,
+         * and the world's own otherwise.
+         */
+        ContactResolver &getActiveResolver();
+
+        /**
+         * Deletes the per-worker resolvers, so they are cloned again
+         * when next needed.
+         */
+        void clearWorkerResolvers();
+
+        /**
+         * Resolves the contacts of the given island with the given
+         * resolver.
+         */
+        void resolveIsland(const Island &island,
+            ContactResolver &islandResolver, real duration);
+
+        /**
+         * Resolves the islands that are awake, on the thread pool if
+         * there is one.
+         */
+        void resolveIslands(real duration);
+
+        /**
+         * The thread pool task that resolves one entry of islandOrder.
+         */
+        static void resolveIslandTask(
+            unsigned index, unsigned worker, void *data);
 
     public:
         /**
-         * Creates a new simulator that can handle up to the given
-         * number of contacts per frame. You can also optionally give
-         * a number of contact-resolution iterations to use. If you
-         * don't give a number of iterations, then four times the
-         * number of detected contacts will be used for each frame.
+         * Creates a new simulator that sets aside room for the given
+         * number of contacts at a time. If a frame has more contacts,
+         * more room is taken, so none are lost. You can also
+         * optionally give a number of contact-resolution iterations
+         * to use. If you don't give a number of iterations, then four
+         * times the number of detected contacts will be used for each
+         * frame.
          */
         World(unsigned maxContacts, unsigned iterations=0);
         ~World();
 
+        /**
+         * Adds the given body to the simulation.
+         */
+        void addBody(RigidBody *body);
+
+        /**
+         * Creates a new body in the world's body store, and returns
+         * its handle. See RigidBodyStore::create for its initial
+         * state.
+         */
+        BodyHandle createBody();
+
+        /**
+         * Destroys a body made with createBody. Any collision
+         * primitives, joints or contact generators pointing at its
+         * RigidBody object must be removed first.
+         */
+        void destroyBody(BodyHandle handle);
+
+        /**
+         * Returns a view of a body made with createBody. The body's
+         * state should be read and changed through this between
+         * frames.
+         */
+        RigidBodyView getBody(BodyHandle handle)
+        {
+            return bodyStore.getView(handle);
+        }
+
+        /**
+         * Returns the RigidBody object of a body made with createBody,
+         * for collision primitives, joints and contact generators to
+         * point at. It only holds the body's current state while the
+         * world is running a frame. Forces and torques added to it
+         * between frames are moved onto the body at the start of the
+         * next.
+         */
+        RigidBody *getBodyObject(BodyHandle handle) const
+        {
+            return bodyStore.getBody(handle);
+        }
+
+        /**
+         * Returns the store of bodies made with createBody.
+         */
+        RigidBodyStore &getBodyStore()
+        {
+            return bodyStore;
+        }
+
+        /**
+         * Adds the given contact generator. It will be asked for its
+         * contacts each frame, whether or not its bodies are asleep,
+         * so it should skip pairs that ContactGenerator::isSettled
+         * reports. A body woken during resolution gets those contacts
+         * back on the next frame.
+         */
+        void addContactGenerator(ContactGenerator *gen);
+
+        /**
+         * Adds the given joint. Joints generate contacts like any
+         * other contact generator, but also keep the bodies they link
+         * in the same island even when the joint is not violated.
+         */
+        void addJoint(Joint *joint);
+
+        /**
+         * Sets the thread pool used to resolve islands at the same
+         * time. The pool is not owned by the world, and can be shared
+         * with other worlds that are not run at the same time. Passing
+         * NULL resolves islands on the calling thread.
+         */
+        void setThreadPool(ThreadPool *pool);
+
+        /**
+         * Sets the resolver used for contacts, such as a
+         * SequentialImpulseResolver, or NULL to use the world's own.
+         * The resolver is not owned by the world. Its iteration counts
+         * are left as they are, even if the world was created to
+         * calculate them. When a thread pool is in use, the resolver
+         * is cloned for each worker, so changes to its settings only
+         * take effect when it is set again.
+         */
+        void setResolver(ContactResolver *resolver);
+
+        /**
+         * Returns the number of islands found in the last frame.
+         */
+        unsigned getIslandCount() const
+        {
+            return (unsigned)islands.size();
+        }
+
+        /**
+         * Returns the arena holding the memory used for one frame.
+         * Anything that is only needed until the frame is over, such
+         * as the list of pairs from a broad phase, can be taken from
+         * it, and is given back when the next frame starts. The arena
+         * keeps track of the most memory a frame has used.
+         */
+        FrameArena *getFrameArena()
+        {
+            return &frameArena;
+        }
+
         /**
          * Calls each of the registered contact generators to report
          * their contacts. Returns the number of generated contacts.
+         * Joints whose bodies are both asleep are skipped. Other
+         * generators are always called, and are left to skip their
+         * own settled pairs.
+         *
+         * A generator is given the room left in the current chunk of
+         * contacts, or a new chunk if less than a chunk is left. If it
+         * fills all of it, it may have had more to report, so it is
+         * called again with twice the room. Contact generators don't
+         * change anything when they are called, so this gives the
+         * same contacts.
          */
         unsigned generateContacts();
 
@@ -108,7 +428,8 @@ namespace cyclone {
          * Initialises the world for a simulation frame. This clears
          * the force and torque accumulators for bodies in the
          * world. After calling this, the bodies can have their forces
-         * and torques for this frame added.
+         * and torques for this frame added. Everything taken from the
+         * frame arena last frame is given back.
          */
         void startFrame();
 
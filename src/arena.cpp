@@ -0,0 +1,100 @@
+/*
+ * Implementation file for the frame arena.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+#include <algorithm>
+#include <cyclone/arena.h>
+
+using namespace cyclone;
+
+FrameArena::FrameArena(size_t blockSize)
+:
+offset(0), used(0), highWater(0), heapAllocations(0)
+{
+    addBlock(blockSize);
+}
+
+FrameArena::~FrameArena()
+{
+    for (unsigned i = 0; i < blocks.size(); i++)
+    {
+        delete[] blocks[i].memory;
+    }
+}
+
+void FrameArena::addBlock(size_t size)
+{
+    Block block;
+    block.size = size;
+    block.memory = new char[size];
+    blocks.push_back(block);
+    offset = 0;
+    heapAllocations++;
+}
+
+void *FrameArena::allocate(size_t size, size_t alignment)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    // Find the padding needed to align the memory in the last block.
+    const Block *block = &blocks.back();
+    size_t address = (size_t)(block->memory + offset);
+    size_t padding = (alignment - (address & (alignment - 1))) &
+        (alignment - 1);
+
+    // If it doesn't fit, start a new block at least twice the size of
+    // the last, so a frame only needs a few.
+    if (offset + padding + size > block->size)
+    {
+        addBlock(std::max(block->size * 2, size + alignment));
+        block = &blocks.back();
+        address = (size_t)block->memory;
+        padding = (alignment - (address & (alignment - 1))) &
+            (alignment - 1);
+    }
+
+    void *memory = block->memory + offset + padding;
+    offset += padding + size;
+    used += padding + size;
+    if (used > highWater) highWater = used;
+    return memory;
+}
+
+void FrameArena::reset()
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    // Replace several blocks with one that holds them all.
+    if (blocks.size() > 1)
+    {
+        size_t capacity = 0;
+        for (unsigned i = 0; i < blocks.size(); i++)
+        {
+            capacity += blocks[i].size;
+            delete[] blocks[i].memory;
+        }
+        blocks.clear();
+        addBlock(capacity);
+    }
+
+    offset = 0;
+    used = 0;
+}
+
+size_t FrameArena::getCapacity() const
+{
+    size_t capacity = 0;
+    for (unsigned i = 0; i < blocks.size(); i++)
+    {
+        capacity += blocks[i].size;
+    }
+    return capacity;
+}
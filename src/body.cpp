@@ -136,6 +136,20 @@ static inline void _calculateTransformMatrix(Matrix4 &transformMatrix,
  * FUNCTIONS DECLARED IN HEADER:
  * --------------------------------------------------------------------------
  */
+void cyclone::calculateTransformMatrix(Matrix4 &transformMatrix,
+                                       const Vector3 &position,
+                                       const Quaternion &orientation)
+{
+    _calculateTransformMatrix(transformMatrix, position, orientation);
+}
+
+void cyclone::transformInertiaTensor(Matrix3 &iitWorld,
+                                     const Matrix3 &iitBody,
+                                     const Matrix4 &transformMatrix)
+{
+    _transformInertiaTensor(iitWorld, Quaternion(), iitBody, transformMatrix);
+}
+
 void RigidBody::calculateDerivedData()
 {
     orientation.normalise();
@@ -151,7 +165,7 @@ void RigidBody::calculateDerivedData()
 
 }
 
-void RigidBody::integrate(real duration)
+void RigidBody::integrate(real duration, bool fallAsleep)
 {
     if (!isAwake) return;
 
@@ -197,7 +211,7 @@ void RigidBody::integrate(real duration)
         real bias = real_pow(0.5, duration);
         motion = bias*motion + (1-bias)*currentMotion;
 
-        if (motion < sleepEpsilon) setAwake(false);
+        if (motion < sleepEpsilon && fallAsleep) setAwake(false);
         else if (motion > 10 * sleepEpsilon) motion = 10 * sleepEpsilon;
     }
 }
@@ -0,0 +1,672 @@
+/*
+ * Implementation file for the rigid body store.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+#include <assert.h>
+#include <algorithm>
+#include <cyclone/bodystore.h>
+
+using namespace cyclone;
+
+/*
+ * Internal functions that read and write one body's vector, quaternion
+ * or matrix from the arrays holding its components.
+ */
+static inline Vector3 getVector(const std::vector<real> *a, unsigned n)
+{
+    return Vector3(a[0][n], a[1][n], a[2][n]);
+}
+
+static inline void setVector(std::vector<real> *a, unsigned n,
+                             const Vector3 &v)
+{
+    a[0][n] = v.x;
+    a[1][n] = v.y;
+    a[2][n] = v.z;
+}
+
+static inline Quaternion getQuaternion(const std::vector<real> *a, unsigned n)
+{
+    return Quaternion(a[0][n], a[1][n], a[2][n], a[3][n]);
+}
+
+static inline void setQuaternion(std::vector<real> *a, unsigned n,
+                                 const Quaternion &q)
+{
+    for (unsigned k = 0; k < 4; k++) a[k][n] = q.data[k];
+}
+
+template <class Matrix, unsigned size>
+static inline Matrix getMatrix(const std::vector<real> *a, unsigned n)
+{
+    Matrix m;
+    for (unsigned k = 0; k < size; k++) m.data[k] = a[k][n];
+    return m;
+}
+
+template <class Matrix, unsigned size>
+static inline void setMatrix(std::vector<real> *a, unsigned n,
+                             const Matrix &m)
+{
+    for (unsigned k = 0; k < size; k++) a[k][n] = m.data[k];
+}
+
+RigidBodyStore::RigidBodyStore()
+{
+}
+
+RigidBodyStore::~RigidBodyStore()
+{
+    for (unsigned i = 0; i < bodies.size(); i++) delete bodies[i];
+}
+
+void RigidBodyStore::getRealArrays(std::vector<real> *arrays[REAL_ARRAYS])
+{
+    unsigned count = 0;
+    arrays[count++] = &inverseMass;
+    arrays[count++] = &linearDamping;
+    arrays[count++] = &angularDamping;
+    arrays[count++] = &motion;
+    for (unsigned k = 0; k < 3; k++)
+    {
+        arrays[count++] = &position[k];
+        arrays[count++] = &velocity[k];
+        arrays[count++] = &rotation[k];
+        arrays[count++] = &forceAccum[k];
+        arrays[count++] = &torqueAccum[k];
+        arrays[count++] = &acceleration[k];
+        arrays[count++] = &lastFrameAcceleration[k];
+    }
+    for (unsigned k = 0; k < 4; k++) arrays[count++] = &orientation[k];
+    for (unsigned k = 0; k < 9; k++)
+    {
+        arrays[count++] = &inverseInertiaTensor[k];
+        arrays[count++] = &inverseInertiaTensorWorld[k];
+    }
+    for (unsigned k = 0; k < 12; k++) arrays[count++] = &transformMatrix[k];
+    assert(count == REAL_ARRAYS);
+}
+
+BodyHandle RigidBodyStore::create()
+{
+    BodyHandle handle;
+    if (freeSlots.empty())
+    {
+        handle.slot = (unsigned)slotIndex.size();
+        slotIndex.push_back(0);
+        slotGeneration.push_back(0);
+    }
+    else
+    {
+        handle.slot = freeSlots.back();
+        freeSlots.pop_back();
+    }
+    handle.generation = slotGeneration[handle.slot];
+
+    unsigned index = (unsigned)bodies.size();
+    slotIndex[handle.slot] = index;
+    indexSlot.push_back(handle.slot);
+
+    // Start everything at zero, then fill in what isn't.
+    std::vector<real> *arrays[REAL_ARRAYS];
+    getRealArrays(arrays);
+    for (unsigned a = 0; a < REAL_ARRAYS; a++) arrays[a]->push_back(0);
+    isAwake.push_back(true);
+    canSleep.push_back(true);
+    objectStale.push_back(true);
+    objectAwake.push_back(true);
+    bodies.push_back(new RigidBody());
+
+    inverseMass[index] = 1;
+    linearDamping[index] = 1;
+    angularDamping[index] = 1;
+    motion[index] = sleepEpsilon*2.0f;
+    orientation[0][index] = 1;
+    for (unsigned k = 0; k < 9; k += 4)
+    {
+        inverseInertiaTensor[k][index] = 1;
+        inverseInertiaTensorWorld[k][index] = 1;
+    }
+    for (unsigned k = 0; k < 12; k += 5) transformMatrix[k][index] = 1;
+
+    return handle;
+}
+
+void RigidBodyStore::destroy(BodyHandle handle)
+{
+    if (!isValid(handle)) return;
+
+    // Fill the gap with the last body, so the arrays stay packed.
+    unsigned index = slotIndex[handle.slot];
+    unsigned last = (unsigned)bodies.size() - 1;
+    delete bodies[index];
+
+    std::vector<real> *arrays[REAL_ARRAYS];
+    getRealArrays(arrays);
+    for (unsigned a = 0; a < REAL_ARRAYS; a++)
+    {
+        (*arrays[a])[index] = (*arrays[a])[last];
+        arrays[a]->pop_back();
+    }
+    isAwake[index] = isAwake[last];
+    isAwake.pop_back();
+    canSleep[index] = canSleep[last];
+    canSleep.pop_back();
+    objectStale[index] = objectStale[last];
+    objectStale.pop_back();
+    objectAwake[index] = objectAwake[last];
+    objectAwake.pop_back();
+    bodies[index] = bodies[last];
+    bodies.pop_back();
+
+    indexSlot[index] = indexSlot[last];
+    indexSlot.pop_back();
+    if (index != last) slotIndex[indexSlot[index]] = index;
+
+    // Any handle still holding the old generation is now stale.
+    slotGeneration[handle.slot]++;
+    freeSlots.push_back(handle.slot);
+}
+
+bool RigidBodyStore::isValid(BodyHandle handle) const
+{
+    return handle.slot < slotGeneration.size() &&
+        slotGeneration[handle.slot] == handle.generation;
+}
+
+unsigned RigidBodyStore::getIndex(BodyHandle handle) const
+{
+    assert(isValid(handle));
+    return slotIndex[handle.slot];
+}
+
+BodyHandle RigidBodyStore::getHandle(unsigned index) const
+{
+    BodyHandle handle;
+    handle.slot = indexSlot[index];
+    handle.generation = slotGeneration[handle.slot];
+    return handle;
+}
+
+RigidBodyView RigidBodyStore::getView(BodyHandle handle)
+{
+    return RigidBodyView(this, handle);
+}
+
+RigidBody *RigidBodyStore::getBody(BodyHandle handle) const
+{
+    return bodies[getIndex(handle)];
+}
+
+BodyArrays RigidBodyStore::getArrays(unsigned first, unsigned count)
+{
+    BodyArrays arrays;
+    arrays.count = count;
+    if (count == 0) return arrays;
+
+    arrays.inverseMass = &inverseMass[first];
+    arrays.linearDamping = &linearDamping[first];
+    arrays.angularDamping = &angularDamping[first];
+    arrays.motion = &motion[first];
+    arrays.isAwake = &isAwake[first];
+    arrays.canSleep = &canSleep[first];
+    for (unsigned k = 0; k < 3; k++)
+    {
+        arrays.position[k] = &position[k][first];
+        arrays.velocity[k] = &velocity[k][first];
+        arrays.rotation[k] = &rotation[k][first];
+        arrays.forceAccum[k] = &forceAccum[k][first];
+        arrays.torqueAccum[k] = &torqueAccum[k][first];
+        arrays.acceleration[k] = &acceleration[k][first];
+        arrays.lastFrameAcceleration[k] = &lastFrameAcceleration[k][first];
+    }
+    for (unsigned k = 0; k < 4; k++)
+    {
+        arrays.orientation[k] = &orientation[k][first];
+    }
+    for (unsigned k = 0; k < 9; k++)
+    {
+        arrays.inverseInertiaTensor[k] = &inverseInertiaTensor[k][first];
+        arrays.inverseInertiaTensorWorld[k] =
+            &inverseInertiaTensorWorld[k][first];
+    }
+    for (unsigned k = 0; k < 12; k++)
+    {
+        arrays.transformMatrix[k] = &transformMatrix[k][first];
+    }
+    return arrays;
+}
+
+void RigidBodyStore::integrate(real duration, bool fallAsleep)
+{
+    integrator.integrate(getArrays(0, getSize()), duration, fallAsleep);
+}
+
+void RigidBodyStore::calculateDerivedData()
+{
+    integrator.calculateDerivedData(getArrays(0, getSize()));
+}
+
+void RigidBodyStore::clearAccumulators()
+{
+    for (unsigned k = 0; k < 3; k++)
+    {
+        std::fill(forceAccum[k].begin(), forceAccum[k].end(), (real)0);
+        std::fill(torqueAccum[k].begin(), torqueAccum[k].end(), (real)0);
+    }
+}
+
+void RigidBodyStore::readForces()
+{
+    unsigned count = getSize();
+    for (unsigned n = 0; n < count; n++)
+    {
+        RigidBody *body = bodies[n];
+        if (!body->isAwake) continue;
+
+        setVector(forceAccum, n, getVector(forceAccum, n) + body->forceAccum);
+        setVector(torqueAccum, n,
+            getVector(torqueAccum, n) + body->torqueAccum);
+        body->clearAccumulators();
+        if (!isAwake[n])
+        {
+            isAwake[n] = true;
+            motion[n] = body->motion;
+            objectAwake[n] = true;
+        }
+    }
+}
+
+void RigidBodyStore::writeBodies()
+{
+    unsigned count = getSize();
+    for (unsigned n = 0; n < count; n++)
+    {
+        if (!isAwake[n] && !objectAwake[n] && !objectStale[n]) continue;
+
+        RigidBody *body = bodies[n];
+        if (objectStale[n])
+        {
+            body->inverseMass = inverseMass[n];
+            body->inverseInertiaTensor =
+                getMatrix<Matrix3, 9>(inverseInertiaTensor, n);
+            body->linearDamping = linearDamping[n];
+            body->angularDamping = angularDamping[n];
+            body->canSleep = canSleep[n] != 0;
+            body->acceleration = getVector(acceleration, n);
+            objectStale[n] = false;
+        }
+
+        body->position = getVector(position, n);
+        body->orientation = getQuaternion(orientation, n);
+        body->velocity = getVector(velocity, n);
+        body->rotation = getVector(rotation, n);
+
+        body->inverseInertiaTensorWorld =
+            getMatrix<Matrix3, 9>(inverseInertiaTensorWorld, n);
+        body->motion = motion[n];
+        body->isAwake = isAwake[n] != 0;
+        body->transformMatrix = getMatrix<Matrix4, 12>(transformMatrix, n);
+        body->lastFrameAcceleration = getVector(lastFrameAcceleration, n);
+        objectAwake[n] = isAwake[n];
+    }
+}
+
+void RigidBodyStore::readBodies()
+{
+    unsigned count = getSize();
+    for (unsigned n = 0; n < count; n++)
+    {
+        // A body the resolver woke has to come back too, and only its
+        // object knows it is awake.
+        const RigidBody *body = bodies[n];
+        if (!objectAwake[n] && !body->isAwake) continue;
+
+        setVector(position, n, body->position);
+        setQuaternion(orientation, n, body->orientation);
+        setVector(velocity, n, body->velocity);
+        setVector(rotation, n, body->rotation);
+
+        setMatrix<Matrix3, 9>(inverseInertiaTensorWorld, n,
+            body->inverseInertiaTensorWorld);
+        motion[n] = body->motion;
+        isAwake[n] = body->isAwake;
+        objectAwake[n] = body->isAwake;
+        setMatrix<Matrix4, 12>(transformMatrix, n, body->transformMatrix);
+    }
+}
+
+RigidBodyView::RigidBodyView(RigidBodyStore *store, BodyHandle handle)
+:
+store(store), handle(handle)
+{
+}
+
+unsigned RigidBodyView::index() const
+{
+    return store->getIndex(handle);
+}
+
+unsigned RigidBodyView::change() const
+{
+    unsigned n = store->getIndex(handle);
+    store->objectStale[n] = true;
+    return n;
+}
+
+void RigidBodyView::calculateDerivedData()
+{
+    store->integrator.calculateDerivedData(store->getArrays(change(), 1));
+}
+
+void RigidBodyView::integrate(real duration)
+{
+    store->integrator.integrate(store->getArrays(change(), 1), duration);
+}
+
+void RigidBodyView::setMass(const real mass)
+{
+    assert(mass != 0);
+    store->inverseMass[change()] = ((real)1.0)/mass;
+}
+
+real RigidBodyView::getMass() const
+{
+    real inverseMass = store->inverseMass[index()];
+    if (inverseMass == 0) {
+        return REAL_MAX;
+    } else {
+        return ((real)1.0)/inverseMass;
+    }
+}
+
+void RigidBodyView::setInverseMass(const real inverseMass)
+{
+    store->inverseMass[change()] = inverseMass;
+}
+
+real RigidBodyView::getInverseMass() const
+{
+    return store->inverseMass[index()];
+}
+
+bool RigidBodyView::hasFiniteMass() const
+{
+    return store->inverseMass[index()] >= 0.0f;
+}
+
+void RigidBodyView::setInertiaTensor(const Matrix3 &inertiaTensor)
+{
+    setInverseInertiaTensor(inertiaTensor.inverse());
+}
+
+Matrix3 RigidBodyView::getInertiaTensor() const
+{
+    return getInverseInertiaTensor().inverse();
+}
+
+Matrix3 RigidBodyView::getInertiaTensorWorld() const
+{
+    return getInverseInertiaTensorWorld().inverse();
+}
+
+void RigidBodyView::setInverseInertiaTensor(
+    const Matrix3 &inverseInertiaTensor)
+{
+    setMatrix<Matrix3, 9>(store->inverseInertiaTensor, change(),
+        inverseInertiaTensor);
+}
+
+Matrix3 RigidBodyView::getInverseInertiaTensor() const
+{
+    return getMatrix<Matrix3, 9>(store->inverseInertiaTensor, index());
+}
+
+Matrix3 RigidBodyView::getInverseInertiaTensorWorld() const
+{
+    return getMatrix<Matrix3, 9>(store->inverseInertiaTensorWorld, index());
+}
+
+void RigidBodyView::setDamping(const real linearDamping,
+                               const real angularDamping)
+{
+    unsigned n = change();
+    store->linearDamping[n] = linearDamping;
+    store->angularDamping[n] = angularDamping;
+}
+
+void RigidBodyView::setLinearDamping(const real linearDamping)
+{
+    store->linearDamping[change()] = linearDamping;
+}
+
+real RigidBodyView::getLinearDamping() const
+{
+    return store->linearDamping[index()];
+}
+
+void RigidBodyView::setAngularDamping(const real angularDamping)
+{
+    store->angularDamping[change()] = angularDamping;
+}
+
+real RigidBodyView::getAngularDamping() const
+{
+    return store->angularDamping[index()];
+}
+
+void RigidBodyView::setPosition(const Vector3 &position)
+{
+    setVector(store->position, change(), position);
+}
+
+void RigidBodyView::setPosition(const real x, const real y, const real z)
+{
+    setVector(store->position, change(), Vector3(x, y, z));
+}
+
+Vector3 RigidBodyView::getPosition() const
+{
+    return getVector(store->position, index());
+}
+
+void RigidBodyView::setOrientation(const Quaternion &orientation)
+{
+    Quaternion q = orientation;
+    q.normalise();
+    setQuaternion(store->orientation, change(), q);
+}
+
+void RigidBodyView::setOrientation(const real r, const real i,
+                                   const real j, const real k)
+{
+    setOrientation(Quaternion(r, i, j, k));
+}
+
+Quaternion RigidBodyView::getOrientation() const
+{
+    return getQuaternion(store->orientation, index());
+}
+
+Matrix4 RigidBodyView::getTransform() const
+{
+    return getMatrix<Matrix4, 12>(store->transformMatrix, index());
+}
+
+void RigidBodyView::getGLTransform(float matrix[16]) const
+{
+    getTransform().fillGLArray(matrix);
+}
+
+Vector3 RigidBodyView::getPointInLocalSpace(const Vector3 &point) const
+{
+    return getTransform().transformInverse(point);
+}
+
+Vector3 RigidBodyView::getPointInWorldSpace(const Vector3 &point) const
+{
+    return getTransform().transform(point);
+}
+
+Vector3 RigidBodyView::getDirectionInLocalSpace(
+    const Vector3 &direction) const
+{
+    return getTransform().transformInverseDirection(direction);
+}
+
+Vector3 RigidBodyView::getDirectionInWorldSpace(
+    const Vector3 &direction) const
+{
+    return getTransform().transformDirection(direction);
+}
+
+void RigidBodyView::setVelocity(const Vector3 &velocity)
+{
+    setVector(store->velocity, change(), velocity);
+}
+
+void RigidBodyView::setVelocity(const real x, const real y, const real z)
+{
+    setVector(store->velocity, change(), Vector3(x, y, z));
+}
+
+Vector3 RigidBodyView::getVelocity() const
+{
+    return getVector(store->velocity, index());
+}
+
+void RigidBodyView::addVelocity(const Vector3 &deltaVelocity)
+{
+    setVelocity(getVelocity() + deltaVelocity);
+}
+
+void RigidBodyView::setRotation(const Vector3 &rotation)
+{
+    setVector(store->rotation, change(), rotation);
+}
+
+void RigidBodyView::setRotation(const real x, const real y, const real z)
+{
+    setVector(store->rotation, change(), Vector3(x, y, z));
+}
+
+Vector3 RigidBodyView::getRotation() const
+{
+    return getVector(store->rotation, index());
+}
+
+void RigidBodyView::addRotation(const Vector3 &deltaRotation)
+{
+    setRotation(getRotation() + deltaRotation);
+}
+
+bool RigidBodyView::getAwake() const
+{
+    return store->isAwake[index()] != 0;
+}
+
+real RigidBodyView::getMotion() const
+{
+    return store->motion[index()];
+}
+
+void RigidBodyView::setAwake(const bool awake)
+{
+    unsigned n = change();
+    if (awake) {
+        store->isAwake[n] = true;
+
+        // Add a bit of motion to avoid it falling asleep immediately.
+        store->motion[n] = sleepEpsilon*2.0f;
+    } else {
+        store->isAwake[n] = false;
+        setVector(store->velocity, n, Vector3());
+        setVector(store->rotation, n, Vector3());
+    }
+}
+
+bool RigidBodyView::getCanSleep() const
+{
+    return store->canSleep[index()] != 0;
+}
+
+void RigidBodyView::setCanSleep(const bool canSleep)
+{
+    store->canSleep[change()] = canSleep;
+
+    if (!canSleep && !getAwake()) setAwake();
+}
+
+Vector3 RigidBodyView::getLastFrameAcceleration() const
+{
+    return getVector(store->lastFrameAcceleration, index());
+}
+
+void RigidBodyView::clearAccumulators()
+{
+    unsigned n = index();
+    setVector(store->forceAccum, n, Vector3());
+    setVector(store->torqueAccum, n, Vector3());
+}
+
+void RigidBodyView::addForce(const Vector3 &force)
+{
+    unsigned n = index();
+    setVector(store->forceAccum, n, getVector(store->forceAccum, n) + force);
+    store->isAwake[n] = true;
+}
+
+void RigidBodyView::addForceAtBodyPoint(const Vector3 &force,
+                                        const Vector3 &point)
+{
+    // Convert to coordinates relative to center of mass.
+    Vector3 pt = getPointInWorldSpace(point);
+    addForceAtPoint(force, pt);
+}
+
+void RigidBodyView::addForceAtPoint(const Vector3 &force,
+                                    const Vector3 &point)
+{
+    unsigned n = index();
+
+    // Convert to coordinates relative to center of mass.
+    Vector3 pt = point;
+    pt -= getVector(store->position, n);
+
+    setVector(store->forceAccum, n, getVector(store->forceAccum, n) + force);
+    setVector(store->torqueAccum, n,
+        getVector(store->torqueAccum, n) + (pt % force));
+
+    store->isAwake[n] = true;
+}
+
+void RigidBodyView::addTorque(const Vector3 &torque)
+{
+    unsigned n = index();
+    setVector(store->torqueAccum, n,
+        getVector(store->torqueAccum, n) + torque);
+    store->isAwake[n] = true;
+}
+
+void RigidBodyView::setAcceleration(const Vector3 &acceleration)
+{
+    setVector(store->acceleration, change(), acceleration);
+}
+
+void RigidBodyView::setAcceleration(const real x, const real y, const real z)
+{
+    setVector(store->acceleration, change(), Vector3(x, y, z));
+}
+
+Vector3 RigidBodyView::getAcceleration() const
+{
+    return getVector(store->acceleration, index());
+}
@@ -10,6 +10,7 @@
  * software licence.
  */
 
+#include <algorithm>
 #include <cyclone/collide_coarse.h>
 
 using namespace cyclone;
@@ -74,4 +75,1088 @@ real BoundingSphere::getGrowth(const BoundingSphere &other) const
     // We return a value proportional to the change in surface
     // area of the sphere.
     return newSphere.radius*newSphere.radius - radius*radius;
-}
\ No newline at end of file
+}
+BoundingBox::BoundingBox(const Vector3 &lower, const Vector3 &upper)
+{
+    BoundingBox::lower = lower;
+    BoundingBox::upper = upper;
+}
+
+BoundingBox::BoundingBox(const BoundingBox &one, const BoundingBox &two)
+{
+#ifdef CYCLONE_USE_SSE
+    lower.setLanes(simd::min(one.lower.lanes(), two.lower.lanes()));
+    upper.setLanes(simd::max(one.upper.lanes(), two.upper.lanes()));
+#else
+    lower.x = std::min(one.lower.x, two.lower.x);
+    lower.y = std::min(one.lower.y, two.lower.y);
+    lower.z = std::min(one.lower.z, two.lower.z);
+    upper.x = std::max(one.upper.x, two.upper.x);
+    upper.y = std::max(one.upper.y, two.upper.y);
+    upper.z = std::max(one.upper.z, two.upper.z);
+#endif
+}
+
+BoundingBox::BoundingBox(const Vector3 &halfSize, const Matrix4 &transform)
+{
+    // Each axis of the world box reaches as far as the box's three
+    // half-sizes, projected onto it, put together.
+    Vector3 extent;
+    for (unsigned i = 0; i < 3; i++)
+    {
+        extent[i] =
+            real_abs(transform.data[i*4]) * halfSize.x +
+            real_abs(transform.data[i*4+1]) * halfSize.y +
+            real_abs(transform.data[i*4+2]) * halfSize.z;
+    }
+
+    Vector3 centre = transform.getAxisVector(3);
+    lower = centre - extent;
+    upper = centre + extent;
+}
+
+bool BoundingBox::overlaps(const BoundingBox *other) const
+{
+#ifdef CYCLONE_USE_SSE
+    // Compare the x, y and z lanes of both pairs of corners at once.
+    int mask =
+        simd::lessEqual(lower.lanes(), other->upper.lanes()) &
+        simd::lessEqual(other->lower.lanes(), upper.lanes());
+    return (mask & 7) == 7;
+#else
+    return lower.x <= other->upper.x && other->lower.x <= upper.x &&
+        lower.y <= other->upper.y && other->lower.y <= upper.y &&
+        lower.z <= other->upper.z && other->lower.z <= upper.z;
+#endif
+}
+
+bool BoundingBox::contains(const BoundingBox &other) const
+{
+    return lower.x <= other.lower.x && other.upper.x <= upper.x &&
+        lower.y <= other.lower.y && other.upper.y <= upper.y &&
+        lower.z <= other.lower.z && other.upper.z <= upper.z;
+}
+
+const unsigned AABBTree::NULL_NODE = 0xffffffff;
+
+AABBTree::AABBTree(real margin)
+:
+root(NULL_NODE), freeList(NULL_NODE), proxyCount(0), margin(margin),
+taskLimit(0)
+{
+}
+
+unsigned AABBTree::allocateNode()
+{
+    // Grow the array if there are no free nodes. The new nodes are
+    // put on the free list, last first, so they are used in order.
+    if (freeList == NULL_NODE)
+    {
+        unsigned oldSize = (unsigned)nodes.size();
+        unsigned newSize = oldSize ? oldSize * 2 : 16;
+        nodes.resize(newSize);
+        for (unsigned i = newSize; i > oldSize; i--)
+        {
+            freeNode(i - 1);
+        }
+    }
+
+    unsigned index = freeList;
+    Node &node = nodes[index];
+    freeList = node.parent;
+    node.parent = NULL_NODE;
+    node.children[0] = node.children[1] = NULL_NODE;
+    node.body = NULL;
+    node.height = 0;
+    node.stale = false;
+    node.awakeSlot = NULL_NODE;
+    return index;
+}
+
+void AABBTree::freeNode(unsigned index)
+{
+    Node &node = nodes[index];
+    node.parent = freeList;
+    node.height = -1;
+    freeList = index;
+}
+
+BoundingBox AABBTree::fatten(const BoundingBox &box,
+                             const Vector3 &displacement) const
+{
+    Vector3 extra(margin, margin, margin);
+    BoundingBox fat(box.lower - extra, box.upper + extra);
+
+    // Stretch the box along the direction of movement, so a body
+    // moving steadily doesn't leave its box every frame.
+    Vector3 stretch = displacement * 2;
+    for (unsigned i = 0; i < 3; i++)
+    {
+        if (stretch[i] < 0) fat.lower[i] += stretch[i];
+        else fat.upper[i] += stretch[i];
+    }
+    return fat;
+}
+
+unsigned AABBTree::createProxy(const BoundingBox &box, RigidBody *body)
+{
+    unsigned proxy = allocateNode();
+    nodes[proxy].box = fatten(box, Vector3());
+    nodes[proxy].body = body;
+    insertLeaf(proxy);
+    proxyCount++;
+    if (body && body->getAwake()) setProxyAwake(proxy);
+    return proxy;
+}
+
+void AABBTree::destroyProxy(unsigned proxy)
+{
+    setProxyAwake(proxy, false);
+    removeLeaf(proxy);
+    freeNode(proxy);
+    proxyCount--;
+}
+
+bool AABBTree::moveProxy(unsigned proxy, const BoundingBox &box,
+                         const Vector3 &displacement)
+{
+    if (nodes[proxy].box.contains(box)) return false;
+
+    removeLeaf(proxy);
+    nodes[proxy].box = fatten(box, displacement);
+    insertLeaf(proxy);
+    return true;
+}
+
+void AABBTree::insertLeaf(unsigned leaf)
+{
+    if (root == NULL_NODE)
+    {
+        root = leaf;
+        nodes[root].parent = NULL_NODE;
+        return;
+    }
+
+    // Go down the tree to find the best sibling for the leaf. At each
+    // node, the leaf can either be paired with the node, or sent on
+    // to one of its children. Pairing makes a new parent around both,
+    // and either way every node above grows to hold the leaf.
+    BoundingBox leafBox = nodes[leaf].box;
+    unsigned index = root;
+    while (!nodes[index].isLeaf())
+    {
+        const Node &node = nodes[index];
+        real area = node.box.getSurfaceArea();
+        real combinedArea = BoundingBox(node.box, leafBox).getSurfaceArea();
+
+        // The cost of pairing the leaf with this node.
+        real cost = 2 * combinedArea;
+
+        // The cost this node adds to going further down.
+        real inheritedCost = 2 * (combinedArea - area);
+
+        real childCost[2];
+        for (unsigned i = 0; i < 2; i++)
+        {
+            const Node &child = nodes[node.children[i]];
+            real grownArea = BoundingBox(child.box, leafBox).getSurfaceArea();
+            if (child.isLeaf())
+            {
+                childCost[i] = grownArea + inheritedCost;
+            }
+            else
+            {
+                childCost[i] = grownArea - child.box.getSurfaceArea() +
+                    inheritedCost;
+            }
+        }
+
+        if (cost < childCost[0] && cost < childCost[1]) break;
+        index = node.children[childCost[0] < childCost[1] ? 0 : 1];
+    }
+    unsigned sibling = index;
+
+    // Make a new parent for the sibling and the leaf.
+    unsigned newParent = allocateNode();
+    unsigned oldParent = nodes[sibling].parent;
+    Node &parent = nodes[newParent];
+    parent.parent = oldParent;
+    parent.box = BoundingBox(nodes[sibling].box, leafBox);
+    parent.height = nodes[sibling].height + 1;
+    parent.stale = nodes[sibling].stale;
+    parent.children[0] = sibling;
+    parent.children[1] = leaf;
+    nodes[sibling].parent = newParent;
+    nodes[leaf].parent = newParent;
+
+    if (oldParent == NULL_NODE)
+    {
+        root = newParent;
+    }
+    else
+    {
+        Node &old = nodes[oldParent];
+        old.children[old.children[0] == sibling ? 0 : 1] = newParent;
+    }
+
+    refitUpwards(oldParent);
+}
+
+void AABBTree::removeLeaf(unsigned leaf)
+{
+    if (leaf == root)
+    {
+        root = NULL_NODE;
+        return;
+    }
+
+    // The leaf's sibling takes the place of their parent.
+    unsigned parent = nodes[leaf].parent;
+    unsigned grandParent = nodes[parent].parent;
+    const Node &parentNode = nodes[parent];
+    unsigned sibling = parentNode.children[parentNode.children[0] == leaf];
+
+    nodes[sibling].parent = grandParent;
+    if (grandParent == NULL_NODE)
+    {
+        root = sibling;
+    }
+    else
+    {
+        Node &grand = nodes[grandParent];
+        grand.children[grand.children[0] == parent ? 0 : 1] = sibling;
+    }
+    freeNode(parent);
+
+    refitUpwards(grandParent);
+}
+
+void AABBTree::refitUpwards(unsigned index)
+{
+    while (index != NULL_NODE)
+    {
+        index = balance(index);
+
+        Node &node = nodes[index];
+        const Node &one = nodes[node.children[0]];
+        const Node &two = nodes[node.children[1]];
+        node.height = 1 + std::max(one.height, two.height);
+        node.box = BoundingBox(one.box, two.box);
+        node.stale = one.stale || two.stale;
+
+        index = node.parent;
+    }
+}
+
+unsigned AABBTree::balance(unsigned index)
+{
+    Node &a = nodes[index];
+    if (a.isLeaf() || a.height < 2) return index;
+
+    // Find the taller child, if it is too tall.
+    int difference = nodes[a.children[1]].height -
+        nodes[a.children[0]].height;
+    if (difference >= -1 && difference <= 1) return index;
+    unsigned side = difference > 0 ? 1 : 0;
+
+    unsigned up = a.children[side];
+    unsigned other = a.children[1 - side];
+    Node &b = nodes[up];
+
+    // The taller child takes this node's place, with this node as
+    // its first child.
+    b.parent = a.parent;
+    a.parent = up;
+    if (b.parent == NULL_NODE)
+    {
+        root = up;
+    }
+    else
+    {
+        Node &parent = nodes[b.parent];
+        parent.children[parent.children[0] == index ? 0 : 1] = up;
+    }
+
+    // Of the taller child's children, the taller one stays with it,
+    // and the shorter one comes down to this node.
+    unsigned keep = b.children[0];
+    unsigned give = b.children[1];
+    if (nodes[give].height > nodes[keep].height) std::swap(keep, give);
+
+    b.children[0] = index;
+    b.children[1] = keep;
+    a.children[side] = give;
+    nodes[give].parent = index;
+
+    const Node &otherNode = nodes[other];
+    const Node &giveNode = nodes[give];
+    const Node &keepNode = nodes[keep];
+    a.box = BoundingBox(otherNode.box, giveNode.box);
+    a.height = 1 + std::max(otherNode.height, giveNode.height);
+    a.stale = otherNode.stale || giveNode.stale;
+    b.box = BoundingBox(a.box, keepNode.box);
+    b.height = 1 + std::max(a.height, keepNode.height);
+    b.stale = a.stale || keepNode.stale;
+
+    return up;
+}
+
+bool AABBTree::refitProxy(unsigned proxy, const BoundingBox &box,
+                          const Vector3 &displacement)
+{
+    if (nodes[proxy].box.contains(box)) return false;
+    nodes[proxy].box = fatten(box, displacement);
+
+    // Mark the nodes above as stale, stopping at the first that
+    // already is, since those above it are too.
+    unsigned index = nodes[proxy].parent;
+    while (index != NULL_NODE && !nodes[index].stale)
+    {
+        nodes[index].stale = true;
+        index = nodes[index].parent;
+    }
+    return true;
+}
+
+void AABBTree::refitNode(unsigned index)
+{
+    Node &node = nodes[index];
+    for (unsigned i = 0; i < 2; i++)
+    {
+        if (nodes[node.children[i]].stale) refitNode(node.children[i]);
+    }
+    node.box = BoundingBox(nodes[node.children[0]].box,
+                           nodes[node.children[1]].box);
+    node.stale = false;
+}
+
+void AABBTree::refit()
+{
+    if (root != NULL_NODE && nodes[root].stale) refitNode(root);
+}
+
+void AABBTree::setProxyAwake(unsigned proxy, bool awake)
+{
+    Node &node = nodes[proxy];
+    if (awake == (node.awakeSlot != NULL_NODE)) return;
+
+    if (awake)
+    {
+        if (!node.body) return;
+        node.awakeSlot = (unsigned)awakeProxies.size();
+        awakeProxies.push_back(proxy);
+    }
+    else
+    {
+        // Move the last proxy in the list into this one's place.
+        unsigned last = awakeProxies.back();
+        awakeProxies[node.awakeSlot] = last;
+        nodes[last].awakeSlot = node.awakeSlot;
+        awakeProxies.pop_back();
+        node.awakeSlot = NULL_NODE;
+    }
+}
+
+unsigned AABBTree::refitAwake(BoxFunction getBox, void *data)
+{
+    unsigned refitted = 0;
+    unsigned slot = 0;
+    while (slot < awakeProxies.size())
+    {
+        unsigned index = awakeProxies[slot];
+        RigidBody *body = nodes[index].body;
+        if (refitProxy(index, getBox(body, data))) refitted++;
+
+        // A body that has fallen asleep has moved for the last time,
+        // so it leaves the list. Another proxy takes its slot.
+        if (!body->getAwake()) setProxyAwake(index, false);
+        else slot++;
+    }
+    refit();
+    return refitted;
+}
+
+unsigned AABBTree::query(const BoundingBox &box, unsigned *proxies,
+                         unsigned limit) const
+{
+    if (root == NULL_NODE || limit == 0) return 0;
+
+    // The stack never holds more than one node for each level of
+    // the tree, plus one, so it only needs the heap for tall trees.
+    unsigned fixedStack[STACK_HEIGHT + 1];
+    std::vector<unsigned> heapStack;
+    unsigned *stack = fixedStack;
+    if (getHeight() > STACK_HEIGHT)
+    {
+        heapStack.resize(getHeight() + 1);
+        stack = &heapStack[0];
+    }
+
+    unsigned count = 0, size = 0;
+    stack[size++] = root;
+    while (size > 0)
+    {
+        unsigned index = stack[--size];
+        const Node &node = nodes[index];
+
+        if (!node.box.overlaps(&box)) continue;
+        if (node.isLeaf())
+        {
+            proxies[count++] = index;
+            if (count == limit) break;
+        }
+        else
+        {
+            stack[size++] = node.children[1];
+            stack[size++] = node.children[0];
+        }
+    }
+    return count;
+}
+
+unsigned AABBTree::walkPairs(unsigned *stack, unsigned &size,
+                             PotentialContact *contacts,
+                             unsigned limit) const
+{
+    if (limit == 0) return 0;
+
+    // Walk the tree comparing pairs of nodes. A node paired with
+    // itself stands for the pairs within it: those within each child,
+    // and those between the two children. Two different nodes stand
+    // for the pairs between them, which only exist if they overlap.
+    unsigned count = 0;
+    while (size > 0)
+    {
+        unsigned indexB = stack[--size];
+        unsigned indexA = stack[--size];
+        const Node &a = nodes[indexA];
+        const Node &b = nodes[indexB];
+
+        if (indexA == indexB)
+        {
+            if (a.isLeaf()) continue;
+            stack[size++] = a.children[0];
+            stack[size++] = a.children[1];
+            stack[size++] = a.children[1];
+            stack[size++] = a.children[1];
+            stack[size++] = a.children[0];
+            stack[size++] = a.children[0];
+            continue;
+        }
+
+        if (!a.box.overlaps(&b.box)) continue;
+
+        if (a.isLeaf() && b.isLeaf())
+        {
+            contacts[count].body[0] = a.body;
+            contacts[count].body[1] = b.body;
+            if (++count == limit) break;
+            continue;
+        }
+
+        // Descend into the larger of the two nodes, unless it is a
+        // leaf.
+        if (b.isLeaf() ||
+            (!a.isLeaf() && a.box.getSurfaceArea() >= b.box.getSurfaceArea()))
+        {
+            stack[size++] = a.children[1];
+            stack[size++] = indexB;
+            stack[size++] = a.children[0];
+            stack[size++] = indexB;
+        }
+        else
+        {
+            stack[size++] = indexA;
+            stack[size++] = b.children[1];
+            stack[size++] = indexA;
+            stack[size++] = b.children[0];
+        }
+    }
+    return count;
+}
+
+unsigned AABBTree::getPotentialContacts(PotentialContact *contacts,
+                                        unsigned limit) const
+{
+    if (root == NULL_NODE) return 0;
+
+    // Keep the stack off the heap unless the tree is very tall.
+    unsigned fixedStack[4 * STACK_HEIGHT + 2];
+    std::vector<unsigned> heapStack;
+    unsigned *stack = fixedStack;
+    if (getHeight() > STACK_HEIGHT)
+    {
+        heapStack.resize(4 * getHeight() + 2);
+        stack = &heapStack[0];
+    }
+
+    unsigned size = 0;
+    stack[size++] = root;
+    stack[size++] = root;
+    return walkPairs(stack, size, contacts, limit);
+}
+
+void AABBTree::splitPairs(unsigned indexA, unsigned indexB, unsigned depth)
+{
+    // This splits the pairs in the order walkPairs visits them, so
+    // the tasks' results, put one after another, come out in the
+    // order walkPairs gives.
+    const Node &a = nodes[indexA];
+    const Node &b = nodes[indexB];
+    if (indexA == indexB)
+    {
+        if (a.isLeaf()) return;
+    }
+    else if (!a.box.overlaps(&b.box)) return;
+
+    if (depth == 0 || (a.isLeaf() && b.isLeaf()))
+    {
+        taskNodes.push_back(indexA);
+        taskNodes.push_back(indexB);
+        return;
+    }
+
+    if (indexA == indexB)
+    {
+        splitPairs(a.children[0], a.children[0], depth-1);
+        splitPairs(a.children[1], a.children[1], depth-1);
+        splitPairs(a.children[0], a.children[1], depth-1);
+    }
+    else if (b.isLeaf() ||
+        (!a.isLeaf() && a.box.getSurfaceArea() >= b.box.getSurfaceArea()))
+    {
+        splitPairs(a.children[0], indexB, depth-1);
+        splitPairs(a.children[1], indexB, depth-1);
+    }
+    else
+    {
+        splitPairs(indexA, b.children[0], depth-1);
+        splitPairs(indexA, b.children[1], depth-1);
+    }
+}
+
+void AABBTree::pairTask(unsigned index, unsigned worker, void *data)
+{
+    AABBTree *tree = (AABBTree*)data;
+    unsigned *stack = &tree->workerStacks[worker][0];
+    std::vector<PotentialContact> &buffer = tree->taskContacts[index];
+    unsigned size = 0;
+    stack[size++] = tree->taskNodes[index*2];
+    stack[size++] = tree->taskNodes[index*2+1];
+
+    // Walk into the buffer, doubling it whenever it fills, until the
+    // walk is done or has found as many pairs as could be used.
+    if (buffer.size() < 16) buffer.resize(16);
+    unsigned count = 0;
+    for (;;)
+    {
+        unsigned room = std::min((unsigned)buffer.size(), tree->taskLimit);
+        count += tree->walkPairs(stack, size, &buffer[count], room - count);
+        if (size == 0 || count == tree->taskLimit) break;
+        buffer.resize(buffer.size() * 2);
+    }
+    tree->taskCounts[index] = count;
+}
+
+unsigned AABBTree::getPotentialContacts(PotentialContact *contacts,
+                                        unsigned limit,
+                                        ThreadPool *pool,
+                                        unsigned splitDepth)
+{
+    if (!pool || pool->getWorkerCount() == 1)
+    {
+        return getPotentialContacts(contacts, limit);
+    }
+    if (root == NULL_NODE || limit == 0) return 0;
+
+    taskNodes.clear();
+    splitPairs(root, root, splitDepth);
+    unsigned tasks = (unsigned)taskNodes.size() / 2;
+    if (taskContacts.size() < tasks) taskContacts.resize(tasks);
+    taskCounts.resize(tasks);
+    workerStacks.resize(pool->getWorkerCount());
+    for (unsigned i = 0; i < workerStacks.size(); i++)
+    {
+        workerStacks[i].resize(4 * getHeight() + 2);
+    }
+    taskLimit = limit;
+    pool->run(tasks, pairTask, this);
+
+    // Put the results together in task order.
+    unsigned count = 0;
+    for (unsigned task = 0; task < tasks && count < limit; task++)
+    {
+        unsigned taken = std::min(taskCounts[task], limit - count);
+        std::copy(taskContacts[task].begin(),
+                  taskContacts[task].begin() + taken,
+                  contacts + count);
+        count += taken;
+    }
+    return count;
+}
+
+const unsigned SweepAndPrune::NULL_PROXY = 0xffffffff;
+
+SweepAndPrune::SweepAndPrune()
+:
+freeList(NULL_PROXY), proxyCount(0), callback(NULL)
+{
+}
+
+void SweepAndPrune::setCallback(PairCallback *callback)
+{
+    SweepAndPrune::callback = callback;
+}
+
+void SweepAndPrune::addPair(unsigned one, unsigned two)
+{
+    if (one > two) std::swap(one, two);
+    if (!proxies[one].box.overlaps(&proxies[two].box)) return;
+
+    Pair pair(one, two);
+    std::vector<Pair>::iterator place =
+        std::lower_bound(pairs.begin(), pairs.end(), pair);
+    if (place != pairs.end() && *place == pair) return;
+    pairs.insert(place, pair);
+
+    if (callback)
+    {
+        callback->addPair(proxies[one].body, proxies[two].body);
+    }
+}
+
+void SweepAndPrune::removePair(unsigned one, unsigned two, unsigned axis)
+{
+    // A pair can only be held while the proxies' ends are in
+    // overlapping order on the other two axes, which is much cheaper
+    // to check than looking it up.
+    for (unsigned other = 0; other < 3; other++)
+    {
+        if (other == axis) continue;
+        const unsigned *endsOne = proxies[one].endpoints[other];
+        const unsigned *endsTwo = proxies[two].endpoints[other];
+        if (endsOne[0] > endsTwo[1] || endsTwo[0] > endsOne[1]) return;
+    }
+
+    if (one > two) std::swap(one, two);
+    Pair pair(one, two);
+    std::vector<Pair>::iterator place =
+        std::lower_bound(pairs.begin(), pairs.end(), pair);
+    if (place == pairs.end() || *place != pair) return;
+    pairs.erase(place);
+
+    if (callback)
+    {
+        callback->removePair(proxies[one].body, proxies[two].body);
+    }
+}
+
+void SweepAndPrune::sortDown(unsigned axis, unsigned index)
+{
+    std::vector<Endpoint> &list = endpoints[axis];
+    Endpoint end = list[index];
+    unsigned proxy = end.getProxy();
+
+    while (index > 0 && end.isBefore(list[index-1]))
+    {
+        const Endpoint &below = list[index-1];
+        unsigned other = below.getProxy();
+
+        // A lower end passing down over an upper end may start an
+        // overlap; an upper end passing down over a lower end ends
+        // one.
+        if (other != proxy)
+        {
+            if (!end.isUpper() && below.isUpper()) addPair(proxy, other);
+            else if (end.isUpper() && !below.isUpper())
+            {
+                removePair(proxy, other, axis);
+            }
+        }
+
+        list[index] = below;
+        proxies[other].endpoints[axis][below.isUpper()] = index;
+        index--;
+    }
+
+    list[index] = end;
+    proxies[proxy].endpoints[axis][end.isUpper()] = index;
+}
+
+void SweepAndPrune::sortUp(unsigned axis, unsigned index)
+{
+    std::vector<Endpoint> &list = endpoints[axis];
+    Endpoint end = list[index];
+    unsigned proxy = end.getProxy();
+    unsigned last = (unsigned)list.size() - 1;
+
+    while (index < last && list[index+1].isBefore(end))
+    {
+        const Endpoint &above = list[index+1];
+        unsigned other = above.getProxy();
+
+        // An upper end passing up over a lower end may start an
+        // overlap; a lower end passing up over an upper end ends one.
+        if (other != proxy)
+        {
+            if (end.isUpper() && !above.isUpper()) addPair(proxy, other);
+            else if (!end.isUpper() && above.isUpper())
+            {
+                removePair(proxy, other, axis);
+            }
+        }
+
+        list[index] = above;
+        proxies[other].endpoints[axis][above.isUpper()] = index;
+        index++;
+    }
+
+    list[index] = end;
+    proxies[proxy].endpoints[axis][end.isUpper()] = index;
+}
+
+void SweepAndPrune::sortProxy(unsigned proxy)
+{
+    // Pairs are only added when the new boxes overlap on every axis,
+    // so the axes can be sorted one after another. On each axis, the
+    // end that moves away from the other goes first, so the ends of
+    // one box never pass each other.
+    for (unsigned axis = 0; axis < 3; axis++)
+    {
+        const unsigned *ends = proxies[proxy].endpoints[axis];
+        sortDown(axis, ends[0]);
+        sortUp(axis, ends[1]);
+        sortUp(axis, ends[0]);
+        sortDown(axis, ends[1]);
+    }
+}
+
+unsigned SweepAndPrune::createProxy(const BoundingBox &box, RigidBody *body)
+{
+    unsigned proxy = freeList;
+    if (proxy == NULL_PROXY)
+    {
+        proxy = (unsigned)proxies.size();
+        proxies.push_back(Proxy());
+    }
+    else
+    {
+        freeList = proxies[proxy].endpoints[0][0];
+    }
+
+    Proxy &newProxy = proxies[proxy];
+    newProxy.box = box;
+    newProxy.body = body;
+    newProxy.inUse = true;
+    proxyCount++;
+
+    // Put the ends straight into their places in each list, and
+    // renumber those above them.
+    for (unsigned axis = 0; axis < 3; axis++)
+    {
+        std::vector<Endpoint> &list = endpoints[axis];
+        unsigned first = NULL_PROXY;
+        for (unsigned upper = 0; upper < 2; upper++)
+        {
+            Endpoint end;
+            end.value = upper ? box.upper[axis] : box.lower[axis];
+            end.data = (proxy << 1) | upper;
+
+            std::vector<Endpoint>::iterator place =
+                std::lower_bound(list.begin(), list.end(), end,
+                                 Endpoint::compare);
+            unsigned index = (unsigned)(place - list.begin());
+            list.insert(place, end);
+            if (index < first) first = index;
+        }
+        for (unsigned index = first; index < list.size(); index++)
+        {
+            const Endpoint &end = list[index];
+            proxies[end.getProxy()].endpoints[axis][end.isUpper()] = index;
+        }
+    }
+
+    // Any proxy overlapping the new one has its lower end below the
+    // new upper end, and its upper end above the new lower end.
+    const unsigned *ends = newProxy.endpoints[0];
+    const std::vector<Endpoint> &list = endpoints[0];
+    for (unsigned index = 0; index < ends[1]; index++)
+    {
+        const Endpoint &end = list[index];
+        unsigned other = end.getProxy();
+        if (end.isUpper() || other == proxy) continue;
+        if (proxies[other].endpoints[0][1] > ends[0]) addPair(proxy, other);
+    }
+    return proxy;
+}
+
+void SweepAndPrune::destroyProxy(unsigned proxy)
+{
+    // Remove the proxy's pairs, closing up the rest in one pass.
+    unsigned kept = 0;
+    for (unsigned i = 0; i < pairs.size(); i++)
+    {
+        const Pair &pair = pairs[i];
+        if (pair.first == proxy || pair.second == proxy)
+        {
+            if (callback)
+            {
+                callback->removePair(proxies[pair.first].body,
+                                     proxies[pair.second].body);
+            }
+        }
+        else pairs[kept++] = pair;
+    }
+    pairs.resize(kept);
+
+    // Take its ends out of each list, and renumber those above.
+    for (unsigned axis = 0; axis < 3; axis++)
+    {
+        std::vector<Endpoint> &list = endpoints[axis];
+        unsigned lower = proxies[proxy].endpoints[axis][0];
+        unsigned upper = proxies[proxy].endpoints[axis][1];
+        list.erase(list.begin() + upper);
+        list.erase(list.begin() + lower);
+
+        for (unsigned index = lower; index < list.size(); index++)
+        {
+            const Endpoint &end = list[index];
+            proxies[end.getProxy()].endpoints[axis][end.isUpper()] = index;
+        }
+    }
+
+    Proxy &oldProxy = proxies[proxy];
+    oldProxy.body = NULL;
+    oldProxy.inUse = false;
+    oldProxy.endpoints[0][0] = freeList;
+    freeList = proxy;
+    proxyCount--;
+}
+
+void SweepAndPrune::moveProxy(unsigned proxy, const BoundingBox &box)
+{
+    Proxy &moved = proxies[proxy];
+    moved.box = box;
+    for (unsigned axis = 0; axis < 3; axis++)
+    {
+        endpoints[axis][moved.endpoints[axis][0]].value = box.lower[axis];
+        endpoints[axis][moved.endpoints[axis][1]].value = box.upper[axis];
+    }
+    sortProxy(proxy);
+}
+
+void SweepAndPrune::updateAwake(AABBTree::BoxFunction getBox, void *data)
+{
+    for (unsigned proxy = 0; proxy < proxies.size(); proxy++)
+    {
+        const Proxy &candidate = proxies[proxy];
+        if (!candidate.inUse || !candidate.body ||
+            !candidate.body->getAwake())
+        {
+            continue;
+        }
+
+        moveProxy(proxy, getBox(candidate.body, data));
+    }
+}
+
+unsigned SweepAndPrune::getPotentialContacts(PotentialContact *contacts,
+                                             unsigned limit) const
+{
+    unsigned count = 0;
+    for (; count < pairs.size() && count < limit; count++)
+    {
+        contacts[count].body[0] = proxies[pairs[count].first].body;
+        contacts[count].body[1] = proxies[pairs[count].second].body;
+    }
+    return count;
+}
+
+SpatialHash::SpatialHash(real cellSize, unsigned maxCells)
+:
+cellSize(cellSize), maxCells(maxCells), bucketMask(0)
+{
+}
+
+void SpatialHash::setCellSize(real cellSize)
+{
+    SpatialHash::cellSize = cellSize;
+}
+
+void SpatialHash::clear()
+{
+    objects.clear();
+    oversize.clear();
+    entries.clear();
+}
+
+unsigned SpatialHash::add(const BoundingBox &box, RigidBody *body)
+{
+    Object object;
+    object.box = box;
+    object.body = body;
+    objects.push_back(object);
+    return (unsigned)objects.size() - 1;
+}
+
+unsigned SpatialHash::getBucket(int x, int y, int z) const
+{
+    // Multiply each coordinate by a large prime, and mix them.
+    return (((unsigned)x * 73856093u) ^
+            ((unsigned)y * 19349663u) ^
+            ((unsigned)z * 83492791u)) & bucketMask;
+}
+
+void SpatialHash::build()
+{
+    // Find the cells each object covers, and count the entries.
+    real inverseSize = ((real)1.0) / cellSize;
+    unsigned entryCount = 0;
+    oversize.clear();
+    for (unsigned index = 0; index < objects.size(); index++)
+    {
+        Object &object = objects[index];
+        real cells = 1;
+        for (unsigned axis = 0; axis < 3; axis++)
+        {
+            object.lower[axis] =
+                (int)real_floor(object.box.lower[axis] * inverseSize);
+            object.upper[axis] =
+                (int)real_floor(object.box.upper[axis] * inverseSize);
+            cells *= (real)(object.upper[axis] - object.lower[axis] + 1);
+        }
+
+        object.oversize = cells > (real)maxCells;
+        if (object.oversize) oversize.push_back(index);
+        else entryCount += (unsigned)cells;
+    }
+
+    // Use at least twice as many buckets as entries, so few cells
+    // share a bucket.
+    unsigned bucketCount = 16;
+    while (bucketCount < entryCount * 2) bucketCount <<= 1;
+    bucketMask = bucketCount - 1;
+    bucketStart.assign(bucketCount + 1, 0);
+    entries.resize(entryCount);
+
+    // Count the entries in each bucket, and add up the counts so each
+    // bucket holds where its entries end.
+    for (unsigned index = 0; index < objects.size(); index++)
+    {
+        const Object &object = objects[index];
+        if (object.oversize) continue;
+
+        for (int x = object.lower[0]; x <= object.upper[0]; x++)
+        for (int y = object.lower[1]; y <= object.upper[1]; y++)
+        for (int z = object.lower[2]; z <= object.upper[2]; z++)
+        {
+            bucketStart[getBucket(x, y, z)]++;
+        }
+    }
+    for (unsigned bucket = 1; bucket < bucketCount; bucket++)
+    {
+        bucketStart[bucket] += bucketStart[bucket-1];
+    }
+    bucketStart[bucketCount] = entryCount;
+
+    // Fill each bucket from its end, last object first, which leaves
+    // each bucket's start in place and its entries in object order.
+    for (unsigned index = (unsigned)objects.size(); index-- > 0; )
+    {
+        const Object &object = objects[index];
+        if (object.oversize) continue;
+
+        for (int x = object.upper[0]; x >= object.lower[0]; x--)
+        for (int y = object.upper[1]; y >= object.lower[1]; y--)
+        for (int z = object.upper[2]; z >= object.lower[2]; z--)
+        {
+            CellEntry &entry = entries[--bucketStart[getBucket(x, y, z)]];
+            entry.cell[0] = x;
+            entry.cell[1] = y;
+            entry.cell[2] = z;
+            entry.object = index;
+        }
+    }
+}
+
+unsigned SpatialHash::getContactsOf(unsigned index,
+                                    PotentialContact *contacts,
+                                    unsigned limit) const
+{
+    const Object &object = objects[index];
+    unsigned count = 0;
+
+    // Objects too big for the grid are checked against every later
+    // object.
+    if (object.oversize)
+    {
+        for (unsigned other = index + 1;
+             other < objects.size() && count < limit; other++)
+        {
+            if (!object.box.overlaps(&objects[other].box)) continue;
+            contacts[count].body[0] = object.body;
+            contacts[count].body[1] = objects[other].body;
+            count++;
+        }
+        return count;
+    }
+
+    for (int x = object.lower[0]; x <= object.upper[0]; x++)
+    for (int y = object.lower[1]; y <= object.upper[1]; y++)
+    for (int z = object.lower[2]; z <= object.upper[2]; z++)
+    {
+        unsigned bucket = getBucket(x, y, z);
+        for (unsigned i = bucketStart[bucket]; i < bucketStart[bucket+1]; i++)
+        {
+            const CellEntry &entry = entries[i];
+            if (entry.object <= index) continue;
+            if (entry.cell[0] != x || entry.cell[1] != y ||
+                entry.cell[2] != z) continue;
+
+            // Two objects can share several cells. The pair is only
+            // written from the lowest cell they share.
+            const Object &other = objects[entry.object];
+            if (std::max(object.lower[0], other.lower[0]) != x ||
+                std::max(object.lower[1], other.lower[1]) != y ||
+                std::max(object.lower[2], other.lower[2]) != z) continue;
+
+            if (!object.box.overlaps(&other.box)) continue;
+            if (count == limit) return count;
+            contacts[count].body[0] = object.body;
+            contacts[count].body[1] = other.body;
+            count++;
+        }
+    }
+
+    // Oversize objects after this one are checked here.
+    std::vector<unsigned>::const_iterator big =
+        std::upper_bound(oversize.begin(), oversize.end(), index);
+    for (; big != oversize.end() && count < limit; ++big)
+    {
+        if (!object.box.overlaps(&objects[*big].box)) continue;
+        contacts[count].body[0] = object.body;
+        contacts[count].body[1] = objects[*big].body;
+        count++;
+    }
+    return count;
+}
+
+unsigned SpatialHash::getPotentialContacts(PotentialContact *contacts,
+                                           unsigned limit) const
+{
+    return getPotentialContacts(contacts, limit, 0,
+                                (unsigned)objects.size());
+}
+
+unsigned SpatialHash::getPotentialContacts(PotentialContact *contacts,
+                                           unsigned limit,
+                                           unsigned first,
+                                           unsigned last) const
+{
+    unsigned count = 0;
+    for (unsigned index = first; index < last && count < limit; index++)
+    {
+        count += getContactsOf(index, contacts + count, limit - count);
+    }
+    return count;
+}
@@ -10,7 +10,10 @@
  * software licence.
  */
 
+#include <algorithm>
 #include <cyclone/collide_fine.h>
+#include <cyclone/convex.h>
+#include <cyclone/trimesh.h>
 #include <memory.h>
 #include <assert.h>
 #include <cstdlib>
@@ -23,6 +26,25 @@ void CollisionPrimitive::calculateInternals()
     transform = body->getTransform() * offset;
 }
 
+Vector3 CollisionConvex::support(const Vector3 &direction) const
+{
+    // Find the furthest vertex in the hull's own coordinates, which
+    // saves transforming every vertex.
+    Vector3 local = transform.transformInverseDirection(direction);
+    unsigned best = 0;
+    real bestDistance = vertices[0] * local;
+    for (unsigned i = 1; i < vertexCount; i++)
+    {
+        real distance = vertices[i] * local;
+        if (distance > bestDistance)
+        {
+            bestDistance = distance;
+            best = i;
+        }
+    }
+    return transform.transform(vertices[best]);
+}
+
 bool IntersectionTests::sphereAndHalfSpace(
     const CollisionSphere &sphere,
     const CollisionPlane &plane)
@@ -139,6 +161,277 @@ bool IntersectionTests::boxAndHalfSpace(
     return boxDistance <= plane.offset;
 }
 
+/*
+ * Returns the value clamped to lie between zero and one.
+ */
+static inline real clampUnit(real value)
+{
+    if (value < 0) return 0;
+    if (value > 1) return 1;
+    return value;
+}
+
+/*
+ * Returns how far along the segment from start to end its point
+ * nearest the given point lies, as a fraction of its length.
+ */
+static inline real nearestOnSegment(
+    const Vector3 &start,
+    const Vector3 &end,
+    const Vector3 &point
+    )
+{
+    Vector3 direction = end - start;
+    real lengthSquared = direction.squareMagnitude();
+    if (lengthSquared <= 0) return 0;
+    return clampUnit(((point - start) * direction) / lengthSquared);
+}
+
+/*
+ * Finds the points of two segments nearest each other, as fractions
+ * along each, and returns the square of the distance between them.
+ * This follows Ericson's Real-Time Collision Detection.
+ */
+static real nearestOnSegments(
+    const Vector3 &startOne, const Vector3 &endOne,
+    const Vector3 &startTwo, const Vector3 &endTwo,
+    real &one, real &two
+    )
+{
+    Vector3 directionOne = endOne - startOne;
+    Vector3 directionTwo = endTwo - startTwo;
+    Vector3 between = startOne - startTwo;
+    real lengthOne = directionOne.squareMagnitude();
+    real lengthTwo = directionTwo.squareMagnitude();
+    real alongTwo = directionTwo * between;
+
+    if (lengthOne <= 0 && lengthTwo <= 0)
+    {
+        // Both are points.
+        one = two = 0;
+    }
+    else if (lengthOne <= 0)
+    {
+        one = 0;
+        two = clampUnit(alongTwo / lengthTwo);
+    }
+    else
+    {
+        real alongOne = directionOne * between;
+        if (lengthTwo <= 0)
+        {
+            two = 0;
+            one = clampUnit(-alongOne / lengthOne);
+        }
+        else
+        {
+            // Find the nearest points of the lines, unless they are
+            // parallel, then clamp each to its segment in turn.
+            real across = directionOne * directionTwo;
+            real denominator = lengthOne*lengthTwo - across*across;
+            one = denominator > 0 ?
+                clampUnit((across*alongTwo - alongOne*lengthTwo) /
+                          denominator) : 0;
+            two = (across*one + alongTwo) / lengthTwo;
+            if (two < 0)
+            {
+                two = 0;
+                one = clampUnit(-alongOne / lengthOne);
+            }
+            else if (two > 1)
+            {
+                two = 1;
+                one = clampUnit((across - alongOne) / lengthOne);
+            }
+        }
+    }
+
+    Vector3 pointOne = startOne + directionOne * one;
+    Vector3 pointTwo = startTwo + directionTwo * two;
+    return (pointOne - pointTwo).squareMagnitude();
+}
+
+/*
+ * Clips the segment between the given points, in a box's own
+ * coordinates, to the slabs of the box with the given half-sizes,
+ * leaving out the slab of the given axis (or none, if it is 3).
+ * Returns false if nothing is left, or else sets the fractions along
+ * the segment where what is left starts and ends.
+ */
+static bool clipSegmentToBox(
+    const Vector3 &start,
+    const Vector3 &end,
+    const Vector3 &halfSize,
+    unsigned skipAxis,
+    real &low,
+    real &high
+    )
+{
+    Vector3 direction = end - start;
+    low = 0;
+    high = 1;
+    for (unsigned i = 0; i < 3; i++)
+    {
+        if (i == skipAxis) continue;
+        if (direction[i] == 0)
+        {
+            if (real_abs(start[i]) > halfSize[i]) return false;
+            continue;
+        }
+
+        real enter = (-halfSize[i] - start[i]) / direction[i];
+        real leave = (halfSize[i] - start[i]) / direction[i];
+        if (enter > leave) std::swap(enter, leave);
+        if (enter > low) low = enter;
+        if (leave < high) high = leave;
+        if (low > high) return false;
+    }
+    return true;
+}
+
+/*
+ * Finds the points of a segment and a box nearest each other, in the
+ * box's own coordinates, for a segment that doesn't pass through the
+ * box. Returns the square of the distance between them, and sets the
+ * fraction along the segment and the point of the box.
+ *
+ * The nearest point of the box is either nearest one end of the
+ * segment, or on one of the box's edges. (If it is inside a face, the
+ * segment is parallel to the face, so an end or an edge does as well.)
+ */
+static real nearestOnSegmentAndBox(
+    const Vector3 &start,
+    const Vector3 &end,
+    const Vector3 &halfSize,
+    real &along,
+    Vector3 &boxPoint
+    )
+{
+    real best = REAL_MAX;
+
+    // Try each end of the segment against the box.
+    for (unsigned i = 0; i < 2; i++)
+    {
+        const Vector3 &point = i ? end : start;
+        Vector3 clamped = point;
+        for (unsigned axis = 0; axis < 3; axis++)
+        {
+            if (clamped[axis] > halfSize[axis]) clamped[axis] = halfSize[axis];
+            if (clamped[axis] < -halfSize[axis]) clamped[axis] = -halfSize[axis];
+        }
+        real distance = (point - clamped).squareMagnitude();
+        if (distance < best)
+        {
+            best = distance;
+            along = (real)i;
+            boxPoint = clamped;
+        }
+    }
+
+    // Then the segment against each of the box's twelve edges.
+    for (unsigned axis = 0; axis < 3; axis++)
+    {
+        unsigned j = (axis + 1) % 3;
+        unsigned k = (axis + 2) % 3;
+        for (unsigned edge = 0; edge < 4; edge++)
+        {
+            Vector3 edgeStart, edgeEnd;
+            edgeStart[axis] = -halfSize[axis];
+            edgeEnd[axis] = halfSize[axis];
+            edgeStart[j] = edgeEnd[j] = (edge & 1) ? -halfSize[j] : halfSize[j];
+            edgeStart[k] = edgeEnd[k] = (edge & 2) ? -halfSize[k] : halfSize[k];
+
+            real onSegment, onEdge;
+            real distance = nearestOnSegments(start, end, edgeStart, edgeEnd,
+                                              onSegment, onEdge);
+            if (distance < best)
+            {
+                best = distance;
+                along = onSegment;
+                boxPoint = edgeStart + (edgeEnd - edgeStart) * onEdge;
+            }
+        }
+    }
+    return best;
+}
+
+bool IntersectionTests::capsuleAndHalfSpace(
+    const CollisionCapsule &capsule,
+    const CollisionPlane &plane
+    )
+{
+    // Check the end further into the half-space.
+    real lowest = plane.direction * capsule.getEnd(0);
+    real other = plane.direction * capsule.getEnd(1);
+    if (other < lowest) lowest = other;
+    return lowest - capsule.radius <= plane.offset;
+}
+
+bool IntersectionTests::capsuleAndSphere(
+    const CollisionCapsule &capsule,
+    const CollisionSphere &sphere
+    )
+{
+    Vector3 start = capsule.getEnd(0);
+    Vector3 end = capsule.getEnd(1);
+    Vector3 centre = sphere.getAxis(3);
+    Vector3 nearest = start + (end - start) * nearestOnSegment(start, end, centre);
+
+    real reach = capsule.radius + sphere.radius;
+    return (nearest - centre).squareMagnitude() <= reach * reach;
+}
+
+bool IntersectionTests::capsuleAndCapsule(
+    const CollisionCapsule &one,
+    const CollisionCapsule &two
+    )
+{
+    real alongOne, alongTwo;
+    real distance = nearestOnSegments(
+        one.getEnd(0), one.getEnd(1), two.getEnd(0), two.getEnd(1),
+        alongOne, alongTwo);
+
+    real reach = one.radius + two.radius;
+    return distance <= reach * reach;
+}
+
+bool IntersectionTests::capsuleAndBox(
+    const CollisionCapsule &capsule,
+    const CollisionBox &box
+    )
+{
+    // Work in the box's coordinates.
+    Vector3 start = box.transform.transformInverse(capsule.getEnd(0));
+    Vector3 end = box.transform.transformInverse(capsule.getEnd(1));
+
+    real low, high;
+    if (clipSegmentToBox(start, end, box.halfSize, 3, low, high)) return true;
+
+    real along;
+    Vector3 boxPoint;
+    real distance = nearestOnSegmentAndBox(start, end, box.halfSize,
+                                           along, boxPoint);
+    return distance <= capsule.radius * capsule.radius;
+}
+
+bool IntersectionTests::convexAndHalfSpace(
+    const CollisionConvex &convex,
+    const CollisionPlane &plane
+    )
+{
+    // Check the vertex furthest into the half-space.
+    Vector3 deepest = convex.support(plane.direction * -1);
+    return deepest * plane.direction <= plane.offset;
+}
+
+bool IntersectionTests::convexAndConvex(
+    const CollisionConvex &one,
+    const CollisionConvex &two
+    )
+{
+    return ConvexTests::intersect(HullShape(one), HullShape(two));
+}
+
 unsigned CollisionDetector::sphereAndTruePlane(
     const CollisionSphere &sphere,
     const CollisionPlane &plane,
@@ -146,7 +439,7 @@ unsigned CollisionDetector::sphereAndTruePlane(
     )
 {
     // Make sure we have contacts
-    if (data->contactsLeft <= 0) return 0;
+    if (!data->makeRoom(1)) return 0;
 
     // Cache the sphere position
     Vector3 position = sphere.getAxis(3);
@@ -189,7 +482,7 @@ unsigned CollisionDetector::sphereAndHalfSpace(
     )
 {
     // Make sure we have contacts
-    if (data->contactsLeft <= 0) return 0;
+    if (!data->makeRoom(1)) return 0;
 
     // Cache the sphere position
     Vector3 position = sphere.getAxis(3);
@@ -214,6 +507,87 @@ unsigned CollisionDetector::sphereAndHalfSpace(
     return 1;
 }
 
+/**
+ * Does what sphereAndHalfSpace does for the sphere with the given
+ * index, taking its details from the arrays.
+ */
+static unsigned sphereAndHalfSpaceAt(
+    const SphereArrays &spheres,
+    unsigned index,
+    const CollisionPlane &plane,
+    CollisionData *data
+    )
+{
+    if (!data->makeRoom(1)) return 0;
+
+    Vector3 position(spheres.x[index], spheres.y[index], spheres.z[index]);
+    real radius = spheres.radius[index];
+
+    real ballDistance =
+        plane.direction * position -
+        radius - plane.offset;
+
+    if (ballDistance >= 0) return 0;
+
+    Contact* contact = data->contacts;
+    contact->contactNormal = plane.direction;
+    contact->penetration = -ballDistance;
+    contact->contactPoint =
+        position - plane.direction * (ballDistance + radius);
+    contact->setBodyData(spheres.spheres[index]->body, NULL,
+        data->friction, data->restitution);
+
+    data->addContacts(1);
+    return 1;
+}
+
+unsigned CollisionDetector::sphereAndHalfSpaceBatch(
+    const SphereArrays &spheres,
+    unsigned count,
+    const CollisionPlane &plane,
+    CollisionData *data
+    )
+{
+    unsigned found = 0;
+    unsigned index = 0;
+
+#ifdef CYCLONE_USE_SSE
+    // Work out the distances of a register of spheres at once, adding
+    // the terms in the order the scalar product does, and only go on
+    // with those that are in contact.
+    const simd::Lanes zero = simd::splatLanes(0);
+    const simd::Lanes normalX = simd::splatLanes(plane.direction.x);
+    const simd::Lanes normalY = simd::splatLanes(plane.direction.y);
+    const simd::Lanes normalZ = simd::splatLanes(plane.direction.z);
+    const simd::Lanes offset = simd::splatLanes(plane.offset);
+    for (; index + simd::LANES <= count; index += simd::LANES)
+    {
+        simd::Lanes distance = simd::add(simd::add(
+            simd::mul(normalX, simd::loadLanes(spheres.x + index)),
+            simd::mul(normalY, simd::loadLanes(spheres.y + index))),
+            simd::mul(normalZ, simd::loadLanes(spheres.z + index)));
+        distance = simd::sub(simd::sub(distance,
+            simd::loadLanes(spheres.radius + index)), offset);
+
+        int hits = simd::less(distance, zero);
+        for (unsigned lane = 0; hits != 0; lane++, hits >>= 1)
+        {
+            if (!(hits & 1)) continue;
+            if (!data->hasMoreContacts()) return found;
+            found += sphereAndHalfSpaceAt(spheres, index + lane, plane, data);
+        }
+    }
+#endif
+
+    // Test whatever doesn't fill a register one at a time.
+    for (; index < count; index++)
+    {
+        if (!data->hasMoreContacts()) return found;
+        found += sphereAndHalfSpaceAt(spheres, index, plane, data);
+    }
+    return found;
+}
+
 unsigned CollisionDetector::sphereAndSphere(
     const CollisionSphere &one,
     const CollisionSphere &two,
@@ -221,7 +595,7 @@ unsigned CollisionDetector::sphereAndSphere(
     )
 {
     // Make sure we have contacts
-    if (data->contactsLeft <= 0) return 0;
+    if (!data->makeRoom(1)) return 0;
 
     // Cache the sphere positions
     Vector3 positionOne = one.getAxis(3);
@@ -252,6 +626,91 @@ unsigned CollisionDetector::sphereAndSphere(
     return 1;
 }
 
+/**
+ * Does what sphereAndSphere does for the pair of spheres with the
+ * given index, taking their details from the arrays.
+ */
+static unsigned sphereAndSphereAt(
+    const SphereArrays &one,
+    const SphereArrays &two,
+    unsigned index,
+    CollisionData *data
+    )
+{
+    if (!data->makeRoom(1)) return 0;
+
+    Vector3 positionOne(one.x[index], one.y[index], one.z[index]);
+    Vector3 positionTwo(two.x[index], two.y[index], two.z[index]);
+    real radii = one.radius[index] + two.radius[index];
+
+    Vector3 midline = positionOne - positionTwo;
+    real size = midline.magnitude();
+    if (size <= 0.0f || size >= radii)
+    {
+        return 0;
+    }
+
+    Vector3 normal = midline * (((real)1.0)/size);
+
+    Contact* contact = data->contacts;
+    contact->contactNormal = normal;
+    contact->contactPoint = positionOne + midline * (real)0.5;
+    contact->penetration = (radii - size);
+    contact->setBodyData(one.spheres[index]->body,
+        two.spheres[index]->body,
+        data->friction, data->restitution);
+
+    data->addContacts(1);
+    return 1;
+}
+
+unsigned CollisionDetector::sphereAndSphereBatch(
+    const SphereArrays &one,
+    const SphereArrays &two,
+    unsigned count,
+    CollisionData *data
+    )
+{
+    unsigned found = 0;
+    unsigned index = 0;
+
+#ifdef CYCLONE_USE_SSE
+    // Work out the distances of a register of pairs at once, the
+    // same way Vector3::magnitude does, and only go on with those
+    // that are in contact.
+    const simd::Lanes zero = simd::splatLanes(0);
+    for (; index + simd::LANES <= count; index += simd::LANES)
+    {
+        simd::Lanes x = simd::sub(simd::loadLanes(one.x + index),
+                                  simd::loadLanes(two.x + index));
+        simd::Lanes y = simd::sub(simd::loadLanes(one.y + index),
+                                  simd::loadLanes(two.y + index));
+        simd::Lanes z = simd::sub(simd::loadLanes(one.z + index),
+                                  simd::loadLanes(two.z + index));
+        simd::Lanes size = simd::squareRoot(simd::add(
+            simd::add(simd::mul(x, x), simd::mul(y, y)), simd::mul(z, z)));
+        simd::Lanes radii = simd::add(simd::loadLanes(one.radius + index),
+                                      simd::loadLanes(two.radius + index));
+
+        int hits = simd::less(zero, size) & simd::less(size, radii);
+        for (unsigned lane = 0; hits != 0; lane++, hits >>= 1)
+        {
+            if (!(hits & 1)) continue;
+            if (!data->hasMoreContacts()) return found;
+            found += sphereAndSphereAt(one, two, index + lane, data);
+        }
+    }
+#endif
+
+    // Test whatever doesn't fill a register one at a time.
+    for (; index < count; index++)
+    {
+        if (!data->hasMoreContacts()) return found;
+        found += sphereAndSphereAt(one, two, index, data);
+    }
+    return found;
+}
+
 
 
 
@@ -325,25 +784,30 @@ void fillPointFaceBoxBox(
     // We know which axis the collision is on (i.e. best),
     // but we need to work out which of the two faces on
     // this axis.
+    // The feature identifier records the face of box one (its axis and
+    // side) and the vertex of box two (one bit per negated axis).
+    unsigned feature = best*2;
     Vector3 normal = one.getAxis(best);
     if (one.getAxis(best) * toCentre > 0)
     {
         normal = normal * -1.0f;
+        feature++;
     }
 
     // Work out which vertex of box two we're colliding with.
     // Using toCentre doesn't work!
     Vector3 vertex = two.halfSize;
-    if (two.getAxis(0) * normal < 0) vertex.x = -vertex.x;
-    if (two.getAxis(1) * normal < 0) vertex.y = -vertex.y;
-    if (two.getAxis(2) * normal < 0) vertex.z = -vertex.z;
+    feature <<= 3;
+    if (two.getAxis(0) * normal < 0) { vertex.x = -vertex.x; feature |= 1; }
+    if (two.getAxis(1) * normal < 0) { vertex.y = -vertex.y; feature |= 2; }
+    if (two.getAxis(2) * normal < 0) { vertex.z = -vertex.z; feature |= 4; }
 
     // Create the contact data
     contact->contactNormal = normal;
     contact->penetration = pen;
     contact->contactPoint = two.getTransform() * vertex;
     contact->setBodyData(one.body, two.body,
-        data->friction, data->restitution);
+        data->friction, data->restitution, feature);
 }
 
 static inline Vector3 contactPoint(
@@ -401,134 +865,729 @@ static inline Vector3 contactPoint(
     }
 }
 
-// This preprocessor definition is only used as a convenience
-// in the boxAndBox contact generation method.
-#define CHECK_OVERLAP(axis, index) \
-    if (!tryAxis(one, two, (axis), toCentre, (index), pen, best)) return 0;
-
-unsigned CollisionDetector::boxAndBox(
+/**
+ * Fills in the contact for two boxes touching edge to edge, given the
+ * index of the edge axis, as used by boxAndBox.
+ */
+static void fillEdgeEdgeBoxBox(
     const CollisionBox &one,
     const CollisionBox &two,
-    CollisionData *data
+    const Vector3 &toCentre,
+    CollisionData *data,
+    unsigned best,
+    real pen,
+    unsigned bestSingleAxis
     )
 {
-    //if (!IntersectionTests::boxAndBox(one, two)) return 0;
-
-    // Find the vector between the two centres
-    Vector3 toCentre = two.getAxis(3) - one.getAxis(3);
-
-    // We start assuming there is no contact
-    real pen = REAL_MAX;
-    unsigned best = 0xffffff;
+    // We've got an edge-edge contact. Find out which axes
+    best -= 6;
+    unsigned oneAxisIndex = best / 3;
+    unsigned twoAxisIndex = best % 3;
+    Vector3 oneAxis = one.getAxis(oneAxisIndex);
+    Vector3 twoAxis = two.getAxis(twoAxisIndex);
+    Vector3 axis = oneAxis % twoAxis;
+    axis.normalise();
 
-    // Now we check each axes, returning if it gives us
-    // a separating axis, and keeping track of the axis with
-    // the smallest penetration otherwise.
-    CHECK_OVERLAP(one.getAxis(0), 0);
-    CHECK_OVERLAP(one.getAxis(1), 1);
-    CHECK_OVERLAP(one.getAxis(2), 2);
+    // The axis should point from box one to box two.
+    if (axis * toCentre > 0) axis = axis * -1.0f;
+
+    // We have the axes, but not the edges: each axis has 4 edges parallel
+    // to it, we need to find which of the 4 for each object. We do
+    // that by finding the point in the centre of the edge. We know
+    // its component in the direction of the box's collision axis is zero
+    // (its a mid-point) and we determine which of the extremes in each
+    // of the other axes is closest.
+    //
+    // The feature identifier records the pair of axes and which of
+    // the edges were picked, with a high bit to keep it apart from
+    // the point-face identifiers.
+    unsigned feature = 0x400 | (best << 6);
+    Vector3 ptOnOneEdge = one.halfSize;
+    Vector3 ptOnTwoEdge = two.halfSize;
+    for (unsigned i = 0; i < 3; i++)
+    {
+        if (i == oneAxisIndex) ptOnOneEdge[i] = 0;
+        else if (one.getAxis(i) * axis > 0)
+        {
+            ptOnOneEdge[i] = -ptOnOneEdge[i];
+            feature |= 1 << i;
+        }
 
-    CHECK_OVERLAP(two.getAxis(0), 3);
-    CHECK_OVERLAP(two.getAxis(1), 4);
-    CHECK_OVERLAP(two.getAxis(2), 5);
+        if (i == twoAxisIndex) ptOnTwoEdge[i] = 0;
+        else if (two.getAxis(i) * axis < 0)
+        {
+            ptOnTwoEdge[i] = -ptOnTwoEdge[i];
+            feature |= 8 << i;
+        }
+    }
 
-    // Store the best axis-major, in case we run into almost
-    // parallel edge collisions later
-    unsigned bestSingleAxis = best;
+    // Move them into world coordinates (they are already oriented
+    // correctly, since they have been derived from the axes).
+    ptOnOneEdge = one.getTransform() * ptOnOneEdge;
+    ptOnTwoEdge = two.getTransform() * ptOnTwoEdge;
+
+    // So we have a point and a direction for the colliding edges.
+    // We need to find out point of closest approach of the two
+    // line-segments.
+    Vector3 vertex = contactPoint(
+        ptOnOneEdge, oneAxis, one.halfSize[oneAxisIndex],
+        ptOnTwoEdge, twoAxis, two.halfSize[twoAxisIndex],
+        bestSingleAxis > 2
+        );
+
+    // We can fill the contact.
+    Contact* contact = data->contacts;
 
-    CHECK_OVERLAP(one.getAxis(0) % two.getAxis(0), 6);
-    CHECK_OVERLAP(one.getAxis(0) % two.getAxis(1), 7);
-    CHECK_OVERLAP(one.getAxis(0) % two.getAxis(2), 8);
-    CHECK_OVERLAP(one.getAxis(1) % two.getAxis(0), 9);
-    CHECK_OVERLAP(one.getAxis(1) % two.getAxis(1), 10);
-    CHECK_OVERLAP(one.getAxis(1) % two.getAxis(2), 11);
-    CHECK_OVERLAP(one.getAxis(2) % two.getAxis(0), 12);
-    CHECK_OVERLAP(one.getAxis(2) % two.getAxis(1), 13);
-    CHECK_OVERLAP(one.getAxis(2) % two.getAxis(2), 14);
+    contact->penetration = pen;
+    contact->contactNormal = axis;
+    contact->contactPoint = vertex;
+    contact->setBodyData(one.body, two.body,
+        data->friction, data->restitution, feature);
+}
 
-    // Make sure we've got a result.
-    assert(best != 0xffffff);
+#ifdef CYCLONE_USE_SSE
+/**
+ * Holds the most axes of one group, the face axes or the edge axes,
+ * rounded up to whole registers of the widest kind.
+ */
+static const unsigned AXIS_ROOM = 16;
 
-    // We now know there's a collision, and we know which
-    // of the axes gave the smallest penetration. We now
-    // can deal with it in different ways depending on
-    // the case.
-    if (best < 3)
-    {
-        // We've got a vertex of box two on a face of box one.
-        fillPointFaceBoxBox(one, two, toCentre, data, best, pen);
-        data->addContacts(1);
-        return 1;
-    }
-    else if (best < 6)
-    {
-        // We've got a vertex of box one on a face of box two.
-        // We use the same algorithm as above, but swap around
-        // one and two (and therefore also the vector between their
-        // centres).
-        fillPointFaceBoxBox(two, one, toCentre*-1.0f, data, best-3, pen);
-        data->addContacts(1);
-        return 1;
-    }
-    else
+/**
+ * Works out how far the boxes overlap along each of the given axes,
+ * a register of axes at a time, with the same arithmetic tryAxis
+ * uses. Returns a mask with a bit set for each axis too short to be
+ * used, as tryAxis skips them. The arrays must have room for whole
+ * registers, padded with zero length axes.
+ */
+static unsigned overlapOnAxes(
+    const CollisionBox &one,
+    const CollisionBox &two,
+    const Vector3 &toCentre,
+    const real *x, const real *y, const real *z,
+    unsigned count,
+    real *overlap
+    )
+{
+    const simd::Lanes shortest = simd::splatLanes((real)0.0001);
+    const simd::Lanes unit = simd::splatLanes(1);
+    const simd::Lanes centreX = simd::splatLanes(toCentre.x);
+    const simd::Lanes centreY = simd::splatLanes(toCentre.y);
+    const simd::Lanes centreZ = simd::splatLanes(toCentre.z);
+
+    // Each box's axes and half-sizes go in every lane.
+    const CollisionBox *boxes[2] = { &one, &two };
+    simd::Lanes boxAxis[2][3][3], halfSize[2][3];
+    for (unsigned b = 0; b < 2; b++)
     {
-        // We've got an edge-edge contact. Find out which axes
-        best -= 6;
-        unsigned oneAxisIndex = best / 3;
-        unsigned twoAxisIndex = best % 3;
-        Vector3 oneAxis = one.getAxis(oneAxisIndex);
-        Vector3 twoAxis = two.getAxis(twoAxisIndex);
-        Vector3 axis = oneAxis % twoAxis;
-        axis.normalise();
-
-        // The axis should point from box one to box two.
-        if (axis * toCentre > 0) axis = axis * -1.0f;
-
-        // We have the axes, but not the edges: each axis has 4 edges parallel
-        // to it, we need to find which of the 4 for each object. We do
-        // that by finding the point in the centre of the edge. We know
-        // its component in the direction of the box's collision axis is zero
-        // (its a mid-point) and we determine which of the extremes in each
-        // of the other axes is closest.
-        Vector3 ptOnOneEdge = one.halfSize;
-        Vector3 ptOnTwoEdge = two.halfSize;
         for (unsigned i = 0; i < 3; i++)
         {
-            if (i == oneAxisIndex) ptOnOneEdge[i] = 0;
-            else if (one.getAxis(i) * axis > 0) ptOnOneEdge[i] = -ptOnOneEdge[i];
-
-            if (i == twoAxisIndex) ptOnTwoEdge[i] = 0;
-            else if (two.getAxis(i) * axis < 0) ptOnTwoEdge[i] = -ptOnTwoEdge[i];
+            Vector3 axis = boxes[b]->getAxis(i);
+            boxAxis[b][i][0] = simd::splatLanes(axis.x);
+            boxAxis[b][i][1] = simd::splatLanes(axis.y);
+            boxAxis[b][i][2] = simd::splatLanes(axis.z);
+            halfSize[b][i] = simd::splatLanes(boxes[b]->halfSize[i]);
         }
+    }
 
-        // Move them into world coordinates (they are already oriented
-        // correctly, since they have been derived from the axes).
-        ptOnOneEdge = one.transform * ptOnOneEdge;
-        ptOnTwoEdge = two.transform * ptOnTwoEdge;
-
-        // So we have a point and a direction for the colliding edges.
-        // We need to find out point of closest approach of the two
-        // line-segments.
-        Vector3 vertex = contactPoint(
-            ptOnOneEdge, oneAxis, one.halfSize[oneAxisIndex],
-            ptOnTwoEdge, twoAxis, two.halfSize[twoAxisIndex],
-            bestSingleAxis > 2
-            );
+    unsigned skipped = 0;
+    for (unsigned base = 0; base < count; base += simd::LANES)
+    {
+        simd::Lanes ax = simd::loadLanes(x + base);
+        simd::Lanes ay = simd::loadLanes(y + base);
+        simd::Lanes az = simd::loadLanes(z + base);
+
+        // Skip almost parallel axes, and normalise the rest.
+        simd::Lanes length = simd::add(simd::add(
+            simd::mul(ax, ax), simd::mul(ay, ay)), simd::mul(az, az));
+        skipped |= (unsigned)simd::less(length, shortest) << base;
+        simd::Lanes scale = simd::div(unit, simd::squareRoot(length));
+        ax = simd::mul(ax, scale);
+        ay = simd::mul(ay, scale);
+        az = simd::mul(az, scale);
+
+        // Project each box's half-size onto the axes, as
+        // transformToAxis does, and take away the distance between
+        // the centres.
+        simd::Lanes project[2];
+        for (unsigned b = 0; b < 2; b++)
+        {
+            simd::Lanes along[3];
+            for (unsigned i = 0; i < 3; i++)
+            {
+                along[i] = simd::absolute(simd::add(simd::add(
+                    simd::mul(ax, boxAxis[b][i][0]),
+                    simd::mul(ay, boxAxis[b][i][1])),
+                    simd::mul(az, boxAxis[b][i][2])));
+            }
+            project[b] = simd::add(simd::add(
+                simd::mul(halfSize[b][0], along[0]),
+                simd::mul(halfSize[b][1], along[1])),
+                simd::mul(halfSize[b][2], along[2]));
+        }
+        simd::Lanes distance = simd::absolute(simd::add(simd::add(
+            simd::mul(centreX, ax), simd::mul(centreY, ay)),
+            simd::mul(centreZ, az)));
 
-        // We can fill the contact.
-        Contact* contact = data->contacts;
+        simd::storeLanes(overlap + base,
+            simd::sub(simd::add(project[0], project[1]), distance));
+    }
+    return skipped;
+}
 
-        contact->penetration = pen;
-        contact->contactNormal = axis;
-        contact->contactPoint = vertex;
-        contact->setBodyData(one.body, two.body,
-            data->friction, data->restitution);
+/**
+ * Keeps the axis of least overlap, as a run of tryAxis calls starting
+ * at the given index would. Returns false if one of the axes
+ * separates the boxes.
+ */
+static inline bool keepSmallestOverlap(
+    const real *overlap,
+    unsigned skipped,
+    unsigned count,
+    unsigned firstIndex,
+    real &smallestPenetration,
+    unsigned &smallestCase
+    )
+{
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (skipped & (1u << i)) continue;
+        if (overlap[i] < 0) return false;
+        if (overlap[i] < smallestPenetration)
+        {
+            smallestPenetration = overlap[i];
+            smallestCase = firstIndex + i;
+        }
+    }
+    return true;
+}
+
+/**
+ * Does the separating axis test of boxAndBox, working on a register
+ * of axes at a time: first the six face axes, then the nine edge
+ * axes, so that boxes separated along a face axis don't need the
+ * edge axes worked out. Gives the same result as the run of tryAxis
+ * calls. Returns false if the boxes are separated. Otherwise gives
+ * the axis of least penetration, and the face axis of least
+ * penetration.
+ */
+static bool findBoxAndBoxAxis(
+    const CollisionBox &one,
+    const CollisionBox &two,
+    const Vector3 &toCentre,
+    real &pen,
+    unsigned &best,
+    real &singleAxisPen,
+    unsigned &bestSingleAxis
+    )
+{
+    real x[AXIS_ROOM], y[AXIS_ROOM], z[AXIS_ROOM], overlap[AXIS_ROOM];
+    const unsigned faceRoom =
+        (6 + simd::LANES - 1) / simd::LANES * simd::LANES;
+    const unsigned edgeRoom =
+        (9 + simd::LANES - 1) / simd::LANES * simd::LANES;
+
+    // The face axes, padded with zero length axes.
+    for (unsigned i = 0; i < faceRoom; i++)
+    {
+        Vector3 axis;
+        if (i < 3) axis = one.getAxis(i);
+        else if (i < 6) axis = two.getAxis(i-3);
+        x[i] = axis.x;
+        y[i] = axis.y;
+        z[i] = axis.z;
+    }
+    unsigned skipped = overlapOnAxes(one, two, toCentre,
+                                     x, y, z, faceRoom, overlap);
+    if (!keepSmallestOverlap(overlap, skipped, 6, 0, pen, best))
+    {
+        return false;
+    }
+    singleAxisPen = pen;
+    bestSingleAxis = best;
+
+    // And the edge axes.
+    for (unsigned i = 0; i < edgeRoom; i++)
+    {
+        Vector3 axis;
+        if (i < 9) axis = one.getAxis(i / 3) % two.getAxis(i % 3);
+        x[i] = axis.x;
+        y[i] = axis.y;
+        z[i] = axis.z;
+    }
+    skipped = overlapOnAxes(one, two, toCentre,
+                            x, y, z, edgeRoom, overlap);
+    return keepSmallestOverlap(overlap, skipped, 9, 6, pen, best);
+}
+#else
+// This preprocessor definition is only used as a convenience
+// in the box and box separating axis test.
+#define CHECK_OVERLAP(axis, index) \
+    if (!tryAxis(one, two, (axis), toCentre, (index), pen, best)) return false;
+
+/**
+ * Does the separating axis test of boxAndBox, one axis at a time.
+ * Returns false if the boxes are separated. Otherwise gives the axis
+ * of least penetration, and the face axis of least penetration.
+ */
+static bool findBoxAndBoxAxis(
+    const CollisionBox &one,
+    const CollisionBox &two,
+    const Vector3 &toCentre,
+    real &pen,
+    unsigned &best,
+    real &singleAxisPen,
+    unsigned &bestSingleAxis
+    )
+{
+    CHECK_OVERLAP(one.getAxis(0), 0);
+    CHECK_OVERLAP(one.getAxis(1), 1);
+    CHECK_OVERLAP(one.getAxis(2), 2);
+
+    CHECK_OVERLAP(two.getAxis(0), 3);
+    CHECK_OVERLAP(two.getAxis(1), 4);
+    CHECK_OVERLAP(two.getAxis(2), 5);
+
+    // Store the best axis-major, in case we run into almost
+    // parallel edge collisions later
+    singleAxisPen = pen;
+    bestSingleAxis = best;
+
+    CHECK_OVERLAP(one.getAxis(0) % two.getAxis(0), 6);
+    CHECK_OVERLAP(one.getAxis(0) % two.getAxis(1), 7);
+    CHECK_OVERLAP(one.getAxis(0) % two.getAxis(2), 8);
+    CHECK_OVERLAP(one.getAxis(1) % two.getAxis(0), 9);
+    CHECK_OVERLAP(one.getAxis(1) % two.getAxis(1), 10);
+    CHECK_OVERLAP(one.getAxis(1) % two.getAxis(2), 11);
+    CHECK_OVERLAP(one.getAxis(2) % two.getAxis(0), 12);
+    CHECK_OVERLAP(one.getAxis(2) % two.getAxis(1), 13);
+    CHECK_OVERLAP(one.getAxis(2) % two.getAxis(2), 14);
+    return true;
+}
+#undef CHECK_OVERLAP
+#endif
+
+unsigned CollisionDetector::boxAndBox(
+    const CollisionBox &one,
+    const CollisionBox &two,
+    CollisionData *data
+    )
+{
+    //if (!IntersectionTests::boxAndBox(one, two)) return 0;
+
+    // Make sure we have contacts
+    if (!data->makeRoom(1)) return 0;
+
+    // Find the vector between the two centres
+    Vector3 toCentre = two.getAxis(3) - one.getAxis(3);
+
+    // We start assuming there is no contact
+    real pen = REAL_MAX;
+    unsigned best = 0xffffff;
+
+    // Now we check each axes, returning if it gives us
+    // a separating axis, and keeping track of the axis with
+    // the smallest penetration otherwise.
+    real singleAxisPen;
+    unsigned bestSingleAxis;
+    if (!findBoxAndBoxAxis(one, two, toCentre, pen, best,
+                           singleAxisPen, bestSingleAxis))
+    {
+        return 0;
+    }
+
+    // Make sure we've got a result.
+    assert(best != 0xffffff);
+
+    // We now know there's a collision, and we know which
+    // of the axes gave the smallest penetration. We now
+    // can deal with it in different ways depending on
+    // the case.
+    if (best < 3)
+    {
+        // We've got a vertex of box two on a face of box one.
+        fillPointFaceBoxBox(one, two, toCentre, data, best, pen);
+        data->addContacts(1);
+        return 1;
+    }
+    else if (best < 6)
+    {
+        // We've got a vertex of box one on a face of box two.
+        // We use the same algorithm as above, but swap around
+        // one and two (and therefore also the vector between their
+        // centres).
+        fillPointFaceBoxBox(two, one, toCentre*-1.0f, data, best-3, pen);
+        data->addContacts(1);
+        return 1;
+    }
+    else
+    {
+        // We've got an edge-edge contact.
+        fillEdgeEdgeBoxBox(one, two, toCentre, data, best, pen,
+                           bestSingleAxis);
         data->addContacts(1);
         return 1;
     }
-    return 0;
 }
-#undef CHECK_OVERLAP
+
+/*
+ * The most contacts boxAndBoxClipped gives for a pair of boxes.
+ */
+static const unsigned MAX_CLIPPED_CONTACTS = 4;
+
+/*
+ * The most points a face can have after clipping: each of the four
+ * side planes can add one.
+ */
+static const unsigned MAX_CLIP_POINTS = 8;
+
+/*
+ * An edge axis is only used in place of the best face axis if its
+ * penetration is less than this fraction of the face's, less the
+ * slop. Otherwise boxes resting face to face would flip between a
+ * face and an edge contact as they settle.
+ */
+static const real EDGE_PREFERENCE = (real)0.98;
+static const real EDGE_SLOP = (real)0.001;
+
+/**
+ * Holds a point of the face being clipped. The identifier is made
+ * from the features the point lies on, so the same point gets the
+ * same identifier from frame to frame. The edge is the feature the
+ * edge from this point to the next lies on: 0 to 3 for the edges of
+ * the incident face, and 4 to 7 for the side planes of the
+ * reference face.
+ */
+struct ClipPoint
+{
+    Vector3 position;
+    unsigned id;
+    unsigned edge;
+};
+
+/**
+ * Clips the polygon against the given side plane of the reference
+ * face (numbered 0 to 3), keeping the part behind it, as the
+ * Sutherland-Hodgman algorithm does. Returns the number of points
+ * written, which is at most one more than were given.
+ */
+static unsigned clipPolygon(
+    const ClipPoint *input,
+    unsigned count,
+    const Vector3 &direction,
+    real offset,
+    unsigned side,
+    ClipPoint *output
+    )
+{
+    unsigned written = 0;
+    for (unsigned i = 0; i < count; i++)
+    {
+        const ClipPoint &a = input[i];
+        const ClipPoint &b = input[(i+1) % count];
+        real distanceA = direction * a.position - offset;
+        real distanceB = direction * b.position - offset;
+        bool insideA = distanceA <= 0;
+        bool insideB = distanceB <= 0;
+
+        if (insideA) output[written++] = a;
+        if (insideA == insideB) continue;
+
+        // The edge crosses the plane: add the crossing point.
+        ClipPoint &crossing = output[written++];
+        crossing.position = a.position +
+            (b.position - a.position) * (distanceA / (distanceA - distanceB));
+        if (a.edge < 4)
+        {
+            // Where an edge of the incident face crosses the plane.
+            crossing.id = 4 + a.edge*4 + side;
+        }
+        else if ((a.edge - 4 < 2) != (side < 2))
+        {
+            // A corner of the reference face, where two side planes
+            // meet. Planes 0 and 1 are along one axis, 2 and 3 the
+            // other.
+            unsigned first = a.edge - 4;
+            unsigned alongU = first < 2 ? first : side;
+            unsigned alongV = first < 2 ? side : first;
+            crossing.id = 20 + alongU*2 + (alongV-2);
+        }
+        else
+        {
+            // Two opposite sides only meet for a flat reference face.
+            crossing.id = 24 + side;
+        }
+        crossing.edge = insideA ? 4 + side : a.edge;
+    }
+    return written;
+}
+
+/**
+ * Chooses up to four of the given points to keep, the way the
+ * manifold cache reduces its points: the deepest, the furthest from
+ * it, the one making the biggest triangle with them, and the one
+ * furthest outside that triangle. Writes the indices of the chosen
+ * points and returns how many there are. The points can be of any
+ * type with a position.
+ */
+template <class Point>
+static unsigned reduceClipPoints(
+    const Point *points,
+    const real *depth,
+    unsigned count,
+    const Vector3 &normal,
+    unsigned *chosen
+    )
+{
+    if (count <= MAX_CLIPPED_CONTACTS)
+    {
+        for (unsigned i = 0; i < count; i++) chosen[i] = i;
+        return count;
+    }
+
+    unsigned first = 0;
+    for (unsigned i = 1; i < count; i++)
+    {
+        if (depth[i] > depth[first]) first = i;
+    }
+    chosen[0] = first;
+
+    unsigned second = first;
+    real best = 0;
+    for (unsigned i = 0; i < count; i++)
+    {
+        real distance =
+            (points[i].position - points[first].position).squareMagnitude();
+        if (distance > best)
+        {
+            best = distance;
+            second = i;
+        }
+    }
+    if (second == first) return 1;
+    chosen[1] = second;
+
+    const Vector3 &a = points[first].position;
+    const Vector3 &b = points[second].position;
+    unsigned third = first;
+    real thirdArea = 0;
+    best = 0;
+    for (unsigned i = 0; i < count; i++)
+    {
+        real area = ((b - a) % (points[i].position - a)) * normal;
+        if (real_abs(area) > best)
+        {
+            best = real_abs(area);
+            thirdArea = area;
+            third = i;
+        }
+    }
+    if (third == first) return 2;
+    chosen[2] = third;
+
+    // Go round the triangle anticlockwise, and look for the point
+    // making the most negative area with one of its edges.
+    const Vector3 *corner[3] = { &a, &b, &points[third].position };
+    if (thirdArea < 0)
+    {
+        corner[1] = &points[third].position;
+        corner[2] = &b;
+    }
+    unsigned fourth = first;
+    best = 0;
+    for (unsigned i = 0; i < count; i++)
+    {
+        for (unsigned edge = 0; edge < 3; edge++)
+        {
+            const Vector3 &start = *corner[edge];
+            const Vector3 &end = *corner[(edge+1) % 3];
+            real area = ((end - start) % (points[i].position - start)) *
+                normal;
+            if (area < best)
+            {
+                best = area;
+                fourth = i;
+            }
+        }
+    }
+    if (fourth == first) return 3;
+    chosen[3] = fourth;
+    return 4;
+}
+
+unsigned CollisionDetector::boxAndBoxClipped(
+    const CollisionBox &one,
+    const CollisionBox &two,
+    CollisionData *data
+    )
+{
+    // Make sure we have contacts
+    if (!data->makeRoom(MAX_CLIPPED_CONTACTS)) return 0;
+
+    // Find the axis of least penetration, as boxAndBox does.
+    Vector3 toCentre = two.getAxis(3) - one.getAxis(3);
+    real pen = REAL_MAX;
+    unsigned best = 0xffffff;
+    real singleAxisPen;
+    unsigned bestSingleAxis;
+    if (!findBoxAndBoxAxis(one, two, toCentre, pen, best,
+                           singleAxisPen, bestSingleAxis))
+    {
+        return 0;
+    }
+
+    // Edges that clearly touch give one contact, as in boxAndBox.
+    // Otherwise use the best face.
+    if (best >= 6)
+    {
+        if (pen < singleAxisPen * EDGE_PREFERENCE - EDGE_SLOP)
+        {
+            fillEdgeEdgeBoxBox(one, two, toCentre, data, best, pen,
+                               bestSingleAxis);
+            data->addContacts(1);
+            return 1;
+        }
+        best = bestSingleAxis;
+        pen = singleAxisPen;
+    }
+
+    // The face of least penetration is the reference face, and the
+    // other box touches it with its incident face.
+    const CollisionBox *reference = &one;
+    const CollisionBox *incident = &two;
+    unsigned axis = best;
+    if (best >= 3)
+    {
+        reference = &two;
+        incident = &one;
+        axis = best - 3;
+    }
+
+    // The contact normal points towards box one, and the reference
+    // face's normal points out of it towards the incident box.
+    Vector3 normal = reference->getAxis(axis);
+    if (normal * toCentre > 0) normal *= -1;
+    Vector3 faceNormal = reference == &one ? normal * -1 : normal;
+    unsigned referenceFace = best*2;
+    if (reference->getAxis(axis) * faceNormal < 0) referenceFace++;
+
+    // The incident face is the one facing most against it.
+    unsigned incidentAxis = 0;
+    real facing = 0;
+    for (unsigned i = 0; i < 3; i++)
+    {
+        real along = incident->getAxis(i) * faceNormal;
+        if (real_abs(along) > real_abs(facing))
+        {
+            facing = along;
+            incidentAxis = i;
+        }
+    }
+    unsigned incidentFace = incidentAxis*2;
+    if (facing > 0) incidentFace++;
+
+    // Put its corners in order round the face.
+    ClipPoint polygon[2][MAX_CLIP_POINTS];
+    unsigned u = (incidentAxis+1) % 3;
+    unsigned v = (incidentAxis+2) % 3;
+    const real signU[4] = { 1, -1, -1, 1 };
+    const real signV[4] = { 1, 1, -1, -1 };
+    for (unsigned i = 0; i < 4; i++)
+    {
+        Vector3 corner;
+        corner[incidentAxis] = facing > 0 ?
+            -incident->halfSize[incidentAxis] :
+            incident->halfSize[incidentAxis];
+        corner[u] = incident->halfSize[u] * signU[i];
+        corner[v] = incident->halfSize[v] * signV[i];
+        polygon[0][i].position = incident->getTransform() * corner;
+        polygon[0][i].id = i;
+        polygon[0][i].edge = i;
+    }
+
+    // Clip it against the sides of the reference face.
+    Vector3 centre = reference->getAxis(3);
+    unsigned count = 4;
+    unsigned current = 0;
+    for (unsigned side = 0; side < 4 && count > 0; side++)
+    {
+        unsigned sideAxis = side < 2 ? (axis+1) % 3 : (axis+2) % 3;
+        Vector3 direction = reference->getAxis(sideAxis);
+        if (side & 1) direction *= -1;
+        real offset = direction * centre + reference->halfSize[sideAxis];
+
+        count = clipPolygon(polygon[current], count, direction, offset,
+                            side, polygon[1-current]);
+        current = 1-current;
+    }
+
+    // Keep the points below the reference face.
+    const ClipPoint *clipped = polygon[current];
+    real faceOffset = faceNormal * centre + reference->halfSize[axis];
+    ClipPoint points[MAX_CLIP_POINTS];
+    real depth[MAX_CLIP_POINTS];
+    unsigned pointCount = 0;
+    for (unsigned i = 0; i < count; i++)
+    {
+        real below = faceOffset - faceNormal * clipped[i].position;
+        if (below < 0) continue;
+        points[pointCount] = clipped[i];
+        depth[pointCount] = below;
+        pointCount++;
+    }
+
+    // Rounding can leave no points for boxes that only just touch,
+    // so fall back to the single contact boxAndBox gives.
+    if (pointCount == 0)
+    {
+        if (best < 3) fillPointFaceBoxBox(one, two, toCentre, data, best, pen);
+        else fillPointFaceBoxBox(two, one, toCentre*-1.0f, data, best-3, pen);
+        data->addContacts(1);
+        return 1;
+    }
+
+    unsigned chosen[MAX_CLIPPED_CONTACTS];
+    pointCount = reduceClipPoints(points, depth, pointCount, normal, chosen);
+
+    // With a contact array, there may not be room for every point.
+    if ((int)pointCount > data->contactsLeft)
+    {
+        pointCount = (unsigned)data->contactsLeft;
+    }
+
+    // The feature identifier records the two faces and the point,
+    // with a high bit to keep it apart from boxAndBox's identifiers.
+    Contact *contact = data->contacts;
+    for (unsigned i = 0; i < pointCount; i++, contact++)
+    {
+        const ClipPoint &point = points[chosen[i]];
+        unsigned feature = 0x1000 | (referenceFace << 8) |
+            (incidentFace << 5) | point.id;
+
+        contact->contactNormal = normal;
+        contact->contactPoint = point.position;
+        contact->penetration = depth[chosen[i]];
+        contact->setBodyData(one.body, two.body,
+            data->friction, data->restitution, feature);
+    }
+    data->addContacts(pointCount);
+    return pointCount;
+}
+
+unsigned CollisionDetector::boxAndBoxBatch(
+    const CollisionBox * const *one,
+    const CollisionBox * const *two,
+    unsigned count,
+    CollisionData *data
+    )
+{
+    unsigned found = 0;
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (!data->hasMoreContacts()) break;
+        found += boxAndBox(*one[i], *two[i], data);
+    }
+    return found;
+}
 
 
 
@@ -539,6 +1598,9 @@ unsigned CollisionDetector::boxAndPoint(
     CollisionData *data
     )
 {
+    // Make sure we have contacts
+    if (!data->makeRoom(1)) return 0;
+
     // Transform the point into box coordinates
     Vector3 relPt = box.transform.transformInverse(point);
 
@@ -588,6 +1650,9 @@ unsigned CollisionDetector::boxAndSphere(
     CollisionData *data
     )
 {
+    // Make sure we have contacts
+    if (!data->makeRoom(1)) return 0;
+
     // Transform the centre of the sphere into box coordinates
     Vector3 centre = sphere.getAxis(3);
     Vector3 relCentre = box.transform.transformInverse(centre);
@@ -644,8 +1709,8 @@ unsigned CollisionDetector::boxAndHalfSpace(
     CollisionData *data
     )
 {
-    // Make sure we have contacts
-    if (data->contactsLeft <= 0) return 0;
+    // Make sure we have room for a contact at each vertex
+    if (!data->makeRoom(8)) return 0;
 
     // Check for intersection
     if (!IntersectionTests::boxAndHalfSpace(box, plane))
@@ -687,17 +1752,1305 @@ unsigned CollisionDetector::boxAndHalfSpace(
             contact->contactNormal = plane.direction;
             contact->penetration = plane.offset - vertexDistance;
 
-            // Write the appropriate data
+            // Write the appropriate data, using the vertex as the
+            // feature identifier.
             contact->setBodyData(box.body, NULL,
-                data->friction, data->restitution);
+                data->friction, data->restitution, i);
 
             // Move onto the next contact
             contact++;
             contactsUsed++;
-            if (contactsUsed == (unsigned)data->contactsLeft) return contactsUsed;
+            if (contactsUsed == (unsigned)data->contactsLeft) break;
         }
     }
 
     data->addContacts(contactsUsed);
     return contactsUsed;
 }
+
+/*
+ * Capsules lying closer to parallel than this (as the cosine of the
+ * angle between them) get a contact at each end of their overlap.
+ */
+static const real CAPSULE_PARALLEL = (real)0.995;
+
+/*
+ * Fills in the contact for two spheres with the given centres and
+ * radii, if they overlap, and returns the number of contacts written.
+ * If the centres are in the same place, the normal is taken along
+ * the given axis.
+ */
+static unsigned fillSphereContact(
+    const Vector3 &centreOne, real radiusOne,
+    const Vector3 &centreTwo, real radiusTwo,
+    const Vector3 &axis,
+    RigidBody *one, RigidBody *two,
+    unsigned feature,
+    Contact *contact,
+    CollisionData *data
+    )
+{
+    Vector3 midline = centreOne - centreTwo;
+    real size = midline.magnitude();
+    if (size >= radiusOne + radiusTwo) return 0;
+
+    Vector3 normal = size > 0 ? midline * (((real)1.0)/size) : axis;
+
+    // The contact point is halfway between the two surfaces.
+    contact->contactNormal = normal;
+    contact->contactPoint = (centreOne - normal * radiusOne +
+                             centreTwo + normal * radiusTwo) * (real)0.5;
+    contact->penetration = radiusOne + radiusTwo - size;
+    contact->setBodyData(one, two,
+        data->friction, data->restitution, feature);
+    return 1;
+}
+
+unsigned CollisionDetector::capsuleAndHalfSpace(
+    const CollisionCapsule &capsule,
+    const CollisionPlane &plane,
+    CollisionData *data
+    )
+{
+    // Make sure we have room for a contact at each end
+    if (!data->makeRoom(2)) return 0;
+
+    // Each end is tested as a sphere, using it as the feature.
+    Contact* contact = data->contacts;
+    unsigned contactsUsed = 0;
+    for (unsigned i = 0; i < 2; i++)
+    {
+        Vector3 position = capsule.getEnd(i);
+        real endDistance =
+            plane.direction * position -
+            capsule.radius - plane.offset;
+        if (endDistance >= 0) continue;
+
+        contact->contactNormal = plane.direction;
+        contact->penetration = -endDistance;
+        contact->contactPoint =
+            position - plane.direction * (endDistance + capsule.radius);
+        contact->setBodyData(capsule.body, NULL,
+            data->friction, data->restitution, i);
+
+        contact++;
+        contactsUsed++;
+        if (contactsUsed == (unsigned)data->contactsLeft) break;
+    }
+
+    data->addContacts(contactsUsed);
+    return contactsUsed;
+}
+
+unsigned CollisionDetector::capsuleAndSphere(
+    const CollisionCapsule &capsule,
+    const CollisionSphere &sphere,
+    CollisionData *data
+    )
+{
+    // Make sure we have contacts
+    if (!data->makeRoom(1)) return 0;
+
+    // Find the point of the segment nearest the sphere.
+    Vector3 start = capsule.getEnd(0);
+    Vector3 end = capsule.getEnd(1);
+    Vector3 centre = sphere.getAxis(3);
+    Vector3 nearest = start + (end - start) * nearestOnSegment(start, end, centre);
+
+    unsigned used = fillSphereContact(
+        nearest, capsule.radius, centre, sphere.radius,
+        capsule.getAxis(0), capsule.body, sphere.body, 0,
+        data->contacts, data);
+    data->addContacts(used);
+    return used;
+}
+
+unsigned CollisionDetector::capsuleAndCapsule(
+    const CollisionCapsule &one,
+    const CollisionCapsule &two,
+    CollisionData *data
+    )
+{
+    // Make sure we have contacts
+    if (!data->makeRoom(2)) return 0;
+
+    Vector3 startOne = one.getEnd(0);
+    Vector3 endOne = one.getEnd(1);
+    Vector3 startTwo = two.getEnd(0);
+    Vector3 endTwo = two.getEnd(1);
+    real reach = one.radius + two.radius;
+
+    real alongOne, alongTwo;
+    real distance = nearestOnSegments(startOne, endOne, startTwo, endTwo,
+                                      alongOne, alongTwo);
+    if (distance >= reach * reach) return 0;
+
+    Vector3 directionOne = endOne - startOne;
+    Vector3 directionTwo = endTwo - startTwo;
+    Contact* contact = data->contacts;
+    unsigned contactsUsed = 0;
+
+    // If they lie side by side, find the stretch of the first that
+    // the second lies along, and put a contact at each end of it.
+    real lengthOne = directionOne.squareMagnitude();
+    real lengthTwo = directionTwo.squareMagnitude();
+    real across = directionOne * directionTwo;
+    if (lengthOne > 0 && lengthTwo > 0 && data->contactsLeft >= 2 &&
+        across * across >=
+        CAPSULE_PARALLEL * CAPSULE_PARALLEL * lengthOne * lengthTwo)
+    {
+        real low = ((startTwo - startOne) * directionOne) / lengthOne;
+        real high = ((endTwo - startOne) * directionOne) / lengthOne;
+        if (low > high) std::swap(low, high);
+        low = clampUnit(low);
+        high = clampUnit(high);
+
+        // Unless the stretch is no more than a point.
+        if ((high - low) * (high - low) * lengthOne >
+            reach * reach * real_epsilon)
+        {
+            for (unsigned i = 0; i < 2; i++)
+            {
+                Vector3 pointOne = startOne + directionOne * (i ? high : low);
+                Vector3 pointTwo = startTwo + directionTwo *
+                    nearestOnSegment(startTwo, endTwo, pointOne);
+                unsigned used = fillSphereContact(
+                    pointOne, one.radius, pointTwo, two.radius,
+                    one.getAxis(0), one.body, two.body, i + 1,
+                    contact, data);
+                contact += used;
+                contactsUsed += used;
+            }
+            if (contactsUsed > 0)
+            {
+                data->addContacts(contactsUsed);
+                return contactsUsed;
+            }
+        }
+    }
+
+    // Otherwise one contact between the nearest points does.
+    contactsUsed = fillSphereContact(
+        startOne + directionOne * alongOne, one.radius,
+        startTwo + directionTwo * alongTwo, two.radius,
+        one.getAxis(0), one.body, two.body, 0,
+        contact, data);
+    data->addContacts(contactsUsed);
+    return contactsUsed;
+}
+
+unsigned CollisionDetector::capsuleAndBox(
+    const CollisionCapsule &capsule,
+    const CollisionBox &box,
+    CollisionData *data
+    )
+{
+    // Make sure we have contacts
+    if (!data->makeRoom(2)) return 0;
+
+    // Work in the box's coordinates.
+    Vector3 start = box.transform.transformInverse(capsule.getEnd(0));
+    Vector3 end = box.transform.transformInverse(capsule.getEnd(1));
+    Vector3 direction = end - start;
+    const Vector3 &halfSize = box.halfSize;
+    Contact* contact = data->contacts;
+
+    real low, high;
+    if (clipSegmentToBox(start, end, halfSize, 3, low, high))
+    {
+        // The segment goes into the box. The box swept along the
+        // segment has faces at right angles to the box's axes and to
+        // the segment crossed with each of them, and the capsule
+        // moves out least along one of those.
+        Vector3 axes[6] = {
+            Vector3(1,0,0), Vector3(0,1,0), Vector3(0,0,1),
+            direction % Vector3(1,0,0),
+            direction % Vector3(0,1,0),
+            direction % Vector3(0,0,1)
+        };
+        real pen = REAL_MAX;
+        Vector3 normal;
+        for (unsigned i = 0; i < 6; i++)
+        {
+            real size = axes[i].magnitude();
+            if (size <= real_epsilon * direction.magnitude()) continue;
+            Vector3 axis = axes[i] * (((real)1.0)/size);
+
+            real boxRadius =
+                real_abs(axis.x) * halfSize.x +
+                real_abs(axis.y) * halfSize.y +
+                real_abs(axis.z) * halfSize.z;
+            real lowest = start * axis;
+            real highest = end * axis;
+            if (lowest > highest) std::swap(lowest, highest);
+
+            real up = boxRadius - lowest + capsule.radius;
+            real down = highest + boxRadius + capsule.radius;
+            if (up < pen) { pen = up; normal = axis; }
+            if (down < pen) { pen = down; normal = axis * -1; }
+        }
+
+        // The deepest point is at the end of the part inside the box
+        // that is furthest against the normal.
+        Vector3 deepest = start + direction *
+            ((start + direction * low) * normal <
+             (start + direction * high) * normal ? low : high);
+        contact->contactNormal = box.transform.transformDirection(normal);
+        contact->penetration = pen;
+        contact->contactPoint = box.transform.transform(
+            deepest - normal * capsule.radius);
+        contact->setBodyData(capsule.body, box.body,
+            data->friction, data->restitution);
+
+        data->addContacts(1);
+        return 1;
+    }
+
+    real along;
+    Vector3 boxPoint;
+    real distance = nearestOnSegmentAndBox(start, end, halfSize,
+                                           along, boxPoint);
+    if (distance >= capsule.radius * capsule.radius) return 0;
+    Vector3 segmentPoint = start + direction * along;
+
+    // If the nearest points are one above the other over a face, and
+    // the segment lies along the face, it gets a contact at each end
+    // of the part over the face.
+    unsigned contactsUsed = 0;
+    real lengthSquared = direction.squareMagnitude();
+    for (unsigned axis = 0; axis < 3 && data->contactsLeft >= 2; axis++)
+    {
+        real sign = segmentPoint[axis] < 0 ? -1 : 1;
+        real height = segmentPoint[axis] * sign - halfSize[axis];
+        if (height <= 0 ||
+            height * height < distance * CAPSULE_PARALLEL * CAPSULE_PARALLEL ||
+            direction[axis] * direction[axis] >
+            lengthSquared * (1 - CAPSULE_PARALLEL * CAPSULE_PARALLEL))
+        {
+            continue;
+        }
+        if (!clipSegmentToBox(start, end, halfSize, axis, low, high) ||
+            (high - low) * (high - low) * lengthSquared <=
+            capsule.radius * capsule.radius * real_epsilon)
+        {
+            break;
+        }
+
+        // The nearest point of the segment has to be in the part over
+        // the face, give or take rounding, or the deeper contact would
+        // be at the edge of the face instead.
+        real outside = along < low ? low - along :
+            (along > high ? along - high : 0);
+        if (outside * outside * lengthSquared >
+            distance * (1 - CAPSULE_PARALLEL) * (1 - CAPSULE_PARALLEL))
+        {
+            break;
+        }
+
+        Vector3 normal = box.getAxis(axis) * sign;
+        for (unsigned i = 0; i < 2; i++)
+        {
+            Vector3 point = start + direction * (i ? high : low);
+            real height = point[axis] * sign - halfSize[axis];
+            if (height >= capsule.radius) continue;
+
+            point[axis] = halfSize[axis] * sign;
+            contact->contactNormal = normal;
+            contact->penetration = capsule.radius - height;
+            contact->contactPoint = box.transform.transform(point);
+            contact->setBodyData(capsule.body, box.body,
+                data->friction, data->restitution, i + 1);
+            contact++;
+            contactsUsed++;
+        }
+        break;
+    }
+
+    // Otherwise one contact between the nearest points does.
+    if (contactsUsed == 0)
+    {
+        real size = real_sqrt(distance);
+        if (size <= 0) return 0;
+
+        contact->contactNormal = box.transform.transformDirection(
+            (segmentPoint - boxPoint) * (((real)1.0)/size));
+        contact->penetration = capsule.radius - size;
+        contact->contactPoint = box.transform.transform(boxPoint);
+        contact->setBodyData(capsule.body, box.body,
+            data->friction, data->restitution);
+        contactsUsed = 1;
+    }
+
+    data->addContacts(contactsUsed);
+    return contactsUsed;
+}
+
+unsigned CollisionDetector::convexAndHalfSpace(
+    const CollisionConvex &convex,
+    const CollisionPlane &plane,
+    CollisionData *data
+    )
+{
+    // Make sure we have room for a contact at each vertex
+    if (!data->makeRoom(convex.vertexCount)) return 0;
+
+    // Check for intersection
+    if (!IntersectionTests::convexAndHalfSpace(convex, plane))
+    {
+        return 0;
+    }
+
+    // As for a box, each vertex below the plane gives a contact.
+    Contact* contact = data->contacts;
+    unsigned contactsUsed = 0;
+    for (unsigned i = 0; i < convex.vertexCount; i++)
+    {
+        Vector3 vertexPos = convex.transform.transform(convex.vertices[i]);
+        real vertexDistance = vertexPos * plane.direction;
+        if (vertexDistance > plane.offset) continue;
+
+        contact->contactPoint = plane.direction;
+        contact->contactPoint *= (vertexDistance-plane.offset);
+        contact->contactPoint += vertexPos;
+        contact->contactNormal = plane.direction;
+        contact->penetration = plane.offset - vertexDistance;
+
+        // The vertex is the feature identifier.
+        contact->setBodyData(convex.body, NULL,
+            data->friction, data->restitution, i);
+
+        contact++;
+        contactsUsed++;
+        if (contactsUsed == (unsigned)data->contactsLeft) break;
+    }
+
+    data->addContacts(contactsUsed);
+    return contactsUsed;
+}
+
+/*
+ * Writes the contact for two convex shapes that overlap by the given
+ * result, taking the first shape as the first body.
+ */
+static unsigned fillConvexContact(
+    RigidBody *one,
+    RigidBody *two,
+    const ConvexResult &result,
+    CollisionData *data
+    )
+{
+    // Shapes that only touch have nothing to resolve.
+    if (result.distance >= 0) return 0;
+
+    // The result's normal points away from the first body, the
+    // contact normal towards it.
+    Contact* contact = data->contacts;
+    contact->contactNormal = result.normal * -1;
+    contact->contactPoint = (result.pointOne + result.pointTwo) * (real)0.5;
+    contact->penetration = -result.distance;
+    contact->setBodyData(one, two,
+        data->friction, data->restitution);
+
+    data->addContacts(1);
+    return 1;
+}
+
+/*
+ * Does the collision test for a convex hull and a shape made of the
+ * points within the given radius of a core (a point or a segment).
+ * The distance to the core, found with GJK, is exact. EPA is only
+ * needed if the core is inside the hull, and then works on the whole
+ * rounded shape.
+ */
+static unsigned convexAndRounded(
+    const CollisionConvex &convex,
+    const ConvexShape &core,
+    const ConvexShape &rounded,
+    real radius,
+    RigidBody *body,
+    CollisionData *data
+    )
+{
+    // Make sure we have contacts
+    if (!data->makeRoom(1)) return 0;
+
+    // Find the distance from the hull to the core.
+    HullShape hull(convex);
+    ConvexResult result;
+    if (ConvexTests::distance(hull, core, &result) && result.distance > 0)
+    {
+        if (result.distance >= radius) return 0;
+
+        Contact* contact = data->contacts;
+        contact->contactNormal = result.normal * -1;
+        contact->contactPoint = result.pointOne;
+        contact->penetration = radius - result.distance;
+        contact->setBodyData(convex.body, body,
+            data->friction, data->restitution);
+
+        data->addContacts(1);
+        return 1;
+    }
+
+    // The core is inside the hull, so find how deep the whole shape
+    // goes.
+    if (!ConvexTests::penetration(hull, rounded, &result)) return 0;
+    return fillConvexContact(convex.body, body, result, data);
+}
+
+unsigned CollisionDetector::convexAndSphere(
+    const CollisionConvex &convex,
+    const CollisionSphere &sphere,
+    CollisionData *data
+    )
+{
+    return convexAndRounded(convex,
+                            SphereShape(sphere.getAxis(3)),
+                            SphereShape(sphere),
+                            sphere.radius, sphere.body, data);
+}
+
+unsigned CollisionDetector::convexAndCapsule(
+    const CollisionConvex &convex,
+    const CollisionCapsule &capsule,
+    CollisionData *data
+    )
+{
+    return convexAndRounded(convex,
+                            CapsuleShape(capsule.getEnd(0), capsule.getEnd(1)),
+                            CapsuleShape(capsule),
+                            capsule.radius, capsule.body, data);
+}
+
+unsigned CollisionDetector::convexAndBox(
+    const CollisionConvex &convex,
+    const CollisionBox &box,
+    CollisionData *data
+    )
+{
+    // Make sure we have contacts
+    if (!data->makeRoom(1)) return 0;
+
+    ConvexResult result;
+    if (!ConvexTests::penetration(HullShape(convex), BoxShape(box), &result))
+    {
+        return 0;
+    }
+    return fillConvexContact(convex.body, box.body, result, data);
+}
+
+unsigned CollisionDetector::convexAndConvex(
+    const CollisionConvex &one,
+    const CollisionConvex &two,
+    CollisionData *data
+    )
+{
+    // Make sure we have contacts
+    if (!data->makeRoom(1)) return 0;
+
+    ConvexResult result;
+    if (!ConvexTests::penetration(HullShape(one), HullShape(two), &result))
+    {
+        return 0;
+    }
+    return fillConvexContact(one.body, two.body, result, data);
+}
+
+/*
+ * Finds the point of the triangle with the given corners nearest the
+ * given point, returning true if it lies inside the face rather than
+ * on an edge or at a corner. This follows the Voronoi region tests of
+ * Ericson's Real-Time Collision Detection, as GJK does.
+ */
+static bool nearestOnTriangle(
+    const Vector3 &point,
+    const Vector3 *corners,
+    Vector3 &nearest
+    )
+{
+    const Vector3 &a = corners[0];
+    const Vector3 &b = corners[1];
+    const Vector3 &c = corners[2];
+    Vector3 ab = b - a;
+    Vector3 ac = c - a;
+
+    // Check the region beyond a.
+    Vector3 ap = point - a;
+    real d1 = ab * ap;
+    real d2 = ac * ap;
+    if (d1 <= 0 && d2 <= 0)
+    {
+        nearest = a;
+        return false;
+    }
+
+    // Beyond b.
+    Vector3 bp = point - b;
+    real d3 = ab * bp;
+    real d4 = ac * bp;
+    if (d3 >= 0 && d4 <= d3)
+    {
+        nearest = b;
+        return false;
+    }
+
+    // Beyond ab.
+    real vc = d1*d4 - d3*d2;
+    if (vc <= 0 && d1 >= 0 && d3 <= 0)
+    {
+        nearest = a + ab * (d1 / (d1 - d3));
+        return false;
+    }
+
+    // Beyond c.
+    Vector3 cp = point - c;
+    real d5 = ab * cp;
+    real d6 = ac * cp;
+    if (d6 >= 0 && d5 <= d6)
+    {
+        nearest = c;
+        return false;
+    }
+
+    // Beyond ac.
+    real vb = d5*d2 - d1*d6;
+    if (vb <= 0 && d2 >= 0 && d6 <= 0)
+    {
+        nearest = a + ac * (d2 / (d2 - d6));
+        return false;
+    }
+
+    // Beyond bc.
+    real va = d3*d6 - d5*d4;
+    if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0)
+    {
+        nearest = b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+        return false;
+    }
+
+    // Inside the face. The mesh leaves out triangles with no area,
+    // so this can't divide by zero.
+    real scale = ((real)1.0) / (va + vb + vc);
+    nearest = a + ab * (vb * scale) + ac * (vc * scale);
+    return true;
+}
+
+/**
+ * Holds a contact found between a primitive and one triangle of a
+ * mesh, before the contacts from every triangle are merged.
+ */
+struct MeshPoint
+{
+    Vector3 position;
+    Vector3 normal;
+    real penetration;
+    unsigned feature;
+};
+
+/*
+ * The most points a triangle test finds for one triangle.
+ */
+static const unsigned MAX_TRIANGLE_POINTS = MAX_CLIPPED_CONTACTS;
+
+/*
+ * The number of points from a mesh that are kept on the machine
+ * stack. A primitive finding more moves them to the heap.
+ */
+static const unsigned MESH_STACK_POINTS = 64;
+
+/*
+ * Points closer than this, whose normals have a dot product greater
+ * than the second value, are the same point found by neighbouring
+ * triangles, as where a sphere rests on a corner they share.
+ */
+static const real MESH_MERGE_DISTANCE = (real)0.001;
+static const real MESH_MERGE_NORMAL = (real)0.999;
+
+/*
+ * Points whose normals have a dot product greater than this with
+ * the deepest point of a cluster are reduced together, as the points
+ * of one clipped face are.
+ */
+static const real MESH_CLUSTER_NORMAL = (real)0.95;
+
+/**
+ * Holds an array that starts on the machine stack, and moves to the
+ * heap if it needs more room.
+ */
+template <class Type, unsigned fixedSize>
+struct ScratchArray
+{
+    Type fixed[fixedSize];
+    std::vector<Type> heap;
+    Type *items;
+    unsigned room;
+
+    ScratchArray()
+    :
+    items(fixed), room(fixedSize)
+    {
+    }
+
+    /**
+     * Makes room for the given number of items, keeping those before
+     * the given one, and returns the array.
+     */
+    Type *reserve(unsigned size, unsigned kept)
+    {
+        if (size > room)
+        {
+            room = std::max(size, room * 2);
+            heap.resize(room);
+            if (items == fixed) std::copy(fixed, fixed + kept, heap.begin());
+            items = &heap[0];
+        }
+        return items;
+    }
+};
+
+/*
+ * Fills in the point for a sphere and a triangle of a mesh with the
+ * given corners and unit normal, if they touch, and returns the
+ * number of points written.
+ *
+ * Triangles are one sided. A sphere over the face is pushed out along
+ * the normal, even if its centre has gone behind the triangle, but
+ * one touching an edge or corner only counts from the front: from
+ * behind, it belongs to the triangle on the other side.
+ */
+static unsigned fillTriangleContact(
+    const Vector3 &centre,
+    real radius,
+    const Vector3 *corners,
+    const Vector3 &normal,
+    unsigned feature,
+    MeshPoint *point
+    )
+{
+    real height = normal * (centre - corners[0]);
+    if (height >= radius || height <= -radius) return 0;
+
+    Vector3 nearest;
+    if (nearestOnTriangle(centre, corners, nearest))
+    {
+        point->normal = normal;
+        point->penetration = radius - height;
+    }
+    else
+    {
+        if (height <= 0) return 0;
+
+        Vector3 away = centre - nearest;
+        real distance = away.magnitude();
+        if (distance >= radius) return 0;
+
+        point->normal = away * (((real)1.0)/distance);
+        point->penetration = radius - distance;
+    }
+    point->position = nearest;
+    point->feature = feature;
+    return 1;
+}
+
+/*
+ * Tests a primitive against one triangle of a mesh, with the given
+ * corners and unit normal, writing up to MAX_TRIANGLE_POINTS points
+ * and returning how many. The feature holds the triangle, to be added
+ * to for each point.
+ */
+typedef unsigned (*TriangleTest)(
+    const CollisionPrimitive &primitive,
+    const Vector3 *corners,
+    const Vector3 &normal,
+    unsigned feature,
+    MeshPoint *points
+    );
+
+/*
+ * Merges the points that neighbouring triangles found in the same
+ * place with the same normal, keeping the deepest penetration. The
+ * points left are moved to the start, and their number returned.
+ */
+static unsigned mergeMeshPoints(MeshPoint *points, unsigned count)
+{
+    unsigned kept = 0;
+    for (unsigned i = 0; i < count; i++)
+    {
+        const MeshPoint &point = points[i];
+        unsigned j = 0;
+        while (j < kept &&
+               ((point.position - points[j].position).squareMagnitude() >=
+                    MESH_MERGE_DISTANCE * MESH_MERGE_DISTANCE ||
+                point.normal * points[j].normal <= MESH_MERGE_NORMAL))
+        {
+            j++;
+        }
+
+        if (j == kept) points[kept++] = point;
+        else if (point.penetration > points[j].penetration)
+        {
+            points[j].penetration = point.penetration;
+        }
+    }
+    return kept;
+}
+
+/*
+ * Writes contacts for the given points, reducing each cluster of
+ * points with much the same normal to at most four, in the same way
+ * as the points of a clipped face. The points are reordered. Returns
+ * the number of contacts written.
+ */
+static unsigned addMeshContacts(
+    const CollisionPrimitive &primitive,
+    MeshPoint *points,
+    unsigned count,
+    CollisionData *data
+    )
+{
+    ScratchArray<real, MESH_STACK_POINTS> depths;
+    real *depth = depths.reserve(count, 0);
+
+    unsigned contactsUsed = 0;
+    unsigned start = 0;
+    while (start < count)
+    {
+        // Start the cluster from the deepest point left, and bring
+        // the points with much the same normal together after it.
+        unsigned deepest = start;
+        for (unsigned i = start + 1; i < count; i++)
+        {
+            if (points[i].penetration > points[deepest].penetration)
+            {
+                deepest = i;
+            }
+        }
+        std::swap(points[start], points[deepest]);
+        Vector3 normal = points[start].normal;
+        unsigned end = start + 1;
+        for (unsigned i = end; i < count; i++)
+        {
+            if (points[i].normal * normal > MESH_CLUSTER_NORMAL)
+            {
+                std::swap(points[i], points[end++]);
+            }
+        }
+
+        const MeshPoint *cluster = points + start;
+        for (unsigned i = start; i < end; i++)
+        {
+            depth[i - start] = points[i].penetration;
+        }
+        unsigned chosen[MAX_CLIPPED_CONTACTS];
+        unsigned chosenCount = reduceClipPoints(cluster, depth, end - start,
+                                                normal, chosen);
+
+        // With a contact array, there may not be room for every point.
+        if (!data->makeRoom(chosenCount)) break;
+        if ((int)chosenCount > data->contactsLeft)
+        {
+            chosenCount = (unsigned)data->contactsLeft;
+        }
+
+        Contact *contact = data->contacts;
+        for (unsigned i = 0; i < chosenCount; i++, contact++)
+        {
+            const MeshPoint &point = cluster[chosen[i]];
+            contact->contactNormal = point.normal;
+            contact->contactPoint = point.position;
+            contact->penetration = point.penetration;
+            contact->setBodyData(primitive.body, NULL,
+                data->friction, data->restitution, point.feature);
+        }
+        data->addContacts(chosenCount);
+        contactsUsed += chosenCount;
+        start = end;
+    }
+    return contactsUsed;
+}
+
+/*
+ * Walks down the mesh's hierarchy, running the given test on each
+ * triangle in the leaves whose boxes overlap the primitive's bounding
+ * box, then merges and reduces the points found and writes them as
+ * contacts. The points from every triangle are gathered first, since
+ * neighbouring triangles find the same point where they meet, and a
+ * patch of small triangles under a box each give a clipped face.
+ */
+static unsigned collideWithMesh(
+    const CollisionPrimitive &primitive,
+    const BoundingBox &bounds,
+    const CollisionTriangleMesh &mesh,
+    TriangleTest test,
+    CollisionData *data
+    )
+{
+    const CollisionTriangleMesh::Node *nodes = mesh.getNodes();
+    if (!nodes) return 0;
+
+    // The stack never holds more than one node for each level of
+    // the hierarchy, plus one, so it only needs the heap for deep
+    // ones.
+    unsigned fixedStack[CollisionTriangleMesh::STACK_HEIGHT + 1];
+    std::vector<unsigned> heapStack;
+    unsigned *stack = fixedStack;
+    if (mesh.getHeight() > CollisionTriangleMesh::STACK_HEIGHT)
+    {
+        heapStack.resize(mesh.getHeight() + 1);
+        stack = &heapStack[0];
+    }
+
+    if (!data->hasMoreContacts()) return 0;
+
+    ScratchArray<MeshPoint, MESH_STACK_POINTS> gathered;
+    MeshPoint *points = gathered.items;
+    unsigned count = 0, size = 0;
+    stack[size++] = 0;
+    while (size > 0)
+    {
+        unsigned index = stack[--size];
+        const CollisionTriangleMesh::Node &node = nodes[index];
+
+        if (!node.box.overlaps(&bounds)) continue;
+        if (!node.isLeaf())
+        {
+            stack[size++] = node.offset;
+            stack[size++] = index + 1;
+            continue;
+        }
+
+        Vector3 corners[3];
+        for (unsigned i = node.offset; i < node.offset + node.count; i++)
+        {
+            mesh.getTriangle(i, corners);
+            unsigned feature = mesh.getSourceTriangle(i) <<
+                CollisionDetector::MESH_FEATURE_BITS;
+            points = gathered.reserve(count + MAX_TRIANGLE_POINTS, count);
+            count += test(primitive, corners, mesh.getNormal(i),
+                          feature, points + count);
+        }
+    }
+    if (count == 0) return 0;
+
+    count = mergeMeshPoints(points, count);
+    return addMeshContacts(primitive, points, count, data);
+}
+
+/*
+ * The triangle test for a sphere.
+ */
+static unsigned sphereAndTriangle(
+    const CollisionPrimitive &primitive,
+    const Vector3 *corners,
+    const Vector3 &normal,
+    unsigned feature,
+    MeshPoint *points
+    )
+{
+    const CollisionSphere &sphere = (const CollisionSphere &)primitive;
+    return fillTriangleContact(sphere.getAxis(3), sphere.radius,
+                               corners, normal, feature, points);
+}
+
+/*
+ * Fills in the point for the middle of a capsule's segment, between
+ * the given ends, and a triangle of a mesh, if they touch, and
+ * returns the number of points written. Either the segment goes
+ * through the face, or it passes over an edge, which as for a sphere
+ * only counts from the front.
+ */
+static unsigned fillTriangleMiddle(
+    const Vector3 &start,
+    const Vector3 &end,
+    real radius,
+    const Vector3 *corners,
+    const Vector3 &normal,
+    unsigned feature,
+    MeshPoint *point
+    )
+{
+    real startHeight = normal * (start - corners[0]);
+    real endHeight = normal * (end - corners[0]);
+    if (startHeight >= radius && endHeight >= radius) return 0;
+
+    if ((startHeight > 0) != (endHeight > 0))
+    {
+        Vector3 crossing = start + (end - start) *
+            (startHeight / (startHeight - endHeight));
+        Vector3 nearest;
+        if (nearestOnTriangle(crossing, corners, nearest))
+        {
+            point->normal = normal;
+            point->position = nearest;
+            point->penetration = radius - std::min(startHeight, endHeight);
+            point->feature = feature;
+            return 1;
+        }
+    }
+
+    // Find the edge nearest the segment.
+    real best = radius * radius;
+    Vector3 onSegment, onEdge;
+    for (unsigned i = 0; i < 3; i++)
+    {
+        const Vector3 &edgeStart = corners[i];
+        const Vector3 &edgeEnd = corners[(i+1) % 3];
+        real alongSegment, alongEdge;
+        real distance = nearestOnSegments(start, end, edgeStart, edgeEnd,
+                                          alongSegment, alongEdge);
+        if (distance < best)
+        {
+            best = distance;
+            onSegment = start + (end - start) * alongSegment;
+            onEdge = edgeStart + (edgeEnd - edgeStart) * alongEdge;
+        }
+    }
+    if (best >= radius * radius || best <= 0) return 0;
+    if (normal * (onSegment - corners[0]) <= 0) return 0;
+
+    real distance = real_sqrt(best);
+    point->normal = (onSegment - onEdge) * (((real)1.0)/distance);
+    point->position = onEdge;
+    point->penetration = radius - distance;
+    point->feature = feature;
+    return 1;
+}
+
+/*
+ * The triangle test for a capsule.
+ */
+static unsigned capsuleAndTriangle(
+    const CollisionPrimitive &primitive,
+    const Vector3 *corners,
+    const Vector3 &normal,
+    unsigned feature,
+    MeshPoint *points
+    )
+{
+    const CollisionCapsule &capsule = (const CollisionCapsule &)primitive;
+    Vector3 start = capsule.getEnd(0);
+    Vector3 end = capsule.getEnd(1);
+
+    // Test each end as a sphere, using features 1 and 2, so a capsule
+    // lying on the triangle rests on both.
+    unsigned pointsUsed = 0;
+    real deepest = 0;
+    for (unsigned i = 0; i < 2; i++)
+    {
+        MeshPoint *endPoint = points + pointsUsed;
+        if (fillTriangleContact(i ? end : start, capsule.radius,
+                                corners, normal, feature + i + 1, endPoint))
+        {
+            deepest = std::max(deepest, endPoint->penetration);
+            pointsUsed++;
+        }
+    }
+
+    // The middle gets a point of its own if it goes in deeper than
+    // the ends, as it does for a capsule lying across an edge.
+    if (fillTriangleMiddle(start, end, capsule.radius, corners, normal,
+                           feature, points + pointsUsed) &&
+        points[pointsUsed].penetration > deepest)
+    {
+        pointsUsed++;
+    }
+    return pointsUsed;
+}
+
+/*
+ * Checks the given axis for a box and a triangle, returning false if
+ * it separates them. Otherwise, if the box is pushed out along the
+ * axis less than the best found so far, the axis becomes the best.
+ * An axis that would push the box behind the triangle can't be the
+ * best, since the triangle is one sided.
+ */
+static inline bool tryTriangleAxis(
+    const CollisionBox &box,
+    const Vector3 *corners,
+    const Vector3 &triangleNormal,
+    Vector3 axis,
+    unsigned index,
+    real &bestPenetration,
+    unsigned &best,
+    Vector3 &bestNormal
+    )
+{
+    // Don't check almost parallel edges
+    if (axis.squareMagnitude() < 0.0001) return true;
+    axis.normalise();
+
+    real centre = axis * box.getAxis(3);
+    real radius = transformToAxis(box, axis);
+    real lowest = axis * corners[0];
+    real highest = lowest;
+    for (unsigned i = 1; i < 3; i++)
+    {
+        real along = axis * corners[i];
+        if (along < lowest) lowest = along;
+        if (along > highest) highest = along;
+    }
+
+    // How far the box would move along the axis, and against it.
+    real up = highest - (centre - radius);
+    real down = (centre + radius) - lowest;
+    if (up < 0 || down < 0) return false;
+
+    if (down < up) axis *= -1;
+    real penetration = std::min(up, down);
+    if (penetration < bestPenetration && axis * triangleNormal >= 0)
+    {
+        bestPenetration = penetration;
+        best = index;
+        bestNormal = axis;
+    }
+    return true;
+}
+
+/*
+ * Contacts of a box with a triangle have these added to the point's
+ * identifier, to tell which face was clipped, or that the edges
+ * touched.
+ */
+static const unsigned MESH_BOX_FACE = 32;
+static const unsigned MESH_EDGES = 64;
+
+/*
+ * The triangle test for a box.
+ */
+static unsigned boxAndTriangle(
+    const CollisionPrimitive &primitive,
+    const Vector3 *corners,
+    const Vector3 &normal,
+    unsigned feature,
+    MeshPoint *points
+    )
+{
+    const CollisionBox &box = (const CollisionBox &)primitive;
+    Vector3 centre = box.getAxis(3);
+
+    // The triangle is one sided, so it leaves alone a box whose centre
+    // is behind it.
+    real height = normal * (centre - corners[0]);
+    if (height < 0) return 0;
+
+    // Find the axis of least penetration: the triangle's normal (0),
+    // the box's axes (1 to 3), or an axis of the box crossed with an
+    // edge of the triangle (4 to 12). The normal points towards the
+    // box.
+    real facePenetration = transformToAxis(box, normal) - height;
+    if (facePenetration < 0) return 0;
+    real pen = facePenetration;
+    unsigned best = 0;
+    Vector3 contactNormal = normal;
+    for (unsigned i = 0; i < 3; i++)
+    {
+        if (!tryTriangleAxis(box, corners, normal, box.getAxis(i),
+                             1 + i, pen, best, contactNormal))
+        {
+            return 0;
+        }
+    }
+    for (unsigned i = 0; i < 3; i++)
+    {
+        for (unsigned j = 0; j < 3; j++)
+        {
+            Vector3 edge = corners[(j+1) % 3] - corners[j];
+            edge.normalise();
+            if (!tryTriangleAxis(box, corners, normal, box.getAxis(i) % edge,
+                                 4 + i*3 + j, pen, best, contactNormal))
+            {
+                return 0;
+            }
+        }
+    }
+
+    // As with two boxes, keep to the triangle's face unless another
+    // axis is clearly better, so a box resting on the mesh settles.
+    if (best != 0 &&
+        pen >= facePenetration * EDGE_PREFERENCE - EDGE_SLOP)
+    {
+        best = 0;
+        pen = facePenetration;
+        contactNormal = normal;
+    }
+
+    if (best >= 4)
+    {
+        // An edge of the box crosses an edge of the triangle. Use the
+        // edge of the box nearest the triangle along the normal.
+        unsigned axis = (best - 4) / 3;
+        unsigned j = (best - 4) % 3;
+        Vector3 middle = centre;
+        for (unsigned i = 0; i < 3; i++)
+        {
+            if (i == axis) continue;
+            Vector3 direction = box.getAxis(i);
+            real side = direction * contactNormal > 0 ? -1 : 1;
+            middle += direction * (box.halfSize[i] * side);
+        }
+        Vector3 along = box.getAxis(axis) * box.halfSize[axis];
+
+        real onBox, onTriangle;
+        nearestOnSegments(middle - along, middle + along,
+                          corners[j], corners[(j+1) % 3],
+                          onBox, onTriangle);
+        Vector3 boxPoint = middle - along + along * (onBox * 2);
+        Vector3 trianglePoint = corners[j] +
+            (corners[(j+1) % 3] - corners[j]) * onTriangle;
+
+        points->normal = contactNormal;
+        points->position = (boxPoint + trianglePoint) * (real)0.5;
+        points->penetration = pen;
+        points->feature = feature + MESH_EDGES + best - 4;
+        return 1;
+    }
+
+    // Otherwise the face of the triangle or the box is the reference
+    // face, and the other is clipped against its sides.
+    ClipPoint polygon[2][MAX_CLIP_POINTS];
+    unsigned count = 0;
+    unsigned current = 0;
+    Vector3 faceNormal;
+    real faceOffset;
+    if (best == 0)
+    {
+        // The box touches the triangle with the face facing most
+        // against its normal.
+        unsigned incidentAxis = 0;
+        real facing = 0;
+        for (unsigned i = 0; i < 3; i++)
+        {
+            real along = box.getAxis(i) * normal;
+            if (real_abs(along) > real_abs(facing))
+            {
+                facing = along;
+                incidentAxis = i;
+            }
+        }
+
+        unsigned u = (incidentAxis+1) % 3;
+        unsigned v = (incidentAxis+2) % 3;
+        const real signU[4] = { 1, -1, -1, 1 };
+        const real signV[4] = { 1, 1, -1, -1 };
+        for (unsigned i = 0; i < 4; i++)
+        {
+            Vector3 corner;
+            corner[incidentAxis] = facing > 0 ?
+                -box.halfSize[incidentAxis] :
+                box.halfSize[incidentAxis];
+            corner[u] = box.halfSize[u] * signU[i];
+            corner[v] = box.halfSize[v] * signV[i];
+            polygon[0][i].position = box.getTransform() * corner;
+            polygon[0][i].id = i;
+            polygon[0][i].edge = i;
+        }
+        count = 4;
+
+        // The sides of the triangle face outwards from its edges.
+        for (unsigned side = 0; side < 3 && count > 0; side++)
+        {
+            Vector3 direction =
+                (corners[(side+1) % 3] - corners[side]) % normal;
+            real offset = direction * corners[side];
+            count = clipPolygon(polygon[current], count, direction, offset,
+                                side, polygon[1-current]);
+            current = 1-current;
+        }
+
+        faceNormal = normal;
+        faceOffset = normal * corners[0];
+    }
+    else
+    {
+        // The triangle touches the box's face, whose normal points
+        // away from the box, towards the triangle.
+        unsigned axis = best - 1;
+        for (unsigned i = 0; i < 3; i++)
+        {
+            polygon[0][i].position = corners[i];
+            polygon[0][i].id = i;
+            polygon[0][i].edge = i;
+        }
+        count = 3;
+
+        for (unsigned side = 0; side < 4 && count > 0; side++)
+        {
+            unsigned sideAxis = side < 2 ? (axis+1) % 3 : (axis+2) % 3;
+            Vector3 direction = box.getAxis(sideAxis);
+            if (side & 1) direction *= -1;
+            real offset = direction * centre + box.halfSize[sideAxis];
+            count = clipPolygon(polygon[current], count, direction, offset,
+                                side, polygon[1-current]);
+            current = 1-current;
+        }
+
+        faceNormal = contactNormal * -1;
+        faceOffset = faceNormal * centre + box.halfSize[axis];
+        feature += MESH_BOX_FACE;
+    }
+
+    // Keep the points below the reference face. For the triangle,
+    // these are the points behind it.
+    const ClipPoint *clipped = polygon[current];
+    ClipPoint kept[MAX_CLIP_POINTS];
+    real depth[MAX_CLIP_POINTS];
+    unsigned pointCount = 0;
+    for (unsigned i = 0; i < count; i++)
+    {
+        real below = faceOffset - faceNormal * clipped[i].position;
+        if (below < 0) continue;
+        kept[pointCount] = clipped[i];
+        depth[pointCount] = below;
+        pointCount++;
+    }
+    if (pointCount == 0) return 0;
+
+    unsigned chosen[MAX_CLIPPED_CONTACTS];
+    pointCount = reduceClipPoints(kept, depth, pointCount,
+                                  contactNormal, chosen);
+    for (unsigned i = 0; i < pointCount; i++)
+    {
+        MeshPoint &point = points[i];
+        point.normal = contactNormal;
+        point.position = kept[chosen[i]].position;
+        point.penetration = depth[chosen[i]];
+        point.feature = feature + kept[chosen[i]].id;
+    }
+    return pointCount;
+}
+
+unsigned CollisionDetector::sphereAndTriangleMesh(
+    const CollisionSphere &sphere,
+    const CollisionTriangleMesh &mesh,
+    CollisionData *data
+    )
+{
+    Vector3 centre = sphere.getAxis(3);
+    Vector3 extent(sphere.radius, sphere.radius, sphere.radius);
+    BoundingBox bounds(centre - extent, centre + extent);
+    return collideWithMesh(sphere, bounds, mesh, sphereAndTriangle, data);
+}
+
+unsigned CollisionDetector::capsuleAndTriangleMesh(
+    const CollisionCapsule &capsule,
+    const CollisionTriangleMesh &mesh,
+    CollisionData *data
+    )
+{
+    Vector3 start = capsule.getEnd(0);
+    Vector3 end = capsule.getEnd(1);
+    Vector3 extent(capsule.radius, capsule.radius, capsule.radius);
+    BoundingBox bounds(BoundingBox(start - extent, start + extent),
+                       BoundingBox(end - extent, end + extent));
+    return collideWithMesh(capsule, bounds, mesh, capsuleAndTriangle, data);
+}
+
+unsigned CollisionDetector::boxAndTriangleMesh(
+    const CollisionBox &box,
+    const CollisionTriangleMesh &mesh,
+    CollisionData *data
+    )
+{
+    BoundingBox bounds(box.halfSize, box.getTransform());
+    return collideWithMesh(box, bounds, mesh, boxAndTriangle, data);
+}
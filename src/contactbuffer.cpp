@@ -0,0 +1,95 @@
+/*
+ * Implementation file for the growable contact buffers.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+#include <algorithm>
+#include <cyclone/contactbuffer.h>
+
+using namespace cyclone;
+
+ContactArena::ContactArena(unsigned chunkSize, FrameArena *frameArena)
+:
+ownArena(NULL), frameArena(frameArena), chunkSize(chunkSize)
+{
+    if (!frameArena)
+    {
+        ownArena = new FrameArena(chunkSize * sizeof(Contact) * 4);
+        ContactArena::frameArena = ownArena;
+    }
+}
+
+ContactArena::~ContactArena()
+{
+    delete ownArena;
+}
+
+Contact *ContactArena::allocate(unsigned count, unsigned &size)
+{
+    size = std::max(count, chunkSize);
+
+    // Chunks can be large, and only the contacts written into them by
+    // generators are ever read, so they aren't constructed.
+    return (Contact*)frameArena->allocate(sizeof(Contact) * size,
+                                          alignof(Contact));
+}
+
+void ContactArena::reset()
+{
+    if (ownArena) ownArena->reset();
+}
+
+void ContactArena::setChunkSize(unsigned chunkSize)
+{
+    ContactArena::chunkSize = chunkSize;
+}
+
+ContactBuffer::ContactBuffer(ContactArena *arena)
+:
+arena(arena), total(0)
+{
+}
+
+void ContactBuffer::clear()
+{
+    chunks.clear();
+    total = 0;
+}
+
+Contact *ContactBuffer::reserve(unsigned count)
+{
+    if (chunks.empty() || getRoom() < count)
+    {
+        Chunk chunk;
+        chunk.contacts = arena->allocate(count, chunk.size);
+        chunk.count = 0;
+        chunks.push_back(chunk);
+    }
+
+    Chunk &last = chunks.back();
+    return last.contacts + last.count;
+}
+
+void ContactBuffer::append(ContactBuffer &other)
+{
+    chunks.insert(chunks.end(), other.chunks.begin(), other.chunks.end());
+    total += other.total;
+    other.clear();
+}
+
+void ContactBuffer::copyTo(Contact *destination) const
+{
+    for (unsigned i = 0; i < chunks.size(); i++)
+    {
+        destination = std::copy(chunks[i].contacts,
+                                chunks[i].contacts + chunks[i].count,
+                                destination);
+    }
+}
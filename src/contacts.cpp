@@ -13,18 +13,21 @@
 #include <cyclone/contacts.h>
 #include <memory.h>
 #include <assert.h>
+#include <algorithm>
 
 using namespace cyclone;
 
 // Contact implementation
 
 void Contact::setBodyData(RigidBody* one, RigidBody *two,
-                          real friction, real restitution)
+                          real friction, real restitution,
+                          unsigned feature)
 {
     Contact::body[0] = one;
     Contact::body[1] = two;
     Contact::friction = friction;
     Contact::restitution = restitution;
+    Contact::feature = feature;
 }
 
 void Contact::matchAwakeState()
@@ -507,11 +510,102 @@ void Contact::applyPositionChange(Vector3 linearChange[2],
 
 
 
+// Contact queue implementation
+
+void ContactQueue::reset(unsigned count)
+{
+    heap.resize(count);
+    position.resize(count);
+    key.assign(count, 0);
+    for (unsigned i = 0; i < count; i++)
+    {
+        heap[i] = i;
+        position[i] = i;
+    }
+}
+
+/*
+ * Returns true if the contact at heap position a should be resolved
+ * before the one at b. Ties go to the lower contact index, so the
+ * queue picks exactly the same contact as a linear scan would.
+ */
+bool ContactQueue::before(unsigned a, unsigned b) const
+{
+    real keyA = key[heap[a]];
+    real keyB = key[heap[b]];
+    if (keyA != keyB) return keyA > keyB;
+    return heap[a] < heap[b];
+}
+
+void ContactQueue::swapEntries(unsigned a, unsigned b)
+{
+    unsigned temp = heap[a];
+    heap[a] = heap[b];
+    heap[b] = temp;
+
+    position[heap[a]] = a;
+    position[heap[b]] = b;
+}
+
+void ContactQueue::siftUp(unsigned at)
+{
+    while (at > 0)
+    {
+        unsigned parent = (at - 1) / 2;
+        if (!before(at, parent)) break;
+        swapEntries(parent, at);
+        at = parent;
+    }
+}
+
+void ContactQueue::siftDown(unsigned at)
+{
+    unsigned count = (unsigned)heap.size();
+    while (true)
+    {
+        unsigned largest = at;
+        unsigned left = at*2 + 1;
+        unsigned right = left + 1;
+
+        if (left < count && before(left, largest)) largest = left;
+        if (right < count && before(right, largest)) largest = right;
+        if (largest == at) break;
+
+        swapEntries(at, largest);
+        at = largest;
+    }
+}
+
+void ContactQueue::heapify()
+{
+    // Sift down every non-leaf entry, from the last one upwards.
+    for (unsigned i = (unsigned)heap.size() / 2; i > 0; i--)
+    {
+        siftDown(i - 1);
+    }
+}
+
+void ContactQueue::update(unsigned index, real value)
+{
+    key[index] = value;
+
+    // Only one of these will move the entry.
+    siftUp(position[index]);
+    siftDown(position[index]);
+}
+
+
+
+
 // Contact resolver implementation
 
+const unsigned ContactResolver::NO_BODY;
+
 ContactResolver::ContactResolver(unsigned iterations,
                                  real velocityEpsilon,
                                  real positionEpsilon)
+:
+useHeap(false)
 {
     setIterations(iterations, iterations);
     setEpsilon(velocityEpsilon, positionEpsilon);
@@ -521,11 +615,18 @@ ContactResolver::ContactResolver(unsigned velocityIterations,
                                  unsigned positionIterations,
                                  real velocityEpsilon,
                                  real positionEpsilon)
+:
+useHeap(false)
 {
-    setIterations(velocityIterations);
+    setIterations(velocityIterations, positionIterations);
     setEpsilon(velocityEpsilon, positionEpsilon);
 }
 
+ContactResolver *ContactResolver::clone() const
+{
+    return new ContactResolver(*this);
+}
+
 void ContactResolver::setIterations(unsigned iterations)
 {
     setIterations(iterations, iterations);
@@ -545,6 +646,11 @@ void ContactResolver::setEpsilon(real velocityEpsilon,
     ContactResolver::positionEpsilon = positionEpsilon;
 }
 
+void ContactResolver::setUseHeap(bool useHeap)
+{
+    ContactResolver::useHeap = useHeap;
+}
+
 void ContactResolver::resolveContacts(Contact *contacts,
                                       unsigned numContacts,
                                       real duration)
@@ -574,6 +680,75 @@ void ContactResolver::prepareContacts(Contact* contacts,
         // Calculate the internal contact data (inertia, basis, etc).
         contact->calculateInternals(duration);
     }
+
+    // Find which contacts share bodies.
+    buildAdjacency(contacts, numContacts);
+}
+
+void ContactResolver::buildAdjacency(Contact *c, unsigned numContacts)
+{
+    // Collect every slot that has a body, and sort them so that slots
+    // for the same body end up next to each other.
+    slotSortBuffer.clear();
+    for (unsigned i = 0; i < numContacts; i++)
+    {
+        for (unsigned b = 0; b < 2; b++) if (c[i].body[b])
+        {
+            slotSortBuffer.push_back(std::make_pair(c[i].body[b], i*2 + b));
+        }
+    }
+    std::sort(slotSortBuffer.begin(), slotSortBuffer.end());
+
+    // Number the bodies, and build the offsets into the slot list.
+    slotBody.assign(numContacts*2, NO_BODY);
+    bodySlots.resize(slotSortBuffer.size());
+    bodySlotStart.clear();
+    numBodies = 0;
+    for (unsigned e = 0; e < slotSortBuffer.size(); e++)
+    {
+        if (e == 0 || slotSortBuffer[e].first != slotSortBuffer[e-1].first)
+        {
+            bodySlotStart.push_back(e);
+            numBodies++;
+        }
+        bodySlots[e] = slotSortBuffer[e].second;
+        slotBody[slotSortBuffer[e].second] = numBodies - 1;
+    }
+    bodySlotStart.push_back((unsigned)slotSortBuffer.size());
+}
+
+void ContactResolver::findAffectedSlots(unsigned index)
+{
+    affectedSlots.clear();
+
+    // Find the runs of slots for each of the contact's bodies.
+    unsigned run[2], runEnd[2];
+    for (unsigned d = 0; d < 2; d++)
+    {
+        unsigned body = slotBody[index*2 + d];
+        if (body == NO_BODY)
+        {
+            run[d] = runEnd[d] = 0;
+        }
+        else
+        {
+            run[d] = bodySlotStart[body];
+            runEnd[d] = bodySlotStart[body+1];
+        }
+    }
+
+    // Merge the two runs, so the slots are visited in the same order
+    // as a scan through the whole contact array would visit them.
+    while (run[0] < runEnd[0] || run[1] < runEnd[1])
+    {
+        unsigned d;
+        if (run[1] >= runEnd[1]) d = 0;
+        else if (run[0] >= runEnd[0]) d = 1;
+        else d = (bodySlots[run[0]] <= bodySlots[run[1]]) ? 0 : 1;
+
+        affectedSlots.push_back((bodySlots[run[d]] << 1) | d);
+        run[d]++;
+    }
 }
 
 void ContactResolver::adjustVelocities(Contact *c,
@@ -583,19 +758,37 @@ void ContactResolver::adjustVelocities(Contact *c,
     Vector3 velocityChange[2], rotationChange[2];
     Vector3 deltaVel;
 
+    // If we're using the heap, fill it with the current severities.
+    if (useHeap)
+    {
+        queue.reset(numContacts);
+        for (unsigned i = 0; i < numContacts; i++)
+        {
+            queue.setKey(i, c[i].desiredDeltaVelocity);
+        }
+        queue.heapify();
+    }
+
     // iteratively handle impacts in order of severity.
     velocityIterationsUsed = 0;
     while (velocityIterationsUsed < velocityIterations)
     {
         // Find contact with maximum magnitude of probable velocity change.
-        real max = velocityEpsilon;
         unsigned index = numContacts;
-        for (unsigned i = 0; i < numContacts; i++)
+        if (useHeap)
         {
-            if (c[i].desiredDeltaVelocity > max)
+            if (queue.topKey() > velocityEpsilon) index = queue.top();
+        }
+        else
+        {
+            real max = velocityEpsilon;
+            for (unsigned i = 0; i < numContacts; i++)
             {
-                max = c[i].desiredDeltaVelocity;
-                index = i;
+                if (c[i].desiredDeltaVelocity > max)
+                {
+                    max = c[i].desiredDeltaVelocity;
+                    index = i;
+                }
             }
         }
         if (index == numContacts) break;
@@ -608,30 +801,29 @@ void ContactResolver::adjustVelocities(Contact *c,
 
         // With the change in velocity of the two bodies, the update of
         // contact velocities means that some of the relative closing
-        // velocities need recomputing.
-        for (unsigned i = 0; i < numContacts; i++)
+        // velocities need recomputing. Only contacts that share a body
+        // with the one we resolved can have changed.
+        findAffectedSlots(index);
+        for (unsigned s = 0; s < affectedSlots.size(); s++)
         {
-            // Check each body in the contact
-            for (unsigned b = 0; b < 2; b++) if (c[i].body[b])
+            unsigned i = affectedSlots[s] >> 2;
+            unsigned b = (affectedSlots[s] >> 1) & 1;
+            unsigned d = affectedSlots[s] & 1;
+
+            deltaVel = velocityChange[d] +
+                rotationChange[d].vectorProduct(
+                    c[i].relativeContactPosition[b]);
+
+            // The sign of the change is negative if we're dealing
+            // with the second body in a contact.
+            c[i].contactVelocity +=
+                c[i].contactToWorld.transformTranspose(deltaVel)
+                * (b?-1:1);
+            c[i].calculateDesiredDeltaVelocity(duration);
+
+            if (useHeap)
             {
-                // Check for a match with each body in the newly
-                // resolved contact
-                for (unsigned d = 0; d < 2; d++)
-                {
-                    if (c[i].body[b] == c[index].body[d])
-                    {
-                        deltaVel = velocityChange[d] +
-                            rotationChange[d].vectorProduct(
-                                c[i].relativeContactPosition[b]);
-
-                        // The sign of the change is negative if we're dealing
-                        // with the second body in a contact.
-                        c[i].contactVelocity +=
-                            c[i].contactToWorld.transformTranspose(deltaVel)
-                            * (b?-1:1);
-                        c[i].calculateDesiredDeltaVelocity(duration);
-                    }
-                }
+                queue.update(i, c[i].desiredDeltaVelocity);
             }
         }
         velocityIterationsUsed++;
@@ -647,6 +839,17 @@ void ContactResolver::adjustPositions(Contact *c,
     real max;
     Vector3 deltaPosition;
 
+    // If we're using the heap, fill it with the current penetrations.
+    if (useHeap)
+    {
+        queue.reset(numContacts);
+        for (i = 0; i < numContacts; i++)
+        {
+            queue.setKey(i, c[i].penetration);
+        }
+        queue.heapify();
+    }
+
     // iteratively resolve interpenetrations in order of severity.
     positionIterationsUsed = 0;
     while (positionIterationsUsed < positionIterations)
@@ -654,12 +857,23 @@ void ContactResolver::adjustPositions(Contact *c,
         // Find biggest penetration
         max = positionEpsilon;
         index = numContacts;
-        for (i=0; i<numContacts; i++)
+        if (useHeap)
         {
-            if (c[i].penetration > max)
+            if (queue.topKey() > max)
             {
-                max = c[i].penetration;
-                index = i;
+                index = queue.top();
+                max = queue.topKey();
+            }
+        }
+        else
+        {
+            for (i=0; i<numContacts; i++)
+            {
+                if (c[i].penetration > max)
+                {
+                    max = c[i].penetration;
+                    index = i;
+                }
             }
         }
         if (index == numContacts) break;
@@ -674,31 +888,29 @@ void ContactResolver::adjustPositions(Contact *c,
             max);
 
         // Again this action may have changed the penetration of other
-        // bodies, so we update contacts.
-        for (i = 0; i < numContacts; i++)
+        // bodies, so we update the contacts that share a body with it.
+        findAffectedSlots(index);
+        for (unsigned s = 0; s < affectedSlots.size(); s++)
         {
-            // Check each body in the contact
-            for (unsigned b = 0; b < 2; b++) if (c[i].body[b])
+            i = affectedSlots[s] >> 2;
+            unsigned b = (affectedSlots[s] >> 1) & 1;
+            unsigned d = affectedSlots[s] & 1;
+
+            deltaPosition = linearChange[d] +
+                angularChange[d].vectorProduct(
+                    c[i].relativeContactPosition[b]);
+
+            // The sign of the change is positive if we're
+            // dealing with the second body in a contact
+            // and negative otherwise (because we're
+            // subtracting the resolution)..
+            c[i].penetration +=
+                deltaPosition.scalarProduct(c[i].contactNormal)
+                * (b?1:-1);
+
+            if (useHeap)
             {
-                // Check for a match with each body in the newly
-                // resolved contact
-                for (unsigned d = 0; d < 2; d++)
-                {
-                    if (c[i].body[b] == c[index].body[d])
-                    {
-                        deltaPosition = linearChange[d] +
-                            angularChange[d].vectorProduct(
-                                c[i].relativeContactPosition[b]);
-
-                        // The sign of the change is positive if we're
-                        // dealing with the second body in a contact
-                        // and negative otherwise (because we're
-                        // subtracting the resolution)..
-                        c[i].penetration +=
-                            deltaPosition.scalarProduct(c[i].contactNormal)
-                            * (b?1:-1);
-                    }
-                }
+                queue.update(i, c[i].penetration);
             }
         }
         positionIterationsUsed++;
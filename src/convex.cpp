@@ -0,0 +1,783 @@
+/*
+ * Implementation file for the convex shape queries.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+#include <algorithm>
+#include <cyclone/convex.h>
+
+using namespace cyclone;
+
+/*
+ * The most steps GJK takes. It usually needs fewer than ten, but can
+ * creep towards the answer between curved shapes.
+ */
+static const unsigned GJK_ITERATIONS = 64;
+
+/*
+ * GJK stops when a step gets the simplex no nearer to the origin than
+ * this fraction of the distance, squared.
+ */
+static const real GJK_TOLERANCE = real_sqrt(real_epsilon);
+
+/*
+ * GJK takes the shapes to touch when the simplex is this near the
+ * origin, as a fraction of the size of the difference.
+ */
+static const real GJK_TOUCHING = real_epsilon * 64;
+
+/*
+ * The most points and faces the expanding polytope can have, and the
+ * most steps EPA takes.
+ */
+static const unsigned EPA_MAX_VERTICES = 128;
+static const unsigned EPA_MAX_FACES = 256;
+static const unsigned EPA_ITERATIONS = 112;
+
+/*
+ * EPA stops when the support point beyond the nearest face is no
+ * further out than this fraction of the size of the shapes.
+ */
+static const real EPA_TOLERANCE = (real)0.0001;
+
+/*
+ * The directions the search tries when it has nothing better to go
+ * on.
+ */
+static const Vector3 AXES[3] = {
+    Vector3(1,0,0), Vector3(0,1,0), Vector3(0,0,1)
+};
+
+Vector3 SphereShape::support(const Vector3 &direction) const
+{
+    real size = direction.magnitude();
+    if (size <= 0) return centre;
+    return centre + direction * (radius / size);
+}
+
+Vector3 CapsuleShape::support(const Vector3 &direction) const
+{
+    // Take the end further along, then go out by the radius.
+    const Vector3 &furthest = (end - start) * direction > 0 ? end : start;
+    real size = direction.magnitude();
+    if (size <= 0) return furthest;
+    return furthest + direction * (radius / size);
+}
+
+Vector3 BoxShape::support(const Vector3 &direction) const
+{
+    // Pick the corner on the side of each axis the direction points.
+    Vector3 local = box.getTransform().transformInverseDirection(direction);
+    Vector3 corner(
+        local.x < 0 ? -box.halfSize.x : box.halfSize.x,
+        local.y < 0 ? -box.halfSize.y : box.halfSize.y,
+        local.z < 0 ? -box.halfSize.z : box.halfSize.z
+        );
+    return box.getTransform().transform(corner);
+}
+
+/*
+ * Holds one point of the difference between the shapes, with the
+ * points of each shape it came from.
+ */
+struct SimplexVertex
+{
+    Vector3 one;
+    Vector3 two;
+    Vector3 point;
+};
+
+/*
+ * Holds the GJK simplex: up to four points of the difference, with
+ * the weights that give the point of the simplex nearest the origin.
+ */
+struct Simplex
+{
+    SimplexVertex vertices[4];
+    real weights[4];
+    unsigned count;
+};
+
+/*
+ * Returns the point of the difference between the shapes furthest in
+ * the given direction.
+ */
+static inline SimplexVertex supportVertex(
+    const ConvexShape &one,
+    const ConvexShape &two,
+    const Vector3 &direction
+    )
+{
+    SimplexVertex vertex;
+    vertex.one = one.support(direction);
+    vertex.two = two.support(direction * -1);
+    vertex.point = vertex.one - vertex.two;
+    return vertex;
+}
+
+/*
+ * Keeps only the given vertices of the simplex, with the given
+ * weights.
+ */
+static void keepVertices(Simplex &simplex, unsigned count,
+                         const unsigned *indices, const real *weights)
+{
+    SimplexVertex kept[4];
+    for (unsigned i = 0; i < count; i++)
+    {
+        kept[i] = simplex.vertices[indices[i]];
+    }
+    for (unsigned i = 0; i < count; i++)
+    {
+        simplex.vertices[i] = kept[i];
+        simplex.weights[i] = weights[i];
+    }
+    simplex.count = count;
+}
+
+/*
+ * Finds the point of the segment between the given vertices of the
+ * simplex nearest the origin, filling in the vertices it depends on
+ * and their weights, and returning how many there are.
+ */
+static unsigned closestOnSegment(const Simplex &simplex,
+                                 unsigned ia, unsigned ib,
+                                 unsigned *indices, real *weights)
+{
+    const Vector3 &a = simplex.vertices[ia].point;
+    Vector3 ab = simplex.vertices[ib].point - a;
+    real lengthSquared = ab.squareMagnitude();
+    real t = lengthSquared > 0 ? (ab * a * -1) / lengthSquared : 1;
+    if (t <= 0)
+    {
+        indices[0] = ia; weights[0] = 1;
+        return 1;
+    }
+    if (t >= 1)
+    {
+        indices[0] = ib; weights[0] = 1;
+        return 1;
+    }
+    indices[0] = ia; weights[0] = 1 - t;
+    indices[1] = ib; weights[1] = t;
+    return 2;
+}
+
+/*
+ * Finds the point of the triangle with the given vertices of the
+ * simplex nearest the origin, filling in the vertices it depends on
+ * and their weights, and returning how many there are. This follows
+ * the Voronoi region tests of Ericson's Real-Time Collision
+ * Detection.
+ */
+static unsigned closestOnTriangle(const Simplex &simplex,
+                                  unsigned ia, unsigned ib, unsigned ic,
+                                  unsigned *indices, real *weights)
+{
+    const Vector3 &a = simplex.vertices[ia].point;
+    const Vector3 &b = simplex.vertices[ib].point;
+    const Vector3 &c = simplex.vertices[ic].point;
+    Vector3 ab = b - a;
+    Vector3 ac = c - a;
+
+    // Check the region beyond a.
+    real d1 = ab * a * -1;
+    real d2 = ac * a * -1;
+    if (d1 <= 0 && d2 <= 0)
+    {
+        indices[0] = ia; weights[0] = 1;
+        return 1;
+    }
+
+    // Beyond b.
+    real d3 = ab * b * -1;
+    real d4 = ac * b * -1;
+    if (d3 >= 0 && d4 <= d3)
+    {
+        indices[0] = ib; weights[0] = 1;
+        return 1;
+    }
+
+    // Beyond ab.
+    real vc = d1*d4 - d3*d2;
+    if (vc <= 0 && d1 >= 0 && d3 <= 0)
+    {
+        real v = d1 / (d1 - d3);
+        indices[0] = ia; weights[0] = 1 - v;
+        indices[1] = ib; weights[1] = v;
+        return 2;
+    }
+
+    // Beyond c.
+    real d5 = ab * c * -1;
+    real d6 = ac * c * -1;
+    if (d6 >= 0 && d5 <= d6)
+    {
+        indices[0] = ic; weights[0] = 1;
+        return 1;
+    }
+
+    // Beyond ac.
+    real vb = d5*d2 - d1*d6;
+    if (vb <= 0 && d2 >= 0 && d6 <= 0)
+    {
+        real w = d2 / (d2 - d6);
+        indices[0] = ia; weights[0] = 1 - w;
+        indices[1] = ic; weights[1] = w;
+        return 2;
+    }
+
+    // Beyond bc.
+    real va = d3*d6 - d5*d4;
+    if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0)
+    {
+        real w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+        indices[0] = ib; weights[0] = 1 - w;
+        indices[1] = ic; weights[1] = w;
+        return 2;
+    }
+
+    // Inside the face. A triangle too thin to have an area has no
+    // inside, so the nearest point is on one of its edges.
+    real denominator = va + vb + vc;
+    if (denominator <= 0)
+    {
+        const unsigned edges[3][2] = {{ia, ib}, {ib, ic}, {ic, ia}};
+        real bestDistance = REAL_MAX;
+        unsigned bestCount = 0;
+        for (unsigned e = 0; e < 3; e++)
+        {
+            unsigned edgeIndices[2];
+            real edgeWeights[2];
+            unsigned count = closestOnSegment(simplex, edges[e][0], edges[e][1],
+                                              edgeIndices, edgeWeights);
+            Vector3 point;
+            for (unsigned i = 0; i < count; i++)
+            {
+                point += simplex.vertices[edgeIndices[i]].point * edgeWeights[i];
+            }
+            if (point.squareMagnitude() < bestDistance)
+            {
+                bestDistance = point.squareMagnitude();
+                bestCount = count;
+                for (unsigned i = 0; i < count; i++)
+                {
+                    indices[i] = edgeIndices[i];
+                    weights[i] = edgeWeights[i];
+                }
+            }
+        }
+        return bestCount;
+    }
+    real v = vb / denominator;
+    real w = vc / denominator;
+    indices[0] = ia; weights[0] = 1 - v - w;
+    indices[1] = ib; weights[1] = v;
+    indices[2] = ic; weights[2] = w;
+    return 3;
+}
+
+/*
+ * Returns the point given by the weights of the simplex.
+ */
+static inline Vector3 weightedPoint(const Simplex &simplex)
+{
+    Vector3 point;
+    for (unsigned i = 0; i < simplex.count; i++)
+    {
+        point += simplex.vertices[i].point * simplex.weights[i];
+    }
+    return point;
+}
+
+/*
+ * Reduces the simplex to the fewest vertices that hold its point
+ * nearest the origin, and sets their weights. Returns false if the
+ * simplex is a tetrahedron holding the origin, in which case it is
+ * left as it is.
+ */
+static bool reduceSimplex(Simplex &simplex)
+{
+    unsigned indices[3];
+    real weights[3];
+
+    switch (simplex.count)
+    {
+    case 1:
+        simplex.weights[0] = 1;
+        return true;
+
+    case 2:
+        {
+            unsigned count = closestOnSegment(simplex, 0, 1,
+                                              indices, weights);
+            keepVertices(simplex, count, indices, weights);
+            return true;
+        }
+
+    case 3:
+        {
+            unsigned count = closestOnTriangle(simplex, 0, 1, 2,
+                                               indices, weights);
+            keepVertices(simplex, count, indices, weights);
+            return true;
+        }
+
+    default:
+        {
+            // Check each face for the origin lying outside it, on the
+            // other side from the fourth vertex. The origin lies
+            // inside if it is outside none. A flat tetrahedron has
+            // no inside, so all its faces are tried.
+            static const unsigned faces[4][4] = {
+                {0,1,2,3}, {0,2,3,1}, {0,3,1,2}, {1,3,2,0}
+            };
+            real bestDistance = REAL_MAX;
+            unsigned bestCount = 0;
+            unsigned bestIndices[3];
+            real bestWeights[3];
+            for (unsigned f = 0; f < 4; f++)
+            {
+                const Vector3 &a = simplex.vertices[faces[f][0]].point;
+                const Vector3 &b = simplex.vertices[faces[f][1]].point;
+                const Vector3 &c = simplex.vertices[faces[f][2]].point;
+                const Vector3 &d = simplex.vertices[faces[f][3]].point;
+                Vector3 normal = (b - a) % (c - a);
+                real signOrigin = a * normal * -1;
+                real signOpposite = (d - a) * normal;
+                if (signOrigin * signOpposite > 0) continue;
+
+                unsigned count = closestOnTriangle(
+                    simplex, faces[f][0], faces[f][1], faces[f][2],
+                    indices, weights);
+                Vector3 point;
+                for (unsigned i = 0; i < count; i++)
+                {
+                    point += simplex.vertices[indices[i]].point * weights[i];
+                }
+                real distance = point.squareMagnitude();
+                if (distance < bestDistance)
+                {
+                    bestDistance = distance;
+                    bestCount = count;
+                    for (unsigned i = 0; i < count; i++)
+                    {
+                        bestIndices[i] = indices[i];
+                        bestWeights[i] = weights[i];
+                    }
+                }
+            }
+            if (bestCount == 0) return false;
+            keepVertices(simplex, bestCount, bestIndices, bestWeights);
+            return true;
+        }
+    }
+}
+
+/*
+ * Runs GJK on the two shapes, leaving the final simplex. Returns true
+ * if the shapes overlap or touch. If they don't, the simplex's
+ * weights give its point nearest the origin. If stopAtSeparation is
+ * set, it returns as soon as it knows they don't overlap, which is
+ * usually well before it has found how far apart they are.
+ */
+static bool runGJK(const ConvexShape &one, const ConvexShape &two,
+                   Simplex &simplex, bool stopAtSeparation)
+{
+    // Start from the support point in the direction between the
+    // shapes.
+    Vector3 direction = two.getCentre() - one.getCentre();
+    if (direction.squareMagnitude() <= 0) direction = Vector3(1, 0, 0);
+    simplex.vertices[0] = supportVertex(one, two, direction);
+    simplex.weights[0] = 1;
+    simplex.count = 1;
+
+    Vector3 closest = simplex.vertices[0].point;
+    real distanceSquared = closest.squareMagnitude();
+    real scale = distanceSquared;
+
+    for (unsigned iteration = 0; iteration < GJK_ITERATIONS; iteration++)
+    {
+        // The simplex holds the origin, so the shapes touch.
+        if (distanceSquared <= GJK_TOUCHING * GJK_TOUCHING * scale)
+        {
+            return true;
+        }
+
+        // Find the point of the difference furthest towards the
+        // origin.
+        SimplexVertex vertex = supportVertex(one, two, closest * -1);
+        real progress = closest * vertex.point;
+        if (stopAtSeparation && progress > 0) return false;
+
+        // If it is no nearer the origin than the simplex, the
+        // simplex's point is the nearest.
+        if (distanceSquared - progress <= GJK_TOLERANCE * distanceSquared)
+        {
+            return false;
+        }
+
+        // Add it, unless it is there already, which only happens
+        // when rounding has stopped progress.
+        for (unsigned i = 0; i < simplex.count; i++)
+        {
+            if ((simplex.vertices[i].point - vertex.point).squareMagnitude()
+                <= GJK_TOLERANCE * GJK_TOLERANCE * scale)
+            {
+                return false;
+            }
+        }
+        simplex.vertices[simplex.count++] = vertex;
+        real size = vertex.point.squareMagnitude();
+        if (size > scale) scale = size;
+
+        if (!reduceSimplex(simplex)) return true;
+
+        // Stop if rounding has stopped the simplex getting nearer.
+        Vector3 next = weightedPoint(simplex);
+        real nextSquared = next.squareMagnitude();
+        if (nextSquared >= distanceSquared) return false;
+        closest = next;
+        distanceSquared = nextSquared;
+    }
+    return false;
+}
+
+/*
+ * Writes the distance result given by the final simplex of GJK.
+ */
+static void fillDistance(const Simplex &simplex, ConvexResult *result)
+{
+    result->pointOne.clear();
+    result->pointTwo.clear();
+    for (unsigned i = 0; i < simplex.count; i++)
+    {
+        result->pointOne += simplex.vertices[i].one * simplex.weights[i];
+        result->pointTwo += simplex.vertices[i].two * simplex.weights[i];
+    }
+
+    // The difference points from the second shape to the first.
+    result->normal = result->pointTwo - result->pointOne;
+    result->distance = result->normal.magnitude();
+    if (result->distance > 0)
+    {
+        result->normal *= ((real)1.0) / result->distance;
+    }
+}
+
+bool ConvexTests::intersect(const ConvexShape &one, const ConvexShape &two)
+{
+    Simplex simplex;
+    return runGJK(one, two, simplex, true);
+}
+
+bool ConvexTests::distance(const ConvexShape &one, const ConvexShape &two,
+                           ConvexResult *result)
+{
+    Simplex simplex;
+    if (runGJK(one, two, simplex, false)) return false;
+    fillDistance(simplex, result);
+    return true;
+}
+
+/*
+ * Holds a face of the expanding polytope.
+ */
+struct PolytopeFace
+{
+    unsigned vertex[3];
+    Vector3 normal;
+    real distance;
+    bool removed;
+};
+
+/*
+ * Holds the polytope EPA expands.
+ */
+struct Polytope
+{
+    SimplexVertex vertices[EPA_MAX_VERTICES];
+    unsigned vertexCount;
+    PolytopeFace faces[EPA_MAX_FACES];
+    unsigned faceCount;
+};
+
+/*
+ * Adds the face with the given vertices, in anticlockwise order seen
+ * from outside. Returns false if there is no room for it.
+ */
+static bool addFace(Polytope &polytope,
+                    unsigned a, unsigned b, unsigned c)
+{
+    if (polytope.faceCount == EPA_MAX_FACES) return false;
+
+    PolytopeFace &face = polytope.faces[polytope.faceCount++];
+    face.vertex[0] = a;
+    face.vertex[1] = b;
+    face.vertex[2] = c;
+    face.removed = false;
+
+    const Vector3 &pa = polytope.vertices[a].point;
+    face.normal = (polytope.vertices[b].point - pa) %
+        (polytope.vertices[c].point - pa);
+    real size = face.normal.magnitude();
+
+    // A face with no area can't be the nearest: it lies along faces
+    // that have one.
+    if (size <= 0)
+    {
+        face.normal.clear();
+        face.distance = REAL_MAX;
+        return true;
+    }
+    face.normal *= ((real)1.0) / size;
+    face.distance = pa * face.normal;
+    return true;
+}
+
+/*
+ * Grows the GJK simplex, which holds the origin, into a tetrahedron,
+ * using support points in directions that leave the simplex. Returns
+ * false if the difference is flat, so that it can't be done.
+ */
+static bool growSimplex(const ConvexShape &one, const ConvexShape &two,
+                        Simplex &simplex, real scale)
+{
+    real tolerance = scale * GJK_TOLERANCE;
+
+    if (simplex.count == 1)
+    {
+        for (unsigned i = 0; i < 6 && simplex.count == 1; i++)
+        {
+            Vector3 direction = AXES[i / 2] * ((i & 1) ? -1 : 1);
+            SimplexVertex vertex = supportVertex(one, two, direction);
+            if ((vertex.point - simplex.vertices[0].point).magnitude()
+                > tolerance)
+            {
+                simplex.vertices[simplex.count++] = vertex;
+            }
+        }
+        if (simplex.count == 1) return false;
+    }
+
+    if (simplex.count == 2)
+    {
+        // Try directions at right angles to the line.
+        Vector3 line = simplex.vertices[1].point - simplex.vertices[0].point;
+        unsigned least = 0;
+        for (unsigned i = 1; i < 3; i++)
+        {
+            if (real_abs(line[i]) < real_abs(line[least])) least = i;
+        }
+        Vector3 across = line % AXES[least];
+        Vector3 directions[4] = {
+            across, across * -1, line % across, (line % across) * -1
+        };
+        for (unsigned i = 0; i < 4 && simplex.count == 2; i++)
+        {
+            SimplexVertex vertex = supportVertex(one, two, directions[i]);
+            Vector3 offset = (vertex.point - simplex.vertices[0].point) % line;
+            if (offset.magnitude() > tolerance * line.magnitude())
+            {
+                simplex.vertices[simplex.count++] = vertex;
+            }
+        }
+        if (simplex.count == 2) return false;
+    }
+
+    if (simplex.count == 3)
+    {
+        // Try both sides of the triangle.
+        const Vector3 &a = simplex.vertices[0].point;
+        Vector3 normal = (simplex.vertices[1].point - a) %
+            (simplex.vertices[2].point - a);
+        real size = normal.magnitude();
+        if (size <= 0) return false;
+        normal *= ((real)1.0) / size;
+        for (unsigned i = 0; i < 2 && simplex.count == 3; i++)
+        {
+            Vector3 direction = normal * (i ? -1 : 1);
+            SimplexVertex vertex = supportVertex(one, two, direction);
+            if (real_abs((vertex.point - a) * normal) > tolerance)
+            {
+                simplex.vertices[simplex.count++] = vertex;
+            }
+        }
+        if (simplex.count == 3) return false;
+    }
+    return true;
+}
+
+bool ConvexTests::penetration(const ConvexShape &one,
+                              const ConvexShape &two,
+                              ConvexResult *result)
+{
+    Simplex simplex;
+    if (!runGJK(one, two, simplex, false))
+    {
+        fillDistance(simplex, result);
+        return false;
+    }
+
+    // Work out the size of the shapes, to scale the tolerances.
+    real scale = 0;
+    for (unsigned i = 0; i < 3; i++)
+    {
+        Vector3 extent = supportVertex(one, two, AXES[i]).point -
+            supportVertex(one, two, AXES[i] * -1).point;
+        if (extent.magnitude() > scale) scale = extent.magnitude();
+    }
+    if (scale <= 0) return false;
+
+    if (!growSimplex(one, two, simplex, scale)) return false;
+
+    // Build the tetrahedron with its faces facing out.
+    Polytope polytope;
+    polytope.vertexCount = 4;
+    polytope.faceCount = 0;
+    for (unsigned i = 0; i < 4; i++)
+    {
+        polytope.vertices[i] = simplex.vertices[i];
+    }
+    Vector3 toFourth = polytope.vertices[3].point - polytope.vertices[0].point;
+    Vector3 normal = (polytope.vertices[1].point - polytope.vertices[0].point) %
+        (polytope.vertices[2].point - polytope.vertices[0].point);
+    if (normal * toFourth > 0)
+    {
+        std::swap(polytope.vertices[1], polytope.vertices[2]);
+    }
+    addFace(polytope, 0, 1, 2);
+    addFace(polytope, 0, 3, 1);
+    addFace(polytope, 0, 2, 3);
+    addFace(polytope, 1, 3, 2);
+
+    PolytopeFace *nearest = NULL;
+    for (unsigned iteration = 0; iteration < EPA_ITERATIONS; iteration++)
+    {
+        // Find the face nearest the origin.
+        nearest = NULL;
+        for (unsigned i = 0; i < polytope.faceCount; i++)
+        {
+            PolytopeFace &face = polytope.faces[i];
+            if (face.removed) continue;
+            if (!nearest || face.distance < nearest->distance)
+            {
+                nearest = &face;
+            }
+        }
+        if (!nearest || nearest->distance == REAL_MAX) return false;
+
+        // Stop if the face is on the surface of the difference.
+        SimplexVertex vertex = supportVertex(one, two, nearest->normal);
+        if (vertex.point * nearest->normal - nearest->distance <=
+            EPA_TOLERANCE * scale)
+        {
+            break;
+        }
+        if (polytope.vertexCount == EPA_MAX_VERTICES) break;
+        unsigned added = polytope.vertexCount++;
+        polytope.vertices[added] = vertex;
+
+        // Remove the faces the new point can see, keeping the edges
+        // around the hole they leave. An edge shared by two removed
+        // faces is inside the hole, and is seen once each way.
+        unsigned edges[EPA_MAX_FACES][2];
+        unsigned edgeCount = 0;
+        for (unsigned i = 0; i < polytope.faceCount; i++)
+        {
+            PolytopeFace &face = polytope.faces[i];
+            if (face.removed) continue;
+            const Vector3 &a = polytope.vertices[face.vertex[0]].point;
+            if (face.normal * (vertex.point - a) <= 0) continue;
+
+            face.removed = true;
+            for (unsigned e = 0; e < 3; e++)
+            {
+                unsigned from = face.vertex[e];
+                unsigned to = face.vertex[(e + 1) % 3];
+                bool shared = false;
+                for (unsigned k = 0; k < edgeCount; k++)
+                {
+                    if (edges[k][0] == to && edges[k][1] == from)
+                    {
+                        edges[k][0] = edges[--edgeCount][0];
+                        edges[k][1] = edges[edgeCount][1];
+                        shared = true;
+                        break;
+                    }
+                }
+                if (!shared && edgeCount < EPA_MAX_FACES)
+                {
+                    edges[edgeCount][0] = from;
+                    edges[edgeCount][1] = to;
+                    edgeCount++;
+                }
+            }
+        }
+
+        // Drop the removed faces, then close the hole with faces to
+        // the new point.
+        unsigned kept = 0;
+        for (unsigned i = 0; i < polytope.faceCount; i++)
+        {
+            if (!polytope.faces[i].removed)
+            {
+                polytope.faces[kept++] = polytope.faces[i];
+            }
+        }
+        polytope.faceCount = kept;
+
+        bool full = false;
+        for (unsigned k = 0; k < edgeCount && !full; k++)
+        {
+            full = !addFace(polytope, edges[k][0], edges[k][1], added);
+        }
+        if (full) break;
+    }
+
+    // Find the nearest face again, in case the last step changed them.
+    nearest = NULL;
+    for (unsigned i = 0; i < polytope.faceCount; i++)
+    {
+        PolytopeFace &face = polytope.faces[i];
+        if (!nearest || face.distance < nearest->distance) nearest = &face;
+    }
+    if (!nearest || nearest->distance == REAL_MAX) return false;
+
+    // Find where the origin's projection falls on the face, and take
+    // the same point of each shape.
+    const SimplexVertex &a = polytope.vertices[nearest->vertex[0]];
+    const SimplexVertex &b = polytope.vertices[nearest->vertex[1]];
+    const SimplexVertex &c = polytope.vertices[nearest->vertex[2]];
+    Vector3 projection = nearest->normal * nearest->distance;
+    Vector3 ab = b.point - a.point;
+    Vector3 ac = c.point - a.point;
+    Vector3 ap = projection - a.point;
+    real d00 = ab * ab;
+    real d01 = ab * ac;
+    real d11 = ac * ac;
+    real d20 = ap * ab;
+    real d21 = ap * ac;
+    real denominator = d00 * d11 - d01 * d01;
+    real v = ((real)1.0) / 3;
+    real w = v;
+    if (denominator > 0)
+    {
+        v = (d11 * d20 - d01 * d21) / denominator;
+        w = (d00 * d21 - d01 * d20) / denominator;
+    }
+    real u = 1 - v - w;
+
+    result->pointOne = a.one * u + b.one * v + c.one * w;
+    result->pointTwo = a.two * u + b.two * v + c.two * w;
+    result->normal = nearest->normal;
+    result->distance = -nearest->distance;
+    return true;
+}
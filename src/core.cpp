@@ -51,6 +51,68 @@ real Matrix4::getDeterminant() const
         data[0]*data[5]*data[10];
 }
 
+#ifdef CYCLONE_USE_SSE
+/*
+ * Works out the inverse a row at a time, for setInverse. Each entry
+ * is a sum of signed products, which are added with their signs
+ * flipped where the plain code subtracts them.
+ */
+static void setInverseLanes(real *data, const real *m, real det)
+{
+    using namespace simd;
+
+    Real4 plusMinus = set4(0.0f, -0.0f, 0.0f, 0.0f);
+    Real4 minusPlus = set4(-0.0f, 0.0f, -0.0f, 0.0f);
+    Real4 scale = splat(det);
+
+    store3(data, mul(add(
+        flip(mul(set4(m[9], m[9], m[5], 0),
+                 set4(m[6], m[2], m[2], 0)), minusPlus),
+        flip(mul(set4(m[5], m[1], m[1], 0),
+                 set4(m[10], m[10], m[6], 0)), plusMinus)),
+        scale));
+    store3(data + 4, mul(add(
+        flip(mul(set4(m[8], m[8], m[4], 0),
+                 set4(m[6], m[2], m[2], 0)), plusMinus),
+        flip(mul(set4(m[4], m[0], m[0], 0),
+                 set4(m[10], m[10], m[6], 0)), minusPlus)),
+        scale));
+    store3(data + 8, mul(add(
+        flip(mul(set4(m[8], m[8], m[4], 0),
+                 set4(m[5], m[1], m[1], 0)), minusPlus),
+        flip(mul(set4(m[4], m[0], m[0], 0),
+                 set4(m[9], m[9], m[5], 0)), plusMinus)),
+        scale));
+
+    // The translation entries, 3, 7 and 11, are held in the first
+    // three lanes.
+    Real4 sum = flip(mul(mul(
+        set4(m[9], m[8], m[8], 0), set4(m[6], m[6], m[5], 0)),
+        splat(m[3])), plusMinus);
+    sum = add(sum, flip(mul(mul(
+        set4(m[5], m[4], m[4], 0), set4(m[10], m[10], m[9], 0)),
+        splat(m[3])), minusPlus));
+    sum = add(sum, flip(mul(mul(
+        set4(m[9], m[8], m[8], 0), set4(m[2], m[2], m[1], 0)),
+        splat(m[7])), minusPlus));
+    sum = add(sum, flip(mul(mul(
+        set4(m[1], m[0], m[0], 0), set4(m[10], m[10], m[9], 0)),
+        splat(m[7])), plusMinus));
+    sum = add(sum, flip(mul(mul(
+        set4(m[5], m[4], m[4], 0), set4(m[2], m[2], m[1], 0)),
+        splat(m[11])), plusMinus));
+    sum = add(sum, flip(mul(mul(
+        set4(m[1], m[0], m[0], 0), set4(m[6], m[6], m[5], 0)),
+        splat(m[11])), minusPlus));
+
+    real translation[4];
+    store4(translation, mul(sum, scale));
+    data[3] = translation[0];
+    data[7] = translation[1];
+    data[11] = translation[2];
+}
+#endif
+
 void Matrix4::setInverse(const Matrix4 &m)
 {
     // Make sure the determinant is non-zero.
@@ -58,6 +120,16 @@ void Matrix4::setInverse(const Matrix4 &m)
     if (det == 0) return;
     det = ((real)1.0)/det;
 
+#ifdef CYCLONE_USE_SSE
+    // Inverting in place reads entries that have already been written,
+    // which only the plain code below reproduces.
+    if (&m != this)
+    {
+        setInverseLanes(data, m.data, det);
+        return;
+    }
+#endif
+
     data[0] = (-m.data[9]*m.data[6]+m.data[5]*m.data[10])*det;
     data[4] = (m.data[8]*m.data[6]-m.data[4]*m.data[10])*det;
     data[8] = (-m.data[8]*m.data[5]+m.data[4]*m.data[9])*det;
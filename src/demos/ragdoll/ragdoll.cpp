@@ -34,19 +34,34 @@ public:
     }
 
     /**
-     * We use a sphere to collide bone on bone to allow some limited
-     * interpenetration.
+     * We use a capsule inside the box to collide bone on bone, which
+     * allows some limited interpenetration, and lets bones slide
+     * over one another rather than catching on their corners.
      */
-    cyclone::CollisionSphere getCollisionSphere() const
+    cyclone::CollisionCapsule getCollisionCapsule() const
     {
-        cyclone::CollisionSphere sphere;
-        sphere.body = body;
-        sphere.radius = halfSize.x;
-        sphere.offset = cyclone::Matrix4();
-        if (halfSize.y < sphere.radius) sphere.radius = halfSize.y;
-        if (halfSize.z < sphere.radius) sphere.radius = halfSize.z;
-        sphere.calculateInternals();
-        return sphere;
+        // Run the capsule along the longest side of the box, as thick
+        // as the thinner of the other two.
+        unsigned longest = 0;
+        if (halfSize.y > halfSize[longest]) longest = 1;
+        if (halfSize.z > halfSize[longest]) longest = 2;
+
+        cyclone::CollisionCapsule capsule;
+        capsule.body = body;
+        capsule.radius = halfSize[(longest+1) % 3];
+        if (halfSize[(longest+2) % 3] < capsule.radius)
+        {
+            capsule.radius = halfSize[(longest+2) % 3];
+        }
+        capsule.halfHeight = halfSize[longest] - capsule.radius;
+
+        // Capsules lie along their Y axis, so turn it onto the side.
+        cyclone::Quaternion turn;
+        if (longest == 0) turn = cyclone::Quaternion(0.7071068f, 0, 0, -0.7071068f);
+        else if (longest == 2) turn = cyclone::Quaternion(0.7071068f, 0.7071068f, 0, 0);
+        capsule.offset.setOrientationAndPos(turn, cyclone::Vector3());
+        capsule.calculateInternals();
+        return capsule;
     }
 
     /** Draws the bone. */
@@ -110,6 +125,9 @@ class RagdollDemo : public RigidBodyApplication
     /** Holds the joints. */
     cyclone::Joint joints[NUM_JOINTS];
 
+    /** Checks if the two bones are held together by a joint. */
+    bool isJointed(const Bone *one, const Bone *two) const;
+
     /** Processes the contact generation code. */
     virtual void generateContacts();
 
@@ -224,6 +242,19 @@ const char* RagdollDemo::getTitle()
     return "Cyclone > Ragdoll Demo";
 }
 
+bool RagdollDemo::isJointed(const Bone *one, const Bone *two) const
+{
+    for (const cyclone::Joint *joint = joints; joint < joints+NUM_JOINTS; joint++)
+    {
+        if ((joint->body[0] == one->body && joint->body[1] == two->body) ||
+            (joint->body[0] == two->body && joint->body[1] == one->body))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 void RagdollDemo::generateContacts()
 {
     // Create the ground plane data
@@ -246,18 +277,22 @@ void RagdollDemo::generateContacts()
         if (!cData.hasMoreContacts()) return;
         cyclone::CollisionDetector::boxAndHalfSpace(*bone, plane, &cData);
 
-        cyclone::CollisionSphere boneSphere = bone->getCollisionSphere();
+        cyclone::CollisionCapsule boneCapsule = bone->getCollisionCapsule();
 
         // Check for collisions with each other box
         for (Bone *other = bone+1; other < bones+NUM_BONES; other++)
         {
             if (!cData.hasMoreContacts()) return;
 
-            cyclone::CollisionSphere otherSphere = other->getCollisionSphere();
+            // The capsules reach the ends of the bones, so bones held
+            // together by a joint are left to the joint.
+            if (isJointed(bone, other)) continue;
+
+            cyclone::CollisionCapsule otherCapsule = other->getCollisionCapsule();
 
-            cyclone::CollisionDetector::sphereAndSphere(
-                boneSphere,
-                otherSphere,
+            cyclone::CollisionDetector::capsuleAndCapsule(
+                boneCapsule,
+                otherCapsule,
                 &cData
                 );
         }
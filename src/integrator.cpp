@@ -0,0 +1,687 @@
+/*
+ * Implementation file for the batch integrator.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+#include <math.h>
+#include <cyclone/integrator.h>
+
+/*
+ * The vector versions are written for double precision x86 processors,
+ * using GCC's support for compiling single functions for extended
+ * instruction sets. Anything else integrates one body at a time.
+ */
+#if defined(DOUBLE_PRECISION) && defined(__GNUC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define CYCLONE_BATCH_SIMD
+#include <immintrin.h>
+#endif
+
+using namespace cyclone;
+
+namespace {
+    /**
+     * Remembers the last damping factor worked out. Neighbouring
+     * bodies usually have the same damping, so this saves most of the
+     * calls to real_pow.
+     */
+    struct DampingFactor
+    {
+        real damping;
+        real factor;
+        bool valid;
+
+        DampingFactor() : damping(0), factor(1), valid(false) {}
+
+        real get(real damping, real duration)
+        {
+            if (!valid || damping != DampingFactor::damping)
+            {
+                DampingFactor::damping = damping;
+                factor = real_pow(damping, duration);
+                valid = true;
+            }
+            return factor;
+        }
+    };
+
+    /**
+     * Returns the square root, for ScalarLanes::sqrt, which hides the
+     * function real_sqrt names.
+     */
+    inline real squareRoot(real a)
+    {
+        return real_sqrt(a);
+    }
+
+    /**
+     * Holds one real, for one body.
+     *
+     * The lane types give the batch functions below the operations
+     * they need, on one real for each body in the batch. A mask has
+     * a lane set for each body a condition holds for.
+     */
+    struct ScalarLanes
+    {
+        enum { WIDTH = 1 };
+        real v;
+
+        static inline ScalarLanes make(real v)
+        {
+            ScalarLanes l; l.v = v; return l;
+        }
+        static inline ScalarLanes set(real a)
+        {
+            return make(a);
+        }
+        static inline ScalarLanes add(ScalarLanes a, ScalarLanes b)
+        {
+            return make(a.v + b.v);
+        }
+        static inline ScalarLanes sub(ScalarLanes a, ScalarLanes b)
+        {
+            return make(a.v - b.v);
+        }
+        static inline ScalarLanes mul(ScalarLanes a, ScalarLanes b)
+        {
+            return make(a.v * b.v);
+        }
+        static inline ScalarLanes div(ScalarLanes a, ScalarLanes b)
+        {
+            return make(a.v / b.v);
+        }
+        static inline ScalarLanes sqrt(ScalarLanes a)
+        {
+            return make(squareRoot(a.v));
+        }
+        static inline ScalarLanes less(ScalarLanes a, ScalarLanes b)
+        {
+            return make(a.v < b.v ? 1 : 0);
+        }
+        static inline ScalarLanes both(ScalarLanes a, ScalarLanes b)
+        {
+            return make(a.v != 0 && b.v != 0 ? 1 : 0);
+        }
+        static inline ScalarLanes bothNot(ScalarLanes a, ScalarLanes b)
+        {
+            // The second mask, where the first is clear.
+            return make(a.v == 0 && b.v != 0 ? 1 : 0);
+        }
+        static inline ScalarLanes select(
+            ScalarLanes mask, ScalarLanes a, ScalarLanes b)
+        {
+            return mask.v != 0 ? a : b;
+        }
+        static inline int bits(ScalarLanes mask)
+        {
+            return mask.v != 0;
+        }
+        static inline ScalarLanes flags(const unsigned char *f)
+        {
+            return make(f[0] ? 1 : 0);
+        }
+        static inline ScalarLanes load(const real *p)
+        {
+            return make(*p);
+        }
+        static inline void store(real *p, ScalarLanes a)
+        {
+            *p = a.v;
+        }
+    };
+
+#ifdef CYCLONE_BATCH_SIMD
+
+#define CYCLONE_SSE2 __attribute__((target("sse2")))
+#define CYCLONE_AVX2 __attribute__((target("avx2")))
+
+    /**
+     * Holds one real for each of two bodies, in an SSE2 register.
+     * Masks have every bit of a lane set or clear.
+     */
+    struct SSE2Lanes
+    {
+        enum { WIDTH = 2 };
+        __m128d v;
+
+        CYCLONE_SSE2 static inline SSE2Lanes make(__m128d v)
+        {
+            SSE2Lanes l; l.v = v; return l;
+        }
+        CYCLONE_SSE2 static inline SSE2Lanes set(real a)
+        {
+            return make(_mm_set1_pd(a));
+        }
+        CYCLONE_SSE2 static inline SSE2Lanes add(SSE2Lanes a, SSE2Lanes b)
+        {
+            return make(_mm_add_pd(a.v, b.v));
+        }
+        CYCLONE_SSE2 static inline SSE2Lanes sub(SSE2Lanes a, SSE2Lanes b)
+        {
+            return make(_mm_sub_pd(a.v, b.v));
+        }
+        CYCLONE_SSE2 static inline SSE2Lanes mul(SSE2Lanes a, SSE2Lanes b)
+        {
+            return make(_mm_mul_pd(a.v, b.v));
+        }
+        CYCLONE_SSE2 static inline SSE2Lanes div(SSE2Lanes a, SSE2Lanes b)
+        {
+            return make(_mm_div_pd(a.v, b.v));
+        }
+        CYCLONE_SSE2 static inline SSE2Lanes sqrt(SSE2Lanes a)
+        {
+            return make(_mm_sqrt_pd(a.v));
+        }
+        CYCLONE_SSE2 static inline SSE2Lanes less(SSE2Lanes a, SSE2Lanes b)
+        {
+            return make(_mm_cmplt_pd(a.v, b.v));
+        }
+        CYCLONE_SSE2 static inline SSE2Lanes both(SSE2Lanes a, SSE2Lanes b)
+        {
+            return make(_mm_and_pd(a.v, b.v));
+        }
+        CYCLONE_SSE2 static inline SSE2Lanes bothNot(SSE2Lanes a, SSE2Lanes b)
+        {
+            return make(_mm_andnot_pd(a.v, b.v));
+        }
+        CYCLONE_SSE2 static inline SSE2Lanes select(
+            SSE2Lanes mask, SSE2Lanes a, SSE2Lanes b)
+        {
+            return make(_mm_or_pd(_mm_and_pd(mask.v, a.v),
+                                  _mm_andnot_pd(mask.v, b.v)));
+        }
+        CYCLONE_SSE2 static inline int bits(SSE2Lanes mask)
+        {
+            return _mm_movemask_pd(mask.v);
+        }
+        CYCLONE_SSE2 static inline SSE2Lanes flags(const unsigned char *f)
+        {
+            return make(_mm_castsi128_pd(_mm_set_epi64x(
+                f[1] ? -1 : 0, f[0] ? -1 : 0)));
+        }
+        CYCLONE_SSE2 static inline SSE2Lanes load(const real *p)
+        {
+            return make(_mm_loadu_pd(p));
+        }
+        CYCLONE_SSE2 static inline void store(real *p, SSE2Lanes a)
+        {
+            _mm_storeu_pd(p, a.v);
+        }
+    };
+
+    /**
+     * Holds one real for each of four bodies, in an AVX register.
+     * Masks have every bit of a lane set or clear.
+     */
+    struct AVX2Lanes
+    {
+        enum { WIDTH = 4 };
+        __m256d v;
+
+        CYCLONE_AVX2 static inline AVX2Lanes make(__m256d v)
+        {
+            AVX2Lanes l; l.v = v; return l;
+        }
+        CYCLONE_AVX2 static inline AVX2Lanes set(real a)
+        {
+            return make(_mm256_set1_pd(a));
+        }
+        CYCLONE_AVX2 static inline AVX2Lanes add(AVX2Lanes a, AVX2Lanes b)
+        {
+            return make(_mm256_add_pd(a.v, b.v));
+        }
+        CYCLONE_AVX2 static inline AVX2Lanes sub(AVX2Lanes a, AVX2Lanes b)
+        {
+            return make(_mm256_sub_pd(a.v, b.v));
+        }
+        CYCLONE_AVX2 static inline AVX2Lanes mul(AVX2Lanes a, AVX2Lanes b)
+        {
+            return make(_mm256_mul_pd(a.v, b.v));
+        }
+        CYCLONE_AVX2 static inline AVX2Lanes div(AVX2Lanes a, AVX2Lanes b)
+        {
+            return make(_mm256_div_pd(a.v, b.v));
+        }
+        CYCLONE_AVX2 static inline AVX2Lanes sqrt(AVX2Lanes a)
+        {
+            return make(_mm256_sqrt_pd(a.v));
+        }
+        CYCLONE_AVX2 static inline AVX2Lanes less(AVX2Lanes a, AVX2Lanes b)
+        {
+            return make(_mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ));
+        }
+        CYCLONE_AVX2 static inline AVX2Lanes both(AVX2Lanes a, AVX2Lanes b)
+        {
+            return make(_mm256_and_pd(a.v, b.v));
+        }
+        CYCLONE_AVX2 static inline AVX2Lanes bothNot(AVX2Lanes a, AVX2Lanes b)
+        {
+            return make(_mm256_andnot_pd(a.v, b.v));
+        }
+        CYCLONE_AVX2 static inline AVX2Lanes select(
+            AVX2Lanes mask, AVX2Lanes a, AVX2Lanes b)
+        {
+            return make(_mm256_blendv_pd(b.v, a.v, mask.v));
+        }
+        CYCLONE_AVX2 static inline int bits(AVX2Lanes mask)
+        {
+            return _mm256_movemask_pd(mask.v);
+        }
+        CYCLONE_AVX2 static inline AVX2Lanes flags(const unsigned char *f)
+        {
+            // Widen the four bytes to four 64 bit lanes, and compare.
+            int packed;
+            __builtin_memcpy(&packed, f, sizeof(packed));
+            __m256i wide = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(packed));
+            return make(_mm256_castsi256_pd(
+                _mm256_cmpgt_epi64(wide, _mm256_setzero_si256())));
+        }
+        CYCLONE_AVX2 static inline AVX2Lanes load(const real *p)
+        {
+            return make(_mm256_loadu_pd(p));
+        }
+        CYCLONE_AVX2 static inline void store(real *p, AVX2Lanes a)
+        {
+            _mm256_storeu_pd(p, a.v);
+        }
+    };
+
+#endif // CYCLONE_BATCH_SIMD
+}
+
+/*
+ * Stores one real for each body whose lane in the mask is set, leaving
+ * the others as they were.
+ */
+template <class L>
+static inline void store(real *p, const L &value, const L &mask)
+{
+    if (L::bits(mask) == (1 << L::WIDTH) - 1) L::store(p, value);
+    else L::store(p, L::select(mask, value, L::load(p)));
+}
+
+/*
+ * Normalises the orientations of the bodies starting at n, and works
+ * out their derived data, as RigidBody::calculateDerivedData. Only the
+ * bodies whose lane in the mask is set are changed.
+ */
+template <class L>
+static inline void calculateLanes(const BodyArrays &b, unsigned n,
+                                  L q[4], const L p[3], const L &mask)
+{
+    // Normalise the orientation, as Quaternion::normalise.
+    L d = L::add(L::add(L::add(
+        L::mul(q[0], q[0]), L::mul(q[1], q[1])),
+        L::mul(q[2], q[2])), L::mul(q[3], q[3]));
+    L one = L::set(1);
+    L zeroLength = L::less(d, L::set(real_epsilon));
+    L scale = L::div(one, L::sqrt(d));
+    q[0] = L::select(zeroLength, one, L::mul(q[0], scale));
+    for (unsigned k = 1; k < 4; k++)
+    {
+        q[k] = L::select(zeroLength, q[k], L::mul(q[k], scale));
+    }
+    for (unsigned k = 0; k < 4; k++) store(b.orientation[k] + n, q[k], mask);
+
+    // Calculate the transform matrix, as _calculateTransformMatrix.
+    L two = L::set(2);
+    L r2 = L::mul(two, q[0]), i2 = L::mul(two, q[1]);
+    L j2 = L::mul(two, q[2]), k2 = L::mul(two, q[3]);
+    L m[12];
+    m[0] = L::sub(L::sub(one, L::mul(j2, q[2])), L::mul(k2, q[3]));
+    m[1] = L::sub(L::mul(i2, q[2]), L::mul(r2, q[3]));
+    m[2] = L::add(L::mul(i2, q[3]), L::mul(r2, q[2]));
+    m[3] = p[0];
+    m[4] = L::add(L::mul(i2, q[2]), L::mul(r2, q[3]));
+    m[5] = L::sub(L::sub(one, L::mul(i2, q[1])), L::mul(k2, q[3]));
+    m[6] = L::sub(L::mul(j2, q[3]), L::mul(r2, q[1]));
+    m[7] = p[1];
+    m[8] = L::sub(L::mul(i2, q[3]), L::mul(r2, q[2]));
+    m[9] = L::add(L::mul(j2, q[3]), L::mul(r2, q[1]));
+    m[10] = L::sub(L::sub(one, L::mul(i2, q[1])), L::mul(j2, q[2]));
+    m[11] = p[2];
+    for (unsigned k = 0; k < 12; k++)
+    {
+        store(b.transformMatrix[k] + n, m[k], mask);
+    }
+
+    // Transform the inertia tensor, as _transformInertiaTensor.
+    L s[9];
+    for (unsigned row = 0; row < 3; row++)
+    {
+        const L *rot = m + row*4;
+        for (unsigned col = 0; col < 3; col++)
+        {
+            s[row*3 + col] = L::add(L::add(
+                L::mul(rot[0], L::load(b.inverseInertiaTensor[col] + n)),
+                L::mul(rot[1], L::load(b.inverseInertiaTensor[3+col] + n))),
+                L::mul(rot[2], L::load(b.inverseInertiaTensor[6+col] + n)));
+        }
+    }
+    for (unsigned row = 0; row < 3; row++)
+    {
+        for (unsigned col = 0; col < 3; col++)
+        {
+            const L *rot = m + col*4;
+            L world = L::add(L::add(
+                L::mul(s[row*3], rot[0]),
+                L::mul(s[row*3 + 1], rot[1])),
+                L::mul(s[row*3 + 2], rot[2]));
+            store(b.inverseInertiaTensorWorld[row*3 + col] + n, world, mask);
+        }
+    }
+}
+
+/*
+ * Integrates the bodies starting at n, as RigidBody::integrate.
+ */
+template <class L>
+static inline void integrateLanes(const BodyArrays &b, unsigned n,
+                                  real duration, real bias,
+                                  real sleepLimit,
+                                  DampingFactor &linear,
+                                  DampingFactor &angular)
+{
+    L awake = L::flags(b.isAwake + n);
+    int awakeBits = L::bits(awake);
+    if (!awakeBits) return;
+
+    L dt = L::set(duration);
+    L zero = L::set(0);
+
+    // Calculate linear acceleration from force inputs.
+    L inverseMass = L::load(b.inverseMass + n);
+    L acceleration[3];
+    for (unsigned k = 0; k < 3; k++)
+    {
+        acceleration[k] = L::add(L::load(b.acceleration[k] + n),
+            L::mul(L::load(b.forceAccum[k] + n), inverseMass));
+        store(b.lastFrameAcceleration[k] + n, acceleration[k], awake);
+    }
+
+    // Calculate angular acceleration from torque inputs.
+    L torque[3], angularAcceleration[3];
+    for (unsigned k = 0; k < 3; k++) torque[k] = L::load(b.torqueAccum[k] + n);
+    for (unsigned row = 0; row < 3; row++)
+    {
+        real *const *tensor = b.inverseInertiaTensorWorld + row*3;
+        angularAcceleration[row] = L::add(L::add(
+            L::mul(torque[0], L::load(tensor[0] + n)),
+            L::mul(torque[1], L::load(tensor[1] + n))),
+            L::mul(torque[2], L::load(tensor[2] + n)));
+    }
+
+    // Work out the drag on each body.
+    real linearFactor[L::WIDTH], angularFactor[L::WIDTH];
+    for (unsigned lane = 0; lane < L::WIDTH; lane++)
+    {
+        linearFactor[lane] = angularFactor[lane] = 1;
+        if (!(awakeBits & (1 << lane))) continue;
+
+        linearFactor[lane] = linear.get(b.linearDamping[n + lane], duration);
+        angularFactor[lane] =
+            angular.get(b.angularDamping[n + lane], duration);
+    }
+    L linearDrag = L::load(linearFactor);
+    L angularDrag = L::load(angularFactor);
+
+    // Adjust velocities, and impose drag.
+    L velocity[3], rotation[3];
+    for (unsigned k = 0; k < 3; k++)
+    {
+        velocity[k] = L::add(L::load(b.velocity[k] + n),
+            L::mul(acceleration[k], dt));
+        rotation[k] = L::add(L::load(b.rotation[k] + n),
+            L::mul(angularAcceleration[k], dt));
+        velocity[k] = L::mul(velocity[k], linearDrag);
+        rotation[k] = L::mul(rotation[k], angularDrag);
+    }
+
+    // Adjust positions.
+    L position[3];
+    for (unsigned k = 0; k < 3; k++)
+    {
+        position[k] = L::add(L::load(b.position[k] + n),
+            L::mul(velocity[k], dt));
+        store(b.position[k] + n, position[k], awake);
+    }
+
+    // Adjust the orientation, as Quaternion::addScaledVector.
+    L q[4];
+    for (unsigned k = 0; k < 4; k++) q[k] = L::load(b.orientation[k] + n);
+    L sx = L::mul(rotation[0], dt);
+    L sy = L::mul(rotation[1], dt);
+    L sz = L::mul(rotation[2], dt);
+    L spin[4];
+    spin[0] = L::sub(L::sub(L::sub(L::mul(zero, q[0]),
+        L::mul(sx, q[1])), L::mul(sy, q[2])), L::mul(sz, q[3]));
+    spin[1] = L::sub(L::add(L::add(L::mul(zero, q[1]),
+        L::mul(sx, q[0])), L::mul(sy, q[3])), L::mul(sz, q[2]));
+    spin[2] = L::sub(L::add(L::add(L::mul(zero, q[2]),
+        L::mul(sy, q[0])), L::mul(sz, q[1])), L::mul(sx, q[3]));
+    spin[3] = L::sub(L::add(L::add(L::mul(zero, q[3]),
+        L::mul(sz, q[0])), L::mul(sx, q[2])), L::mul(sy, q[1]));
+    L half = L::set((real)0.5);
+    for (unsigned k = 0; k < 4; k++)
+    {
+        q[k] = L::add(q[k], L::mul(spin[k], half));
+    }
+
+    calculateLanes(b, n, q, position, awake);
+
+    // Clear accumulators.
+    for (unsigned k = 0; k < 3; k++)
+    {
+        store(b.forceAccum[k] + n, zero, awake);
+        store(b.torqueAccum[k] + n, zero, awake);
+    }
+
+    // Update the kinetic energy store, and possibly put the body to
+    // sleep.
+    L canSleep = L::flags(b.canSleep + n);
+    L currentMotion = L::add(
+        L::add(L::add(L::mul(velocity[0], velocity[0]),
+            L::mul(velocity[1], velocity[1])),
+            L::mul(velocity[2], velocity[2])),
+        L::add(L::add(L::mul(rotation[0], rotation[0]),
+            L::mul(rotation[1], rotation[1])),
+            L::mul(rotation[2], rotation[2])));
+    L oldMotion = L::load(b.motion + n);
+    L motion = L::add(L::mul(L::set(bias), oldMotion),
+        L::mul(L::set(1-bias), currentMotion));
+
+    L limit = L::set(10 * sleepEpsilon);
+    L falling = L::both(canSleep, L::less(motion, L::set(sleepLimit)));
+    L capped = L::bothNot(falling, L::less(limit, motion));
+    motion = L::select(capped, limit, motion);
+    store(b.motion + n, motion, L::both(canSleep, awake));
+
+    for (unsigned k = 0; k < 3; k++)
+    {
+        store(b.velocity[k] + n,
+            L::select(falling, zero, velocity[k]), awake);
+        store(b.rotation[k] + n,
+            L::select(falling, zero, rotation[k]), awake);
+    }
+
+    int fallingBits = L::bits(falling) & awakeBits;
+    for (unsigned lane = 0; lane < L::WIDTH; lane++)
+    {
+        if (fallingBits & (1 << lane)) b.isAwake[n + lane] = false;
+    }
+}
+
+/*
+ * Go through the bodies from the given one, as many at a time as the
+ * lanes hold, and return the number of the first body left over.
+ */
+template <class L>
+static inline unsigned integrateBatches(const BodyArrays &b, unsigned n,
+                                        real duration, real bias,
+                                        real sleepLimit,
+                                        DampingFactor &linear,
+                                        DampingFactor &angular)
+{
+    for (; n + L::WIDTH <= b.count; n += L::WIDTH)
+    {
+        integrateLanes<L>(b, n, duration, bias, sleepLimit,
+                          linear, angular);
+    }
+    return n;
+}
+
+template <class L>
+static inline unsigned calculateBatches(const BodyArrays &b, unsigned n)
+{
+    L all = L::less(L::set(0), L::set(1));
+    for (; n + L::WIDTH <= b.count; n += L::WIDTH)
+    {
+        L q[4], p[3];
+        for (unsigned k = 0; k < 4; k++) q[k] = L::load(b.orientation[k] + n);
+        for (unsigned k = 0; k < 3; k++) p[k] = L::load(b.position[k] + n);
+        calculateLanes(b, n, q, p, all);
+    }
+    return n;
+}
+
+/*
+ * The batch functions for one body at a time, for any processor.
+ */
+
+#ifdef __GNUC__
+__attribute__((flatten))
+#endif
+static unsigned integrateScalar(const BodyArrays &b, unsigned n,
+                                real duration, real bias, real sleepLimit,
+                                DampingFactor &linear, DampingFactor &angular)
+{
+    return integrateBatches<ScalarLanes>(b, n, duration, bias, sleepLimit,
+        linear, angular);
+}
+
+#ifdef __GNUC__
+__attribute__((flatten))
+#endif
+static unsigned calculateScalar(const BodyArrays &b, unsigned n)
+{
+    return calculateBatches<ScalarLanes>(b, n);
+}
+
+#ifdef CYCLONE_BATCH_SIMD
+
+/*
+ * The batch functions for each instruction set. Each is compiled for
+ * its instruction set, with everything it calls compiled into it.
+ */
+
+CYCLONE_SSE2 __attribute__((flatten))
+static unsigned integrateSSE2(const BodyArrays &b, real duration, real bias,
+                              real sleepLimit,
+                              DampingFactor &linear, DampingFactor &angular)
+{
+    return integrateBatches<SSE2Lanes>(b, 0, duration, bias, sleepLimit,
+        linear, angular);
+}
+
+CYCLONE_AVX2 __attribute__((flatten))
+static unsigned integrateAVX2(const BodyArrays &b, real duration, real bias,
+                              real sleepLimit,
+                              DampingFactor &linear, DampingFactor &angular)
+{
+    return integrateBatches<AVX2Lanes>(b, 0, duration, bias, sleepLimit,
+        linear, angular);
+}
+
+CYCLONE_SSE2 __attribute__((flatten))
+static unsigned calculateSSE2(const BodyArrays &b)
+{
+    return calculateBatches<SSE2Lanes>(b, 0);
+}
+
+CYCLONE_AVX2 __attribute__((flatten))
+static unsigned calculateAVX2(const BodyArrays &b)
+{
+    return calculateBatches<AVX2Lanes>(b, 0);
+}
+
+#endif // CYCLONE_BATCH_SIMD
+
+BatchIntegrator::BatchIntegrator()
+:
+instructionSet(getBestInstructionSet())
+{
+}
+
+BatchIntegrator::InstructionSet BatchIntegrator::getBestInstructionSet()
+{
+#ifdef CYCLONE_BATCH_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return INSTRUCTIONS_AVX2;
+    if (__builtin_cpu_supports("sse2")) return INSTRUCTIONS_SSE2;
+#endif
+    return INSTRUCTIONS_SCALAR;
+}
+
+void BatchIntegrator::setInstructionSet(InstructionSet instructionSet)
+{
+    InstructionSet best = getBestInstructionSet();
+    if (instructionSet > best) instructionSet = best;
+    BatchIntegrator::instructionSet = instructionSet;
+}
+
+void BatchIntegrator::integrate(const BodyArrays &bodies, real duration,
+                                bool fallAsleep) const
+{
+    // These are the same for every body. No body's motion is below
+    // zero, so that limit keeps them all awake.
+    real bias = real_pow(0.5, duration);
+    real sleepLimit = fallAsleep ? sleepEpsilon : 0;
+    DampingFactor linear, angular;
+
+    unsigned done = 0;
+#ifdef CYCLONE_BATCH_SIMD
+    switch (instructionSet)
+    {
+    case INSTRUCTIONS_AVX2:
+        done = integrateAVX2(bodies, duration, bias, sleepLimit,
+                             linear, angular);
+        break;
+    case INSTRUCTIONS_SSE2:
+        done = integrateSSE2(bodies, duration, bias, sleepLimit,
+                             linear, angular);
+        break;
+    default:
+        break;
+    }
+#endif
+
+    integrateScalar(bodies, done, duration, bias, sleepLimit,
+                    linear, angular);
+}
+
+void BatchIntegrator::calculateDerivedData(const BodyArrays &bodies) const
+{
+    unsigned done = 0;
+#ifdef CYCLONE_BATCH_SIMD
+    switch (instructionSet)
+    {
+    case INSTRUCTIONS_AVX2:
+        done = calculateAVX2(bodies);
+        break;
+    case INSTRUCTIONS_SSE2:
+        done = calculateSSE2(bodies);
+        break;
+    default:
+        break;
+    }
+#endif
+
+    calculateScalar(bodies, done);
+}
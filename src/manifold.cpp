@@ -0,0 +1,395 @@
+/*
+ * Implementation file for persistent contact manifolds.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+#include <algorithm>
+#include <cyclone/manifold.h>
+
+using namespace cyclone;
+
+/*
+ * The most contacts the collision detector can return for one pair
+ * (a box with all eight vertices below a plane).
+ */
+static const unsigned MAX_DETECTED = 8;
+
+/*
+ * Points whose normal has turned by more than this (as a cosine) are
+ * from a different pair of features, and can't be kept.
+ */
+static const real NORMAL_TOLERANCE = (real)0.95;
+
+/*
+ * Returns the position of a manifold point on the given body in world
+ * coordinates.
+ */
+static inline Vector3 anchorInWorld(RigidBody *body, const Vector3 &local)
+{
+    if (body) return body->getPointInWorldSpace(local);
+    return local;
+}
+
+/*
+ * Returns the area of the triangle a, b, c as seen along the normal,
+ * times two. It is positive if the points go anticlockwise.
+ */
+static inline real signedArea(const Vector3 &a, const Vector3 &b,
+                              const Vector3 &c, const Vector3 &normal)
+{
+    return ((b - a) % (c - a)) * normal;
+}
+
+/*
+ * Chooses up to four of the given points to keep, writing them into
+ * the output array and returning how many were chosen. The deepest
+ * point is always kept, then the point furthest from it, then the
+ * two that add the most area around them.
+ */
+static unsigned reducePoints(const ManifoldPoint *points, unsigned count,
+                             const Vector3 &normal, ManifoldPoint *output)
+{
+    if (count <= ContactManifold::MAX_POINTS)
+    {
+        for (unsigned i = 0; i < count; i++) output[i] = points[i];
+        return count;
+    }
+
+    // Deepest point, favouring the oldest on a tie.
+    unsigned first = 0;
+    for (unsigned i = 1; i < count; i++)
+    {
+        if (points[i].penetration > points[first].penetration ||
+            (points[i].penetration == points[first].penetration &&
+             points[i].lifetime > points[first].lifetime))
+        {
+            first = i;
+        }
+    }
+
+    // Furthest from it.
+    unsigned second = first;
+    real best = 0;
+    for (unsigned i = 0; i < count; i++)
+    {
+        real distance =
+            (points[i].contactPoint - points[first].contactPoint)
+            .squareMagnitude();
+        if (distance > best)
+        {
+            best = distance;
+            second = i;
+        }
+    }
+    output[0] = points[first];
+    if (second == first) return 1;
+    output[1] = points[second];
+
+    // The one making the biggest triangle with them.
+    unsigned third = first;
+    best = 0;
+    for (unsigned i = 0; i < count; i++)
+    {
+        real area = real_abs(signedArea(points[first].contactPoint,
+            points[second].contactPoint, points[i].contactPoint, normal));
+        if (area > best)
+        {
+            best = area;
+            third = i;
+        }
+    }
+    if (third == first) return 2;
+    output[2] = points[third];
+
+    // And the one furthest outside that triangle, which we find by
+    // looking for the most negative area it makes with any edge of the
+    // triangle, going anticlockwise.
+    const Vector3 *corner[3] = {
+        &points[first].contactPoint,
+        &points[second].contactPoint,
+        &points[third].contactPoint
+    };
+    if (signedArea(*corner[0], *corner[1], *corner[2], normal) < 0)
+    {
+        const Vector3 *temp = corner[1];
+        corner[1] = corner[2];
+        corner[2] = temp;
+    }
+
+    unsigned fourth = first;
+    best = 0;
+    for (unsigned i = 0; i < count; i++)
+    {
+        for (unsigned edge = 0; edge < 3; edge++)
+        {
+            real area = signedArea(*corner[edge], *corner[(edge+1)%3],
+                points[i].contactPoint, normal);
+            if (area < best)
+            {
+                best = area;
+                fourth = i;
+            }
+        }
+    }
+    if (fourth == first) return 3;
+    output[3] = points[fourth];
+    return 4;
+}
+
+ManifoldCache::ManifoldCache(real breakingThreshold)
+:
+frame(0), breakingThreshold(breakingThreshold)
+{
+}
+
+void ManifoldCache::setBreakingThreshold(real breakingThreshold)
+{
+    ManifoldCache::breakingThreshold = breakingThreshold;
+}
+
+unsigned ManifoldCache::boxAndBox(
+    const CollisionBox &one,
+    const CollisionBox &two,
+    CollisionData *data
+    )
+{
+    if (!data->makeRoom(ContactManifold::MAX_POINTS)) return 0;
+
+    Contact detected[MAX_DETECTED];
+    CollisionData local = *data;
+    local.contactArray = detected;
+    local.reset(MAX_DETECTED);
+    unsigned count = CollisionDetector::boxAndBox(one, two, &local);
+
+    return mergeContacts(&one, &two, one.body, two.body,
+                         detected, count, data);
+}
+
+unsigned ManifoldCache::boxAndHalfSpace(
+    const CollisionBox &box,
+    const CollisionPlane &plane,
+    CollisionData *data
+    )
+{
+    if (!data->makeRoom(ContactManifold::MAX_POINTS)) return 0;
+
+    Contact detected[MAX_DETECTED];
+    CollisionData local = *data;
+    local.contactArray = detected;
+    local.reset(MAX_DETECTED);
+    unsigned count = CollisionDetector::boxAndHalfSpace(box, plane, &local);
+
+    return mergeContacts(&box, &plane, box.body, NULL,
+                         detected, count, data);
+}
+
+unsigned ManifoldCache::mergeContacts(const void *one, const void *two,
+                                      RigidBody *bodyOne, RigidBody *bodyTwo,
+                                      Contact *contacts, unsigned count,
+                                      CollisionData *data)
+{
+    Key key(one, two);
+    unsigned place = findEntry(key);
+    bool found = place < index.size() && index[place].key == key;
+
+    // If the pair isn't touching, it has no manifold.
+    if (count == 0)
+    {
+        if (found) removeEntry(place);
+        return 0;
+    }
+
+    // Manifolds that weren't updated last frame have been discarded,
+    // and new ones are zero filled, so this has no points if it is new.
+    if (!found)
+    {
+        Entry entry;
+        entry.key = key;
+        if (freeManifolds.empty())
+        {
+            entry.manifold = (unsigned)manifolds.size();
+            manifolds.push_back(ContactManifold());
+        }
+        else
+        {
+            entry.manifold = freeManifolds.back();
+            freeManifolds.pop_back();
+            manifolds[entry.manifold] = ContactManifold();
+        }
+        index.insert(index.begin() + place, entry);
+    }
+    ContactManifold &manifold = manifolds[index[place].manifold];
+    manifold.lastFrame = frame;
+
+    // The detector can give the bodies either way round, so put them
+    // in the order of the pair.
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (contacts[i].body[0] != bodyOne)
+        {
+            contacts[i].body[0] = bodyOne;
+            contacts[i].body[1] = bodyTwo;
+            contacts[i].contactNormal *= -1;
+        }
+    }
+    Vector3 normal = contacts[0].contactNormal;
+
+    // Old points only survive if they are from the same pair of faces.
+    ManifoldPoint *old = manifold.points;
+    unsigned oldCount = manifold.pointCount;
+    if (manifold.normal * normal < NORMAL_TOLERANCE) oldCount = 0;
+    bool used[ContactManifold::MAX_POINTS] = { false, false, false, false };
+
+    ManifoldPoint candidates[MAX_DETECTED + ContactManifold::MAX_POINTS];
+    unsigned candidateCount = 0;
+    real threshold = breakingThreshold * breakingThreshold;
+
+    // Add the new contacts, matching each with an old point from the
+    // same feature if there is one, or failing that the nearest.
+    for (unsigned i = 0; i < count; i++)
+    {
+        ManifoldPoint &point = candidates[candidateCount++];
+        point.contactPoint = contacts[i].contactPoint;
+        point.penetration = contacts[i].penetration;
+        point.basePenetration = point.penetration;
+        point.feature = contacts[i].feature;
+        point.localPoint[0] =
+            bodyOne->getPointInLocalSpace(point.contactPoint);
+        point.localPoint[1] = bodyTwo ?
+            bodyTwo->getPointInLocalSpace(point.contactPoint) :
+            point.contactPoint;
+
+        unsigned match = oldCount;
+        real nearest = threshold;
+        for (unsigned j = 0; j < oldCount; j++)
+        {
+            if (used[j]) continue;
+
+            real distance = (anchorInWorld(bodyOne, old[j].localPoint[0]) -
+                point.contactPoint).squareMagnitude();
+            if (distance >= threshold) continue;
+            if (old[j].feature == point.feature)
+            {
+                match = j;
+                break;
+            }
+            if (distance < nearest)
+            {
+                nearest = distance;
+                match = j;
+            }
+        }
+
+        if (match < oldCount)
+        {
+            used[match] = true;
+            point.id = old[match].id;
+            point.lifetime = old[match].lifetime + 1;
+        }
+        else
+        {
+            point.id = manifold.nextId++;
+            point.lifetime = 0;
+        }
+    }
+
+    // Keep old points the detector didn't find again, as long as the
+    // bodies haven't drifted apart at them.
+    for (unsigned j = 0; j < oldCount; j++)
+    {
+        if (used[j]) continue;
+
+        Vector3 pointOne = anchorInWorld(bodyOne, old[j].localPoint[0]);
+        Vector3 pointTwo = anchorInWorld(bodyTwo, old[j].localPoint[1]);
+        Vector3 drift = pointOne - pointTwo;
+
+        // Body one moving along the normal reduces the penetration.
+        real separation = drift * normal;
+        real penetration = old[j].basePenetration - separation;
+        if (penetration < -breakingThreshold) continue;
+
+        drift.addScaledVector(normal, -separation);
+        if (drift.squareMagnitude() > threshold) continue;
+
+        ManifoldPoint &point = candidates[candidateCount++];
+        point = old[j];
+        point.contactPoint = (pointOne + pointTwo) * (real)0.5;
+        point.penetration = penetration;
+        point.lifetime++;
+    }
+
+    // Reduce to the points we'll keep.
+    manifold.normal = normal;
+    manifold.pointCount = reducePoints(candidates, candidateCount,
+                                       normal, manifold.points);
+
+    // And write them out as contacts.
+    unsigned written = 0;
+    for (unsigned i = 0; i < manifold.pointCount; i++)
+    {
+        if (!data->hasMoreContacts()) break;
+
+        const ManifoldPoint &point = manifold.points[i];
+        Contact *contact = data->contacts;
+        contact->contactPoint = point.contactPoint;
+        contact->contactNormal = normal;
+        contact->penetration = point.penetration;
+        contact->setBodyData(bodyOne, bodyTwo,
+            data->friction, data->restitution, point.id);
+        data->addContacts(1);
+        written++;
+    }
+    return written;
+}
+
+unsigned ManifoldCache::findEntry(const Key &key) const
+{
+    return (unsigned)(std::lower_bound(index.begin(), index.end(),
+                                       key, Entry::compare) -
+                      index.begin());
+}
+
+void ManifoldCache::removeEntry(unsigned place)
+{
+    freeManifolds.push_back(index[place].manifold);
+    index.erase(index.begin() + place);
+}
+
+void ManifoldCache::advanceFrame()
+{
+    // Free the stale manifolds, closing up the index in one pass.
+    unsigned kept = 0;
+    for (unsigned i = 0; i < index.size(); i++)
+    {
+        if (manifolds[index[i].manifold].lastFrame != frame)
+        {
+            freeManifolds.push_back(index[i].manifold);
+        }
+        else index[kept++] = index[i];
+    }
+    index.resize(kept);
+    frame++;
+}
+
+void ManifoldCache::clear()
+{
+    index.clear();
+    manifolds.clear();
+    freeManifolds.clear();
+}
+
+const ContactManifold *ManifoldCache::getManifold(const void *one,
+                                                  const void *two) const
+{
+    Key key(one, two);
+    unsigned place = findEntry(key);
+    if (place == index.size() || index[place].key != key) return NULL;
+    return &manifolds[index[place].manifold];
+}
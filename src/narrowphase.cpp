@@ -0,0 +1,362 @@
+/*
+ * Implementation file for the narrow phase dispatcher.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+#include <algorithm>
+#include <cyclone/narrowphase.h>
+
+using namespace cyclone;
+
+Narrowphase::Narrowphase()
+:
+sorted(true)
+{
+    for (unsigned i = 0; i < PRIMITIVE_TYPE_COUNT; i++)
+    {
+        for (unsigned j = 0; j < PRIMITIVE_TYPE_COUNT; j++)
+        {
+            table[i][j] = NULL;
+        }
+    }
+    for (unsigned i = 0; i <= PRIMITIVE_TYPE_COUNT*PRIMITIVE_TYPE_COUNT; i++)
+    {
+        batchStart[i] = 0;
+    }
+
+    setBatchFunction(PRIMITIVE_SPHERE, PRIMITIVE_SPHERE, sphereAndSphereBatch);
+    setBatchFunction(PRIMITIVE_SPHERE, PRIMITIVE_BOX, sphereAndBoxBatch);
+    setBatchFunction(PRIMITIVE_BOX, PRIMITIVE_BOX, boxAndBoxBatch);
+    setBatchFunction(PRIMITIVE_SPHERE, PRIMITIVE_CONVEX, sphereAndConvexBatch);
+    setBatchFunction(PRIMITIVE_BOX, PRIMITIVE_CONVEX, boxAndConvexBatch);
+    setBatchFunction(PRIMITIVE_CONVEX, PRIMITIVE_CONVEX, convexAndConvexBatch);
+    setBatchFunction(PRIMITIVE_SPHERE, PRIMITIVE_CAPSULE, sphereAndCapsuleBatch);
+    setBatchFunction(PRIMITIVE_BOX, PRIMITIVE_CAPSULE, boxAndCapsuleBatch);
+    setBatchFunction(PRIMITIVE_CONVEX, PRIMITIVE_CAPSULE, convexAndCapsuleBatch);
+    setBatchFunction(PRIMITIVE_CAPSULE, PRIMITIVE_CAPSULE, capsuleAndCapsuleBatch);
+}
+
+void Narrowphase::addPrimitive(const CollisionPrimitive *primitive,
+                               PrimitiveType type)
+{
+    Entry entry;
+    entry.body = primitive->body;
+    entry.primitive = primitive;
+    entry.type = type;
+    entries.push_back(entry);
+    sorted = false;
+}
+
+void Narrowphase::removePrimitive(const CollisionPrimitive *primitive)
+{
+    for (unsigned i = 0; i < entries.size(); i++)
+    {
+        if (entries[i].primitive == primitive)
+        {
+            // Removing keeps the entries in order.
+            entries.erase(entries.begin() + i);
+            return;
+        }
+    }
+}
+
+void Narrowphase::clear()
+{
+    entries.clear();
+    sorted = true;
+}
+
+void Narrowphase::setBatchFunction(PrimitiveType one, PrimitiveType two,
+                                   BatchFunction function)
+{
+    if (one > two) std::swap(one, two);
+    table[one][two] = function;
+}
+
+Narrowphase::BatchFunction Narrowphase::getBatchFunction(
+    PrimitiveType one, PrimitiveType two) const
+{
+    if (one > two) std::swap(one, two);
+    return table[one][two];
+}
+
+const Narrowphase::Entry *Narrowphase::findEntry(RigidBody *body) const
+{
+    Entry key;
+    key.body = body;
+    std::vector<Entry>::const_iterator found =
+        std::lower_bound(entries.begin(), entries.end(), key);
+    if (found == entries.end() || found->body != body) return NULL;
+    return &*found;
+}
+
+unsigned Narrowphase::collide(const PotentialContact *contacts,
+                              unsigned count,
+                              CollisionData *data)
+{
+    if (!sorted)
+    {
+        std::sort(entries.begin(), entries.end());
+        sorted = true;
+    }
+
+    // Look up the primitives of each pair, putting the earlier kind
+    // first, and count the pairs in each batch.
+    const unsigned batches = PRIMITIVE_TYPE_COUNT*PRIMITIVE_TYPE_COUNT;
+    unsigned batchCount[batches] = {0};
+    found.clear();
+    foundBatch.clear();
+    for (unsigned i = 0; i < count; i++)
+    {
+        const Entry *one = findEntry(contacts[i].body[0]);
+        const Entry *two = findEntry(contacts[i].body[1]);
+        if (!one || !two) continue;
+        if (one->type > two->type) std::swap(one, two);
+
+        PrimitivePair pair;
+        pair.one = one->primitive;
+        pair.two = two->primitive;
+        unsigned batch = one->type * PRIMITIVE_TYPE_COUNT + two->type;
+        found.push_back(pair);
+        foundBatch.push_back(batch);
+        batchCount[batch]++;
+    }
+
+    // Sort the pairs into their batches, keeping their order within
+    // each batch.
+    unsigned offset = 0;
+    for (unsigned batch = 0; batch < batches; batch++)
+    {
+        batchStart[batch] = offset;
+        offset += batchCount[batch];
+    }
+    batchStart[batches] = offset;
+
+    batched.resize(found.size());
+    for (unsigned i = 0; i < found.size(); i++)
+    {
+        unsigned batch = foundBatch[i];
+        unsigned end = batchStart[batch+1] - batchCount[batch]--;
+        batched[end] = found[i];
+    }
+
+    // And hand each batch to its function.
+    unsigned startCount = data->contactCount;
+    for (unsigned one = 0; one < PRIMITIVE_TYPE_COUNT; one++)
+    {
+        for (unsigned two = one; two < PRIMITIVE_TYPE_COUNT; two++)
+        {
+            unsigned batch = one * PRIMITIVE_TYPE_COUNT + two;
+            unsigned size = batchStart[batch+1] - batchStart[batch];
+            if (size == 0 || !table[one][two]) continue;
+
+            table[one][two](&batched[batchStart[batch]], size, data);
+        }
+    }
+    return data->contactCount - startCount;
+}
+
+unsigned Narrowphase::getBatchSize(PrimitiveType one,
+                                   PrimitiveType two) const
+{
+    if (one > two) std::swap(one, two);
+    unsigned batch = one * PRIMITIVE_TYPE_COUNT + two;
+    return batchStart[batch+1] - batchStart[batch];
+}
+
+void Narrowphase::sphereAndSphereBatch(const PrimitivePair *pairs,
+                                       unsigned count,
+                                       CollisionData *data)
+{
+    // Lay the spheres out in arrays, a block at a time, for the
+    // detector to test several pairs at once.
+    const unsigned BLOCK = 64;
+    real x[2][BLOCK], y[2][BLOCK], z[2][BLOCK], radius[2][BLOCK];
+    const CollisionSphere *spheres[2][BLOCK];
+    SphereArrays arrays[2];
+    for (unsigned n = 0; n < 2; n++)
+    {
+        arrays[n].x = x[n];
+        arrays[n].y = y[n];
+        arrays[n].z = z[n];
+        arrays[n].radius = radius[n];
+        arrays[n].spheres = spheres[n];
+    }
+
+    for (unsigned start = 0; start < count; start += BLOCK)
+    {
+        if (!data->hasMoreContacts()) return;
+
+        unsigned size = std::min(BLOCK, count - start);
+        for (unsigned i = 0; i < size; i++)
+        {
+            spheres[0][i] = (const CollisionSphere*)pairs[start+i].one;
+            spheres[1][i] = (const CollisionSphere*)pairs[start+i].two;
+            for (unsigned n = 0; n < 2; n++)
+            {
+                Vector3 position = spheres[n][i]->getAxis(3);
+                x[n][i] = position.x;
+                y[n][i] = position.y;
+                z[n][i] = position.z;
+                radius[n][i] = spheres[n][i]->radius;
+            }
+        }
+        CollisionDetector::sphereAndSphereBatch(
+            arrays[0], arrays[1], size, data);
+    }
+}
+
+void Narrowphase::sphereAndBoxBatch(const PrimitivePair *pairs,
+                                    unsigned count,
+                                    CollisionData *data)
+{
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (!data->hasMoreContacts()) return;
+        CollisionDetector::boxAndSphere(
+            *(const CollisionBox*)pairs[i].two,
+            *(const CollisionSphere*)pairs[i].one,
+            data);
+    }
+}
+
+void Narrowphase::boxAndBoxBatch(const PrimitivePair *pairs,
+                                 unsigned count,
+                                 CollisionData *data)
+{
+    // Split the pairs into the detector's two lists, a block at a
+    // time.
+    const unsigned BLOCK = 64;
+    const CollisionBox *boxes[2][BLOCK];
+    for (unsigned start = 0; start < count; start += BLOCK)
+    {
+        if (!data->hasMoreContacts()) return;
+
+        unsigned size = std::min(BLOCK, count - start);
+        for (unsigned i = 0; i < size; i++)
+        {
+            boxes[0][i] = (const CollisionBox*)pairs[start+i].one;
+            boxes[1][i] = (const CollisionBox*)pairs[start+i].two;
+        }
+        CollisionDetector::boxAndBoxBatch(boxes[0], boxes[1], size, data);
+    }
+}
+
+void Narrowphase::boxAndBoxClippedBatch(const PrimitivePair *pairs,
+                                        unsigned count,
+                                        CollisionData *data)
+{
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (!data->hasMoreContacts()) return;
+        CollisionDetector::boxAndBoxClipped(
+            *(const CollisionBox*)pairs[i].one,
+            *(const CollisionBox*)pairs[i].two,
+            data);
+    }
+}
+
+void Narrowphase::sphereAndConvexBatch(const PrimitivePair *pairs,
+                                       unsigned count,
+                                       CollisionData *data)
+{
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (!data->hasMoreContacts()) return;
+        CollisionDetector::convexAndSphere(
+            *(const CollisionConvex*)pairs[i].two,
+            *(const CollisionSphere*)pairs[i].one,
+            data);
+    }
+}
+
+void Narrowphase::boxAndConvexBatch(const PrimitivePair *pairs,
+                                    unsigned count,
+                                    CollisionData *data)
+{
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (!data->hasMoreContacts()) return;
+        CollisionDetector::convexAndBox(
+            *(const CollisionConvex*)pairs[i].two,
+            *(const CollisionBox*)pairs[i].one,
+            data);
+    }
+}
+
+void Narrowphase::convexAndConvexBatch(const PrimitivePair *pairs,
+                                       unsigned count,
+                                       CollisionData *data)
+{
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (!data->hasMoreContacts()) return;
+        CollisionDetector::convexAndConvex(
+            *(const CollisionConvex*)pairs[i].one,
+            *(const CollisionConvex*)pairs[i].two,
+            data);
+    }
+}
+
+void Narrowphase::sphereAndCapsuleBatch(const PrimitivePair *pairs,
+                                        unsigned count,
+                                        CollisionData *data)
+{
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (!data->hasMoreContacts()) return;
+        CollisionDetector::capsuleAndSphere(
+            *(const CollisionCapsule*)pairs[i].two,
+            *(const CollisionSphere*)pairs[i].one,
+            data);
+    }
+}
+
+void Narrowphase::boxAndCapsuleBatch(const PrimitivePair *pairs,
+                                     unsigned count,
+                                     CollisionData *data)
+{
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (!data->hasMoreContacts()) return;
+        CollisionDetector::capsuleAndBox(
+            *(const CollisionCapsule*)pairs[i].two,
+            *(const CollisionBox*)pairs[i].one,
+            data);
+    }
+}
+
+void Narrowphase::convexAndCapsuleBatch(const PrimitivePair *pairs,
+                                        unsigned count,
+                                        CollisionData *data)
+{
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (!data->hasMoreContacts()) return;
+        CollisionDetector::convexAndCapsule(
+            *(const CollisionConvex*)pairs[i].one,
+            *(const CollisionCapsule*)pairs[i].two,
+            data);
+    }
+}
+
+void Narrowphase::capsuleAndCapsuleBatch(const PrimitivePair *pairs,
+                                         unsigned count,
+                                         CollisionData *data)
+{
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (!data->hasMoreContacts()) return;
+        CollisionDetector::capsuleAndCapsule(
+            *(const CollisionCapsule*)pairs[i].one,
+            *(const CollisionCapsule*)pairs[i].two,
+            data);
+    }
+}
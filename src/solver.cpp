@@ -0,0 +1,612 @@
+/*
+ * Implementation file for the sequential impulse contact solver.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+#include <algorithm>
+#include <functional>
+#include <cyclone/solver.h>
+
+using namespace cyclone;
+
+// Contact cache implementation
+
+bool ContactCache::keyLess(const Entry &a, const Entry &b)
+{
+    std::less<RigidBody*> bodyLess;
+    if (a.body[0] != b.body[0]) return bodyLess(a.body[0], b.body[0]);
+    if (a.body[1] != b.body[1]) return bodyLess(a.body[1], b.body[1]);
+    return a.feature < b.feature;
+}
+
+bool ContactCache::lookup(RigidBody *one, RigidBody *two, unsigned feature,
+                          Vector3 *impulse) const
+{
+    Entry key;
+    key.body[0] = one;
+    key.body[1] = two;
+    key.feature = feature;
+
+    std::vector<Entry>::const_iterator found =
+        std::lower_bound(previous.begin(), previous.end(), key, keyLess);
+    if (found == previous.end() || keyLess(key, *found)) return false;
+
+    *impulse = found->impulse;
+    return true;
+}
+
+void ContactCache::store(const Entry *entries, unsigned count)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    current.insert(current.end(), entries, entries + count);
+}
+
+void ContactCache::advanceFrame()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    previous.swap(current);
+    current.clear();
+    std::sort(previous.begin(), previous.end(), keyLess);
+}
+
+void ContactCache::clear()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    previous.clear();
+    current.clear();
+}
+
+
+
+
+// Sequential impulse resolver implementation
+
+SequentialImpulseResolver::SequentialImpulseResolver(
+    unsigned velocityIterations,
+    unsigned positionIterations,
+    real velocityEpsilon,
+    real positionEpsilon)
+:
+ContactResolver(velocityIterations, positionIterations,
+                velocityEpsilon, positionEpsilon),
+cache(NULL),
+threadPool(NULL),
+movedBatch(0),
+colouring(false)
+{
+}
+
+ContactResolver *SequentialImpulseResolver::clone() const
+{
+    return new SequentialImpulseResolver(*this);
+}
+
+void SequentialImpulseResolver::setCache(ContactCache *cache)
+{
+    SequentialImpulseResolver::cache = cache;
+}
+
+void SequentialImpulseResolver::setThreadPool(ThreadPool *pool)
+{
+    threadPool = pool;
+}
+
+void SequentialImpulseResolver::startFrame()
+{
+    if (cache) cache->advanceFrame();
+}
+
+void SequentialImpulseResolver::resolveContacts(Contact *contacts,
+                                                unsigned numContacts,
+                                                real duration)
+{
+    // Make sure we have something to do.
+    if (numContacts == 0) return;
+    if (!isValid()) return;
+
+    // Prepare the contacts for processing
+    prepareContacts(contacts, numContacts, duration);
+
+    // Inside one of the pool's tasks the other workers are taken, so
+    // colouring would only cost time.
+    colouring = threadPool && !threadPool->isRunningTask();
+    if (colouring) colourContacts(numContacts);
+
+    // Resolve the interpenetration problems with the contacts.
+    if (colouring) solvePositionsByColour(contacts, numContacts);
+    else solvePositions(contacts, numContacts);
+
+    // Wake up any body that is about to be hit, so we know which
+    // bodies can move before working out the contact states.
+    for (unsigned i = 0; i < numContacts; i++)
+    {
+        if (contacts[i].desiredDeltaVelocity > velocityEpsilon)
+        {
+            contacts[i].matchAwakeState();
+        }
+    }
+
+    // Resolve the velocity problems with the contacts.
+    prepareStates(contacts, numContacts);
+    solveVelocities(contacts, numContacts);
+
+    // And remember the result for next frame.
+    storeImpulses(contacts, numContacts);
+}
+
+void SequentialImpulseResolver::prepareStates(Contact *contacts,
+                                              unsigned numContacts)
+{
+    states.resize(numContacts);
+    for (unsigned i = 0; i < numContacts; i++)
+    {
+        Contact &contact = contacts[i];
+        ContactState &state = states[i];
+
+        // Sleeping bodies can't be moved by the contact.
+        for (unsigned b = 0; b < 2; b++)
+        {
+            RigidBody *body = contact.body[b];
+            if (body && body->getAwake())
+            {
+                state.inverseMass[b] = body->getInverseMass();
+                body->getInverseInertiaTensorWorld(
+                    &state.inverseInertiaTensor[b]);
+            }
+            else
+            {
+                state.inverseMass[b] = 0;
+                state.inverseInertiaTensor[b] = Matrix3();
+            }
+        }
+
+        // Work out the change in velocity along each contact axis for
+        // a unit impulse along it, in the same way as the frictionless
+        // impulse calculation does for the normal.
+        for (unsigned axis = 0; axis < 3; axis++)
+        {
+            Vector3 direction = contact.contactToWorld.getAxisVector(axis);
+            real deltaVelocity = state.inverseMass[0] + state.inverseMass[1];
+            for (unsigned b = 0; b < 2; b++) if (contact.body[b])
+            {
+                Vector3 deltaVelWorld =
+                    contact.relativeContactPosition[b] % direction;
+                deltaVelWorld =
+                    state.inverseInertiaTensor[b].transform(deltaVelWorld);
+                deltaVelWorld =
+                    deltaVelWorld % contact.relativeContactPosition[b];
+                deltaVelocity += deltaVelWorld * direction;
+            }
+            state.axisMass[axis] =
+                (deltaVelocity > 0) ? ((real)1.0 / deltaVelocity) : 0;
+        }
+
+        // The desired change in velocity already includes the bounce,
+        // so the target is wherever that change would leave us.
+        state.targetVelocity =
+            contact.contactVelocity.x + contact.desiredDeltaVelocity;
+
+        // Start from last frame's impulse, if we have it, limited so it
+        // can't pull or exceed the friction cone.
+        state.impulse.clear();
+        Vector3 impulse;
+        if (cache && cache->lookup(contact.body[0], contact.body[1],
+                                   contact.feature, &impulse))
+        {
+            impulse = contact.contactToWorld.transformTranspose(impulse);
+            if (impulse.x > 0)
+            {
+                real planarImpulse = real_sqrt(
+                    impulse.y*impulse.y + impulse.z*impulse.z);
+                real limit = contact.friction * impulse.x;
+                if (planarImpulse > limit)
+                {
+                    impulse.y *= limit / planarImpulse;
+                    impulse.z *= limit / planarImpulse;
+                }
+                state.impulse = impulse;
+                applyImpulse(contact, state,
+                    contact.contactToWorld.transform(impulse));
+            }
+        }
+    }
+}
+
+void SequentialImpulseResolver::applyImpulse(Contact &contact,
+                                             const ContactState &state,
+                                             const Vector3 &impulse)
+{
+    Vector3 impulsiveTorque =
+        contact.relativeContactPosition[0] % impulse;
+    contact.body[0]->addVelocity(impulse * state.inverseMass[0]);
+    contact.body[0]->addRotation(
+        state.inverseInertiaTensor[0].transform(impulsiveTorque));
+
+    if (contact.body[1])
+    {
+        impulsiveTorque = impulse % contact.relativeContactPosition[1];
+        contact.body[1]->addVelocity(impulse * -state.inverseMass[1]);
+        contact.body[1]->addRotation(
+            state.inverseInertiaTensor[1].transform(impulsiveTorque));
+    }
+}
+
+/*
+ * Returns the relative velocity of the bodies at the given contact,
+ * in contact coordinates.
+ */
+static inline Vector3 relativeVelocity(const Contact &contact,
+                                       const Matrix3 &contactToWorld,
+                                       const Vector3 *relativePosition)
+{
+    Vector3 velocity = contact.body[0]->getVelocity() +
+        contact.body[0]->getRotation() % relativePosition[0];
+    if (contact.body[1])
+    {
+        velocity -= contact.body[1]->getVelocity() +
+            contact.body[1]->getRotation() % relativePosition[1];
+    }
+    return contactToWorld.transformTranspose(velocity);
+}
+
+void SequentialImpulseResolver::solveContactVelocity(Contact &contact,
+                                                     ContactState &state)
+{
+    // Find the impulse along the normal that gives the target
+    // velocity, and clamp the total so it never pulls.
+    Vector3 velocity = relativeVelocity(contact,
+        contact.contactToWorld, contact.relativeContactPosition);
+    real oldImpulse = state.impulse.x;
+    state.impulse.x +=
+        (state.targetVelocity - velocity.x) * state.axisMass.x;
+    if (state.impulse.x < 0) state.impulse.x = 0;
+
+    applyImpulse(contact, state, contact.contactToWorld.transform(
+        Vector3(state.impulse.x - oldImpulse, 0, 0)));
+
+    if (contact.friction == (real)0.0) return;
+
+    // Then find the impulse that stops the contact sliding, and clamp
+    // the total to the friction cone, whose size depends on the normal
+    // impulse we've just found.
+    velocity = relativeVelocity(contact,
+        contact.contactToWorld, contact.relativeContactPosition);
+    Vector3 oldFriction(0, state.impulse.y, state.impulse.z);
+    state.impulse.y -= velocity.y * state.axisMass.y;
+    state.impulse.z -= velocity.z * state.axisMass.z;
+
+    real planarImpulse = real_sqrt(
+        state.impulse.y*state.impulse.y +
+        state.impulse.z*state.impulse.z
+        );
+    real limit = contact.friction * state.impulse.x;
+    if (planarImpulse > limit)
+    {
+        state.impulse.y *= limit / planarImpulse;
+        state.impulse.z *= limit / planarImpulse;
+    }
+
+    applyImpulse(contact, state, contact.contactToWorld.transform(
+        Vector3(0, state.impulse.y, state.impulse.z) - oldFriction));
+}
+
+void SequentialImpulseResolver::solveVelocities(Contact *contacts,
+                                                unsigned numContacts)
+{
+    velocityIterationsUsed = 0;
+    while (velocityIterationsUsed < velocityIterations)
+    {
+        if (colouring)
+        {
+            // Contacts of one colour share no bodies, so they can all
+            // be resolved at once.
+            for (unsigned k = 0; k + 1 < colourStart.size(); k++)
+            {
+                runBatch(velocityTask, contacts,
+                    &colouredContacts[colourStart[k]],
+                    colourStart[k+1] - colourStart[k]);
+            }
+        }
+        else
+        {
+            for (unsigned i = 0; i < numContacts; i++)
+            {
+                solveContactVelocity(contacts[i], states[i]);
+            }
+        }
+        velocityIterationsUsed++;
+    }
+}
+
+void SequentialImpulseResolver::colourContacts(unsigned numContacts)
+{
+    // Give each contact the lowest colour not already taken by a
+    // contact it shares a body with. Every body with a contact has a
+    // number in the adjacency data, so we can find its contacts.
+    contactColour.assign(numContacts, 0xffffffff);
+    colourMark.clear();
+    unsigned colourCount = 0;
+    for (unsigned i = 0; i < numContacts; i++)
+    {
+        for (unsigned b = 0; b < 2; b++)
+        {
+            unsigned body = slotBody[i*2 + b];
+            if (body == NO_BODY) continue;
+
+            for (unsigned e = bodySlotStart[body];
+                 e < bodySlotStart[body+1]; e++)
+            {
+                unsigned colour = contactColour[bodySlots[e] >> 1];
+                if (colour < colourCount) colourMark[colour] = i;
+            }
+        }
+
+        unsigned colour = 0;
+        while (colour < colourCount && colourMark[colour] == i) colour++;
+        if (colour == colourCount)
+        {
+            colourCount++;
+            colourMark.push_back(0xffffffff);
+        }
+        contactColour[i] = colour;
+    }
+
+    // Group the contacts by colour, keeping them in order within each.
+    colourStart.assign(colourCount + 1, 0);
+    for (unsigned i = 0; i < numContacts; i++)
+    {
+        colourStart[contactColour[i] + 1]++;
+    }
+    for (unsigned k = 0; k < colourCount; k++)
+    {
+        colourStart[k+1] += colourStart[k];
+    }
+    colouredContacts.resize(numContacts);
+    for (unsigned k = 0; k < colourCount; k++)
+    {
+        colourMark[k] = colourStart[k];
+    }
+    for (unsigned i = 0; i < numContacts; i++)
+    {
+        colouredContacts[colourMark[contactColour[i]]++] = i;
+    }
+}
+
+void SequentialImpulseResolver::findColourNeighbours(unsigned numContacts)
+{
+    // Colours share no bodies, so each body is visited at most once
+    // per colour, but a contact between two bodies of the colour
+    // would be found twice without the marks.
+    unsigned colourCount = (unsigned)colourStart.size() - 1;
+    neighbourMark.assign(numContacts, 0xffffffff);
+    neighbourStart.resize(colourCount + 1);
+    colourNeighbours.clear();
+    for (unsigned k = 0; k < colourCount; k++)
+    {
+        neighbourStart[k] = (unsigned)colourNeighbours.size();
+        for (unsigned n = colourStart[k]; n < colourStart[k+1]; n++)
+        {
+            unsigned i = colouredContacts[n];
+            for (unsigned b = 0; b < 2; b++)
+            {
+                unsigned body = slotBody[i*2 + b];
+                if (body == NO_BODY) continue;
+
+                for (unsigned e = bodySlotStart[body];
+                     e < bodySlotStart[body+1]; e++)
+                {
+                    unsigned j = bodySlots[e] >> 1;
+                    if (neighbourMark[j] == k) continue;
+                    neighbourMark[j] = k;
+                    colourNeighbours.push_back(j);
+                }
+            }
+        }
+    }
+    neighbourStart[colourCount] = (unsigned)colourNeighbours.size();
+}
+
+void SequentialImpulseResolver::runBatch(ThreadPool::Task task,
+                                         Contact *contacts,
+                                         const unsigned *order,
+                                         unsigned count)
+{
+    if (count == 0) return;
+
+    // Give each worker a couple of chunks, so a slow one can be helped
+    // out, but don't make chunks so small the overhead dominates.
+    const unsigned minChunkSize = 32;
+    unsigned chunks = threadPool->getWorkerCount() * 2;
+    unsigned chunkSize = (count + chunks - 1) / chunks;
+    if (chunkSize < minChunkSize) chunkSize = minChunkSize;
+
+    batch.resolver = this;
+    batch.contacts = contacts;
+    batch.order = order;
+    batch.count = count;
+    batch.chunkSize = chunkSize;
+    threadPool->run((count + chunkSize - 1) / chunkSize, task, &batch);
+}
+
+void SequentialImpulseResolver::velocityTask(unsigned index, unsigned,
+                                             void *data)
+{
+    const Batch &batch = *(Batch*)data;
+    unsigned end = std::min(batch.count, (index + 1) * batch.chunkSize);
+    for (unsigned n = index * batch.chunkSize; n < end; n++)
+    {
+        unsigned i = batch.order[n];
+        batch.resolver->solveContactVelocity(
+            batch.contacts[i], batch.resolver->states[i]);
+    }
+}
+
+void SequentialImpulseResolver::positionTask(unsigned index, unsigned,
+                                             void *data)
+{
+    const Batch &batch = *(Batch*)data;
+    SequentialImpulseResolver *resolver = batch.resolver;
+    Vector3 linearChange[2], angularChange[2];
+
+    unsigned end = std::min(batch.count, (index + 1) * batch.chunkSize);
+    for (unsigned n = index * batch.chunkSize; n < end; n++)
+    {
+        unsigned i = batch.order[n];
+        Contact &contact = batch.contacts[i];
+        if (contact.penetration <= resolver->positionEpsilon) continue;
+
+        contact.matchAwakeState();
+        contact.applyPositionChange(
+            linearChange,
+            angularChange,
+            contact.penetration);
+
+        // No other contact in the batch shares these bodies, so we can
+        // record their movement without locking.
+        for (unsigned b = 0; b < 2; b++)
+        {
+            unsigned body = resolver->slotBody[i*2 + b];
+            if (body == NO_BODY) continue;
+
+            resolver->bodyLinearChange[body] = linearChange[b];
+            resolver->bodyAngularChange[body] = angularChange[b];
+            resolver->bodyMovedBatch[body] = resolver->movedBatch;
+        }
+    }
+}
+
+void SequentialImpulseResolver::penetrationTask(unsigned index, unsigned,
+                                                void *data)
+{
+    const Batch &batch = *(Batch*)data;
+    SequentialImpulseResolver *resolver = batch.resolver;
+
+    unsigned end = std::min(batch.count, (index + 1) * batch.chunkSize);
+    for (unsigned n = index * batch.chunkSize; n < end; n++)
+    {
+        unsigned i = batch.order[n];
+        Contact &contact = batch.contacts[i];
+        for (unsigned b = 0; b < 2; b++)
+        {
+            unsigned body = resolver->slotBody[i*2 + b];
+            if (body == NO_BODY) continue;
+            if (resolver->bodyMovedBatch[body] != resolver->movedBatch)
+            {
+                continue;
+            }
+
+            Vector3 deltaPosition = resolver->bodyLinearChange[body] +
+                resolver->bodyAngularChange[body].vectorProduct(
+                    contact.relativeContactPosition[b]);
+
+            contact.penetration +=
+                deltaPosition.scalarProduct(contact.contactNormal)
+                * (b?1:-1);
+        }
+    }
+}
+
+void SequentialImpulseResolver::solvePositions(Contact *c,
+                                               unsigned numContacts)
+{
+    Vector3 linearChange[2], angularChange[2];
+    Vector3 deltaPosition;
+
+    positionIterationsUsed = 0;
+    while (positionIterationsUsed < positionIterations)
+    {
+        bool moved = false;
+        for (unsigned index = 0; index < numContacts; index++)
+        {
+            if (c[index].penetration <= positionEpsilon) continue;
+            moved = true;
+
+            // Match the awake state at the contact
+            c[index].matchAwakeState();
+
+            // Resolve the penetration.
+            c[index].applyPositionChange(
+                linearChange,
+                angularChange,
+                c[index].penetration);
+
+            // Update the penetration of every contact that shares a
+            // body with this one, including itself.
+            findAffectedSlots(index);
+            for (unsigned s = 0; s < affectedSlots.size(); s++)
+            {
+                unsigned i = affectedSlots[s] >> 2;
+                unsigned b = (affectedSlots[s] >> 1) & 1;
+                unsigned d = affectedSlots[s] & 1;
+
+                deltaPosition = linearChange[d] +
+                    angularChange[d].vectorProduct(
+                        c[i].relativeContactPosition[b]);
+
+                c[i].penetration +=
+                    deltaPosition.scalarProduct(c[i].contactNormal)
+                    * (b?1:-1);
+            }
+        }
+        if (!moved) break;
+        positionIterationsUsed++;
+    }
+}
+
+void SequentialImpulseResolver::solvePositionsByColour(Contact *c,
+                                                       unsigned numContacts)
+{
+    bodyLinearChange.resize(numBodies);
+    bodyAngularChange.resize(numBodies);
+    bodyMovedBatch.assign(numBodies, movedBatch);
+    findColourNeighbours(numContacts);
+
+    positionIterationsUsed = 0;
+    while (positionIterationsUsed < positionIterations)
+    {
+        bool penetrating = false;
+        for (unsigned i = 0; i < numContacts && !penetrating; i++)
+        {
+            if (c[i].penetration > positionEpsilon) penetrating = true;
+        }
+        if (!penetrating) break;
+
+        // Move the bodies of each colour at once, then bring the
+        // contacts touching them up to date before the next.
+        for (unsigned k = 0; k + 1 < colourStart.size(); k++)
+        {
+            movedBatch++;
+            runBatch(positionTask, c,
+                &colouredContacts[colourStart[k]],
+                colourStart[k+1] - colourStart[k]);
+            runBatch(penetrationTask, c,
+                &colourNeighbours[neighbourStart[k]],
+                neighbourStart[k+1] - neighbourStart[k]);
+        }
+        positionIterationsUsed++;
+    }
+}
+
+void SequentialImpulseResolver::storeImpulses(Contact *contacts,
+                                              unsigned numContacts)
+{
+    if (!cache) return;
+
+    cacheEntries.resize(numContacts);
+    for (unsigned i = 0; i < numContacts; i++)
+    {
+        ContactCache::Entry &entry = cacheEntries[i];
+        entry.body[0] = contacts[i].body[0];
+        entry.body[1] = contacts[i].body[1];
+        entry.feature = contacts[i].feature;
+        entry.impulse = contacts[i].contactToWorld.transform(states[i].impulse);
+    }
+    cache->store(&cacheEntries[0], numContacts);
+}
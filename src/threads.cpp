@@ -0,0 +1,179 @@
+/*
+ * Implementation file for the thread pool.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+#include <cyclone/threads.h>
+
+using namespace cyclone;
+
+/*
+ * Holds the pool whose task is running on this thread, if any, and
+ * the worker it is running as.
+ */
+static thread_local ThreadPool *activePool = NULL;
+static thread_local unsigned activeWorker = 0;
+
+ThreadPool::ThreadPool(unsigned workers)
+:
+batch(0), busy(0), quit(false), task(NULL), data(NULL)
+{
+    if (workers == 0) workers = std::thread::hardware_concurrency();
+    if (workers == 0) workers = 1;
+
+    workerCount = workers;
+    this->workers = new Worker[workerCount];
+
+    for (unsigned i = 1; i < workerCount; i++)
+    {
+        threads.push_back(std::thread(&ThreadPool::threadMain, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        quit = true;
+    }
+    started.notify_all();
+
+    for (unsigned i = 0; i < threads.size(); i++)
+    {
+        threads[i].join();
+    }
+    delete[] workers;
+}
+
+bool ThreadPool::takeTask(unsigned worker, unsigned &index)
+{
+    // Try our own queue first, from the front.
+    {
+        Worker &own = workers[worker];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (own.head < own.tail)
+        {
+            index = own.tasks[own.head++];
+            return true;
+        }
+    }
+
+    // Then steal from the back of everyone else's, starting with our
+    // neighbour so the thieves spread out.
+    for (unsigned i = 1; i < workerCount; i++)
+    {
+        Worker &victim = workers[(worker + i) % workerCount];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (victim.head < victim.tail)
+        {
+            index = victim.tasks[--victim.tail];
+            return true;
+        }
+    }
+
+    // No new tasks are added during a batch, so an empty set of
+    // queues means we're done.
+    return false;
+}
+
+void ThreadPool::work(unsigned worker)
+{
+    ThreadPool *outerPool = activePool;
+    unsigned outerWorker = activeWorker;
+    activePool = this;
+    activeWorker = worker;
+
+    unsigned index;
+    while (takeTask(worker, index))
+    {
+        task(index, worker, data);
+    }
+
+    activePool = outerPool;
+    activeWorker = outerWorker;
+}
+
+bool ThreadPool::isRunningTask() const
+{
+    return activePool == this;
+}
+
+void ThreadPool::threadMain(unsigned worker)
+{
+    unsigned lastBatch = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            while (!quit && batch == lastBatch) started.wait(guard);
+            if (quit) return;
+            lastBatch = batch;
+        }
+
+        work(worker);
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (--busy == 0) finished.notify_one();
+        }
+    }
+}
+
+void ThreadPool::run(unsigned count, Task task, void *data)
+{
+    if (count == 0) return;
+
+    // With one worker, or one task, there is nothing to share out. If
+    // we're inside one of our own tasks, the other workers are busy
+    // with the rest of the outer batch, so we do it all ourselves.
+    if (activePool == this)
+    {
+        for (unsigned i = 0; i < count; i++) task(i, activeWorker, data);
+        return;
+    }
+    if (workerCount == 1 || count == 1)
+    {
+        for (unsigned i = 0; i < count; i++) task(i, 0, data);
+        return;
+    }
+
+    // Deal the tasks out in order, so each worker starts on the
+    // earliest of its share. The other threads are waiting for the
+    // batch to start, so the queues can be filled without locking.
+    unsigned share = (count + workerCount - 1) / workerCount;
+    for (unsigned i = 0; i < workerCount; i++)
+    {
+        Worker &worker = workers[i];
+        if (worker.tasks.size() < share) worker.tasks.resize(share);
+        worker.head = 0;
+        worker.tail = 0;
+    }
+    for (unsigned i = 0; i < count; i++)
+    {
+        Worker &worker = workers[i % workerCount];
+        worker.tasks[worker.tail++] = i;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        this->task = task;
+        this->data = data;
+        busy = workerCount - 1;
+        batch++;
+    }
+    started.notify_all();
+
+    // Join in, then wait for the other threads to finish what they
+    // have taken.
+    work(0);
+
+    std::unique_lock<std::mutex> guard(lock);
+    while (busy > 0) finished.wait(guard);
+}
@@ -0,0 +1,325 @@
+/*
+ * Implementation file for the static triangle mesh.
+ *
+ * Part of the Cyclone physics system.
+ *
+ * Copyright (c) Icosagon 2003. All Rights Reserved.
+ *
+ * This software is distributed under licence. Use of this software
+ * implies agreement with all terms and conditions of the accompanying
+ * software licence.
+ */
+
+#include <algorithm>
+#include <cyclone/trimesh.h>
+
+using namespace cyclone;
+
+/*
+ * The cost of visiting a node, compared with testing one triangle,
+ * as the surface area heuristic counts it.
+ */
+static const real NODE_COST = (real)1.0;
+
+/*
+ * Marks a range of triangles that isn't the second child of a node.
+ */
+static const unsigned NO_PARENT = 0xffffffff;
+
+/**
+ * Holds a triangle while the hierarchy is built.
+ */
+struct BuildTriangle
+{
+    BoundingBox box;
+    Vector3 centre;
+    unsigned source;
+};
+
+/**
+ * Holds a range of triangles waiting to be made into a node, with
+ * the node it is the second child of, if any, and its level.
+ */
+struct BuildRange
+{
+    unsigned start;
+    unsigned end;
+    unsigned parent;
+    unsigned depth;
+};
+
+/**
+ * Holds what goes into one bin when looking for the best split.
+ */
+struct SplitBin
+{
+    BoundingBox box;
+    unsigned count;
+};
+
+/*
+ * Returns the bin that the given coordinate of a triangle's centre
+ * falls in.
+ */
+static inline unsigned binOf(real value, real lower, real scale)
+{
+    int bin = (int)((value - lower) * scale);
+    if (bin < 0) return 0;
+    if (bin >= (int)CollisionTriangleMesh::SPLIT_BINS)
+    {
+        return CollisionTriangleMesh::SPLIT_BINS - 1;
+    }
+    return (unsigned)bin;
+}
+
+/**
+ * Tells whether a triangle's centre falls below the given plane
+ * between bins, for partitioning the triangles.
+ */
+struct BelowPlane
+{
+    unsigned axis;
+    unsigned plane;
+    real lower;
+    real scale;
+
+    bool operator()(const BuildTriangle &triangle) const
+    {
+        return binOf(triangle.centre[axis], lower, scale) < plane;
+    }
+};
+
+/*
+ * Adds the second bounding box to the first, which is empty if it
+ * encloses nothing yet.
+ */
+static inline void addToBox(BoundingBox &box, bool &empty,
+                            const BoundingBox &other)
+{
+    box = empty ? other : BoundingBox(box, other);
+    empty = false;
+}
+
+/*
+ * Decides how to split the given triangles, which fit in the given
+ * box, and moves them so the first part comes first. Returns the
+ * number of triangles in the first part, or zero if they should be
+ * a leaf.
+ */
+static unsigned splitTriangles(BuildTriangle *triangles,
+                               unsigned count,
+                               const BoundingBox &box,
+                               unsigned leafSize)
+{
+    if (count <= 1) return 0;
+
+    // The bins are spread over the box round the centres, rather
+    // than the triangles, so they split where the triangles are.
+    Vector3 lower = triangles[0].centre;
+    Vector3 upper = lower;
+    for (unsigned i = 1; i < count; i++)
+    {
+        for (unsigned axis = 0; axis < 3; axis++)
+        {
+            real value = triangles[i].centre[axis];
+            if (value < lower[axis]) lower[axis] = value;
+            if (value > upper[axis]) upper[axis] = value;
+        }
+    }
+
+    real area = box.getSurfaceArea();
+    if (area <= 0) area = 1;
+
+    // Try the planes between the bins on each axis.
+    const unsigned BINS = CollisionTriangleMesh::SPLIT_BINS;
+    real bestCost = REAL_MAX;
+    unsigned bestAxis = 3;
+    unsigned bestPlane = 0;
+    for (unsigned axis = 0; axis < 3; axis++)
+    {
+        real extent = upper[axis] - lower[axis];
+        if (extent <= 0) continue;
+        real scale = BINS / extent;
+
+        SplitBin bins[BINS];
+        for (unsigned b = 0; b < BINS; b++) bins[b].count = 0;
+        for (unsigned i = 0; i < count; i++)
+        {
+            SplitBin &bin = bins[binOf(triangles[i].centre[axis],
+                                       lower[axis], scale)];
+            bin.box = bin.count ? BoundingBox(bin.box, triangles[i].box)
+                                : triangles[i].box;
+            bin.count++;
+        }
+
+        // Sweep from the top to find the cost of what lies above each
+        // plane, then from the bottom to add what lies below.
+        real aboveCost[BINS];
+        BoundingBox above;
+        bool empty = true;
+        unsigned aboveCount = 0;
+        for (unsigned b = BINS-1; b > 0; b--)
+        {
+            if (bins[b].count) addToBox(above, empty, bins[b].box);
+            aboveCount += bins[b].count;
+            aboveCost[b] = empty ? 0 : above.getSurfaceArea() * aboveCount;
+        }
+
+        BoundingBox below;
+        empty = true;
+        unsigned belowCount = 0;
+        for (unsigned plane = 1; plane < BINS; plane++)
+        {
+            const SplitBin &bin = bins[plane-1];
+            if (bin.count) addToBox(below, empty, bin.box);
+            belowCount += bin.count;
+            if (belowCount == 0 || belowCount == count) continue;
+
+            real cost = NODE_COST +
+                (below.getSurfaceArea() * belowCount + aboveCost[plane]) /
+                area;
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestPlane = plane;
+            }
+        }
+    }
+
+    // Triangles whose centres are all in the same place can't be told
+    // apart, so they are split down the middle if there are too many.
+    if (bestAxis == 3)
+    {
+        return count > leafSize ? count / 2 : 0;
+    }
+
+    // Small sets are only split if it makes queries cheaper.
+    if (count <= leafSize && bestCost >= (real)count) return 0;
+
+    BelowPlane below;
+    below.axis = bestAxis;
+    below.plane = bestPlane;
+    below.lower = lower[bestAxis];
+    below.scale = BINS / (upper[bestAxis] - lower[bestAxis]);
+    BuildTriangle *middle =
+        std::partition(triangles, triangles + count, below);
+    return (unsigned)(middle - triangles);
+}
+
+CollisionTriangleMesh::CollisionTriangleMesh()
+:
+height(0)
+{
+}
+
+CollisionTriangleMesh::CollisionTriangleMesh(const Vector3 *vertices,
+                                             unsigned vertexCount,
+                                             const unsigned *indices,
+                                             unsigned triangleCount,
+                                             unsigned leafSize)
+:
+height(0)
+{
+    build(vertices, vertexCount, indices, triangleCount, leafSize);
+}
+
+void CollisionTriangleMesh::build(const Vector3 *vertices,
+                                  unsigned vertexCount,
+                                  const unsigned *indices,
+                                  unsigned triangleCount,
+                                  unsigned leafSize)
+{
+    this->vertices.assign(vertices, vertices + vertexCount);
+    this->indices.clear();
+    normals.clear();
+    sourceTriangles.clear();
+    nodes.clear();
+    height = 0;
+    if (leafSize == 0) leafSize = 1;
+
+    // Find the box and centre of each triangle, leaving out those
+    // with no area, which have no normal to push anything along.
+    std::vector<BuildTriangle> triangles;
+    triangles.reserve(triangleCount);
+    for (unsigned i = 0; i < triangleCount; i++)
+    {
+        const Vector3 &a = vertices[indices[i*3]];
+        const Vector3 &b = vertices[indices[i*3+1]];
+        const Vector3 &c = vertices[indices[i*3+2]];
+        if (((b - a) % (c - a)).squareMagnitude() <= 0) continue;
+
+        BuildTriangle triangle;
+        triangle.box = BoundingBox(BoundingBox(a, a), BoundingBox(b, b));
+        triangle.box = BoundingBox(triangle.box, BoundingBox(c, c));
+        triangle.centre = (a + b + c) * ((real)1.0/(real)3.0);
+        triangle.source = i;
+        triangles.push_back(triangle);
+    }
+    if (triangles.empty()) return;
+
+    // Build the nodes depth first, so each node's first child comes
+    // straight after it. The second child is put on the stack, and
+    // fills in its parent's offset when its turn comes.
+    std::vector<BuildRange> stack;
+    BuildRange root = { 0, (unsigned)triangles.size(), NO_PARENT, 1 };
+    stack.push_back(root);
+    while (!stack.empty())
+    {
+        BuildRange range = stack.back();
+        stack.pop_back();
+
+        unsigned index = (unsigned)nodes.size();
+        nodes.push_back(Node());
+        if (range.parent != NO_PARENT) nodes[range.parent].offset = index;
+        if (range.depth > height) height = range.depth;
+
+        BoundingBox box = triangles[range.start].box;
+        for (unsigned i = range.start + 1; i < range.end; i++)
+        {
+            box = BoundingBox(box, triangles[i].box);
+        }
+        nodes[index].box = box;
+
+        unsigned count = range.end - range.start;
+        unsigned split = splitTriangles(&triangles[range.start], count,
+                                        box, leafSize);
+        if (split == 0)
+        {
+            nodes[index].offset = range.start;
+            nodes[index].count = count;
+            continue;
+        }
+
+        nodes[index].offset = NO_PARENT;
+        nodes[index].count = 0;
+        BuildRange second = {
+            range.start + split, range.end, index, range.depth + 1
+        };
+        BuildRange first = {
+            range.start, range.start + split, NO_PARENT, range.depth + 1
+        };
+        stack.push_back(second);
+        stack.push_back(first);
+    }
+
+    // Store the triangles in the order of the leaves.
+    this->indices.reserve(triangles.size() * 3);
+    normals.reserve(triangles.size());
+    sourceTriangles.reserve(triangles.size());
+    for (unsigned i = 0; i < triangles.size(); i++)
+    {
+        const unsigned *triangle = &indices[triangles[i].source * 3];
+        const Vector3 &a = vertices[triangle[0]];
+        const Vector3 &b = vertices[triangle[1]];
+        const Vector3 &c = vertices[triangle[2]];
+        Vector3 normal = (b - a) % (c - a);
+        normal.normalise();
+
+        this->indices.push_back(triangle[0]);
+        this->indices.push_back(triangle[1]);
+        this->indices.push_back(triangle[2]);
+        normals.push_back(normal);
+        sourceTriangles.push_back(triangles[i].source);
+    }
+}
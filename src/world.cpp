@@ -11,6 +11,7 @@
  */
 
 #include <cstdlib>
+#include <algorithm>
 #include <cyclone/world.h>
 
 using namespace cyclone;
@@ -19,20 +20,110 @@ World::World(unsigned maxContacts, unsigned iterations)
 :
 firstBody(NULL),
 resolver(iterations),
+customResolver(NULL),
 firstContactGen(NULL),
-maxContacts(maxContacts)
+frameArena(maxContacts * sizeof(Contact) * 2),
+contactArena(maxContacts, &frameArena),
+contacts(&contactArena),
+firstJoint(NULL),
+islandBodies(NULL),
+islandContacts(NULL),
+threadPool(NULL)
 {
-    contacts = new Contact[maxContacts];
     calculateIterations = (iterations == 0);
 }
 
 World::~World()
 {
-    delete[] contacts;
+    while (firstBody)
+    {
+        BodyRegistration *next = firstBody->next;
+        delete firstBody;
+        firstBody = next;
+    }
+    while (firstContactGen)
+    {
+        ContactGenRegistration *next = firstContactGen->next;
+        delete firstContactGen;
+        firstContactGen = next;
+    }
+    while (firstJoint)
+    {
+        JointRegistration *next = firstJoint->next;
+        delete firstJoint;
+        firstJoint = next;
+    }
+
+    clearWorkerResolvers();
+}
+
+void World::addBody(RigidBody *body)
+{
+    BodyRegistration *reg = new BodyRegistration;
+    reg->body = body;
+    reg->next = firstBody;
+    firstBody = reg;
+}
+
+BodyHandle World::createBody()
+{
+    return bodyStore.create();
+}
+
+void World::destroyBody(BodyHandle handle)
+{
+    bodyStore.destroy(handle);
+}
+
+void World::addContactGenerator(ContactGenerator *gen)
+{
+    ContactGenRegistration *reg = new ContactGenRegistration;
+    reg->gen = gen;
+    reg->next = firstContactGen;
+    firstContactGen = reg;
+}
+
+void World::addJoint(Joint *joint)
+{
+    JointRegistration *reg = new JointRegistration;
+    reg->joint = joint;
+    reg->next = firstJoint;
+    firstJoint = reg;
+}
+
+void World::setThreadPool(ThreadPool *pool)
+{
+    threadPool = pool;
+    clearWorkerResolvers();
+}
+
+void World::setResolver(ContactResolver *resolver)
+{
+    customResolver = resolver;
+    clearWorkerResolvers();
+}
+
+ContactResolver &World::getActiveResolver()
+{
+    if (customResolver) return *customResolver;
+    return resolver;
+}
+
+void World::clearWorkerResolvers()
+{
+    for (unsigned i = 0; i < workerResolvers.size(); i++)
+    {
+        delete workerResolvers[i];
+    }
+    workerResolvers.clear();
 }
 
 void World::startFrame()
 {
+    // Last frame's contacts and islands are finished with.
+    contacts.clear();
+    frameArena.reset();
+
     BodyRegistration *reg = firstBody;
     while (reg)
     {
@@ -43,29 +134,338 @@ void World::startFrame()
         // Get the next registration
         reg = reg->next;
     }
+
+    bodyStore.clearAccumulators();
+    bodyStore.calculateDerivedData();
+}
+
+void World::addGeneratorContacts(const ContactGenerator *gen)
+{
+    // Give the generator at least a whole chunk, so one that finds
+    // more than the end of the last chunk holds isn't run twice, and
+    // doesn't leave its first try behind in the arena.
+    unsigned room = std::max(contacts.getRoom(), contactArena.getChunkSize());
+
+    for (;;)
+    {
+        Contact *next = contacts.reserve(room);
+        unsigned used = gen->addContact(next, room);
+        if (used < room)
+        {
+            contacts.commit(used);
+            return;
+        }
+
+        // The generator filled the room it was given, so it may have
+        // had more contacts. Run it again with more room.
+        room *= 2;
+    }
 }
 
 unsigned World::generateContacts()
 {
-    unsigned limit = maxContacts;
-    Contact *nextContact = contacts;
+    // The contacts are found afresh each time.
+    contacts.clear();
 
     ContactGenRegistration * reg = firstContactGen;
     while (reg)
     {
-        unsigned used = reg->gen->addContact(nextContact, limit);
-        limit -= used;
-        nextContact += used;
+        addGeneratorContacts(reg->gen);
+        reg = reg->next;
+    }
 
-        // We've run out of contacts to fill. This means we're missing
-        // contacts.
-        if (limit <= 0) break;
+    JointRegistration *jointReg = firstJoint;
+    while (jointReg)
+    {
+        // A joint between two sleeping bodies has nothing to do.
+        Joint *joint = jointReg->joint;
+        if (!ContactGenerator::isSettled(joint->body[0], joint->body[1]))
+        {
+            addGeneratorContacts(joint);
+        }
 
-        reg = reg->next;
+        jointReg = jointReg->next;
     }
 
     // Return the number of contacts used.
-    return maxContacts - limit;
+    return contacts.getSize();
+}
+
+unsigned World::findBody(RigidBody *body) const
+{
+    return (unsigned)(std::lower_bound(
+        frameBodies.begin(), frameBodies.end(), body
+        ) - frameBodies.begin());
+}
+
+unsigned World::findRoot(unsigned body)
+{
+    unsigned root = body;
+    while (bodyIsland[root] != root) root = bodyIsland[root];
+
+    // Point everything on the path straight at the root.
+    while (bodyIsland[body] != root)
+    {
+        unsigned next = bodyIsland[body];
+        bodyIsland[body] = root;
+        body = next;
+    }
+    return root;
+}
+
+void World::joinBodies(RigidBody *one, RigidBody *two)
+{
+    if (!one || !two) return;
+
+    unsigned rootOne = findRoot(findBody(one));
+    unsigned rootTwo = findRoot(findBody(two));
+
+    // Always hang the later root from the earlier one, so the result
+    // doesn't depend on the order bodies are joined in.
+    if (rootOne < rootTwo) bodyIsland[rootTwo] = rootOne;
+    else if (rootTwo < rootOne) bodyIsland[rootOne] = rootTwo;
+}
+
+void World::buildIslands()
+{
+    unsigned numContacts = contacts.getSize();
+
+    // Collect every body that takes part in this frame: those that
+    // are registered, and any others that turn up in contacts or joints.
+    frameBodies.clear();
+    for (BodyRegistration *reg = firstBody; reg; reg = reg->next)
+    {
+        frameBodies.push_back(reg->body);
+    }
+    for (unsigned b = 0; b < bodyStore.getSize(); b++)
+    {
+        frameBodies.push_back(bodyStore.getBodyAt(b));
+    }
+    for (unsigned c = 0; c < contacts.getChunkCount(); c++)
+    {
+        const Contact *contact = contacts.getChunk(c);
+        const Contact *end = contact + contacts.getChunkSize(c);
+        for (; contact < end; contact++)
+        {
+            if (contact->body[0]) frameBodies.push_back(contact->body[0]);
+            if (contact->body[1]) frameBodies.push_back(contact->body[1]);
+        }
+    }
+    for (JointRegistration *reg = firstJoint; reg; reg = reg->next)
+    {
+        frameBodies.push_back(reg->joint->body[0]);
+        frameBodies.push_back(reg->joint->body[1]);
+    }
+    std::sort(frameBodies.begin(), frameBodies.end());
+    frameBodies.erase(
+        std::unique(frameBodies.begin(), frameBodies.end()),
+        frameBodies.end());
+
+    // Start with each body in its own set, then join the sets of
+    // bodies that touch or are jointed.
+    unsigned numBodies = (unsigned)frameBodies.size();
+    bodyIsland.resize(numBodies);
+    for (unsigned b = 0; b < numBodies; b++) bodyIsland[b] = b;
+
+    for (unsigned c = 0; c < contacts.getChunkCount(); c++)
+    {
+        const Contact *contact = contacts.getChunk(c);
+        const Contact *end = contact + contacts.getChunkSize(c);
+        for (; contact < end; contact++)
+        {
+            joinBodies(contact->body[0], contact->body[1]);
+        }
+    }
+    for (JointRegistration *reg = firstJoint; reg; reg = reg->next)
+    {
+        joinBodies(reg->joint->body[0], reg->joint->body[1]);
+    }
+
+    // Point every body straight at its root.
+    for (unsigned b = 0; b < numBodies; b++) findRoot(b);
+
+    // Number the islands in the order of their root bodies, and
+    // count their bodies. Roots always come before the bodies hanging
+    // from them, so a root's island number is set before it is needed.
+    islands.clear();
+    for (unsigned b = 0; b < numBodies; b++)
+    {
+        if (bodyIsland[b] == b)
+        {
+            Island island;
+            island.firstBody = island.bodyCount = 0;
+            island.firstContact = island.contactCount = 0;
+            island.awake = false;
+
+            bodyIsland[b] = (unsigned)islands.size();
+            islands.push_back(island);
+        }
+        else
+        {
+            bodyIsland[b] = bodyIsland[bodyIsland[b]];
+        }
+
+        Island &island = islands[bodyIsland[b]];
+        island.bodyCount++;
+        if (frameBodies[b]->getAwake()) island.awake = true;
+    }
+    for (unsigned c = 0; c < contacts.getChunkCount(); c++)
+    {
+        const Contact *contact = contacts.getChunk(c);
+        const Contact *end = contact + contacts.getChunkSize(c);
+        for (; contact < end; contact++)
+        {
+            RigidBody *body = contact->body[0];
+            if (!body) body = contact->body[1];
+            islands[bodyIsland[findBody(body)]].contactCount++;
+        }
+    }
+
+    // Turn the counts into offsets.
+    unsigned bodyOffset = 0, contactOffset = 0;
+    for (unsigned n = 0; n < islands.size(); n++)
+    {
+        islands[n].firstBody = bodyOffset;
+        islands[n].firstContact = contactOffset;
+        bodyOffset += islands[n].bodyCount;
+        contactOffset += islands[n].contactCount;
+        islands[n].bodyCount = islands[n].contactCount = 0;
+    }
+
+    // And scatter the bodies and contacts into their islands.
+    islandBodies = frameArena.allocate<RigidBody*>(numBodies);
+    for (unsigned b = 0; b < numBodies; b++)
+    {
+        Island &island = islands[bodyIsland[b]];
+        islandBodies[island.firstBody + island.bodyCount++] = frameBodies[b];
+    }
+    islandContacts = frameArena.allocate<Contact>(numContacts);
+    for (unsigned c = 0; c < contacts.getChunkCount(); c++)
+    {
+        const Contact *contact = contacts.getChunk(c);
+        const Contact *end = contact + contacts.getChunkSize(c);
+        for (; contact < end; contact++)
+        {
+            RigidBody *body = contact->body[0];
+            if (!body) body = contact->body[1];
+
+            Island &island = islands[bodyIsland[findBody(body)]];
+            islandContacts[island.firstContact + island.contactCount++] =
+                *contact;
+        }
+    }
+}
+
+void World::updateIslandSleep()
+{
+    for (unsigned n = 0; n < islands.size(); n++)
+    {
+        Island &island = islands[n];
+        RigidBody **body = &islandBodies[island.firstBody];
+        RigidBody **lastBody = body + island.bodyCount;
+
+        // The island has settled when every body is asleep or has
+        // less than the sleep motion. Integration leaves the decision
+        // to us, but a body can still be woken by a contact with an
+        // awake one, with twice the sleep motion, which it takes many
+        // frames to lose. So a body woken since the last frame only
+        // needs to be within that. The island is moving if any body
+        // has more.
+        bool settled = true;
+        bool moving = false;
+        for (RigidBody **b = body; b < lastBody; b++)
+        {
+            if (!(*b)->getAwake()) continue;
+            if (!(*b)->getCanSleep())
+            {
+                settled = false;
+                moving = true;
+                continue;
+            }
+
+            real motion = (*b)->getMotion();
+            bool woken = std::binary_search(
+                sleepingBodies.begin(), sleepingBodies.end(), *b);
+            if (motion >= (woken ? 2*sleepEpsilon : sleepEpsilon))
+            {
+                settled = false;
+            }
+            if (motion > 2*sleepEpsilon) moving = true;
+        }
+        if (!island.awake) continue;
+
+        // Either put the whole island to sleep, or wake all of it.
+        if (settled)
+        {
+            for (RigidBody **b = body; b < lastBody; b++)
+            {
+                (*b)->setAwake(false);
+            }
+            island.awake = false;
+        }
+        else if (moving)
+        {
+            for (RigidBody **b = body; b < lastBody; b++)
+            {
+                if (!(*b)->getAwake()) (*b)->setAwake();
+            }
+        }
+    }
+
+    // Remember which bodies are asleep, for the next frame. The frame
+    // bodies are sorted, so these are too.
+    sleepingBodies.clear();
+    for (unsigned b = 0; b < frameBodies.size(); b++)
+    {
+        if (!frameBodies[b]->getAwake())
+        {
+            sleepingBodies.push_back(frameBodies[b]);
+        }
+    }
+}
+
+void World::resolveIsland(const Island &island,
+                          ContactResolver &islandResolver, real duration)
+{
+    if (calculateIterations && !customResolver)
+    {
+        islandResolver.setIterations(island.contactCount * 4);
+    }
+    islandResolver.resolveContacts(
+        &islandContacts[island.firstContact],
+        island.contactCount,
+        duration
+        );
+}
+
+void World::resolveIslandTask(unsigned index, unsigned worker, void *data)
+{
+    World *world = (World*)data;
+    world->resolveIsland(
+        world->islands[world->islandOrder[index]],
+        *world->workerResolvers[worker],
+        world->frameDuration
+        );
+}
+
+namespace {
+    /**
+     * Orders island indices by decreasing number of contacts, so the
+     * islands that take longest to resolve are started first.
+     */
+    struct LargerIsland
+    {
+        const unsigned *contactCounts;
+
+        bool operator()(unsigned a, unsigned b) const
+        {
+            if (contactCounts[a] != contactCounts[b])
+            {
+                return contactCounts[a] > contactCounts[b];
+            }
+            return a < b;
+        }
+    };
 }
 
 void World::runPhysics(real duration)
@@ -73,21 +473,80 @@ void World::runPhysics(real duration)
     // First apply the force generators
     //registry.updateForces(duration);
 
-    // Then integrate the objects
+    // Then integrate the objects. Bodies aren't put to sleep on their
+    // own: updateIslandSleep puts whole islands to sleep instead.
     BodyRegistration *reg = firstBody;
     while (reg)
     {
         // Remove all forces from the accumulator
-        reg->body->integrate(duration);
+        reg->body->integrate(duration, false);
 
         // Get the next registration
         reg = reg->next;
     }
+    // Forces can have been added to the store's RigidBody objects
+    // since the last frame.
+    bodyStore.readForces();
+    bodyStore.integrate(duration, false);
+
+    // The collision detectors and resolver work on RigidBody objects,
+    // so bring those in the store up to date.
+    bodyStore.writeBodies();
 
     // Generate contacts
-    unsigned usedContacts = generateContacts();
+    generateContacts();
+
+    // Split the bodies and contacts into islands, and put settled
+    // islands to sleep before they are resolved.
+    buildIslands();
+    updateIslandSleep();
+
+    // And process each island on its own.
+    resolveIslands(duration);
+
+    // Take back the changes the resolver and sleeping made.
+    bodyStore.readBodies();
+}
+
+void World::resolveIslands(real duration)
+{
+    // Islands that are entirely asleep are left alone.
+    ContactResolver &activeResolver = getActiveResolver();
+    activeResolver.startFrame();
+    if (!threadPool || threadPool->getWorkerCount() == 1)
+    {
+        for (unsigned n = 0; n < islands.size(); n++)
+        {
+            const Island &island = islands[n];
+            if (!island.awake || island.contactCount == 0) continue;
+
+            resolveIsland(island, activeResolver, duration);
+        }
+        return;
+    }
+
+    // With a thread pool, start the largest islands first so that a
+    // single big island doesn't end up running on its own at the end.
+    islandOrder.clear();
+    unsigned *contactCounts =
+        frameArena.allocate<unsigned>((unsigned)islands.size());
+    for (unsigned n = 0; n < islands.size(); n++)
+    {
+        contactCounts[n] = islands[n].contactCount;
+        if (islands[n].awake && islands[n].contactCount > 0)
+        {
+            islandOrder.push_back(n);
+        }
+    }
+    LargerIsland larger = { contactCounts };
+    std::sort(islandOrder.begin(), islandOrder.end(), larger);
+
+    // Each worker gets its own clone of the resolver.
+    while (workerResolvers.size() < threadPool->getWorkerCount())
+    {
+        workerResolvers.push_back(activeResolver.clone());
+    }
 
-    // And process them
-    if (calculateIterations) resolver.setIterations(usedContacts * 4);
-    resolver.resolveContacts(contacts, usedContacts, duration);
+    frameDuration = duration;
+    threadPool->run((unsigned)islandOrder.size(), resolveIslandTask, this);
 }